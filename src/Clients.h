@@ -32,6 +32,7 @@
 #endif
 #include "MQTTClient.h"
 #include "LinkedList.h"
+#include "Tree.h"
 #include "MQTTClientPersistence.h"
 
 /**
@@ -61,6 +62,7 @@ typedef struct
 	START_TIME_TYPE lastTouch;		    /**> used for retry and expiry */
 	char nextMessageType;	/**> PUBREC, PUBREL, PUBCOMP */
 	int len;				/**> length of the whole structure+data */
+	int retried;			/**> resent, so the send the ack is for is not known */
 } Messages;
 
 /**
@@ -111,6 +113,23 @@ typedef struct
 /** Disconnecting */
 #define DISCONNECTING    -2
 
+/**
+ * Token buckets limiting the rate at which a client sends publications
+ */
+typedef struct
+{
+	int rate;                /**< publications per second, 0 for no limit */
+	int burst;               /**< the most publications which can be sent at once */
+	int byteRate;            /**< bytes of payload and topic per second, 0 for no limit */
+	int byteBurst;           /**< the most bytes which can be sent at once */
+	int64_t tokens;          /**< the publications which can be sent now, in thousandths */
+	int64_t byteTokens;      /**< the bytes which can be sent now, in thousandths; negative after a large publication */
+	START_TIME_TYPE filled;  /**< when the buckets were last filled */
+	int blocked;             /**< a publication is waiting for the buckets to fill */
+	int resending;           /**< the messages in flight on reconnect have not all been resent yet */
+	START_TIME_TYPE resendStart; /**< when the resending started */
+} publishPacing;
+
 /**
  * Data related to one client
  */
@@ -138,18 +157,30 @@ typedef struct
 	unsigned int qentry_seqno;
 	void* phandle;                  /**< the persistence handle */
 	MQTTClient_persistence* persistence; /**< a persistence implementation */
+	Persistence_putMany pputMany;   /**< optional batch put for the persistence implementation */
+	Persistence_removeMany premoveMany; /**< optional batch remove for the persistence implementation */
     MQTTPersistence_beforeWrite* beforeWrite; /**< persistence write callback */
     MQTTPersistence_afterRead* afterRead; /**< persistence read callback */
     void* beforeWrite_context;      /**< context to be used with the persistence beforeWrite callbacks */
     void* afterRead_context;        /**< context to be used with the persistence afterRead callback */
+	int deferPersistenceInterval;   /**< ms to hold outbound records in memory before persisting them, 0 for none */
+	Tree* deferredPersistence;      /**< outbound records not yet written to persistence, by time and by key */
 	void* context;                  /**< calling context - used when calling disconnect_internal */
 	int MQTTVersion;                /**< the version of MQTT being used, 3, 4 or 5 */
 	int sessionExpiry;              /**< MQTT 5 session expiry */
 	char* httpProxy;                /**< HTTP proxy for websockets */
 	char* httpsProxy;               /**< HTTPS proxy for websockets */
+	MQTTClient_socketOptions sockopts; /**< options set on the TCP socket before connecting */
+	int tlsHandshakes;              /**< the number of TLS handshakes completed */
+	int tlsResumedHandshakes;       /**< the number of those which resumed an earlier session */
+	ELAPSED_TIME_TYPE tlsHandshakeTime; /**< the total time in ms taken by TLS handshakes */
+	ELAPSED_TIME_TYPE tlsLastHandshakeTime; /**< the time in ms taken by the last TLS handshake */
+	int tlsKernelSend;              /**< whether the kernel is encrypting data sent on the current connection */
+	int tlsKernelReceive;           /**< whether the kernel is decrypting data received on the current connection */
+	publishPacing pacing;           /**< the limits on the rate of publications */
 #if defined(OPENSSL)
 	MQTTClient_SSLOptions *sslopts; /**< the SSL/TLS connect options */
-	SSL_SESSION* session;           /**< SSL session pointer for fast handhake */
+	SSL_SESSION* session;           /**< the last TLS session, resumed on reconnect for a fast handshake */
 #endif
 } Clients;
 
@@ -86,6 +86,7 @@ static int ptrCompare(void* a, void* b, int value);
 static void checkEyecatchers(char* file, int line, void* p, size_t size);
 static int Internal_heap_unlink(char* file, int line, void* p);
 static void HeapScan(enum LOG_LEVELS log_level);
+static void Internal_heap_initialize(void);
 
 
 // comment by Clark:: hit: 碰到 weird: 怪异的  apart from:　除...之外 heap_roundup: 将size 变为 4 的整数倍 ::2020-12-27
@@ -164,6 +165,7 @@ void* mymalloc(char* file, int line, size_t size)			// comment by Clark:: file
 	void* rc = NULL;
 
 	Thread_lock_mutex(heap_mutex);
+	Internal_heap_initialize();
 	size = Heap_roundup(size);
 	if ((s = malloc(sizeof(storageElement))) == NULL)
 	{
@@ -403,13 +405,29 @@ static void HeapScan(enum LOG_LEVELS log_level)
 }
 
 
+/**
+ * Initializes the allocation records, if they are not already.  They are kept from then
+ * on, so that the items allocated before the library is initialized, or freed after it is
+ * terminated, are recorded too.  Must be called with the heap mutex held.
+ */
+static void Internal_heap_initialize(void)
+{
+	if (heap.indexes == 0)
+	{
+		TreeInitializeNoMalloc(&heap, ptrCompare);
+		heap.heap_tracking = 0; /* no recursive heap tracking! */
+	}
+}
+
+
 /**
  * Heap initialization.
  */
 int Heap_initialize(void)
 {
-	TreeInitializeNoMalloc(&heap, ptrCompare);
-	heap.heap_tracking = 0; /* no recursive heap tracking! */
+	Thread_lock_mutex(heap_mutex);
+	Internal_heap_initialize();
+	Thread_unlock_mutex(heap_mutex);
 	return 0;
 }
 
@@ -59,6 +59,7 @@
 #include "MQTTProtocolOut.h"
 #include "Thread.h"
 #include "SocketBuffer.h"
+#include "Resolver.h"
 #include "StackTrace.h"
 #include "Heap.h"
 #include "OsWrapper.h"
@@ -72,8 +73,6 @@ const char *client_timestamp_eye = "MQTTAsyncV3_Timestamp " BUILD_TIMESTAMP;
 const char *client_version_eye = "MQTTAsyncV3_Version " CLIENT_VERSION;
 
 volatile int global_initialized = 0;
-List* MQTTAsync_handles = NULL;
-List* MQTTAsync_commands = NULL;
 int MQTTAsync_tostop = 0;
 
 static ClientStates ClientState =
@@ -82,13 +81,11 @@ static ClientStates ClientState =
 	NULL /* client list */
 };
 
-MQTTProtocol state;
-ClientStates* bstate = &ClientState;
+static MQTTProtocol ProtocolState;
 
-enum MQTTAsync_threadStates sendThread_state = STOPPED;
-enum MQTTAsync_threadStates receiveThread_state = STOPPED;
-thread_id_type sendThread_id = 0,
-               receiveThread_id = 0;
+/* the states of the clients of the reactor the calling thread is working on */
+THREAD_LOCAL MQTTProtocol* state = &ProtocolState;
+THREAD_LOCAL ClientStates* bstate = &ClientState;
 
 // global objects init declaration
 int MQTTAsync_init(void);
@@ -98,7 +95,15 @@ void MQTTAsync_global_init(MQTTAsync_init_options* inits)
 	MQTTAsync_init();
 #if defined(OPENSSL)
 	SSLSocket_handleOpensslInit(inits->do_openssl_init);
+	if (inits->struct_version >= 1)
+		MQTTAsync_setHandshakeThreads(inits->handshakeThreads);
 #endif
+	if (inits->struct_version >= 2)
+		MQTTAsync_setReactorThreads(inits->reactorThreads);
+	if (inits->struct_version >= 3)
+		MQTTAsync_setCallbackThreads(inits->callbackThreads, inits->callbackQueueLimit);
+	if (inits->struct_version >= 4)
+		MQTTAsync_setInboundLimits(inits->maxInboundMessages, inits->maxInboundBytes);
 }
 
 #if !defined(min)
@@ -127,14 +132,13 @@ void MQTTAsync_init_rand(void)
 
 #if defined(_WIN32) || defined(_WIN64)
 mutex_type mqttasync_mutex = NULL;
-mutex_type socket_mutex = NULL;
-mutex_type mqttcommand_mutex = NULL;
-sem_type send_sem = NULL;
 #if !defined(NO_HEAP_TRACKING)
 extern mutex_type stack_mutex;
 extern mutex_type heap_mutex;
 #endif
 extern mutex_type log_mutex;
+extern mutex_type resolver_mutex;
+extern mutex_type deferred_mutex;
 
 int MQTTAsync_init(void)
 {
@@ -148,23 +152,6 @@ int MQTTAsync_init(void)
 			printf("mqttasync_mutex error %d\n", rc);
 			goto exit;
 		}
-		if ((mqttcommand_mutex = CreateMutex(NULL, 0, NULL)) == NULL)
-		{
-			rc = GetLastError();
-			printf("mqttcommand_mutex error %d\n", rc);
-			goto exit;
-		}
-		if ((send_sem = CreateEvent(
-				NULL,               /* default security attributes */
-				FALSE,              /* manual-reset event? */
-				FALSE,              /* initial state is nonsignaled */
-				NULL                /* object name */
-				)) == NULL)
-		{
-			rc = GetLastError();
-			printf("send_sem error %d\n", rc);
-			goto exit;
-		}
 #if !defined(NO_HEAP_TRACKING)
 		if ((stack_mutex = CreateMutex(NULL, 0, NULL)) == NULL)
 		{
@@ -185,10 +172,16 @@ int MQTTAsync_init(void)
 			printf("log_mutex error %d\n", rc);
 			goto exit;
 		}
-		if ((socket_mutex = CreateMutex(NULL, 0, NULL)) == NULL)
+		if ((resolver_mutex = CreateMutex(NULL, 0, NULL)) == NULL)
 		{
 			rc = GetLastError();
-			printf("socket_mutex error %d\n", rc);
+			printf("resolver_mutex error %d\n", rc);
+			goto exit;
+		}
+		if ((deferred_mutex = CreateMutex(NULL, 0, NULL)) == NULL)
+		{
+			rc = GetLastError();
+			printf("deferred_mutex error %d\n", rc);
 			goto exit;
 		}
 	}
@@ -202,8 +195,6 @@ exit:
 
 void MQTTAsync_cleanup(void)
 {
-	if (send_sem)
-		CloseHandle(send_sem);
 #if !defined(NO_HEAP_TRACKING)
 	if (stack_mutex)
 		CloseHandle(stack_mutex);
@@ -212,8 +203,10 @@ void MQTTAsync_cleanup(void)
 #endif
 	if (log_mutex)
 		CloseHandle(log_mutex);
-	if (socket_mutex)
-		CloseHandle(socket_mutex);
+	if (resolver_mutex)
+		CloseHandle(resolver_mutex);
+	if (deferred_mutex)
+		CloseHandle(deferred_mutex);
 	if (mqttasync_mutex)
 		CloseHandle(mqttasync_mutex);
 }
@@ -258,15 +251,6 @@ BOOL APIENTRY DllMain(HANDLE hModule,
 static pthread_mutex_t mqttasync_mutex_store = PTHREAD_MUTEX_INITIALIZER;
 mutex_type mqttasync_mutex = &mqttasync_mutex_store;				// comment by Clark:: mutex_type 兼容各种操作系统下的 mutex写法  ::2020-12-22
 
-static pthread_mutex_t socket_mutex_store = PTHREAD_MUTEX_INITIALIZER;
-mutex_type socket_mutex = &socket_mutex_store;
-
-static pthread_mutex_t mqttcommand_mutex_store = PTHREAD_MUTEX_INITIALIZER;
-mutex_type mqttcommand_mutex = &mqttcommand_mutex_store;
-
-static cond_type_struct send_cond_store = { PTHREAD_COND_INITIALIZER, PTHREAD_MUTEX_INITIALIZER };
-cond_type send_cond = &send_cond_store;
-
 int MQTTAsync_init(void)
 {
 	pthread_mutexattr_t attr;
@@ -280,32 +264,31 @@ int MQTTAsync_init(void)
 #endif
 	if ((rc = pthread_mutex_init(mqttasync_mutex, &attr)) != 0)
 		printf("MQTTAsync: error %d initializing async_mutex\n", rc);
-	else if ((rc = pthread_mutex_init(mqttcommand_mutex, &attr)) != 0)
-		printf("MQTTAsync: error %d initializing command_mutex\n", rc);
-	else if ((rc = pthread_mutex_init(socket_mutex, &attr)) != 0)
-		printf("MQTTClient: error %d initializing socket_mutex\n", rc);
-	else if ((rc = pthread_cond_init(&send_cond->cond, NULL)) != 0)
-		printf("MQTTAsync: error %d initializing send_cond cond\n", rc);
-	else if ((rc = pthread_mutex_init(&send_cond->mutex, &attr)) != 0)
-		printf("MQTTAsync: error %d initializing send_cond mutex\n", rc);
 
 	return rc;
 }
 #endif
 
 
-int MQTTAsync_createWithOptions(MQTTAsync* handle, const char* serverURI, const char* clientId,
-		int persistence_type, void* persistence_context,  MQTTAsync_createOptions* options)
+/**
+ * Creates a client on a given reactor, or on the one with the fewest clients.
+ * @param reactor the number of the reactor, taken modulo the number of reactors, or -1
+ * @see MQTTAsync_createWithOptions for the other parameters
+ */
+int MQTTAsync_createOnReactor(MQTTAsync* handle, const char* serverURI, const char* clientId,
+		int persistence_type, void* persistence_context, MQTTAsync_createOptions* options, int reactor)
 {
 	int rc = 0;
 	MQTTAsyncs *m = NULL;			// comment by Clark:: MQTTAsyncs 主要的结构体  ::2020-12-22
+	MQTTAsync_reactor* r = NULL;
+	MQTTAsync_reactor* previous = NULL;
 
 #if (defined(_WIN32) || defined(_WIN64)) && defined(PAHO_MQTT_STATIC)
 	 /* intializes mutexes once.  Must come before FUNC_ENTRY */
 	BOOL bStatus = InitOnceExecuteOnce(&g_InitOnce, InitMutexesOnce, NULL, NULL);
 #endif
 	FUNC_ENTRY;
-	MQTTAsync_lock_mutex(mqttasync_mutex);
+	previous = MQTTAsync_lockGlobal();
 
 	if (serverURI == NULL || clientId == NULL)
 	{
@@ -319,7 +302,8 @@ int MQTTAsync_createWithOptions(MQTTAsync* handle, const char* serverURI, const
 		goto exit;
 	}
 
-	if (strlen(clientId) == 0 && persistence_type == MQTTCLIENT_PERSISTENCE_DEFAULT)
+	if (strlen(clientId) == 0 && (persistence_type == MQTTCLIENT_PERSISTENCE_DEFAULT ||
+		persistence_type == MQTTCLIENT_PERSISTENCE_RING))
 	{
 		rc = MQTTASYNC_PERSISTENCE_ERROR;
 		goto exit;
@@ -332,6 +316,9 @@ int MQTTAsync_createWithOptions(MQTTAsync* handle, const char* serverURI, const
 #if defined(OPENSSL)
             && strncmp(URI_SSL, serverURI, strlen(URI_SSL)) != 0
 		 && strncmp(URI_WSS, serverURI, strlen(URI_WSS)) != 0
+#endif
+#if defined(UNIXSOCK)
+		 && strncmp(URI_UNIX, serverURI, strlen(URI_UNIX)) != 0
 #endif
 			)
 		{
@@ -341,7 +328,7 @@ int MQTTAsync_createWithOptions(MQTTAsync* handle, const char* serverURI, const
 	}
 
 	if (options && (strncmp(options->struct_id, "MQCO", 4) != 0 ||
-					options->struct_version < 0 || options->struct_version > 2))
+					options->struct_version < 0 || options->struct_version > 7))
 	{
 		rc = MQTTASYNC_BAD_STRUCTURE;
 		goto exit;
@@ -353,16 +340,18 @@ int MQTTAsync_createWithOptions(MQTTAsync* handle, const char* serverURI, const
 			Heap_initialize();
 		#endif
 		Log_initialize((Log_nameValue*)MQTTAsync_getVersionInfo());
-		bstate->clients = ListInitialize();		// comment by Clark:: 全局的client列表  ::2020-12-22
+		/* the first reactor takes the default client list, the others their own */
+		if ((rc = MQTTAsync_createReactors(&ClientState, &ProtocolState)) != 0)
+			goto exit;
 		Socket_outInitialize();
 		Socket_setWriteCompleteCallback(MQTTAsync_writeComplete);
-		MQTTAsync_handles = ListInitialize();
-		MQTTAsync_commands = ListInitialize();
 #if defined(OPENSSL)
 		SSLSocket_initialize();
 #endif
 		global_initialized = 1;
 	}
+	r = MQTTAsync_assignReactor(reactor);
+	MQTTAsync_lockReactor(r);
 	if ((m = malloc(sizeof(MQTTAsyncs))) == NULL)
 	{
 		rc = PAHO_MEMORY_ERROR;
@@ -370,6 +359,7 @@ int MQTTAsync_createWithOptions(MQTTAsync* handle, const char* serverURI, const
 	}
 	*handle = m;
 	memset(m, '\0', sizeof(MQTTAsyncs));
+	m->reactor = r;
 	if (strncmp(URI_TCP, serverURI, strlen(URI_TCP)) == 0)
 		serverURI += strlen(URI_TCP);
 	else if (strncmp(URI_WS, serverURI, strlen(URI_WS)) == 0)
@@ -396,7 +386,9 @@ int MQTTAsync_createWithOptions(MQTTAsync* handle, const char* serverURI, const
 		goto exit;
 	}
 	m->responses = ListInitialize();
-	ListAppend(MQTTAsync_handles, m, sizeof(MQTTAsyncs));// comment by Clark:: 加入 MQTTAsync_handles 链表  ::2020-12-22
+	Thread_lock_mutex(r->socket_mutex); /* the handles are searched when a write completes */
+	ListAppend(r->handles, m, sizeof(MQTTAsyncs));// comment by Clark:: 加入 MQTTAsync_handles 链表  ::2020-12-22
+	Thread_unlock_mutex(r->socket_mutex);
 
 	if ((m->c = malloc(sizeof(Clients))) == NULL)
 	{
@@ -428,6 +420,11 @@ int MQTTAsync_createWithOptions(MQTTAsync* handle, const char* serverURI, const
 		memcpy(m->createOptions, options, sizeof(MQTTAsync_createOptions));
 		if (options->struct_version > 0)
 			m->c->MQTTVersion = options->MQTTVersion;			// comment by Clark:: 版本号在此赋值          ::2020-12-22
+		if (options->struct_version >= 4)
+			m->c->deferPersistenceInterval = options->deferPersistenceInterval;
+		if (options->struct_version >= 6)
+			MQTTProtocol_setPacing(m->c, options->publishRate, options->publishBurst,
+					options->publishByteRate, options->publishByteBurst);
 	}
 
 #if !defined(NO_PERSISTENCE)
@@ -443,19 +440,33 @@ int MQTTAsync_createWithOptions(MQTTAsync* handle, const char* serverURI, const
 			{
 				MQTTAsync_restoreCommands(m);
 				MQTTPersistence_restoreMessageQueue(m->c);
+				MQTTAsync_countInbound(m);
 			}
 		}
 	}
 #endif
 	ListAppend(bstate->clients, m->c, sizeof(Clients) + 3*sizeof(List));
+	/* deferred records are written by the reactor's threads, even before the first connect */
+	if (rc == 0 && m->c->deferPersistenceInterval > 0)
+		MQTTAsync_startThreads(m->reactor);
 
 exit:
-	MQTTAsync_unlock_mutex(mqttasync_mutex);
+	if (r)
+		MQTTAsync_unlockReactor(r, NULL);
+	MQTTAsync_unlockGlobal(previous);
 	FUNC_EXIT_RC(rc);
 	return rc;
 }
 
 
+int MQTTAsync_createWithOptions(MQTTAsync* handle, const char* serverURI, const char* clientId,
+		int persistence_type, void* persistence_context,  MQTTAsync_createOptions* options)
+{
+	return MQTTAsync_createOnReactor(handle, serverURI, clientId, persistence_type,
+		persistence_context, options, -1);
+}
+
+
 int MQTTAsync_create(MQTTAsync* handle, const char* serverURI, const char* clientId,
 		int persistence_type, void* persistence_context)
 {
@@ -469,13 +480,20 @@ int MQTTAsync_create(MQTTAsync* handle, const char* serverURI, const char* clien
 void MQTTAsync_destroy(MQTTAsync* handle)
 {
 	MQTTAsyncs* m = *handle;
+	MQTTAsync_reactor* r = NULL;
+	MQTTAsync_reactor* previous = NULL;
+	int own = 0;
 
 	FUNC_ENTRY;
-	MQTTAsync_lock_mutex(mqttasync_mutex);
+	if (m)
+		MQTTAsync_cancelCallbacks(m); /* before the global lock, which a callback being waited for may want */
+	previous = MQTTAsync_lockGlobal();
 
 	if (m == NULL)
 		goto exit;
 
+	r = m->reactor;
+	own = MQTTAsync_lockReactorUnlent(r); /* a callback on the reactor may be using m */
 	MQTTAsync_closeSession(m->c, MQTTREASONCODE_SUCCESS, NULL);
 
 	MQTTAsync_freeResponses(m);
@@ -502,6 +520,7 @@ void MQTTAsync_destroy(MQTTAsync* handle)
 		free(m->serverURI);
 	if (m->createOptions)
 		free(m->createOptions);
+	MQTTAsync_freeTopicAliases(m);
 	MQTTAsync_freeServerURIs(m);
 	if (m->connectProps)
 	{
@@ -515,14 +534,17 @@ void MQTTAsync_destroy(MQTTAsync* handle)
 		free(m->willProps);
 		m->willProps = NULL;
 	}
-	if (!ListRemove(MQTTAsync_handles, m))
+	Thread_lock_mutex(r->socket_mutex);
+	if (!ListRemove(r->handles, m))
 		Log(LOG_ERROR, -1, "free error");
+	Thread_unlock_mutex(r->socket_mutex);
 	*handle = NULL;
-	if (bstate->clients->count == 0)
+	MQTTAsync_unlockReactorUnlent(r, own);
+	if (MQTTAsync_getHandleCount() == 0)
 		MQTTAsync_terminate();
 
 exit:
-	MQTTAsync_unlock_mutex(mqttasync_mutex);
+	MQTTAsync_unlockGlobal(previous);
 	FUNC_EXIT;
 }
 
@@ -532,8 +554,7 @@ int MQTTAsync_connect(MQTTAsync handle, const MQTTAsync_connectOptions* options)
 	MQTTAsyncs* m = handle;			// comment by Clark:: 创建时底层具体返回的是一个 MQTTAsyncs 结构体  ::2020-12-22
 	int rc = MQTTASYNC_SUCCESS;
 	MQTTAsync_queuedCommand* conn;
-	thread_id_type thread_id = 0;
-	int locked = 0;
+	MQTTAsync_reactor* previous = NULL;
 
 	FUNC_ENTRY;
 	if (options == NULL)
@@ -542,7 +563,7 @@ int MQTTAsync_connect(MQTTAsync handle, const MQTTAsync_connectOptions* options)
 		goto exit;
 	}
 
-	if (strncmp(options->struct_id, "MQTC", 4) != 0 || options->struct_version < 0 || options->struct_version > 8)
+	if (strncmp(options->struct_id, "MQTC", 4) != 0 || options->struct_version < 0 || options->struct_version > 11)
 	{
 		rc = MQTTASYNC_BAD_STRUCTURE;
 		goto exit;
@@ -580,7 +601,16 @@ int MQTTAsync_connect(MQTTAsync handle, const MQTTAsync_connectOptions* options)
 	}
 	if (options->struct_version != 0 && options->ssl) /* check validity of SSL options structure */
 	{
-		if (strncmp(options->ssl->struct_id, "MQTS", 4) != 0 || options->ssl->struct_version < 0 || options->ssl->struct_version > 5)
+		if (strncmp(options->ssl->struct_id, "MQTS", 4) != 0 || options->ssl->struct_version < 0 || options->ssl->struct_version > 7)
+		{
+			rc = MQTTASYNC_BAD_STRUCTURE;
+			goto exit;
+		}
+	}
+	if (options->struct_version >= 9 && options->socketOptions) /* check validity of socket options structure */
+	{
+		if (strncmp(options->socketOptions->struct_id, "MQSO", 4) != 0 ||
+				options->socketOptions->struct_version < 0 || options->socketOptions->struct_version > 2)
 		{
 			rc = MQTTASYNC_BAD_STRUCTURE;
 			goto exit;
@@ -629,25 +659,10 @@ int MQTTAsync_connect(MQTTAsync handle, const MQTTAsync_connectOptions* options)
 
 	MQTTAsync_tostop = 0;
 
-	/* don't lock async mutex if we are being called from a callback */
-	thread_id = Thread_getid();
-	if (thread_id != sendThread_id && thread_id != receiveThread_id)
-	{
-		MQTTAsync_lock_mutex(mqttasync_mutex);
-		locked = 1;
-	}
-	if (sendThread_state != STARTING && sendThread_state != RUNNING)
-	{
-		sendThread_state = STARTING;
-		Thread_start(MQTTAsync_sendThread, NULL);		// comment by Clark:: 创建发送线程  ::2020-12-22
-	}
-	if (receiveThread_state != STARTING && receiveThread_state != RUNNING)
-	{
-		receiveThread_state = STARTING;
-		Thread_start(MQTTAsync_receiveThread, handle);		// comment by Clark:: 创建接收线程        ::2020-12-22
-	}
-	if (locked)
-		MQTTAsync_unlock_mutex(mqttasync_mutex);
+	/* the reactor is already locked if we are being called from one of its callbacks */
+	previous = MQTTAsync_lockReactor(m->reactor);
+	MQTTAsync_startThreads(m->reactor);		// comment by Clark:: 创建发送线程, 接收线程  ::2020-12-22
+	MQTTAsync_unlockReactor(m->reactor, previous);
 
 	m->c->keepAliveInterval = options->keepAliveInterval;
 	setRetryLoopInterval(options->keepAliveInterval);
@@ -674,6 +689,28 @@ int MQTTAsync_connect(MQTTAsync handle, const MQTTAsync_connectOptions* options)
 		if (options->httpsProxy)
 			m->c->httpsProxy = MQTTStrdup(options->httpsProxy);
 	}
+	memset(&m->c->sockopts, '\0', sizeof(m->c->sockopts));
+	if (options->struct_version >= 9 && options->socketOptions)
+	{
+		m->c->sockopts.noDelay = options->socketOptions->noDelay;
+		m->c->sockopts.sendBufferSize = options->socketOptions->sendBufferSize;
+		m->c->sockopts.receiveBufferSize = options->socketOptions->receiveBufferSize;
+		m->c->sockopts.userTimeout = options->socketOptions->userTimeout;
+		m->c->sockopts.busyPoll = options->socketOptions->busyPoll;
+		m->c->sockopts.quickAck = options->socketOptions->quickAck;
+		m->c->sockopts.tos = options->socketOptions->tos;
+		m->c->sockopts.priority = options->socketOptions->priority;
+		if (options->socketOptions->struct_version >= 1)
+			m->c->sockopts.connectAttemptDelay = options->socketOptions->connectAttemptDelay;
+		if (options->socketOptions->struct_version >= 2)
+		{
+			m->c->sockopts.dnsCacheTTL = options->socketOptions->dnsCacheTTL;
+			m->c->sockopts.dnsNegativeTTL = options->socketOptions->dnsNegativeTTL;
+			m->c->sockopts.asyncDNS = options->socketOptions->asyncDNS;
+		}
+	}
+	if (m->c->sockopts.asyncDNS)
+		Resolver_setCallback(MQTTAsync_dnsResolved);
 
 	if (m->c->will)
 	{
@@ -787,6 +824,10 @@ int MQTTAsync_connect(MQTTAsync handle, const MQTTAsync_connectOptions* options)
 			m->c->sslopts->protos = options->ssl->protos;
 			m->c->sslopts->protos_len = options->ssl->protos_len;
 		}
+		if (m->c->sslopts->struct_version >= 6)
+			m->c->sslopts->shareSessions = options->ssl->shareSessions;
+		if (m->c->sslopts->struct_version >= 7)
+			m->c->sslopts->enableKernelTLS = options->ssl->enableKernelTLS;
 	}
 #else
 	if (options->struct_version != 0 && options->ssl)
@@ -837,6 +878,8 @@ int MQTTAsync_connect(MQTTAsync handle, const MQTTAsync_connectOptions* options)
 		for (i = 0; i < options->serverURIcount; ++i)
 			m->serverURIs[i] = MQTTStrdup(options->serverURIs[i]);
 	}
+	m->raceServerURIs = (options->struct_version >= 10) ? options->raceServerURIs : 0;
+	m->adaptiveInflight = (options->struct_version >= 11) ? options->adaptiveInflight : 0;
 
 	if (m->connectProps)
 	{
@@ -882,6 +925,30 @@ int MQTTAsync_connect(MQTTAsync handle, const MQTTAsync_connectOptions* options)
 			*m->willProps = MQTTProperties_copy(options->willProperties);
 		}
 		m->c->cleanstart = options->cleanstart;
+
+		/* tell the server how many messages can wait for messageArrived, unless the application has */
+		if (options->MQTTVersion >= MQTTVERSION_5 && m->createOptions && m->createOptions->struct_version >= 5 &&
+				m->createOptions->maxInboundMessages > 0 && (m->connectProps == NULL ||
+				!MQTTProperties_hasProperty(m->connectProps, MQTTPROPERTY_CODE_RECEIVE_MAXIMUM)))
+		{
+			MQTTProperty property;
+
+			if (m->connectProps == NULL)
+			{
+				MQTTProperties initialized = MQTTProperties_initializer;
+
+				if ((m->connectProps = malloc(sizeof(MQTTProperties))) == NULL)
+				{
+					rc = PAHO_MEMORY_ERROR;
+					goto exit;
+				}
+				*m->connectProps = initialized;
+			}
+			property.identifier = MQTTPROPERTY_CODE_RECEIVE_MAXIMUM;
+			property.value.integer2 = (m->createOptions->maxInboundMessages > 65535) ?
+					65535 : m->createOptions->maxInboundMessages;
+			MQTTProperties_add(m->connectProps, &property);
+		}
 	}
 
 	/* Add connect request to operation queue */
@@ -902,6 +969,7 @@ int MQTTAsync_connect(MQTTAsync handle, const MQTTAsync_connectOptions* options)
 	}
 	conn->command.type = CONNECT;
 	conn->command.details.conn.currentURI = 0;
+	m->dnsPending = 0; /* a new connect, so its time starts now */
 	rc = MQTTAsync_addCommand(conn, sizeof(conn));
 
 exit:
@@ -914,9 +982,10 @@ int MQTTAsync_reconnect(MQTTAsync handle)
 {
 	int rc = MQTTASYNC_FAILURE;
 	MQTTAsyncs* m = handle;
+	MQTTAsync_reactor* previous = NULL;
 
 	FUNC_ENTRY;
-	MQTTAsync_lock_mutex(mqttasync_mutex);
+	previous = MQTTAsync_lockClient(m);
 
 	if (m->automaticReconnect)
 	{
@@ -951,7 +1020,7 @@ int MQTTAsync_reconnect(MQTTAsync handle)
 	}
 
 exit:
-	MQTTAsync_unlock_mutex(mqttasync_mutex);
+	MQTTAsync_unlockClient(m, previous);
 	FUNC_EXIT_RC(rc);
 	return rc;
 }
@@ -1023,6 +1092,8 @@ int MQTTAsync_subscribeMany(MQTTAsync handle, int count, char* const* topic, int
 		sub->command.onFailure5 = response->onFailure5;
 		sub->command.context = response->context;
 		response->token = sub->command.token;
+		if (response->struct_version >= 2)
+			sub->command.priority = response->priority;
 		if (m->c->MQTTVersion >= MQTTVERSION_5)
 		{
 			sub->command.properties = MQTTProperties_copy(&response->properties);
@@ -1143,6 +1214,8 @@ int MQTTAsync_unsubscribeMany(MQTTAsync handle, int count, char* const* topic, M
 		unsub->command.onFailure5 = response->onFailure5;
 		unsub->command.context = response->context;
 		response->token = unsub->command.token;
+		if (response->struct_version >= 2)
+			unsub->command.priority = response->priority;
 		if (m->c->MQTTVersion >= MQTTVERSION_5)
 			unsub->command.properties = MQTTProperties_copy(&response->properties);
 	}
@@ -1172,8 +1245,12 @@ int MQTTAsync_unsubscribe(MQTTAsync handle, const char* topic, MQTTAsync_respons
 }
 
 
-int MQTTAsync_send(MQTTAsync handle, const char* destinationName, int payloadlen, const void* payload,
-							 int qos, int retained, MQTTAsync_responseOptions* response)
+/**
+ * Queues a publish command, of a new publication or of one prepared by MQTTAsync_preparePublish.
+ * The topic and qos of a prepared publication have already been validated.
+ */
+static int MQTTAsync_send1(MQTTAsync handle, const char* destinationName, int payloadlen, const void* payload,
+							 int qos, int retained, MQTTAsync_responseOptions* response, MQTTAsync_preparedPublish* prepared)
 {
 	int rc = MQTTASYNC_SUCCESS;
 	MQTTAsyncs* m = handle;
@@ -1196,9 +1273,9 @@ int MQTTAsync_send(MQTTAsync handle, const char* destinationName, int payloadlen
 	if (rc != MQTTASYNC_SUCCESS)
 		goto exit;
 
-	if (!UTF8_validateString(destinationName))
+	if (prepared == NULL && !UTF8_validateString(destinationName))
 		rc = MQTTASYNC_BAD_UTF8_STRING;
-	else if (qos < 0 || qos > 2)
+	else if (prepared == NULL && (qos < 0 || qos > 2))
 		rc = MQTTASYNC_BAD_QOS;
 	else if (qos > 0 && (msgid = MQTTAsync_assignMsgId(m)) == 0)
 		rc = MQTTASYNC_NO_MORE_MSGIDS;
@@ -1241,11 +1318,22 @@ int MQTTAsync_send(MQTTAsync handle, const char* destinationName, int payloadlen
 		pub->command.onFailure5 = response->onFailure5;
 		pub->command.context = response->context;
 		response->token = pub->command.token;
-		if (m->c->MQTTVersion >= MQTTVERSION_5)
+		if (response->struct_version >= 2)
+			pub->command.priority = response->priority;
+		if (m->c->MQTTVersion >= MQTTVERSION_5 && prepared == NULL)
 			pub->command.properties = MQTTProperties_copy(&response->properties);
 	}
-	if ((pub->command.details.pub.destinationName = MQTTStrdup(destinationName)) == NULL)
+	if (prepared)
+	{
+		/* the protocol code frees the topic of a publication, so each command has its own copy */
+		if ((pub->command.details.pub.destinationName = malloc(prepared->topiclen + 1)) != NULL)
+			memcpy(pub->command.details.pub.destinationName, prepared->topic, prepared->topiclen + 1);
+	}
+	else
+		pub->command.details.pub.destinationName = MQTTStrdup(destinationName);
+	if (pub->command.details.pub.destinationName == NULL)
 	{
+		MQTTProperties_free(&pub->command.properties);
 		free(pub);
 		rc = PAHO_MEMORY_ERROR;
 		goto exit;
@@ -1254,6 +1342,7 @@ int MQTTAsync_send(MQTTAsync handle, const char* destinationName, int payloadlen
 	if ((pub->command.details.pub.payload = malloc(payloadlen)) == NULL)
 	{
 		free(pub->command.details.pub.destinationName);
+		MQTTProperties_free(&pub->command.properties);
 		free(pub);
 		rc = PAHO_MEMORY_ERROR;
 		goto exit;
@@ -1261,6 +1350,13 @@ int MQTTAsync_send(MQTTAsync handle, const char* destinationName, int payloadlen
 	memcpy(pub->command.details.pub.payload, payload, payloadlen);
 	pub->command.details.pub.qos = qos;
 	pub->command.details.pub.retained = retained;
+	if (prepared)
+	{
+		if (m->c->MQTTVersion >= MQTTVERSION_5)
+			pub->command.properties = MQTTProperties_copy(&prepared->properties);
+		Thread_increment(&prepared->refs);
+		pub->command.details.pub.prepared = prepared;
+	}
 	rc = MQTTAsync_addCommand(pub, sizeof(pub));
 
 exit:
@@ -1269,6 +1365,105 @@ exit:
 }
 
 
+int MQTTAsync_send(MQTTAsync handle, const char* destinationName, int payloadlen, const void* payload,
+							 int qos, int retained, MQTTAsync_responseOptions* response)
+{
+	return MQTTAsync_send1(handle, destinationName, payloadlen, payload, qos, retained, response, NULL);
+}
+
+
+int MQTTAsync_preparePublish(MQTTAsync handle, const char* destinationName, int qos, int retained,
+		const MQTTProperties* properties, MQTTAsync_prepared* prepared)
+{
+	int rc = MQTTASYNC_SUCCESS;
+	MQTTAsyncs* m = handle;
+	MQTTAsync_preparedPublish* p = NULL;
+
+	FUNC_ENTRY;
+	if (m == NULL || m->c == NULL)
+		rc = MQTTASYNC_FAILURE;
+	else if (destinationName == NULL || prepared == NULL)
+		rc = MQTTASYNC_NULL_PARAMETER;
+	else if (!UTF8_validateString(destinationName))
+		rc = MQTTASYNC_BAD_UTF8_STRING;
+	else if (qos < 0 || qos > 2)
+		rc = MQTTASYNC_BAD_QOS;
+	else if (properties && properties->count > 0 && m->c->MQTTVersion < MQTTVERSION_5)
+		rc = MQTTASYNC_BAD_MQTT_OPTION;
+	if (rc != MQTTASYNC_SUCCESS)
+		goto exit;
+
+	if ((p = malloc(sizeof(MQTTAsync_preparedPublish))) == NULL)
+	{
+		rc = PAHO_MEMORY_ERROR;
+		goto exit;
+	}
+	memset(p, '\0', sizeof(MQTTAsync_preparedPublish));
+	p->refs = 1;
+	p->client = m;
+	p->topiclen = (int)strlen(destinationName);
+	p->qos = qos;
+	p->retained = retained;
+	if ((p->topic = malloc(p->topiclen + 1)) == NULL)
+	{
+		free(p);
+		rc = PAHO_MEMORY_ERROR;
+		goto exit;
+	}
+	memcpy(p->topic, destinationName, p->topiclen + 1);
+	if (properties)
+		p->properties = MQTTProperties_copy(properties);
+	if (m->c->MQTTVersion >= MQTTVERSION_5)
+	{
+		char* ptr = NULL;
+
+		p->encodedPropertiesLen = MQTTProperties_len(&p->properties);
+		if ((ptr = p->encodedProperties = malloc(p->encodedPropertiesLen)) == NULL)
+		{
+			MQTTAsync_releasePrepared(p);
+			rc = PAHO_MEMORY_ERROR;
+			goto exit;
+		}
+		MQTTProperties_write(&ptr, &p->properties);
+	}
+	*prepared = p;
+
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+int MQTTAsync_sendPrepared(MQTTAsync handle, MQTTAsync_prepared prepared, int payloadlen, const void* payload,
+		MQTTAsync_responseOptions* response)
+{
+	MQTTAsync_preparedPublish* p = prepared;
+	int rc = MQTTASYNC_SUCCESS;
+
+	FUNC_ENTRY;
+	if (p == NULL)
+		rc = MQTTASYNC_NULL_PARAMETER;
+	else if (p->client != handle)
+		rc = MQTTASYNC_FAILURE; /* the properties were checked and encoded for another client's MQTT version */
+	else
+		rc = MQTTAsync_send1(handle, p->topic, payloadlen, payload, p->qos, p->retained, response, p);
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+void MQTTAsync_freePrepared(MQTTAsync_prepared* prepared)
+{
+	FUNC_ENTRY;
+	if (prepared && *prepared)
+	{
+		MQTTAsync_releasePrepared(*prepared);
+		*prepared = NULL;
+	}
+	FUNC_EXIT;
+}
+
+
 int MQTTAsync_sendMessage(MQTTAsync handle, const char* destinationName, const MQTTAsync_message* message,
 													 MQTTAsync_responseOptions* response)
 {
@@ -1311,13 +1506,58 @@ int MQTTAsync_disconnect(MQTTAsync handle, const MQTTAsync_disconnectOptions* op
 int MQTTAsync_isConnected(MQTTAsync handle)
 {
 	MQTTAsyncs* m = handle;
+	MQTTAsync_reactor* previous = NULL;
 	int rc = 0;
 
 	FUNC_ENTRY;
-	MQTTAsync_lock_mutex(mqttasync_mutex);
+	previous = MQTTAsync_lockClient(m);
 	if (m && m->c)
 		rc = m->c->connected;
-	MQTTAsync_unlock_mutex(mqttasync_mutex);
+	MQTTAsync_unlockClient(m, previous);
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+int MQTTAsync_getStatistics(MQTTAsync handle, MQTTAsync_statistics* stats)
+{
+	MQTTAsyncs* m = handle;
+	MQTTAsync_reactor* previous = NULL;
+	int rc = MQTTASYNC_SUCCESS;
+
+	FUNC_ENTRY;
+	if (stats == NULL || strncmp(stats->struct_id, "MQSS", 4) != 0 || stats->struct_version < 0 || stats->struct_version > 3)
+	{
+		rc = MQTTASYNC_BAD_STRUCTURE;
+		goto exit;
+	}
+	previous = MQTTAsync_lockClient(m);
+	if (m == NULL || m->c == NULL)
+		rc = MQTTASYNC_FAILURE;
+	else
+	{
+		stats->tlsHandshakes = m->c->tlsHandshakes;
+		stats->tlsResumedHandshakes = m->c->tlsResumedHandshakes;
+		stats->tlsHandshakeTime = (long)m->c->tlsHandshakeTime;
+		stats->tlsLastHandshakeTime = (int)m->c->tlsLastHandshakeTime;
+		if (stats->struct_version >= 1)
+		{
+			stats->tlsKernelSend = m->c->tlsKernelSend;
+			stats->tlsKernelReceive = m->c->tlsKernelReceive;
+		}
+		if (stats->struct_version >= 2)
+		{
+			stats->inflightWindow = MQTTAsync_inflightLimit(m);
+			stats->inflightRTT = m->inflightSRTT8 / 8;
+		}
+		if (stats->struct_version >= 3)
+		{
+			stats->topicAliases = (m->topicAliases) ? m->topicAliases->count : 0;
+			stats->topicAliasBytesSaved = m->topicAliasBytesSaved;
+		}
+	}
+	MQTTAsync_unlockClient(m, previous);
+exit:
 	FUNC_EXIT_RC(rc);
 	return rc;
 }
@@ -1327,10 +1567,11 @@ int MQTTAsync_isComplete(MQTTAsync handle, MQTTAsync_token dt)
 {
 	int rc = MQTTASYNC_SUCCESS;
 	MQTTAsyncs* m = handle;
+	MQTTAsync_reactor* previous = NULL;
 	ListElement* current = NULL;
 
 	FUNC_ENTRY;
-	MQTTAsync_lock_mutex(mqttasync_mutex);
+	previous = MQTTAsync_lockClient(m);
 
 	if (m == NULL)
 	{
@@ -1340,13 +1581,17 @@ int MQTTAsync_isComplete(MQTTAsync handle, MQTTAsync_token dt)
 
 	/* First check unprocessed commands */
 	current = NULL;
-	while (ListNextElement(MQTTAsync_commands, &current))
+	MQTTAsync_lock_mutex(m->reactor->command_mutex);
+	while (ListNextElement(m->reactor->commands, &current))
 	{
 		MQTTAsync_queuedCommand* cmd = (MQTTAsync_queuedCommand*)(current->content);
 
 		if (cmd->client == m && cmd->command.token == dt)
-			goto exit;
+			break;
 	}
+	MQTTAsync_unlock_mutex(m->reactor->command_mutex);
+	if (current != NULL)
+		goto exit;
 
 	/* Now check the inflight messages */
 	if (m->c && m->c->outboundMsgs->count > 0)
@@ -1362,7 +1607,7 @@ int MQTTAsync_isComplete(MQTTAsync handle, MQTTAsync_token dt)
 	rc = MQTTASYNC_TRUE; /* Can't find it, so it must be complete */
 
 exit:
-	MQTTAsync_unlock_mutex(mqttasync_mutex);
+	MQTTAsync_unlockClient(m, previous);
 	FUNC_EXIT_RC(rc);
 	return rc;
 }
@@ -1374,23 +1619,24 @@ int MQTTAsync_waitForCompletion(MQTTAsync handle, MQTTAsync_token dt, unsigned l
 	START_TIME_TYPE start = MQTTTime_start_clock();
 	ELAPSED_TIME_TYPE elapsed = 0L;
 	MQTTAsyncs* m = handle;
+	MQTTAsync_reactor* previous = NULL;
 
 	FUNC_ENTRY;
-	MQTTAsync_lock_mutex(mqttasync_mutex);
+	previous = MQTTAsync_lockClient(m);
 
 	if (m == NULL || m->c == NULL)
 	{
-		MQTTAsync_unlock_mutex(mqttasync_mutex);
+		MQTTAsync_unlockClient(m, previous);
 		rc = MQTTASYNC_FAILURE;
 		goto exit;
 	}
 	if (m->c->connected == 0)
 	{
-		MQTTAsync_unlock_mutex(mqttasync_mutex);
+		MQTTAsync_unlockClient(m, previous);
 		rc = MQTTASYNC_DISCONNECTED;
 		goto exit;
 	}
-	MQTTAsync_unlock_mutex(mqttasync_mutex);
+	MQTTAsync_unlockClient(m, previous);
 
 	if (MQTTAsync_isComplete(handle, dt) == 1)
 	{
@@ -1404,10 +1650,10 @@ int MQTTAsync_waitForCompletion(MQTTAsync handle, MQTTAsync_token dt, unsigned l
 		MQTTTime_sleep(100);
 		if (MQTTAsync_isComplete(handle, dt) == 1)
 			rc = MQTTASYNC_SUCCESS; /* well we couldn't find it */
-		MQTTAsync_lock_mutex(mqttasync_mutex);
+		previous = MQTTAsync_lockClient(m);
 		if (m->c->connected == 0)
 			rc = MQTTASYNC_DISCONNECTED;
-		MQTTAsync_unlock_mutex(mqttasync_mutex);
+		MQTTAsync_unlockClient(m, previous);
 		elapsed = MQTTTime_elapsed(start);
 	}
 exit:
@@ -1420,11 +1666,12 @@ int MQTTAsync_getPendingTokens(MQTTAsync handle, MQTTAsync_token **tokens)
 {
 	int rc = MQTTASYNC_SUCCESS;
 	MQTTAsyncs* m = handle;
+	MQTTAsync_reactor* previous = NULL;
 	ListElement* current = NULL;
 	int count = 0;
 
 	FUNC_ENTRY;
-	MQTTAsync_lock_mutex(mqttasync_mutex);
+	previous = MQTTAsync_lockClient(m);
 	*tokens = NULL;
 
 	if (m == NULL)
@@ -1434,7 +1681,8 @@ int MQTTAsync_getPendingTokens(MQTTAsync handle, MQTTAsync_token **tokens)
 	}
 
 	/* calculate the number of pending tokens - commands plus inflight */
-	while (ListNextElement(MQTTAsync_commands, &current))
+	MQTTAsync_lock_mutex(m->reactor->command_mutex);
+	while (ListNextElement(m->reactor->commands, &current))
 	{
 		MQTTAsync_queuedCommand* cmd = (MQTTAsync_queuedCommand*)(current->content);
 
@@ -1455,7 +1703,7 @@ int MQTTAsync_getPendingTokens(MQTTAsync handle, MQTTAsync_token **tokens)
 	/* First add the unprocessed commands to the pending tokens */
 	current = NULL;
 	count = 0;
-	while (ListNextElement(MQTTAsync_commands, &current))
+	while (ListNextElement(m->reactor->commands, &current))
 	{
 		MQTTAsync_queuedCommand* cmd = (MQTTAsync_queuedCommand*)(current->content);
 
@@ -1476,7 +1724,9 @@ int MQTTAsync_getPendingTokens(MQTTAsync handle, MQTTAsync_token **tokens)
 	(*tokens)[count] = -1; /* indicate end of list */
 
 exit:
-	MQTTAsync_unlock_mutex(mqttasync_mutex);
+	if (m)
+		MQTTAsync_unlock_mutex(m->reactor->command_mutex);
+	MQTTAsync_unlockClient(m, previous);
 	FUNC_EXIT_RC(rc);
 	return rc;
 }
@@ -1489,9 +1739,10 @@ int MQTTAsync_setCallbacks(MQTTAsync handle, void* context,
 {
 	int rc = MQTTASYNC_SUCCESS;
 	MQTTAsyncs* m = handle;		// comment by Clark:: MQTTAsync -> void *  ::2020-12-22
+	MQTTAsync_reactor* previous = NULL;
 
 	FUNC_ENTRY;
-	MQTTAsync_lock_mutex(mqttasync_mutex);
+	previous = MQTTAsync_lockClient(m);
 
 	if (m == NULL || ma == NULL || m->c == NULL || m->c->connect_state != NOT_IN_PROGRESS)
 		rc = MQTTASYNC_FAILURE;
@@ -1503,7 +1754,7 @@ int MQTTAsync_setCallbacks(MQTTAsync handle, void* context,
 		m->dc = dc;
 	}
 
-	MQTTAsync_unlock_mutex(mqttasync_mutex);
+	MQTTAsync_unlockClient(m, previous);
 	FUNC_EXIT_RC(rc);
 	return rc;
 }
@@ -1513,9 +1764,10 @@ int MQTTAsync_setConnectionLostCallback(MQTTAsync handle, void* context,
 {
 	int rc = MQTTASYNC_SUCCESS;
 	MQTTAsyncs* m = handle;
+	MQTTAsync_reactor* previous = NULL;
 
 	FUNC_ENTRY;
-	MQTTAsync_lock_mutex(mqttasync_mutex);
+	previous = MQTTAsync_lockClient(m);
 
 	if (m == NULL || m->c->connect_state != 0)
 		rc = MQTTASYNC_FAILURE;
@@ -1525,7 +1777,7 @@ int MQTTAsync_setConnectionLostCallback(MQTTAsync handle, void* context,
 		m->cl = cl;
 	}
 
-	MQTTAsync_unlock_mutex(mqttasync_mutex);
+	MQTTAsync_unlockClient(m, previous);
 	FUNC_EXIT_RC(rc);
 	return rc;
 }
@@ -1536,9 +1788,10 @@ int MQTTAsync_setMessageArrivedCallback(MQTTAsync handle, void* context,
 {
 	int rc = MQTTASYNC_SUCCESS;
 	MQTTAsyncs* m = handle;
+	MQTTAsync_reactor* previous = NULL;
 
 	FUNC_ENTRY;
-	MQTTAsync_lock_mutex(mqttasync_mutex);
+	previous = MQTTAsync_lockClient(m);
 
 	if (m == NULL || ma == NULL || m->c->connect_state != 0)
 		rc = MQTTASYNC_FAILURE;
@@ -1548,7 +1801,7 @@ int MQTTAsync_setMessageArrivedCallback(MQTTAsync handle, void* context,
 		m->ma = ma;
 	}
 
-	MQTTAsync_unlock_mutex(mqttasync_mutex);
+	MQTTAsync_unlockClient(m, previous);
 	FUNC_EXIT_RC(rc);
 	return rc;
 }
@@ -1558,9 +1811,10 @@ int MQTTAsync_setDeliveryCompleteCallback(MQTTAsync handle, void* context,
 {
 	int rc = MQTTASYNC_SUCCESS;
 	MQTTAsyncs* m = handle;
+	MQTTAsync_reactor* previous = NULL;
 
 	FUNC_ENTRY;
-	MQTTAsync_lock_mutex(mqttasync_mutex);
+	previous = MQTTAsync_lockClient(m);
 
 	if (m == NULL || m->c->connect_state != 0)
 		rc = MQTTASYNC_FAILURE;
@@ -1570,7 +1824,7 @@ int MQTTAsync_setDeliveryCompleteCallback(MQTTAsync handle, void* context,
 		m->dc = dc;
 	}
 
-	MQTTAsync_unlock_mutex(mqttasync_mutex);
+	MQTTAsync_unlockClient(m, previous);
 	FUNC_EXIT_RC(rc);
 	return rc;
 }
@@ -1580,9 +1834,10 @@ int MQTTAsync_setDisconnected(MQTTAsync handle, void* context, MQTTAsync_disconn
 {
 	int rc = MQTTASYNC_SUCCESS;
 	MQTTAsyncs* m = handle;
+	MQTTAsync_reactor* previous = NULL;
 
 	FUNC_ENTRY;
-	MQTTAsync_lock_mutex(mqttasync_mutex);
+	previous = MQTTAsync_lockClient(m);
 
 	if (m == NULL || m->c->connect_state != NOT_IN_PROGRESS)
 		rc = MQTTASYNC_FAILURE;
@@ -1592,7 +1847,7 @@ int MQTTAsync_setDisconnected(MQTTAsync handle, void* context, MQTTAsync_disconn
 		m->disconnected = disconnected;
 	}
 
-	MQTTAsync_unlock_mutex(mqttasync_mutex);
+	MQTTAsync_unlockClient(m, previous);
 	FUNC_EXIT_RC(rc);
 	return rc;
 }
@@ -1602,9 +1857,10 @@ int MQTTAsync_setConnected(MQTTAsync handle, void* context, MQTTAsync_connected*
 {
 	int rc = MQTTASYNC_SUCCESS;
 	MQTTAsyncs* m = handle;
+	MQTTAsync_reactor* previous = NULL;
 
 	FUNC_ENTRY;
-	MQTTAsync_lock_mutex(mqttasync_mutex);
+	previous = MQTTAsync_lockClient(m);
 
 	if (m == NULL || m->c->connect_state != NOT_IN_PROGRESS)
 		rc = MQTTASYNC_FAILURE;
@@ -1614,7 +1870,7 @@ int MQTTAsync_setConnected(MQTTAsync handle, void* context, MQTTAsync_connected*
 		m->connected = connected;
 	}
 
-	MQTTAsync_unlock_mutex(mqttasync_mutex);
+	MQTTAsync_unlockClient(m, previous);
 	FUNC_EXIT_RC(rc);
 	return rc;
 }
@@ -1624,9 +1880,10 @@ int MQTTAsync_setUpdateConnectOptions(MQTTAsync handle, void* context, MQTTAsync
 {
 	int rc = MQTTASYNC_SUCCESS;
 	MQTTAsyncs* m = handle;
+	MQTTAsync_reactor* previous = NULL;
 
 	FUNC_ENTRY;
-	MQTTAsync_lock_mutex(mqttasync_mutex);
+	previous = MQTTAsync_lockClient(m);
 
 	if (m == NULL)
 		rc = MQTTASYNC_FAILURE;
@@ -1636,7 +1893,7 @@ int MQTTAsync_setUpdateConnectOptions(MQTTAsync handle, void* context, MQTTAsync
 		m->updateConnectOptions = updateOptions;
 	}
 
-	MQTTAsync_unlock_mutex(mqttasync_mutex);
+	MQTTAsync_unlockClient(m, previous);
 	FUNC_EXIT_RC(rc);
 	return rc;
 }
@@ -1646,9 +1903,10 @@ int MQTTAsync_setBeforePersistenceWrite(MQTTAsync handle, void* context, MQTTPer
 {
 	int rc = MQTTASYNC_SUCCESS;
 	MQTTAsyncs* m = handle;
+	MQTTAsync_reactor* previous = NULL;
 
 	FUNC_ENTRY;
-	MQTTAsync_lock_mutex(mqttasync_mutex);
+	previous = MQTTAsync_lockClient(m);
 
 	if (m == NULL)
 		rc = MQTTASYNC_FAILURE;
@@ -1658,7 +1916,7 @@ int MQTTAsync_setBeforePersistenceWrite(MQTTAsync handle, void* context, MQTTPer
 		m->c->beforeWrite_context = context;
 	}
 
-	MQTTAsync_unlock_mutex(mqttasync_mutex);
+	MQTTAsync_unlockClient(m, previous);
 	FUNC_EXIT_RC(rc);
 	return rc;
 }
@@ -1668,9 +1926,10 @@ int MQTTAsync_setAfterPersistenceRead(MQTTAsync handle, void* context, MQTTPersi
 {
 	int rc = MQTTASYNC_SUCCESS;
 	MQTTAsyncs* m = handle;
+	MQTTAsync_reactor* previous = NULL;
 
 	FUNC_ENTRY;
-	MQTTAsync_lock_mutex(mqttasync_mutex);
+	previous = MQTTAsync_lockClient(m);
 
 	if (m == NULL)
 		rc = MQTTASYNC_FAILURE;
@@ -1680,7 +1939,30 @@ int MQTTAsync_setAfterPersistenceRead(MQTTAsync handle, void* context, MQTTPersi
 		m->c->afterRead_context = context;
 	}
 
-	MQTTAsync_unlock_mutex(mqttasync_mutex);
+	MQTTAsync_unlockClient(m, previous);
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+int MQTTAsync_setPersistenceBatch(MQTTAsync handle, Persistence_putMany pputMany, Persistence_removeMany premoveMany)
+{
+	int rc = MQTTASYNC_SUCCESS;
+	MQTTAsyncs* m = handle;
+	MQTTAsync_reactor* previous = NULL;
+
+	FUNC_ENTRY;
+	previous = MQTTAsync_lockClient(m);
+
+	if (m == NULL || m->c->persistence == NULL)
+		rc = MQTTASYNC_FAILURE;
+	else
+	{
+		m->c->pputMany = pputMany;
+		m->c->premoveMany = premoveMany;
+	}
+
+	MQTTAsync_unlockClient(m, previous);
 	FUNC_EXIT_RC(rc);
 	return rc;
 }
@@ -170,7 +170,7 @@
  */
 #define MQTTASYNC_SSL_NOT_SUPPORTED -13										// comment by Clark:: 使用不带SSL 版本的库试图 完成 SSL连接                 ::2020-12-21
  /**
-  * Return code: protocol prefix in serverURI should be tcp://, ssl://, ws:// or wss://
+  * Return code: protocol prefix in serverURI should be tcp://, ssl://, ws://, wss:// or unix://
   * The TLS enabled prefixes (ssl, wss) are only valid if the TLS version of the library
   * is linked with.
   */
@@ -222,14 +222,64 @@ typedef struct
 	
 	// comment by Clark:: 结构体的版本  ::2020-12-21
 	
-	/** The version number of this structure.  Must be 0 */
+	/** The version number of this structure.  Must be 0, 1, 2, 3 or 4.  0 means no handshakeThreads,
+	 * 0 or 1 means no reactorThreads, 0 to 2 means no callbackThreads or callbackQueueLimit,
+	 * 0 to 3 means no maxInboundMessages or maxInboundBytes */
 	int struct_version;
 	
 	/** 1 = we do openssl init, 0 = leave it to the application */
 	int do_openssl_init;
+	/**
+	 * The number of threads used to run TLS handshakes, 0 (the default) to run them on
+	 * the receive thread.  When many connections are made at once, such as when a large
+	 * number of clients reconnect after a broker restart, a pool of handshake threads
+	 * stops the cost of the handshakes from delaying the traffic on established connections.
+	 */
+	int handshakeThreads;
+	/**
+	 * The number of reactors, each a send and a receive thread, serving the clients.  Each
+	 * client is assigned to the reactor with the fewest clients when it is created, apart from
+	 * the members of a consumer group, which are spread over the reactors in turn, and that
+	 * reactor's threads run its network I/O, timers and callbacks, so that clients on
+	 * different reactors are served in parallel.  1 (the default) is a single pair of threads
+	 * for all clients.  The most is 64.  Must be set before the first client is created.
+	 */
+	int reactorThreads;
+	/**
+	 * The number of threads used to call the messageArrived, deliveryComplete and publish
+	 * onSuccess/onFailure callbacks, 0 (the default) to call them on the receive threads.
+	 * With callback threads, a slow callback does not stop the network reads of the clients.
+	 * The callbacks for the messages of one client on one topic are called in order, on the
+	 * same thread, as are the publish completions for one client and topic.  There is no
+	 * ordering between different topics.  The connect, subscribe, unsubscribe, disconnect
+	 * and connection lost callbacks are still called on the receive threads.
+	 * A message is removed from persistence once messageArrived has returned true for it.
+	 * A message for which messageArrived returns false is offered again later, and the later
+	 * messages on its topic wait for it, while the thread goes on with the other topics.
+	 */
+	int callbackThreads;
+	/**
+	 * The most messages of one client which are waiting for, or being run by, the callback
+	 * threads.  Further messages wait in the client's queue of undelivered messages until
+	 * the callbacks have caught up.  The default is 100.
+	 */
+	int callbackQueueLimit;
+	/**
+	 * The most messages waiting to be delivered to messageArrived, over all the clients.
+	 * When it is reached, the clients stop reading from their sockets, so that TCP flow
+	 * control slows the brokers, until the queues have drained to half of it.  0, the
+	 * default, means no limit.  See also the per client limits in ::MQTTAsync_createOptions.
+	 */
+	int maxInboundMessages;
+	/**
+	 * The most bytes of payload and topic of the messages waiting to be delivered to
+	 * messageArrived, over all the clients, as for maxInboundMessages.  0, the default,
+	 * means no limit.
+	 */
+	int maxInboundBytes;
 } MQTTAsync_init_options;
 
-#define MQTTAsync_init_options_initializer { {'M', 'Q', 'T', 'G'}, 0, 0 }
+#define MQTTAsync_init_options_initializer { {'M', 'Q', 'T', 'G'}, 4, 0, 0, 1, 0, 100, 0, 0 }
 
 /**
  * Global init of mqtt library. Call once on program start to set global behaviour.
@@ -520,6 +570,26 @@ LIBMQTT_API int MQTTAsync_setBeforePersistenceWrite(MQTTAsync handle, void* cont
 LIBMQTT_API int MQTTAsync_setAfterPersistenceRead(MQTTAsync handle, void* context, MQTTPersistence_afterRead* co);
 
 
+/**
+ * Sets the optional batch functions of an application-specific persistence
+ * implementation (::MQTTCLIENT_PERSISTENCE_USER).  When they are set, the client
+ * writes or removes several records with one call where it can, for instance when
+ * deferred records are written, or when the records for an acknowledged message are
+ * removed.  Without them, Persistence_put() and Persistence_remove() are called for
+ * each record.  The default persistence implementation has its own batch functions.
+ *
+ * Each buffered command is written when it is queued, unless
+ * MQTTAsync_createOptions.deferPersistenceInterval is set, because the call that queues
+ * it must not return before it is persisted.  So the writes of a burst of publications
+ * are only batched with deferred persistence; the removals are batched in either case.
+ * @param handle A valid client handle from a successful call to MQTTAsync_create().
+ * @param pputMany A pointer to a Persistence_putMany() function, or NULL.
+ * @param premoveMany A pointer to a Persistence_removeMany() function, or NULL.
+ * @return ::MQTTASYNC_SUCCESS if the functions are set, otherwise ::MQTTASYNC_FAILURE.
+ */
+LIBMQTT_API int MQTTAsync_setPersistenceBatch(MQTTAsync handle, Persistence_putMany pputMany, Persistence_removeMany premoveMany);
+
+
 /** The data returned on completion of an unsuccessful API call in the response callback onFailure. */
 typedef struct
 {
@@ -694,6 +764,16 @@ typedef void MQTTAsync_onFailure5(void* context,  MQTTAsync_failureData5* respon
 
 // comment by Clark:: synonym: 同义词,   ::2020-12-21
 
+/** The priority of requests which must get through first, such as alarms */
+#define MQTTASYNC_PRIORITY_CONTROL 2
+/** The priority of requests which should be sent before the normal ones */
+#define MQTTASYNC_PRIORITY_HIGH 1
+/** The priority of requests by default */
+#define MQTTASYNC_PRIORITY_NORMAL 0
+/** The priority of requests which can wait, such as bulk telemetry, and which are
+ * the first to be dropped when the buffer is full */
+#define MQTTASYNC_PRIORITY_BULK -1
+
 /** Structure to define call options.  For MQTT 5.0 there is input data as well as that
  * describing the response method.  So there is now also a synonym ::MQTTAsync_callOptions
  * to better reflect the use.  This responseOptions name is kept for backward
@@ -703,8 +783,9 @@ typedef struct MQTTAsync_responseOptions
 {
 	/** The eyecatcher for this structure.  Must be MQTR */
 	char struct_id[4];
-	/** The version number of this structure.  Must be 0 or 1
-	 *   if 0, no MQTTV5 options */
+	/** The version number of this structure.  Must be 0, 1 or 2
+	 *   if 0, no MQTTV5 options
+	 *   if 1, no priority */
 	int struct_version;
 	/**
     * A pointer to a callback function to be called if the API call successfully
@@ -759,9 +840,22 @@ typedef struct MQTTAsync_responseOptions
 	 * MQTT V5 subscribe option array, when used with subscribeMany only.
 	 */
 	MQTTSubscribe_options* subscribeOptionsList;
+	/**
+	 * The priority of a publish, subscribe or unsubscribe request: one of the
+	 * MQTTASYNC_PRIORITY_ values.  The queued requests of a higher priority are
+	 * sent before any of a lower one, while requests of the same priority are
+	 * always sent in the order they were made.  When the buffer of messages
+	 * is full and MQTTAsync_createOptions.deleteOldestMessages is set, the oldest
+	 * message of the lowest priority is dropped, unless the new message has a lower
+	 * priority than all those buffered, when the send fails with
+	 * MQTTASYNC_MAX_BUFFERED_MESSAGES.  A disconnect is sent after all the requests
+	 * made before it, and the requests made after it wait behind it, whatever their
+	 * priority.  Messages restored from persistence after a restart have the normal priority.
+	 */
+	int priority;
 } MQTTAsync_responseOptions;
 
-#define MQTTAsync_responseOptions_initializer { {'M', 'Q', 'T', 'R'}, 1, NULL, NULL, 0, 0, NULL, NULL, MQTTProperties_initializer, MQTTSubscribe_options_initializer, 0, NULL}
+#define MQTTAsync_responseOptions_initializer { {'M', 'Q', 'T', 'R'}, 2, NULL, NULL, 0, 0, NULL, NULL, MQTTProperties_initializer, MQTTSubscribe_options_initializer, 0, NULL, MQTTASYNC_PRIORITY_NORMAL}
 
 /** A synonym for responseOptions to better reflect its usage since MQTT 5.0 */
 typedef struct MQTTAsync_responseOptions MQTTAsync_callOptions;
@@ -914,6 +1008,9 @@ LIBMQTT_API int MQTTAsync_reconnect(MQTTAsync handle);
  * specify either an IP address or a host name. For instance, to connect to
  * a server running on the local machines with the default MQTT port, specify
  * <i>tcp://localhost:1883</i>.
+ * A server on the same machine can also be reached through a Unix domain socket
+ * (not on Windows), with <i>unix:///path/to/socket</i>.  On Linux,
+ * <i>unix://@name</i> names a socket in the abstract namespace.
  * @param clientId The client identifier passed to the server when the
  * client connects to it. It is a null-terminated UTF-8 encoded string.
  * @param persistence_type The type of persistence to be used by the client:
@@ -928,6 +1025,9 @@ LIBMQTT_API int MQTTAsync_reconnect(MQTTAsync handle);
  * storage and provides some protection against message loss in the case of
  * unexpected failure.
  * <br>
+ * ::MQTTCLIENT_PERSISTENCE_RING: Use a single preallocated, memory-mapped file
+ * per client, which holds the persisted data in a ring buffer of fixed size.
+ * <br>
  * ::MQTTCLIENT_PERSISTENCE_USER: Use an application-specific persistence
  * implementation. Using this type of persistence gives control of the
  * persistence mechanism to the application. The application has to implement
@@ -937,6 +1037,8 @@ LIBMQTT_API int MQTTAsync_reconnect(MQTTAsync handle);
  * be set to NULL. For ::MQTTCLIENT_PERSISTENCE_DEFAULT persistence, it
  * should be set to the location of the persistence directory (if set
  * to NULL, the persistence directory used is the working directory).
+ * For ::MQTTCLIENT_PERSISTENCE_RING persistence, it must point to a valid
+ * MQTTClient_ringPersistenceOptions structure.
  * Applications that use ::MQTTCLIENT_PERSISTENCE_USER persistence set this
  * argument to point to a valid MQTTClient_persistence structure.
  * @return ::MQTTASYNC_SUCCESS if the client is successfully created, otherwise
@@ -950,10 +1052,15 @@ typedef struct
 {
 	/** The eyecatcher for this structure.  must be MQCO. */
 	char struct_id[4];
-	/** The version number of this structure.  Must be 0, 1, 2 or 3
+	/** The version number of this structure.  Must be 0, 1, 2, 3, 4, 5, 6 or 7
 	 * 0 means no MQTTVersion
 	 * 1 means no allowDisconnectedSendAtAnyTime, deleteOldestMessages, restoreMessages
 	 * 2 means no persistQoS0
+	 * 3 means no maxCachedPayloadBytes
+	 * 4 means no deferPersistenceInterval
+	 * 5 means no maxInboundMessages, maxInboundBytes
+	 * 6 means no publishRate, publishBurst, publishByteRate, publishByteBurst
+	 * 7 means no maxTopicAliases
 	 */
 	int struct_version;
 
@@ -988,11 +1095,74 @@ typedef struct
 	 * Persist QoS0 publish commands - an option to not persist them.
 	 */
 	int persistQoS0;
+	/*
+	 * The number of bytes of persisted publish commands (payload, topic and properties) which
+	 * are also kept in memory while they are buffered, so that they don't have to be read back
+	 * from persistence before being sent.  Commands buffered once this is reached are only held
+	 * in persistence until they are sent.  0 means don't keep any.
+	 */
+	int maxCachedPayloadBytes;
+	/*
+	 * The number of milliseconds for which outbound records (buffered commands, and QoS 1 and 2
+	 * messages in flight) are held in memory before being written to persistence.  Records which
+	 * are removed within this time, for instance because the message was acknowledged, are never
+	 * written.  The rest are written in batches, with Persistence_putMany() if it is set, and
+	 * everything outstanding is written when the client disconnects or is destroyed.  Messages held in memory can be lost if the process
+	 * fails.  0, the default, means write each record immediately.
+	 */
+	int deferPersistenceInterval;
+	/*
+	 * The most messages which can wait in the client's queue to be delivered to messageArrived,
+	 * when it is slow or returns false.  When the queue is full, the client stops reading from
+	 * its socket, so that TCP flow control slows the broker, until the queue has drained to half
+	 * of the limit.  With MQTT V5, it is sent to the server as the Receive Maximum, if the connect
+	 * properties don't have one.  0, the default, means no limit.
+	 */
+	int maxInboundMessages;
+	/*
+	 * The most bytes of payload and topic which can wait in the client's queue to be delivered,
+	 * as for maxInboundMessages.  0, the default, means no limit.
+	 */
+	int maxInboundBytes;
+	/*
+	 * The most publications per second the client sends, counting new messages and those
+	 * resent on reconnect, so that replaying a buffer after an outage doesn't flood the server
+	 * or the network.  Publications over the limit wait in the queue.  0, the default, means
+	 * no limit.
+	 */
+	int publishRate;
+	/*
+	 * The most publications which can be sent at once, after the client has been idle.
+	 * 0 means the number of one second, publishRate.
+	 */
+	int publishBurst;
+	/*
+	 * The most bytes of payload and topic per second the client sends, as for publishRate.
+	 * A message larger than publishByteBurst can still be sent, and delays the following
+	 * ones.  0, the default, means no limit.
+	 */
+	int publishByteRate;
+	/*
+	 * The most bytes of payload and topic which can be sent at once, after the client has been
+	 * idle.  0 means the number of one second, publishByteRate.
+	 */
+	int publishByteBurst;
+	/*
+	 * The most MQTT V5 topic aliases the client assigns to the topics it publishes to, on each
+	 * connection, and no more than the Topic Alias Maximum in the server's CONNACK.  The first
+	 * message sent to a topic carries the topic and a new alias, and the following ones only the
+	 * alias, with an empty topic.  When all the aliases are in use, the one least recently used
+	 * is given to the new topic.  The aliases are forgotten when the connection is lost.
+	 * Messages whose properties already have a Topic Alias are sent as they are, so an
+	 * application which assigns its own aliases should leave this at 0, the default, which
+	 * means don't assign any.
+	 */
+	int maxTopicAliases;
 } MQTTAsync_createOptions;
 
-#define MQTTAsync_createOptions_initializer  { {'M', 'Q', 'C', 'O'}, 2, 0, 100, MQTTVERSION_DEFAULT, 0, 0, 1, 1}
+#define MQTTAsync_createOptions_initializer  { {'M', 'Q', 'C', 'O'}, 7, 0, 100, MQTTVERSION_DEFAULT, 0, 0, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0}
 
-#define MQTTAsync_createOptions_initializer5 { {'M', 'Q', 'C', 'O'}, 2, 0, 100, MQTTVERSION_5, 0, 0, 1, 1}
+#define MQTTAsync_createOptions_initializer5 { {'M', 'Q', 'C', 'O'}, 7, 0, 100, MQTTVERSION_5, 0, 0, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0}
 
 
 LIBMQTT_API int MQTTAsync_createWithOptions(MQTTAsync* handle, const char* serverURI, const char* clientId,
@@ -1063,12 +1233,14 @@ typedef struct
 	/** The eyecatcher for this structure.  Must be MQTS */
 	char struct_id[4];
 
-	/** The version number of this structure. Must be 0, 1, 2, 3, 4 or 5.
+	/** The version number of this structure. Must be 0, 1, 2, 3, 4, 5, 6 or 7.
 	 * 0 means no sslVersion
 	 * 1 means no verify, CApath
 	 * 2 means no ssl_error_context, ssl_error_cb
 	 * 3 means no ssl_psk_cb, ssl_psk_context, disableDefaultTrustStore
 	 * 4 means no protos, protos_len
+	 * 5 means no shareSessions
+	 * 6 means no enableKernelTLS
 	 */
 	int struct_version;
 
@@ -1167,9 +1339,26 @@ typedef struct
 	 * Exists only if struct_version >= 5
 	 */
 	unsigned int protos_len;
+
+	/**
+	 * TLS sessions are always resumed when the client reconnects.  Set this to 1 to also
+	 * resume sessions established by other clients in this process which connect to the
+	 * same server with the same SSL options, saving a full handshake on their first connect.
+	 * Exists only if struct_version >= 6
+	 */
+	int shareSessions;
+
+	/**
+	 * Set this to 1 to hand encryption to the kernel (Linux kTLS) once the handshake is
+	 * complete, so that data is written straight from the message buffers.  This needs
+	 * OpenSSL 3 built with kTLS support and the kernel tls module.  If either is missing,
+	 * or the negotiated cipher is not supported by the kernel, OpenSSL is used as usual.
+	 * Exists only if struct_version >= 7
+	 */
+	int enableKernelTLS;
 } MQTTAsync_SSLOptions;
 
-#define MQTTAsync_SSLOptions_initializer { {'M', 'Q', 'T', 'S'}, 5, NULL, NULL, NULL, NULL, NULL, 1, MQTT_SSL_VERSION_DEFAULT, 0, NULL, NULL, NULL, NULL, NULL, 0, NULL, 0 }
+#define MQTTAsync_SSLOptions_initializer { {'M', 'Q', 'T', 'S'}, 7, NULL, NULL, NULL, NULL, NULL, 1, MQTT_SSL_VERSION_DEFAULT, 0, NULL, NULL, NULL, NULL, NULL, 0, NULL, 0, 0, 0 }
 
 /** Utility structure where name/value pairs are needed */
 typedef struct
@@ -1178,6 +1367,81 @@ typedef struct
 	const char* value; /**< value string */
 } MQTTAsync_nameValue;
 
+/**
+ * MQTTAsync_socketOptions sets options on the TCP socket before it is connected.  All the
+ * members default to 0, which leaves the operating system's setting in place.  An option
+ * which is not available on the platform is ignored, and an option the operating system
+ * refuses is logged, but does not stop the connect.
+ */
+typedef struct
+{
+	/** The eyecatcher for this structure.  Must be MQSO. */
+	char struct_id[4];
+	/** The version number of this structure.  Must be 0, 1 or 2.
+	 * 0 signifies no connectAttemptDelay
+	 * 1 signifies no dnsCacheTTL, dnsNegativeTTL or asyncDNS
+	 */
+	int struct_version;
+	/**
+	 * Set to 1 to disable Nagle's algorithm (TCP_NODELAY), so that small packets such as
+	 * acknowledgements and control messages are not held back behind earlier unacknowledged data.
+	 */
+	int noDelay;
+	/** The size of the socket send buffer in bytes (SO_SNDBUF) */
+	int sendBufferSize;
+	/** The size of the socket receive buffer in bytes (SO_RCVBUF) */
+	int receiveBufferSize;
+	/**
+	 * The time in milliseconds that sent data may remain unacknowledged before the
+	 * connection is closed (TCP_USER_TIMEOUT, Linux only).  This detects a dead connection
+	 * sooner than the keepalive interval when there is data outstanding.
+	 */
+	int userTimeout;
+	/** The time in microseconds to busy poll the device queue for incoming data (SO_BUSY_POLL, Linux only) */
+	int busyPoll;
+	/**
+	 * Set to 1 to send acknowledgements immediately rather than delaying them (TCP_QUICKACK,
+	 * Linux only).  This is best effort: the option is set once, when the socket is created,
+	 * and Linux may turn delayed acknowledgements back on later in the connection.
+	 */
+	int quickAck;
+	/**
+	 * The IP type of service byte (IP_TOS, or IPV6_TCLASS for IPv6).  The DSCP value goes in
+	 * the top six bits, so for example 0xB8 marks packets as expedited forwarding.
+	 */
+	int tos;
+	/** The priority of packets sent on the socket (SO_PRIORITY, Linux only) */
+	int priority;
+	/**
+	 * When a server's host name resolves to more than one address, and the connect to the
+	 * first has not completed after this many milliseconds, a connect to the next address is
+	 * started alongside it, and so on through the addresses.  The first address is the one
+	 * the system prefers, and after it the addresses alternate between IPv4 and IPv6
+	 * (RFC 8305 "Happy Eyeballs").  The first to connect is used and the others are
+	 * abandoned.  0 means the default of 250 milliseconds, -1 means only the first address
+	 * is tried.  Not available on Windows, where the first address is always used.
+	 */
+	int connectAttemptDelay;
+	/**
+	 * The number of seconds the addresses a server's host name resolves to are kept and
+	 * reused by later connects, by this client or any other in the process.  getaddrinfo
+	 * does not report the DNS record's own TTL, so this should be no longer than it.
+	 * 0 means the name is looked up on every connect.
+	 */
+	int dnsCacheTTL;
+	/** The number of seconds a failure to look a host name up is kept for, 0 for none */
+	int dnsNegativeTTL;
+	/**
+	 * Set to 1 to look the server's host name up on a helper thread, so that other clients
+	 * carry on while DNS answers.  The connect continues when the lookup completes, and
+	 * lookups of the same name by several clients are shared.  The time spent waiting for
+	 * the lookup counts against the connect timeout.
+	 */
+	int asyncDNS;
+} MQTTAsync_socketOptions;
+
+#define MQTTAsync_socketOptions_initializer { {'M', 'Q', 'S', 'O'}, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 }
+
 /**
  * MQTTAsync_connectOptions defines several settings that control the way the
  * client connects to an MQTT server.  Default values are set in
@@ -1187,7 +1451,7 @@ typedef struct
 {
 	/** The eyecatcher for this structure.  must be MQTC. */
 	char struct_id[4];
-	/** The version number of this structure.  Must be 0, 1, 2, 3 4 5 6, 7 or 8.
+	/** The version number of this structure.  Must be 0, 1, 2, 3 4 5 6, 7, 8, 9, 10 or 11.
 	  * 0 signifies no SSL options and no serverURIs
 	  * 1 signifies no serverURIs
       * 2 signifies no MQTTVersion
@@ -1196,6 +1460,9 @@ typedef struct
       * 5 signifies no MQTTV5 properties
       * 6 signifies no HTTP headers option
       * 7 signifies no HTTP proxy and HTTPS proxy options
+      * 8 signifies no socket options
+      * 9 signifies no raceServerURIs
+      * 10 signifies no adaptiveInflight
 	  */
 	int struct_version;
 
@@ -1301,7 +1568,7 @@ typedef struct
 	/**
 	  * An array of null-terminated strings specifying the servers to
       * which the client will connect. Each string takes the form <i>protocol://host:port</i>.
-      * <i>protocol</i> must be <i>tcp</i>, <i>ssl</i>, <i>ws</i> or <i>wss</i>.
+      * <i>protocol</i> must be <i>tcp</i>, <i>ssl</i>, <i>ws</i>, <i>wss</i> or <i>unix</i>.
       * The TLS enabled prefixes (ssl, wss) are only valid if a TLS version of the library
       * is linked with.
       * For <i>host</i>, you can
@@ -1372,20 +1639,40 @@ typedef struct
 	 * HTTPS proxy for websockets
 	 */
 	const char* httpsProxy;
+	/**
+	 * Options for the TCP socket, or NULL to use the operating system defaults
+	 */
+	const MQTTAsync_socketOptions* socketOptions;
+	/**
+	 * Set to 1 to connect to the serverURIs in parallel rather than one after another.
+	 * The connect to the next URI in the list is started if the TCP connect to the previous
+	 * has not completed within the socket options' connectAttemptDelay, and the first to
+	 * connect is used.  Only the run of URIs with the same scheme as the first is raced,
+	 * and not when connecting through an HTTP proxy.  Not available on Windows.
+	 */
+	int raceServerURIs;
+	/**
+	 * Set to 1 to adapt the number of QoS 1 and 2 messages in flight to the round trip
+	 * times of their acknowledgements, rather than always allowing maxInflight.  The window
+	 * starts at 10, grows while the acknowledgements come back as fast as the quickest seen,
+	 * and is halved when they slow down because messages are queueing on the way.  It never
+	 * goes above maxInflight, or the Receive Maximum of an MQTT V5 server.
+	 */
+	int adaptiveInflight;
 } MQTTAsync_connectOptions;
 
 
-#define MQTTAsync_connectOptions_initializer { {'M', 'Q', 'T', 'C'}, 8, 60, 1, 65535, NULL, NULL, NULL, 30, 0,\
-NULL, NULL, NULL, NULL, 0, NULL, MQTTVERSION_DEFAULT, 0, 1, 60, {0, NULL}, 0, NULL, NULL, NULL, NULL, NULL, NULL, NULL}
+#define MQTTAsync_connectOptions_initializer { {'M', 'Q', 'T', 'C'}, 11, 60, 1, 65535, NULL, NULL, NULL, 30, 0,\
+NULL, NULL, NULL, NULL, 0, NULL, MQTTVERSION_DEFAULT, 0, 1, 60, {0, NULL}, 0, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, 0, 0}
 
-#define MQTTAsync_connectOptions_initializer5 { {'M', 'Q', 'T', 'C'}, 8, 60, 0, 65535, NULL, NULL, NULL, 30, 0,\
-NULL, NULL, NULL, NULL, 0, NULL, MQTTVERSION_5, 0, 1, 60, {0, NULL}, 1, NULL, NULL, NULL, NULL, NULL, NULL, NULL}
+#define MQTTAsync_connectOptions_initializer5 { {'M', 'Q', 'T', 'C'}, 11, 60, 0, 65535, NULL, NULL, NULL, 30, 0,\
+NULL, NULL, NULL, NULL, 0, NULL, MQTTVERSION_5, 0, 1, 60, {0, NULL}, 1, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, 0, 0}
 
-#define MQTTAsync_connectOptions_initializer_ws { {'M', 'Q', 'T', 'C'}, 8, 45, 1, 65535, NULL, NULL, NULL, 30, 0,\
-NULL, NULL, NULL, NULL, 0, NULL, MQTTVERSION_DEFAULT, 0, 1, 60, {0, NULL}, 0, NULL, NULL, NULL, NULL, NULL, NULL, NULL}
+#define MQTTAsync_connectOptions_initializer_ws { {'M', 'Q', 'T', 'C'}, 11, 45, 1, 65535, NULL, NULL, NULL, 30, 0,\
+NULL, NULL, NULL, NULL, 0, NULL, MQTTVERSION_DEFAULT, 0, 1, 60, {0, NULL}, 0, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, 0, 0}
 
-#define MQTTAsync_connectOptions_initializer5_ws { {'M', 'Q', 'T', 'C'}, 8, 45, 0, 65535, NULL, NULL, NULL, 30, 0,\
-NULL, NULL, NULL, NULL, 0, NULL, MQTTVERSION_5, 0, 1, 60, {0, NULL}, 1, NULL, NULL, NULL, NULL, NULL, NULL, NULL}
+#define MQTTAsync_connectOptions_initializer5_ws { {'M', 'Q', 'T', 'C'}, 11, 45, 0, 65535, NULL, NULL, NULL, 30, 0,\
+NULL, NULL, NULL, NULL, 0, NULL, MQTTVERSION_5, 0, 1, 60, {0, NULL}, 1, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, 0, 0}
 
 
 /**
@@ -1499,6 +1786,62 @@ LIBMQTT_API int MQTTAsync_disconnect(MQTTAsync handle, const MQTTAsync_disconnec
 LIBMQTT_API int MQTTAsync_isConnected(MQTTAsync handle);
 
 
+/**
+ * Statistics about the connections of a client, returned by MQTTAsync_getStatistics().
+ * The counts are kept over the lifetime of the client, across reconnects.
+ */
+typedef struct
+{
+	/** The eyecatcher for this structure.  Must be MQSS */
+	char struct_id[4];
+	/** The version number of this structure.  Must be 0, 1, 2 or 3.
+	 * 0 means no tlsKernelSend, tlsKernelReceive
+	 * 1 means no inflightWindow, inflightRTT
+	 * 2 means no topicAliases, topicAliasBytesSaved
+	 */
+	int struct_version;
+	/** The number of TLS handshakes completed */
+	int tlsHandshakes;
+	/** The number of those TLS handshakes which resumed an earlier session */
+	int tlsResumedHandshakes;
+	/** The total time in milliseconds taken by the TLS handshakes */
+	long tlsHandshakeTime;
+	/** The time in milliseconds taken by the last TLS handshake */
+	int tlsLastHandshakeTime;
+	/** Whether the kernel is encrypting the data sent on the current TLS connection,
+	 * as requested by MQTTAsync_SSLOptions.enableKernelTLS */
+	int tlsKernelSend;
+	/** Whether the kernel is decrypting the data received on the current TLS connection */
+	int tlsKernelReceive;
+	/** The number of QoS 1 and 2 messages allowed in flight now: the adaptive window,
+	 * if MQTTAsync_connectOptions.adaptiveInflight is set, otherwise the fixed limit */
+	int inflightWindow;
+	/** The smoothed round trip time in milliseconds of the acknowledgements of
+	 * QoS 1 and 2 messages on the current connection, 0 if none yet */
+	int inflightRTT;
+	/** The number of topic aliases assigned on the current connection, as set by
+	 * MQTTAsync_createOptions.maxTopicAliases */
+	int topicAliases;
+	/** The bytes of topic not sent because an alias was sent instead, less the bytes
+	 * of the Topic Alias properties sent */
+	long topicAliasBytesSaved;
+} MQTTAsync_statistics;
+
+#define MQTTAsync_statistics_initializer { {'M', 'Q', 'S', 'S'}, 3, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 }
+
+/**
+  * This function gets statistics about the connections of a client.
+  * @param handle A valid client handle from a successful call to
+  * MQTTAsync_create().
+  * @param stats A pointer to an ::MQTTAsync_statistics structure, initialized
+  * with ::MQTTAsync_statistics_initializer, in which the statistics are returned.
+  * @return ::MQTTASYNC_SUCCESS if the statistics were returned,
+  * ::MQTTASYNC_FAILURE if the handle is not valid, or
+  * ::MQTTASYNC_BAD_STRUCTURE if the statistics structure is not valid.
+  */
+LIBMQTT_API int MQTTAsync_getStatistics(MQTTAsync handle, MQTTAsync_statistics* stats);
+
+
 /**
   * This function attempts to subscribe a client to a single topic, which may
   * contain wildcards (see @ref wildcard). This call also specifies the
@@ -1603,6 +1946,57 @@ LIBMQTT_API int MQTTAsync_send(MQTTAsync handle, const char* destinationName, in
   */
 LIBMQTT_API int MQTTAsync_sendMessage(MQTTAsync handle, const char* destinationName, const MQTTAsync_message* msg, MQTTAsync_responseOptions* response);
 
+/**
+  * A handle to a publication prepared by MQTTAsync_preparePublish().
+  */
+typedef void* MQTTAsync_prepared;
+
+/**
+  * This function prepares the parts of a publication which do not change from one
+  * message to the next, to publish many messages to the same topic with
+  * MQTTAsync_sendPrepared().  The topic is validated once, here, and the MQTT V5
+  * properties are copied and encoded as they are sent, so that sending each message
+  * only adds its payload.  The prepared publication cannot be changed; it can be used
+  * by several threads at once, and only with the client it was prepared for.
+  * @param handle A valid client handle from a successful call to
+  * MQTTAsync_create().
+  * @param destinationName The topic associated with the messages.
+  * @param qos The @ref qos of the messages.
+  * @param retained The retained flag for the messages.
+  * @param properties The MQTT V5 properties of the messages, or NULL.  Properties can only
+  * be given for a client created with MQTTVERSION_5.
+  * @param prepared A pointer to an ::MQTTAsync_prepared handle, which is set
+  * following a successful return from this function.
+  * @return ::MQTTASYNC_SUCCESS if the publication is prepared.
+  * An error code is returned if the topic, qos or properties are not valid.
+  */
+LIBMQTT_API int MQTTAsync_preparePublish(MQTTAsync handle, const char* destinationName, int qos, int retained,
+		const MQTTProperties* properties, MQTTAsync_prepared* prepared);
+
+/**
+  * This function publishes a message with the topic, qos, retained flag and properties
+  * of a prepared publication, as MQTTAsync_send() does.  The properties in
+  * <i>response</i> are not used.
+  * @param handle The client handle the publication was prepared for.
+  * @param prepared A handle from a successful call to MQTTAsync_preparePublish().
+  * @param payloadlen The length of the payload in bytes.
+  * @param payload A pointer to the byte array payload of the message.
+  * @param response A pointer to an ::MQTTAsync_responseOptions structure. Used to set callback functions.
+  * This is optional and can be set to NULL.
+  * @return ::MQTTASYNC_SUCCESS if the message is accepted for publication.
+  * ::MQTTASYNC_FAILURE if the publication was prepared for another client.
+  * An error code is returned if there was a problem accepting the message.
+  */
+LIBMQTT_API int MQTTAsync_sendPrepared(MQTTAsync handle, MQTTAsync_prepared prepared, int payloadlen, const void* payload,
+		MQTTAsync_responseOptions* response);
+
+/**
+  * This function frees a prepared publication.  Messages already sent with it are
+  * not affected: the memory is freed once they have been published.
+  * @param prepared A pointer to the handle of the prepared publication.  It is set to NULL.
+  */
+LIBMQTT_API void MQTTAsync_freePrepared(MQTTAsync_prepared* prepared);
+
 
 /**
   * This function sets a pointer to an array of tokens for
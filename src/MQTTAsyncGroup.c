@@ -0,0 +1,628 @@
+/*******************************************************************************
+ * Copyright (c) 2026 Contributors to the Eclipse Foundation
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v2.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    https://www.eclipse.org/legal/epl-2.0/
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *******************************************************************************/
+
+/**
+ * @file
+ * \brief A consumer group which spreads the messages of a shared subscription over
+ * several MQTT connections.
+ *
+ * Each member is an ordinary MQTTAsync client, whose connected callback subscribes it to
+ * the shared subscription.  A start or stop of all the members completes once, when the
+ * last member has subscribed or disconnected.
+ */
+
+#include "MQTTAsyncGroup.h"
+#include "MQTTAsyncUtils.h"
+#include "LinkedList.h"
+#include "Thread.h"
+#include "StackTrace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Heap.h"
+
+struct MQTTAsyncGroups_struct;
+
+/**
+ * The callbacks of a start or stop of all the members.
+ */
+typedef struct
+{
+	struct MQTTAsyncGroups_struct* parent;
+	int pending;              /**< the number of members on which the request has not completed */
+	int failed;               /**< the request has failed on a member, and onFailure has been called */
+	MQTTAsync_onSuccess* onSuccess;
+	MQTTAsync_onFailure* onFailure;
+	MQTTAsync_onSuccess5* onSuccess5;
+	MQTTAsync_onFailure5* onFailure5;
+	void* context;
+} MQTTAsyncGroup_response;
+
+typedef struct
+{
+	int index;                             /**< the number of the member */
+	MQTTAsync client;                      /**< the client which makes the connection */
+	struct MQTTAsyncGroups_struct* parent;
+	MQTTAsyncGroup_response* start;        /**< the start waiting for this member to subscribe */
+	int subscribed;                        /**< the member is subscribed on its current connection */
+	long messages;                         /**< the messages accepted by messageArrived */
+	long bytes;                            /**< the bytes of payload of those messages */
+} MQTTAsyncGroup_member;
+
+typedef struct MQTTAsyncGroups_struct
+{
+	int count;                        /**< the number of members */
+	MQTTAsyncGroup_member* members;
+	char* filter;                     /**< the shared subscription, $share/name/filter */
+	int qos;
+	int MQTTVersion;                  /**< the MQTT version the members connect with */
+	mutex_type mutex;                 /**< protects the responses and the members' state */
+	List* responses;                  /**< the starts and stops which have not completed */
+	void* context;                    /**< the context of the callbacks set on all the members */
+	MQTTAsync_connectionLost* cl;
+	MQTTAsync_messageArrived* ma;
+} MQTTAsyncGroups;
+
+enum { GROUP_PENDING, GROUP_SUCCEEDED, GROUP_FAILED };
+
+
+/**
+ * Record that a start or stop has completed on a member, and find which of the
+ * application's callbacks, if any, is to be called.  The response is freed once the
+ * request has completed on all the members.  Called with the group's mutex held.
+ * @param r the response
+ * @param failed whether the request failed on the member
+ * @param copy set to the response to call the callback with, as the original may be freed
+ * @return GROUP_SUCCEEDED or GROUP_FAILED to call onSuccess or onFailure, otherwise GROUP_PENDING
+ */
+static int MQTTAsyncGroup_complete(MQTTAsyncGroup_response* r, int failed, MQTTAsyncGroup_response* copy)
+{
+	int rc = GROUP_PENDING;
+
+	if (failed && !r->failed)
+	{
+		r->failed = 1;
+		rc = GROUP_FAILED;
+	}
+	if (--r->pending == 0 && !r->failed)
+		rc = GROUP_SUCCEEDED;
+	*copy = *r;
+	if (r->pending == 0)
+		ListRemove(r->parent->responses, r); /* frees it */
+	return rc;
+}
+
+
+/**
+ * Call the application's callback for a start or stop which has completed.
+ * @param r the copy of the response
+ * @param rc GROUP_SUCCEEDED or GROUP_FAILED, otherwise nothing is called
+ * @param code the error code of a failure
+ * @param message the error message of a failure, or NULL
+ */
+static void MQTTAsyncGroup_callback(MQTTAsyncGroup_response* r, int rc, int code, const char* message)
+{
+	if (rc == GROUP_SUCCEEDED)
+	{
+		if (r->onSuccess)
+		{
+			MQTTAsync_successData data;
+
+			memset(&data, '\0', sizeof(data));
+			(*(r->onSuccess))(r->context, &data);
+		}
+		else if (r->onSuccess5)
+		{
+			MQTTAsync_successData5 data = MQTTAsync_successData5_initializer;
+
+			(*(r->onSuccess5))(r->context, &data);
+		}
+	}
+	else if (rc == GROUP_FAILED)
+	{
+		if (r->onFailure)
+		{
+			MQTTAsync_failureData data;
+
+			data.token = 0;
+			data.code = code;
+			data.message = message;
+			(*(r->onFailure))(r->context, &data);
+		}
+		else if (r->onFailure5)
+		{
+			MQTTAsync_failureData5 data = MQTTAsync_failureData5_initializer;
+
+			data.code = code;
+			data.message = message;
+			(*(r->onFailure5))(r->context, &data);
+		}
+	}
+}
+
+
+/**
+ * Complete the start waiting for a member to subscribe, if there is one.
+ * @param member the member
+ * @param failed whether the member failed to connect or to subscribe
+ * @param code, message the error of a failure
+ */
+static void MQTTAsyncGroup_started(MQTTAsyncGroup_member* member, int failed, int code, const char* message)
+{
+	MQTTAsyncGroups* g = member->parent;
+	MQTTAsyncGroup_response r;
+	int rc = GROUP_PENDING;
+
+	Thread_lock_mutex(g->mutex);
+	if (!failed)
+		member->subscribed = 1;
+	if (member->start)
+	{
+		rc = MQTTAsyncGroup_complete(member->start, failed, &r);
+		member->start = NULL;
+	}
+	Thread_unlock_mutex(g->mutex);
+	MQTTAsyncGroup_callback(&r, rc, code, message);
+}
+
+
+static void MQTTAsyncGroup_onSubscribe(void* context, MQTTAsync_successData* response)
+{
+	MQTTAsyncGroup_member* member = context;
+
+	if (response && response->alt.qos == 0x80)
+		MQTTAsyncGroup_started(member, 1, MQTTASYNC_FAILURE, "shared subscription refused");
+	else
+		MQTTAsyncGroup_started(member, 0, MQTTASYNC_SUCCESS, NULL);
+}
+
+
+static void MQTTAsyncGroup_onFailure(void* context, MQTTAsync_failureData* response)
+{
+	MQTTAsyncGroup_started(context, 1, (response) ? response->code : MQTTASYNC_FAILURE,
+			(response) ? response->message : NULL);
+}
+
+
+static void MQTTAsyncGroup_onSubscribe5(void* context, MQTTAsync_successData5* response)
+{
+	MQTTAsyncGroup_started(context, 0, MQTTASYNC_SUCCESS, NULL);
+}
+
+
+static void MQTTAsyncGroup_onFailure5(void* context, MQTTAsync_failureData5* response)
+{
+	if (response && response->code == MQTTASYNC_SUCCESS) /* the server refused the subscription */
+		MQTTAsyncGroup_started(context, 1, MQTTASYNC_FAILURE, "shared subscription refused");
+	else
+		MQTTAsyncGroup_started(context, 1, (response) ? response->code : MQTTASYNC_FAILURE,
+				(response) ? response->message : NULL);
+}
+
+
+/**
+ * The connected callback of a member, which subscribes it to the shared subscription
+ * on each new connection.  An MQTT V5 client only takes the V5 callbacks.
+ */
+static void MQTTAsyncGroup_connected(void* context, char* cause)
+{
+	MQTTAsyncGroup_member* member = context;
+	MQTTAsync_responseOptions opts = MQTTAsync_responseOptions_initializer;
+	int rc;
+
+	if (member->parent->MQTTVersion >= MQTTVERSION_5)
+	{
+		opts.onSuccess5 = MQTTAsyncGroup_onSubscribe5;
+		opts.onFailure5 = MQTTAsyncGroup_onFailure5;
+	}
+	else
+	{
+		opts.onSuccess = MQTTAsyncGroup_onSubscribe;
+		opts.onFailure = MQTTAsyncGroup_onFailure;
+	}
+	opts.context = member;
+	if ((rc = MQTTAsync_subscribe(member->client, member->parent->filter, member->parent->qos, &opts)) != MQTTASYNC_SUCCESS)
+		MQTTAsyncGroup_started(member, 1, rc, "shared subscription failed");
+}
+
+
+static void MQTTAsyncGroup_connectionLost(void* context, char* cause)
+{
+	MQTTAsyncGroup_member* member = context;
+	MQTTAsyncGroups* g = member->parent;
+
+	Thread_lock_mutex(g->mutex);
+	member->subscribed = 0;
+	Thread_unlock_mutex(g->mutex);
+	if (g->cl)
+		(*(g->cl))(g->context, cause);
+}
+
+
+static int MQTTAsyncGroup_messageArrived(void* context, char* topicName, int topicLen, MQTTAsync_message* message)
+{
+	MQTTAsyncGroup_member* member = context;
+	MQTTAsyncGroups* g = member->parent;
+	int payloadlen = message->payloadlen;
+	int rc;
+
+	if ((rc = (*(g->ma))(g->context, topicName, topicLen, message)) != 0)
+	{
+		Thread_lock_mutex(g->mutex);
+		member->messages++;
+		member->bytes += payloadlen;
+		Thread_unlock_mutex(g->mutex);
+	}
+	return rc;
+}
+
+
+static void MQTTAsyncGroup_onDisconnect(void* context, MQTTAsync_successData* response)
+{
+	MQTTAsyncGroup_response* r = context;
+	MQTTAsyncGroups* g = r->parent;
+	MQTTAsyncGroup_response copy;
+	int rc;
+
+	Thread_lock_mutex(g->mutex);
+	rc = MQTTAsyncGroup_complete(r, 0, &copy);
+	Thread_unlock_mutex(g->mutex);
+	MQTTAsyncGroup_callback(&copy, rc, MQTTASYNC_SUCCESS, NULL);
+}
+
+
+static void MQTTAsyncGroup_onDisconnectFailure(void* context, MQTTAsync_failureData* response)
+{
+	MQTTAsyncGroup_response* r = context;
+	MQTTAsyncGroups* g = r->parent;
+	MQTTAsyncGroup_response copy;
+	int rc;
+
+	Thread_lock_mutex(g->mutex);
+	rc = MQTTAsyncGroup_complete(r, 1, &copy);
+	Thread_unlock_mutex(g->mutex);
+	MQTTAsyncGroup_callback(&copy, rc, (response) ? response->code : MQTTASYNC_FAILURE,
+			(response) ? response->message : NULL);
+}
+
+
+/**
+ * Make a response to wrap the callbacks of a start or stop.
+ * @param g the group
+ * @param onSuccess, onFailure, onSuccess5, onFailure5, context the application's callbacks
+ * @return the response, or NULL if there is no memory
+ */
+static MQTTAsyncGroup_response* MQTTAsyncGroup_newResponse(MQTTAsyncGroups* g,
+		MQTTAsync_onSuccess* onSuccess, MQTTAsync_onFailure* onFailure,
+		MQTTAsync_onSuccess5* onSuccess5, MQTTAsync_onFailure5* onFailure5, void* context)
+{
+	MQTTAsyncGroup_response* r = NULL;
+
+	if ((r = malloc(sizeof(MQTTAsyncGroup_response))) == NULL)
+		goto exit;
+	r->parent = g;
+	r->pending = g->count;
+	r->failed = 0;
+	r->onSuccess = onSuccess;
+	r->onFailure = onFailure;
+	r->onSuccess5 = onSuccess5;
+	r->onFailure5 = onFailure5;
+	r->context = context;
+	ListAppend(g->responses, r, sizeof(MQTTAsyncGroup_response));
+exit:
+	return r;
+}
+
+
+int MQTTAsyncGroup_create(MQTTAsyncGroup* handle, const char* serverURI, const char* clientId,
+		const char* topicFilter, int persistence_type, void* persistence_context, const MQTTAsyncGroup_options* options)
+{
+	MQTTAsyncGroups* g = NULL;
+	const char* shareName = NULL;
+	char* memberId = NULL;
+	int rc = MQTTASYNC_SUCCESS;
+	int i;
+
+	FUNC_ENTRY;
+	if (handle == NULL || clientId == NULL || topicFilter == NULL || options == NULL ||
+		strncmp(options->struct_id, "MQGP", 4) != 0 || options->struct_version != 0 ||
+		options->members < 1 || options->members > MQTTASYNCGROUP_MAX_MEMBERS)
+	{
+		rc = MQTTASYNC_BAD_STRUCTURE;
+		goto exit;
+	}
+	if (options->qos < 0 || options->qos > 2)
+	{
+		rc = MQTTASYNC_BAD_QOS;
+		goto exit;
+	}
+	shareName = (options->shareName) ? options->shareName : clientId;
+	if (shareName[0] == '\0' || strpbrk(shareName, "/+#") != NULL)
+	{
+		rc = MQTTASYNC_BAD_STRUCTURE;
+		goto exit;
+	}
+	if ((g = malloc(sizeof(MQTTAsyncGroups))) == NULL)
+	{
+		rc = PAHO_MEMORY_ERROR;
+		goto exit;
+	}
+	memset(g, '\0', sizeof(MQTTAsyncGroups));
+	g->qos = options->qos;
+	if ((g->members = malloc(sizeof(MQTTAsyncGroup_member) * options->members)) == NULL ||
+		(g->filter = malloc(strlen(shareName) + strlen(topicFilter) + 9)) == NULL ||
+		(memberId = malloc(strlen(clientId) + 4)) == NULL ||
+		(g->responses = ListInitialize()) == NULL ||
+		(g->mutex = Thread_create_mutex(&rc)) == NULL)
+	{
+		rc = PAHO_MEMORY_ERROR;
+		goto exit;
+	}
+	sprintf(g->filter, "$share/%s/%s", shareName, topicFilter);
+	memset(g->members, '\0', sizeof(MQTTAsyncGroup_member) * options->members);
+	for (i = 0; i < options->members; ++i)
+	{
+		MQTTAsyncGroup_member* member = &g->members[i];
+
+		sprintf(memberId, "%s-%d", clientId, i);
+		member->index = i;
+		member->parent = g;
+		/* each member on a reactor of its own, while there are enough of them */
+		rc = MQTTAsync_createOnReactor(&member->client, serverURI, memberId,
+				persistence_type, persistence_context, options->createOptions, i);
+		if (rc != MQTTASYNC_SUCCESS)
+			goto exit;
+		g->count++;
+		if ((rc = MQTTAsync_setConnected(member->client, member, MQTTAsyncGroup_connected)) != MQTTASYNC_SUCCESS)
+			goto exit;
+	}
+	*handle = g;
+exit:
+	if (memberId)
+		free(memberId);
+	if (rc != MQTTASYNC_SUCCESS && g)
+		MQTTAsyncGroup_destroy((MQTTAsyncGroup*)&g);
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+int MQTTAsyncGroup_setCallbacks(MQTTAsyncGroup handle, void* context, MQTTAsync_connectionLost* cl,
+		MQTTAsync_messageArrived* ma)
+{
+	MQTTAsyncGroups* g = handle;
+	int rc = MQTTASYNC_SUCCESS;
+	int i;
+
+	FUNC_ENTRY;
+	if (g == NULL || ma == NULL)
+	{
+		rc = MQTTASYNC_FAILURE;
+		goto exit;
+	}
+	g->context = context;
+	g->cl = cl;
+	g->ma = ma;
+	for (i = 0; i < g->count && rc == MQTTASYNC_SUCCESS; ++i)
+		rc = MQTTAsync_setCallbacks(g->members[i].client, &g->members[i],
+				MQTTAsyncGroup_connectionLost, MQTTAsyncGroup_messageArrived, NULL);
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+int MQTTAsyncGroup_start(MQTTAsyncGroup handle, const MQTTAsync_connectOptions* options)
+{
+	MQTTAsyncGroups* g = handle;
+	MQTTAsyncGroup_response* r = NULL;
+	MQTTAsync_connectOptions opts;
+	int rc = MQTTASYNC_SUCCESS;
+	int i;
+
+	FUNC_ENTRY;
+	if (g == NULL || options == NULL || g->ma == NULL)
+	{
+		rc = MQTTASYNC_FAILURE;
+		goto exit;
+	}
+	opts = *options;
+	opts.onSuccess = NULL; /* the connected callback subscribes, and completes the start */
+	opts.onFailure = MQTTAsyncGroup_onFailure;
+	if (options->struct_version >= 6)
+	{
+		opts.onSuccess5 = NULL;
+		opts.onFailure5 = NULL;
+	}
+	Thread_lock_mutex(g->mutex);
+	g->MQTTVersion = (options->struct_version >= 3) ? options->MQTTVersion : MQTTVERSION_DEFAULT;
+	if ((r = MQTTAsyncGroup_newResponse(g, options->onSuccess, options->onFailure,
+			(options->struct_version >= 6) ? options->onSuccess5 : NULL,
+			(options->struct_version >= 6) ? options->onFailure5 : NULL, options->context)) == NULL)
+	{
+		Thread_unlock_mutex(g->mutex);
+		rc = PAHO_MEMORY_ERROR;
+		goto exit;
+	}
+	for (i = 0; i < g->count; ++i)
+		g->members[i].start = r;
+	Thread_unlock_mutex(g->mutex);
+	for (i = 0; i < g->count; ++i)
+	{
+		MQTTAsyncGroup_member* member = &g->members[i];
+		int member_rc;
+
+		opts.context = member;
+		if ((member_rc = MQTTAsync_connect(member->client, &opts)) != MQTTASYNC_SUCCESS)
+		{
+			MQTTAsyncGroup_response ignored;
+
+			if (rc == MQTTASYNC_SUCCESS)
+				rc = member_rc;
+			Thread_lock_mutex(g->mutex);
+			if (member->start)
+			{
+				MQTTAsyncGroup_complete(member->start, 1, &ignored); /* the failure is returned, not called back */
+				member->start = NULL;
+			}
+			Thread_unlock_mutex(g->mutex);
+		}
+	}
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+int MQTTAsyncGroup_stop(MQTTAsyncGroup handle, const MQTTAsync_disconnectOptions* options)
+{
+	MQTTAsyncGroups* g = handle;
+	MQTTAsyncGroup_response* r = NULL;
+	MQTTAsync_disconnectOptions opts = MQTTAsync_disconnectOptions_initializer;
+	int rc = MQTTASYNC_SUCCESS;
+	int i;
+
+	FUNC_ENTRY;
+	if (g == NULL)
+	{
+		rc = MQTTASYNC_FAILURE;
+		goto exit;
+	}
+	if (options)
+	{
+		opts = *options;
+		Thread_lock_mutex(g->mutex);
+		if ((r = MQTTAsyncGroup_newResponse(g, options->onSuccess, options->onFailure,
+				(options->struct_version >= 1) ? options->onSuccess5 : NULL,
+				(options->struct_version >= 1) ? options->onFailure5 : NULL, options->context)) != NULL)
+		{
+			opts.onSuccess = MQTTAsyncGroup_onDisconnect;
+			opts.onFailure = MQTTAsyncGroup_onDisconnectFailure;
+			if (options->struct_version >= 1)
+			{
+				opts.onSuccess5 = NULL;
+				opts.onFailure5 = NULL;
+			}
+			opts.context = r;
+		}
+		Thread_unlock_mutex(g->mutex);
+	}
+	for (i = 0; i < g->count; ++i)
+	{
+		int member_rc;
+
+		Thread_lock_mutex(g->mutex);
+		g->members[i].subscribed = 0;
+		Thread_unlock_mutex(g->mutex);
+		if ((member_rc = MQTTAsync_disconnect(g->members[i].client, (options) ? &opts : NULL)) != MQTTASYNC_SUCCESS)
+		{
+			MQTTAsyncGroup_response ignored;
+
+			if (rc == MQTTASYNC_SUCCESS)
+				rc = member_rc;
+			if (r)
+			{
+				Thread_lock_mutex(g->mutex);
+				MQTTAsyncGroup_complete(r, 1, &ignored); /* the failure is returned, not called back */
+				Thread_unlock_mutex(g->mutex);
+			}
+		}
+	}
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+int MQTTAsyncGroup_getStatistics(MQTTAsyncGroup handle, MQTTAsyncGroup_statistics* stats)
+{
+	MQTTAsyncGroups* g = handle;
+	int rc = MQTTASYNC_SUCCESS;
+	int i;
+
+	FUNC_ENTRY;
+	if (g == NULL)
+	{
+		rc = MQTTASYNC_FAILURE;
+		goto exit;
+	}
+	if (stats == NULL || strncmp(stats->struct_id, "MQGS", 4) != 0 || stats->struct_version != 0)
+	{
+		rc = MQTTASYNC_BAD_STRUCTURE;
+		goto exit;
+	}
+	stats->members = g->count;
+	stats->connected = stats->subscribed = 0;
+	stats->messages = stats->bytes = 0;
+	for (i = 0; i < g->count; ++i)
+	{
+		if (MQTTAsync_isConnected(g->members[i].client))
+			stats->connected++;
+	}
+	Thread_lock_mutex(g->mutex);
+	stats->minMemberMessages = stats->maxMemberMessages = g->members[0].messages;
+	for (i = 0; i < g->count; ++i)
+	{
+		MQTTAsyncGroup_member* member = &g->members[i];
+
+		if (member->subscribed)
+			stats->subscribed++;
+		stats->messages += member->messages;
+		stats->bytes += member->bytes;
+		if (member->messages < stats->minMemberMessages)
+			stats->minMemberMessages = member->messages;
+		if (member->messages > stats->maxMemberMessages)
+			stats->maxMemberMessages = member->messages;
+	}
+	Thread_unlock_mutex(g->mutex);
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+MQTTAsync MQTTAsyncGroup_getClient(MQTTAsyncGroup handle, int member)
+{
+	MQTTAsyncGroups* g = handle;
+
+	if (g == NULL || member < 0 || member >= g->count)
+		return NULL;
+	return g->members[member].client;
+}
+
+
+void MQTTAsyncGroup_destroy(MQTTAsyncGroup* handle)
+{
+	MQTTAsyncGroups* g = NULL;
+	int i;
+
+	FUNC_ENTRY;
+	if (handle == NULL || (g = *handle) == NULL)
+		goto exit;
+	for (i = 0; i < g->count; ++i)
+		MQTTAsync_destroy(&g->members[i].client);
+	if (g->responses)
+		ListFree(g->responses); /* the starts and stops which never completed */
+	if (g->mutex)
+		Thread_destroy_mutex(g->mutex);
+	if (g->filter)
+		free(g->filter);
+	if (g->members)
+		free(g->members);
+	free(g);
+	*handle = NULL;
+exit:
+	FUNC_EXIT;
+}
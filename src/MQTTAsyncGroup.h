@@ -0,0 +1,193 @@
+/*******************************************************************************
+ * Copyright (c) 2026 Contributors to the Eclipse Foundation
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v2.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    https://www.eclipse.org/legal/epl-2.0/
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *******************************************************************************/
+
+/**
+ * @file
+ * \brief A consumer group which spreads the messages of a shared subscription over
+ * several MQTT connections.
+ *
+ * The server shares the messages matching a shared subscription, <i>$share/group/filter</i>,
+ * between the clients subscribed to it, but the messages of one ::MQTTAsync client are all
+ * read, and their callbacks called, by the same thread.  A consumer group creates a number
+ * of clients, the members, with client identifiers made from the one given and the number
+ * of the member, and subscribes each of them to the shared subscription whenever it
+ * connects, so that the messages are read and processed in parallel.
+ *
+ * For the members to be read on different threads, the library must have been initialized
+ * with at least as many reactors, MQTTAsync_init_options.reactorThreads, as there are
+ * members.  Member n runs on reactor n, counting modulo the number of reactors, whatever
+ * other clients the application has, so that each member has a reactor of its own, and
+ * the reactors are shared out evenly when there are fewer of them.  With
+ * MQTTAsync_init_options.callbackThreads, the messageArrived callbacks of the members are
+ * also called on the pool of callback threads.
+ */
+
+#if !defined(MQTTASYNCGROUP_H)
+#define MQTTASYNCGROUP_H
+
+#if defined(__cplusplus)
+ extern "C" {
+#endif
+
+#include "MQTTAsync.h"
+
+/** The most members a consumer group can have */
+#define MQTTASYNCGROUP_MAX_MEMBERS 64
+
+/**
+ * A handle representing a consumer group.
+ */
+typedef void* MQTTAsyncGroup;
+
+/**
+ * Options for MQTTAsyncGroup_create().
+ */
+typedef struct
+{
+	/** The eyecatcher for this structure.  Must be MQGP */
+	char struct_id[4];
+	/** The version number of this structure.  Must be 0 */
+	int struct_version;
+	/** The number of connections, from 1 to ::MQTTASYNCGROUP_MAX_MEMBERS */
+	int members;
+	/** The name of the share, or NULL to use the client identifier.  It must not contain
+	 * '/', '+' or '#' */
+	const char* shareName;
+	/** The quality of service with which the members subscribe */
+	int qos;
+	/** The options used to create each member, or NULL for none */
+	MQTTAsync_createOptions* createOptions;
+} MQTTAsyncGroup_options;
+
+#define MQTTAsyncGroup_options_initializer { {'M', 'Q', 'G', 'P'}, 0, 4, NULL, 1, NULL }
+
+/**
+ * Statistics about the members of a consumer group, returned by MQTTAsyncGroup_getStatistics().
+ * The counts are kept over the lifetime of the group, across reconnects.
+ */
+typedef struct
+{
+	/** The eyecatcher for this structure.  Must be MQGS */
+	char struct_id[4];
+	/** The version number of this structure.  Must be 0 */
+	int struct_version;
+	/** The number of members */
+	int members;
+	/** The number of members which are connected */
+	int connected;
+	/** The number of members which are subscribed to the shared subscription */
+	int subscribed;
+	/** The number of messages accepted by the messageArrived callback, over all the members */
+	long messages;
+	/** The number of bytes of payload of those messages */
+	long bytes;
+	/** The fewest messages accepted by one member */
+	long minMemberMessages;
+	/** The most messages accepted by one member */
+	long maxMemberMessages;
+} MQTTAsyncGroup_statistics;
+
+#define MQTTAsyncGroup_statistics_initializer { {'M', 'Q', 'G', 'S'}, 0, 0, 0, 0, 0, 0, 0, 0 }
+
+/**
+ * This function creates a consumer group, and the MQTTAsync clients for its members,
+ * which have the client identifiers <i>clientId</i>-0, <i>clientId</i>-1 and so on.
+ * @param handle A pointer to an ::MQTTAsyncGroup handle.  The handle is
+ * populated with a valid group reference following a successful return from
+ * this function.
+ * @param serverURI A null-terminated string specifying the server to
+ * which the members will connect, as for MQTTAsync_create().
+ * @param clientId The client identifier from which those of the members are made.
+ * @param topicFilter The topic filter to which the members subscribe, shared as
+ * <i>$share/shareName/topicFilter</i>.
+ * @param persistence_type The type of persistence to be used by the members,
+ * as for MQTTAsync_create().  Each member has its own store.
+ * @param persistence_context As for MQTTAsync_create().
+ * @param options The number of members, the share name and the quality of service.
+ * @return ::MQTTASYNC_SUCCESS if the group is successfully created, otherwise
+ * an error code.
+ */
+LIBMQTT_API int MQTTAsyncGroup_create(MQTTAsyncGroup* handle, const char* serverURI, const char* clientId,
+		const char* topicFilter, int persistence_type, void* persistence_context, const MQTTAsyncGroup_options* options);
+
+/**
+ * This function sets the callbacks of all the members, as MQTTAsync_setCallbacks()
+ * does for one client.  It must be called before MQTTAsyncGroup_start().  The connection
+ * lost callback is called for each member which loses its connection.  The messageArrived
+ * callback may be called for different members at the same time, on different threads.
+ * @param handle A valid group handle from a successful call to MQTTAsyncGroup_create().
+ * @param context A pointer to any application-specific context, passed to the callbacks.
+ * @param cl A pointer to an MQTTAsync_connectionLost() callback function, or NULL.
+ * @param ma A pointer to an MQTTAsync_messageArrived() callback function.
+ * @return ::MQTTASYNC_SUCCESS if the callbacks were correctly set,
+ * ::MQTTASYNC_FAILURE if an error occurred.
+ */
+LIBMQTT_API int MQTTAsyncGroup_setCallbacks(MQTTAsyncGroup handle, void* context, MQTTAsync_connectionLost* cl,
+		MQTTAsync_messageArrived* ma);
+
+/**
+ * This function connects all the members, with the same options, and subscribes each to
+ * the shared subscription once it has connected, and again whenever it reconnects.  The
+ * onSuccess callback is called once all the members have subscribed, and the onFailure
+ * callback once if any of them fails to connect or to subscribe.
+ * @param handle A valid group handle from a successful call to MQTTAsyncGroup_create().
+ * @param options A pointer to a valid MQTTAsync_connectOptions structure.
+ * @return ::MQTTASYNC_SUCCESS if the connects were accepted, otherwise the error
+ * code of the first which was not.
+ */
+LIBMQTT_API int MQTTAsyncGroup_start(MQTTAsyncGroup handle, const MQTTAsync_connectOptions* options);
+
+/**
+ * This function disconnects all the members, with the same options.  The onSuccess
+ * callback is called once all the members have disconnected, and the onFailure callback
+ * once if any of them fails to.  Messages in flight to a member when it disconnects are
+ * delivered to the other members, or to it when it reconnects, as the server decides.
+ * @param handle A valid group handle from a successful call to MQTTAsyncGroup_create().
+ * @param options The disconnect options, or NULL for the defaults.
+ * @return ::MQTTASYNC_SUCCESS if the disconnects were accepted, otherwise the error
+ * code of the first which was not.
+ */
+LIBMQTT_API int MQTTAsyncGroup_stop(MQTTAsyncGroup handle, const MQTTAsync_disconnectOptions* options);
+
+/**
+ * This function gets statistics about the members of a consumer group.
+ * @param handle A valid group handle from a successful call to MQTTAsyncGroup_create().
+ * @param stats A pointer to an ::MQTTAsyncGroup_statistics structure, initialized
+ * with ::MQTTAsyncGroup_statistics_initializer, in which the statistics are returned.
+ * @return ::MQTTASYNC_SUCCESS if the statistics were returned,
+ * ::MQTTASYNC_FAILURE if the handle is not valid, or
+ * ::MQTTASYNC_BAD_STRUCTURE if the statistics structure is not valid.
+ */
+LIBMQTT_API int MQTTAsyncGroup_getStatistics(MQTTAsyncGroup handle, MQTTAsyncGroup_statistics* stats);
+
+/**
+ * This function returns the MQTTAsync client of one of the members, to get its
+ * statistics.  It must not be destroyed.
+ * @param handle A valid group handle from a successful call to MQTTAsyncGroup_create().
+ * @param member The number of the member, from 0.
+ * @return The client of the member, or NULL for an invalid handle or member.
+ */
+LIBMQTT_API MQTTAsync MQTTAsyncGroup_getClient(MQTTAsyncGroup handle, int member);
+
+/**
+ * This function frees the memory allocated to a consumer group and destroys the
+ * clients of its members.  They should be stopped first.
+ * @param handle A pointer to the handle referring to the group.  It is set to NULL.
+ */
+LIBMQTT_API void MQTTAsyncGroup_destroy(MQTTAsyncGroup* handle);
+
+#if defined(__cplusplus)
+     }
+#endif
+
+#endif
@@ -0,0 +1,619 @@
+/*******************************************************************************
+ * Copyright (c) 2026 Contributors to the Eclipse Foundation
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v2.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    https://www.eclipse.org/legal/epl-2.0/
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *******************************************************************************/
+
+/**
+ * @file
+ * \brief A publisher which spreads its messages over several MQTT connections.
+ *
+ * Each stripe is an ordinary MQTTAsync client.  The callbacks of the requests made through
+ * the striped client are wrapped, so that the tokens passed to them are the striped ones,
+ * and so that a connect or disconnect of all the stripes completes once.
+ */
+
+#include "MQTTAsyncStripe.h"
+#include "LinkedList.h"
+#include "Thread.h"
+#include "StackTrace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Heap.h"
+
+struct MQTTAsyncStripes_struct;
+
+typedef struct
+{
+	int index;                             /**< the number of the stripe */
+	MQTTAsync client;                      /**< the client which makes the connection */
+	struct MQTTAsyncStripes_struct* parent;
+} MQTTAsyncStripe_stripe;
+
+typedef struct MQTTAsyncStripes_struct
+{
+	int count;                        /**< the number of stripes */
+	MQTTAsyncStripe_stripe* stripes;
+	mutex_type mutex;                 /**< protects the responses */
+	List* responses;                  /**< the requests which have not completed */
+	void* context;                    /**< the context of the callbacks set on all the stripes */
+	MQTTAsync_connectionLost* cl;
+	MQTTAsync_messageArrived* ma;
+	MQTTAsync_deliveryComplete* dc;
+} MQTTAsyncStripes;
+
+/**
+ * The callbacks of a request made through the striped client.
+ */
+typedef struct
+{
+	MQTTAsyncStripes* parent;
+	int stripe;               /**< the stripe of a publish, or -1 for a request made on all stripes */
+	int pending;              /**< the number of stripes on which the request has not completed */
+	int failed;               /**< the request has failed on a stripe, and onFailure has been called */
+	MQTTAsync_onSuccess* onSuccess;
+	MQTTAsync_onFailure* onFailure;
+	MQTTAsync_onSuccess5* onSuccess5;
+	MQTTAsync_onFailure5* onFailure5;
+	void* context;
+} MQTTAsyncStripe_response;
+
+enum { STRIPE_PENDING, STRIPE_SUCCEEDED, STRIPE_FAILED };
+
+
+/**
+ * Make the token of the striped client from that of a stripe.
+ * @param stripe the number of the stripe
+ * @param token the token of the stripe's client
+ * @return the token, 0 if the stripe's token is 0
+ */
+static MQTTAsync_token MQTTAsyncStripe_token(int stripe, MQTTAsync_token token)
+{
+	return (token == 0) ? 0 : token * MQTTASYNCSTRIPE_MAX_STRIPES + stripe;
+}
+
+
+/**
+ * The stripe on which the messages of a topic are sent.
+ * @param s the striped client
+ * @param topic the topic
+ * @return the number of the stripe
+ */
+static int MQTTAsyncStripe_index(MQTTAsyncStripes* s, const char* topic)
+{
+	unsigned int hash = 2166136261u; /* FNV-1a */
+
+	while (*topic)
+	{
+		hash ^= (unsigned char)*topic++;
+		hash *= 16777619u;
+	}
+	return (int)(hash % (unsigned int)s->count);
+}
+
+
+/**
+ * Record that a request has completed on a stripe, and find which of the application's
+ * callbacks, if any, is to be called.  The response is freed once the request has
+ * completed on all its stripes.
+ * @param r the response
+ * @param failed whether the request failed on the stripe
+ * @param copy set to the response to call the callback with, as the original may be freed
+ * @return STRIPE_SUCCEEDED or STRIPE_FAILED to call onSuccess or onFailure, otherwise STRIPE_PENDING
+ */
+static int MQTTAsyncStripe_complete(MQTTAsyncStripe_response* r, int failed, MQTTAsyncStripe_response* copy)
+{
+	MQTTAsyncStripes* s = r->parent;
+	int rc = STRIPE_PENDING;
+
+	Thread_lock_mutex(s->mutex);
+	if (failed && !r->failed)
+	{
+		r->failed = 1;
+		rc = STRIPE_FAILED;
+	}
+	if (failed)
+		--r->pending;
+	else if (--r->pending == 0 && !r->failed)
+		rc = STRIPE_SUCCEEDED;
+	*copy = *r;
+	if (r->pending == 0)
+		ListRemove(s->responses, r); /* frees it */
+	Thread_unlock_mutex(s->mutex);
+	return rc;
+}
+
+
+static void MQTTAsyncStripe_onSuccess(void* context, MQTTAsync_successData* response)
+{
+	MQTTAsyncStripe_response r;
+
+	if (MQTTAsyncStripe_complete(context, 0, &r) == STRIPE_SUCCEEDED && r.onSuccess)
+	{
+		if (response && r.stripe >= 0)
+		{
+			MQTTAsync_successData data = *response;
+
+			data.token = MQTTAsyncStripe_token(r.stripe, response->token);
+			(*(r.onSuccess))(r.context, &data);
+		}
+		else
+			(*(r.onSuccess))(r.context, response);
+	}
+}
+
+
+static void MQTTAsyncStripe_onSuccess5(void* context, MQTTAsync_successData5* response)
+{
+	MQTTAsyncStripe_response r;
+
+	if (MQTTAsyncStripe_complete(context, 0, &r) == STRIPE_SUCCEEDED && r.onSuccess5)
+	{
+		if (response && r.stripe >= 0)
+		{
+			MQTTAsync_successData5 data = *response;
+
+			data.token = MQTTAsyncStripe_token(r.stripe, response->token);
+			(*(r.onSuccess5))(r.context, &data);
+		}
+		else
+			(*(r.onSuccess5))(r.context, response);
+	}
+}
+
+
+static void MQTTAsyncStripe_onFailure(void* context, MQTTAsync_failureData* response)
+{
+	MQTTAsyncStripe_response r;
+
+	if (MQTTAsyncStripe_complete(context, 1, &r) == STRIPE_FAILED && r.onFailure)
+	{
+		if (response && r.stripe >= 0)
+		{
+			MQTTAsync_failureData data = *response;
+
+			data.token = MQTTAsyncStripe_token(r.stripe, response->token);
+			(*(r.onFailure))(r.context, &data);
+		}
+		else
+			(*(r.onFailure))(r.context, response);
+	}
+}
+
+
+static void MQTTAsyncStripe_onFailure5(void* context, MQTTAsync_failureData5* response)
+{
+	MQTTAsyncStripe_response r;
+
+	if (MQTTAsyncStripe_complete(context, 1, &r) == STRIPE_FAILED && r.onFailure5)
+	{
+		if (response && r.stripe >= 0)
+		{
+			MQTTAsync_failureData5 data = *response;
+
+			data.token = MQTTAsyncStripe_token(r.stripe, response->token);
+			(*(r.onFailure5))(r.context, &data);
+		}
+		else
+			(*(r.onFailure5))(r.context, response);
+	}
+}
+
+
+/**
+ * Make a response to wrap the callbacks of a request.
+ * @param s the striped client
+ * @param stripe the stripe of a publish, or -1 for a request made on all stripes
+ * @param onSuccess, onFailure, onSuccess5, onFailure5, context the application's callbacks
+ * @return the response, or NULL if none is needed or there is no memory
+ */
+static MQTTAsyncStripe_response* MQTTAsyncStripe_newResponse(MQTTAsyncStripes* s, int stripe,
+		MQTTAsync_onSuccess* onSuccess, MQTTAsync_onFailure* onFailure,
+		MQTTAsync_onSuccess5* onSuccess5, MQTTAsync_onFailure5* onFailure5, void* context)
+{
+	MQTTAsyncStripe_response* r = NULL;
+
+	if (!onSuccess && !onFailure && !onSuccess5 && !onFailure5)
+		goto exit;
+	if ((r = malloc(sizeof(MQTTAsyncStripe_response))) == NULL)
+		goto exit;
+	r->parent = s;
+	r->stripe = stripe;
+	r->pending = (stripe >= 0) ? 1 : s->count;
+	r->failed = 0;
+	r->onSuccess = onSuccess;
+	r->onFailure = onFailure;
+	r->onSuccess5 = onSuccess5;
+	r->onFailure5 = onFailure5;
+	r->context = context;
+	Thread_lock_mutex(s->mutex);
+	ListAppend(s->responses, r, sizeof(MQTTAsyncStripe_response));
+	Thread_unlock_mutex(s->mutex);
+exit:
+	return r;
+}
+
+
+/**
+ * Free a response whose request could not be made.
+ * @param r the response
+ */
+static void MQTTAsyncStripe_freeResponse(MQTTAsyncStripe_response* r)
+{
+	MQTTAsyncStripes* s = r->parent;
+
+	Thread_lock_mutex(s->mutex);
+	ListRemove(s->responses, r);
+	Thread_unlock_mutex(s->mutex);
+}
+
+
+static void MQTTAsyncStripe_connectionLost(void* context, char* cause)
+{
+	MQTTAsyncStripe_stripe* stripe = context;
+
+	if (stripe->parent->cl)
+		(*(stripe->parent->cl))(stripe->parent->context, cause);
+}
+
+
+static int MQTTAsyncStripe_messageArrived(void* context, char* topicName, int topicLen, MQTTAsync_message* message)
+{
+	MQTTAsyncStripe_stripe* stripe = context;
+
+	if (stripe->parent->ma == NULL)
+	{
+		/* a client must have a messageArrived callback, but a publisher may not subscribe */
+		MQTTAsync_freeMessage(&message);
+		MQTTAsync_free(topicName);
+		return 1;
+	}
+	return (*(stripe->parent->ma))(stripe->parent->context, topicName, topicLen, message);
+}
+
+
+static void MQTTAsyncStripe_deliveryComplete(void* context, MQTTAsync_token token)
+{
+	MQTTAsyncStripe_stripe* stripe = context;
+
+	(*(stripe->parent->dc))(stripe->parent->context, MQTTAsyncStripe_token(stripe->index, token));
+}
+
+
+int MQTTAsyncStripe_create(MQTTAsyncStripe* handle, const char* serverURI, const char* clientId,
+		int persistence_type, void* persistence_context, const MQTTAsyncStripe_options* options)
+{
+	MQTTAsyncStripes* s = NULL;
+	char* stripeId = NULL;
+	int rc = MQTTASYNC_SUCCESS;
+	int i;
+
+	FUNC_ENTRY;
+	if (handle == NULL || clientId == NULL || options == NULL || strncmp(options->struct_id, "MQSP", 4) != 0 ||
+		options->struct_version != 0 || options->stripes < 1 || options->stripes > MQTTASYNCSTRIPE_MAX_STRIPES)
+	{
+		rc = MQTTASYNC_BAD_STRUCTURE;
+		goto exit;
+	}
+	if ((s = malloc(sizeof(MQTTAsyncStripes))) == NULL)
+	{
+		rc = PAHO_MEMORY_ERROR;
+		goto exit;
+	}
+	memset(s, '\0', sizeof(MQTTAsyncStripes));
+	if ((s->stripes = malloc(sizeof(MQTTAsyncStripe_stripe) * options->stripes)) == NULL ||
+		(stripeId = malloc(strlen(clientId) + 4)) == NULL ||
+		(s->responses = ListInitialize()) == NULL ||
+		(s->mutex = Thread_create_mutex(&rc)) == NULL)
+	{
+		rc = PAHO_MEMORY_ERROR;
+		goto exit;
+	}
+	memset(s->stripes, '\0', sizeof(MQTTAsyncStripe_stripe) * options->stripes);
+	for (i = 0; i < options->stripes; ++i)
+	{
+		sprintf(stripeId, "%s-%d", clientId, i);
+		s->stripes[i].index = i;
+		s->stripes[i].parent = s;
+		if (options->createOptions)
+			rc = MQTTAsync_createWithOptions(&s->stripes[i].client, serverURI, stripeId,
+					persistence_type, persistence_context, options->createOptions);
+		else
+			rc = MQTTAsync_create(&s->stripes[i].client, serverURI, stripeId, persistence_type, persistence_context);
+		if (rc != MQTTASYNC_SUCCESS)
+			goto exit;
+		s->count++;
+	}
+	*handle = s;
+exit:
+	if (stripeId)
+		free(stripeId);
+	if (rc != MQTTASYNC_SUCCESS && s)
+		MQTTAsyncStripe_destroy((MQTTAsyncStripe*)&s);
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+int MQTTAsyncStripe_setCallbacks(MQTTAsyncStripe handle, void* context, MQTTAsync_connectionLost* cl,
+		MQTTAsync_messageArrived* ma, MQTTAsync_deliveryComplete* dc)
+{
+	MQTTAsyncStripes* s = handle;
+	int rc = MQTTASYNC_SUCCESS;
+	int i;
+
+	FUNC_ENTRY;
+	if (s == NULL)
+	{
+		rc = MQTTASYNC_FAILURE;
+		goto exit;
+	}
+	s->context = context;
+	s->cl = cl;
+	s->ma = ma;
+	s->dc = dc;
+	for (i = 0; i < s->count && rc == MQTTASYNC_SUCCESS; ++i)
+		rc = MQTTAsync_setCallbacks(s->stripes[i].client, &s->stripes[i],
+				(cl) ? MQTTAsyncStripe_connectionLost : NULL, MQTTAsyncStripe_messageArrived,
+				(dc) ? MQTTAsyncStripe_deliveryComplete : NULL);
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+int MQTTAsyncStripe_connect(MQTTAsyncStripe handle, const MQTTAsync_connectOptions* options)
+{
+	MQTTAsyncStripes* s = handle;
+	MQTTAsyncStripe_response* r = NULL;
+	MQTTAsync_connectOptions opts;
+	int rc = MQTTASYNC_SUCCESS;
+	int i;
+
+	FUNC_ENTRY;
+	if (s == NULL || options == NULL)
+	{
+		rc = MQTTASYNC_FAILURE;
+		goto exit;
+	}
+	opts = *options;
+	if ((r = MQTTAsyncStripe_newResponse(s, -1, options->onSuccess, options->onFailure,
+			(options->struct_version >= 6) ? options->onSuccess5 : NULL,
+			(options->struct_version >= 6) ? options->onFailure5 : NULL, options->context)) != NULL)
+	{
+		opts.onSuccess = (r->onSuccess) ? MQTTAsyncStripe_onSuccess : NULL;
+		opts.onFailure = (r->onFailure) ? MQTTAsyncStripe_onFailure : NULL;
+		if (options->struct_version >= 6)
+		{
+			opts.onSuccess5 = (r->onSuccess5) ? MQTTAsyncStripe_onSuccess5 : NULL;
+			opts.onFailure5 = (r->onFailure5) ? MQTTAsyncStripe_onFailure5 : NULL;
+		}
+		opts.context = r;
+	}
+	for (i = 0; i < s->count; ++i)
+	{
+		int stripe_rc;
+
+		if ((stripe_rc = MQTTAsync_connect(s->stripes[i].client, &opts)) != MQTTASYNC_SUCCESS)
+		{
+			MQTTAsyncStripe_response ignored;
+
+			if (rc == MQTTASYNC_SUCCESS)
+				rc = stripe_rc;
+			if (r)
+				MQTTAsyncStripe_complete(r, 1, &ignored); /* the failure is returned, not called back */
+		}
+	}
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+int MQTTAsyncStripe_disconnect(MQTTAsyncStripe handle, const MQTTAsync_disconnectOptions* options)
+{
+	MQTTAsyncStripes* s = handle;
+	MQTTAsyncStripe_response* r = NULL;
+	MQTTAsync_disconnectOptions opts = MQTTAsync_disconnectOptions_initializer;
+	int rc = MQTTASYNC_SUCCESS;
+	int i;
+
+	FUNC_ENTRY;
+	if (s == NULL)
+	{
+		rc = MQTTASYNC_FAILURE;
+		goto exit;
+	}
+	if (options)
+	{
+		opts = *options;
+		if ((r = MQTTAsyncStripe_newResponse(s, -1, options->onSuccess, options->onFailure,
+				(options->struct_version >= 1) ? options->onSuccess5 : NULL,
+				(options->struct_version >= 1) ? options->onFailure5 : NULL, options->context)) != NULL)
+		{
+			opts.onSuccess = (r->onSuccess) ? MQTTAsyncStripe_onSuccess : NULL;
+			opts.onFailure = (r->onFailure) ? MQTTAsyncStripe_onFailure : NULL;
+			if (options->struct_version >= 1)
+			{
+				opts.onSuccess5 = (r->onSuccess5) ? MQTTAsyncStripe_onSuccess5 : NULL;
+				opts.onFailure5 = (r->onFailure5) ? MQTTAsyncStripe_onFailure5 : NULL;
+			}
+			opts.context = r;
+		}
+	}
+	for (i = 0; i < s->count; ++i)
+	{
+		int stripe_rc;
+
+		if ((stripe_rc = MQTTAsync_disconnect(s->stripes[i].client, (options) ? &opts : NULL)) != MQTTASYNC_SUCCESS)
+		{
+			MQTTAsyncStripe_response ignored;
+
+			if (rc == MQTTASYNC_SUCCESS)
+				rc = stripe_rc;
+			if (r)
+				MQTTAsyncStripe_complete(r, 1, &ignored); /* the failure is returned, not called back */
+		}
+	}
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+int MQTTAsyncStripe_isConnected(MQTTAsyncStripe handle)
+{
+	MQTTAsyncStripes* s = handle;
+	int rc = 0;
+	int i;
+
+	FUNC_ENTRY;
+	if (s == NULL)
+		goto exit;
+	rc = 1;
+	for (i = 0; i < s->count && rc; ++i)
+		rc = MQTTAsync_isConnected(s->stripes[i].client);
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/**
+ * Publish a message on the stripe chosen by its topic.
+ * @param s the striped client
+ * @param destinationName the topic
+ * @param payloadlen, payload, qos, retained the message, if msg is NULL
+ * @param msg the message, or NULL
+ * @param response the application's response options, or NULL
+ * @return the completion code
+ */
+static int MQTTAsyncStripe_publish(MQTTAsyncStripes* s, const char* destinationName, int payloadlen,
+		const void* payload, int qos, int retained, const MQTTAsync_message* msg, MQTTAsync_responseOptions* response)
+{
+	MQTTAsyncStripe_response* r = NULL;
+	MQTTAsync_responseOptions opts = MQTTAsync_responseOptions_initializer;
+	int stripe = 0;
+	int rc = MQTTASYNC_SUCCESS;
+
+	FUNC_ENTRY;
+	if (s == NULL || destinationName == NULL)
+	{
+		rc = MQTTASYNC_FAILURE;
+		goto exit;
+	}
+	stripe = MQTTAsyncStripe_index(s, destinationName);
+	if (response)
+	{
+		opts = *response;
+		if ((r = MQTTAsyncStripe_newResponse(s, stripe, response->onSuccess, response->onFailure,
+				(response->struct_version >= 1) ? response->onSuccess5 : NULL,
+				(response->struct_version >= 1) ? response->onFailure5 : NULL, response->context)) != NULL)
+		{
+			opts.onSuccess = (r->onSuccess) ? MQTTAsyncStripe_onSuccess : NULL;
+			opts.onFailure = (r->onFailure) ? MQTTAsyncStripe_onFailure : NULL;
+			if (response->struct_version >= 1)
+			{
+				opts.onSuccess5 = (r->onSuccess5) ? MQTTAsyncStripe_onSuccess5 : NULL;
+				opts.onFailure5 = (r->onFailure5) ? MQTTAsyncStripe_onFailure5 : NULL;
+			}
+			opts.context = r;
+		}
+	}
+	if (msg)
+		rc = MQTTAsync_sendMessage(s->stripes[stripe].client, destinationName, msg, (response) ? &opts : NULL);
+	else
+		rc = MQTTAsync_send(s->stripes[stripe].client, destinationName, payloadlen, payload, qos, retained,
+				(response) ? &opts : NULL);
+	if (rc != MQTTASYNC_SUCCESS)
+	{
+		if (r)
+			MQTTAsyncStripe_freeResponse(r);
+	}
+	else if (response)
+		response->token = MQTTAsyncStripe_token(stripe, opts.token);
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+int MQTTAsyncStripe_send(MQTTAsyncStripe handle, const char* destinationName, int payloadlen,
+		const void* payload, int qos, int retained, MQTTAsync_responseOptions* response)
+{
+	return MQTTAsyncStripe_publish(handle, destinationName, payloadlen, payload, qos, retained, NULL, response);
+}
+
+
+int MQTTAsyncStripe_sendMessage(MQTTAsyncStripe handle, const char* destinationName,
+		const MQTTAsync_message* msg, MQTTAsync_responseOptions* response)
+{
+	if (msg == NULL)
+		return MQTTASYNC_FAILURE;
+	return MQTTAsyncStripe_publish(handle, destinationName, 0, NULL, 0, 0, msg, response);
+}
+
+
+int MQTTAsyncStripe_isComplete(MQTTAsyncStripe handle, MQTTAsync_token token)
+{
+	MQTTAsyncStripes* s = handle;
+	int stripe = token % MQTTASYNCSTRIPE_MAX_STRIPES;
+
+	if (s == NULL || stripe >= s->count)
+		return 0;
+	return MQTTAsync_isComplete(s->stripes[stripe].client, token / MQTTASYNCSTRIPE_MAX_STRIPES);
+}
+
+
+int MQTTAsyncStripe_waitForCompletion(MQTTAsyncStripe handle, MQTTAsync_token token, unsigned long timeout)
+{
+	MQTTAsyncStripes* s = handle;
+	int stripe = token % MQTTASYNCSTRIPE_MAX_STRIPES;
+
+	if (s == NULL || stripe >= s->count)
+		return MQTTASYNC_FAILURE;
+	return MQTTAsync_waitForCompletion(s->stripes[stripe].client, token / MQTTASYNCSTRIPE_MAX_STRIPES, timeout);
+}
+
+
+MQTTAsync MQTTAsyncStripe_getClient(MQTTAsyncStripe handle, const char* topic)
+{
+	MQTTAsyncStripes* s = handle;
+
+	if (s == NULL || topic == NULL)
+		return NULL;
+	return s->stripes[MQTTAsyncStripe_index(s, topic)].client;
+}
+
+
+void MQTTAsyncStripe_destroy(MQTTAsyncStripe* handle)
+{
+	MQTTAsyncStripes* s = NULL;
+	int i;
+
+	FUNC_ENTRY;
+	if (handle == NULL || (s = *handle) == NULL)
+		goto exit;
+	for (i = 0; i < s->count; ++i)
+		MQTTAsync_destroy(&s->stripes[i].client);
+	if (s->responses)
+		ListFree(s->responses); /* the requests which never completed */
+	if (s->mutex)
+		Thread_destroy_mutex(s->mutex);
+	if (s->stripes)
+		free(s->stripes);
+	free(s);
+	*handle = NULL;
+exit:
+	FUNC_EXIT;
+}
@@ -0,0 +1,208 @@
+/*******************************************************************************
+ * Copyright (c) 2026 Contributors to the Eclipse Foundation
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v2.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    https://www.eclipse.org/legal/epl-2.0/
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *******************************************************************************/
+
+/**
+ * @file
+ * \brief A publisher which spreads its messages over several MQTT connections.
+ *
+ * One MQTT connection is one TCP stream, which the server serves in order, so the rate
+ * at which a single client can publish is limited.  A striped client opens a number of
+ * ::MQTTAsync clients, the stripes, to the same server, with client identifiers made from
+ * the one given and the number of the stripe, and sends each message on the stripe chosen
+ * by a hash of its topic.  So the messages on one topic are always sent in order, on the
+ * same connection, while those on different topics are sent in parallel.
+ *
+ * Each stripe reconnects on its own, with the automatic reconnect options given on
+ * connect.  The tokens returned by MQTTAsyncStripe_send() identify the stripe as well as
+ * the request, and are the ones passed to the success, failure and delivery complete
+ * callbacks, so they can be used as the tokens of a single client are.
+ */
+
+#if !defined(MQTTASYNCSTRIPE_H)
+#define MQTTASYNCSTRIPE_H
+
+#if defined(__cplusplus)
+ extern "C" {
+#endif
+
+#include "MQTTAsync.h"
+
+/** The most stripes a striped client can have */
+#define MQTTASYNCSTRIPE_MAX_STRIPES 64
+
+/**
+ * A handle representing a striped client.
+ */
+typedef void* MQTTAsyncStripe;
+
+/**
+ * Options for MQTTAsyncStripe_create().
+ */
+typedef struct
+{
+	/** The eyecatcher for this structure.  Must be MQSP */
+	char struct_id[4];
+	/** The version number of this structure.  Must be 0 */
+	int struct_version;
+	/** The number of connections, from 1 to ::MQTTASYNCSTRIPE_MAX_STRIPES */
+	int stripes;
+	/** The options used to create each stripe, or NULL for none */
+	MQTTAsync_createOptions* createOptions;
+} MQTTAsyncStripe_options;
+
+#define MQTTAsyncStripe_options_initializer { {'M', 'Q', 'S', 'P'}, 0, 4, NULL }
+
+/**
+ * This function creates a striped client, and the MQTTAsync clients for its stripes,
+ * which have the client identifiers <i>clientId</i>-0, <i>clientId</i>-1 and so on.
+ * @param handle A pointer to an ::MQTTAsyncStripe handle.  The handle is
+ * populated with a valid client reference following a successful return from
+ * this function.
+ * @param serverURI A null-terminated string specifying the server to
+ * which the stripes will connect, as for MQTTAsync_create().
+ * @param clientId The client identifier from which those of the stripes are made.
+ * @param persistence_type The type of persistence to be used by the stripes,
+ * as for MQTTAsync_create().  Each stripe has its own store.
+ * @param persistence_context As for MQTTAsync_create().
+ * @param options The number of stripes and the options to create them with.
+ * @return ::MQTTASYNC_SUCCESS if the client is successfully created, otherwise
+ * an error code.
+ */
+LIBMQTT_API int MQTTAsyncStripe_create(MQTTAsyncStripe* handle, const char* serverURI, const char* clientId,
+		int persistence_type, void* persistence_context, const MQTTAsyncStripe_options* options);
+
+/**
+ * This function sets the callbacks of all the stripes, as MQTTAsync_setCallbacks()
+ * does for one client.  The connection lost callback is called for each stripe which
+ * loses its connection.  The delivery complete callback is passed the tokens returned
+ * by MQTTAsyncStripe_send().
+ * @param handle A valid striped client handle from a successful call to
+ * MQTTAsyncStripe_create().
+ * @param context A pointer to any application-specific context, passed to the callbacks.
+ * @param cl A pointer to an MQTTAsync_connectionLost() callback function, or NULL.
+ * @param ma A pointer to an MQTTAsync_messageArrived() callback function, or NULL.
+ * @param dc A pointer to an MQTTAsync_deliveryComplete() callback function, or NULL.
+ * @return ::MQTTASYNC_SUCCESS if the callbacks were correctly set,
+ * ::MQTTASYNC_FAILURE if an error occurred.
+ */
+LIBMQTT_API int MQTTAsyncStripe_setCallbacks(MQTTAsyncStripe handle, void* context, MQTTAsync_connectionLost* cl,
+		MQTTAsync_messageArrived* ma, MQTTAsync_deliveryComplete* dc);
+
+/**
+ * This function connects all the stripes, with the same options.  The onSuccess callback
+ * is called once all the stripes have connected, and the onFailure callback once if any
+ * of them fails to.
+ * @param handle A valid striped client handle from a successful call to
+ * MQTTAsyncStripe_create().
+ * @param options A pointer to a valid MQTTAsync_connectOptions structure.
+ * @return ::MQTTASYNC_SUCCESS if the connects were accepted, otherwise the error
+ * code of the first which was not.
+ */
+LIBMQTT_API int MQTTAsyncStripe_connect(MQTTAsyncStripe handle, const MQTTAsync_connectOptions* options);
+
+/**
+ * This function disconnects all the stripes, with the same options.  The onSuccess
+ * callback is called once all the stripes have disconnected, and the onFailure callback
+ * once if any of them fails to.
+ * @param handle A valid striped client handle from a successful call to
+ * MQTTAsyncStripe_create().
+ * @param options The disconnect options, or NULL for the defaults.
+ * @return ::MQTTASYNC_SUCCESS if the disconnects were accepted, otherwise the error
+ * code of the first which was not.
+ */
+LIBMQTT_API int MQTTAsyncStripe_disconnect(MQTTAsyncStripe handle, const MQTTAsync_disconnectOptions* options);
+
+/**
+ * This function tests whether all the stripes are connected.
+ * @param handle A valid striped client handle from a successful call to
+ * MQTTAsyncStripe_create().
+ * @return Boolean true if all the stripes are connected, otherwise false.
+ */
+LIBMQTT_API int MQTTAsyncStripe_isConnected(MQTTAsyncStripe handle);
+
+/**
+ * This function publishes a message on the stripe chosen by its topic, as
+ * MQTTAsync_send() does for one client.  The token returned in <i>response</i>,
+ * and passed to its callbacks, identifies the stripe as well as the request.
+ * @param handle A valid striped client handle from a successful call to
+ * MQTTAsyncStripe_create().
+ * @param destinationName The topic associated with this message.
+ * @param payloadlen The length of the payload in bytes.
+ * @param payload A pointer to the byte array payload of the message.
+ * @param qos The quality of service of the message.
+ * @param retained The retained flag for the message.
+ * @param response A pointer to an ::MQTTAsync_responseOptions structure, or NULL.
+ * @return ::MQTTASYNC_SUCCESS if the message is accepted for publication,
+ * otherwise an error code.
+ */
+LIBMQTT_API int MQTTAsyncStripe_send(MQTTAsyncStripe handle, const char* destinationName, int payloadlen,
+		const void* payload, int qos, int retained, MQTTAsync_responseOptions* response);
+
+/**
+ * This function publishes a message on the stripe chosen by its topic, as
+ * MQTTAsync_sendMessage() does for one client.
+ * @param handle A valid striped client handle from a successful call to
+ * MQTTAsyncStripe_create().
+ * @param destinationName The topic associated with this message.
+ * @param msg A pointer to a valid MQTTAsync_message structure.
+ * @param response A pointer to an ::MQTTAsync_responseOptions structure, or NULL.
+ * @return ::MQTTASYNC_SUCCESS if the message is accepted for publication,
+ * otherwise an error code.
+ */
+LIBMQTT_API int MQTTAsyncStripe_sendMessage(MQTTAsyncStripe handle, const char* destinationName,
+		const MQTTAsync_message* msg, MQTTAsync_responseOptions* response);
+
+/**
+ * This function tests whether a request made with MQTTAsyncStripe_send() is complete.
+ * @param handle A valid striped client handle from a successful call to
+ * MQTTAsyncStripe_create().
+ * @param token The token returned for the request.
+ * @return 1 if the request is complete, 0 if not.
+ */
+LIBMQTT_API int MQTTAsyncStripe_isComplete(MQTTAsyncStripe handle, MQTTAsync_token token);
+
+/**
+ * This function waits for a request made with MQTTAsyncStripe_send() to complete,
+ * as MQTTAsync_waitForCompletion() does for one client.
+ * @param handle A valid striped client handle from a successful call to
+ * MQTTAsyncStripe_create().
+ * @param token The token returned for the request.
+ * @param timeout The maximum time to wait in milliseconds.
+ * @return ::MQTTASYNC_SUCCESS if the request completed in time,
+ * ::MQTTASYNC_FAILURE if it did not.
+ */
+LIBMQTT_API int MQTTAsyncStripe_waitForCompletion(MQTTAsyncStripe handle, MQTTAsync_token token, unsigned long timeout);
+
+/**
+ * This function returns the MQTTAsync client of one of the stripes, to subscribe with
+ * or to get its statistics.  It must not be destroyed.
+ * @param handle A valid striped client handle from a successful call to
+ * MQTTAsyncStripe_create().
+ * @param topic The topic whose messages the stripe sends.
+ * @return The client of the stripe, or NULL for an invalid handle.
+ */
+LIBMQTT_API MQTTAsync MQTTAsyncStripe_getClient(MQTTAsyncStripe handle, const char* topic);
+
+/**
+ * This function frees the memory allocated to a striped client and destroys the
+ * clients of its stripes.  They should be disconnected first.
+ * @param handle A pointer to the handle referring to the striped client.  It is set
+ * to NULL.
+ */
+LIBMQTT_API void MQTTAsyncStripe_destroy(MQTTAsyncStripe* handle);
+
+#if defined(__cplusplus)
+     }
+#endif
+
+#endif
@@ -17,6 +17,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #if !defined(_WIN32) && !defined(_WIN64)
 	#include <sys/time.h>
 #endif
@@ -35,6 +36,9 @@
 #include "Heap.h"
 #include "OsWrapper.h"
 #include "WebSocket.h"
+#if defined(OPENSSL)
+#include <openssl/err.h>
+#endif
 
 static int clientSockCompare(void* a, void* b);
 static int MQTTAsync_checkConn(MQTTAsync_command* command, MQTTAsyncs* client);
@@ -48,31 +52,44 @@ static void MQTTAsync_checkDisconnect(MQTTAsync handle, MQTTAsync_command* comma
 static void MQTTProtocol_checkPendingWrites(void);
 static void MQTTAsync_freeCommand1(MQTTAsync_queuedCommand *command);
 static void MQTTAsync_freeCommand(MQTTAsync_queuedCommand *command);
-static int MQTTAsync_processCommand(void);
-static void MQTTAsync_checkTimeouts(void);
+static void MQTTAsync_uncacheCommand(MQTTAsync_queuedCommand *command);
+static int MQTTAsync_processCommand(MQTTAsync_reactor* r);
+static void MQTTAsync_checkTimeouts(MQTTAsync_reactor* r);
+static void MQTTAsync_useReactor(MQTTAsync_reactor* r);
+static void MQTTAsync_freeReactors(void);
 static int MQTTAsync_completeConnection(MQTTAsyncs* m, Connack* connack);
+static int MQTTAsync_topicAliasCompare(void* a, void* b, int content);
+static void MQTTAsync_aliasTopic(MQTTAsyncs* m, Publish* p);
 static void MQTTAsync_stop(void);
 static void MQTTAsync_closeOnly(Clients* client, enum MQTTReasonCodes reasonCode, MQTTProperties* props);
-static int clientStructCompare(void* a, void* b);
 static int MQTTAsync_cleanSession(Clients* client);
 static int MQTTAsync_deliverMessage(MQTTAsyncs* m, char* topicName, size_t topicLen, MQTTAsync_message* mm);
+static int MQTTAsync_dispatchMessage(MQTTAsyncs* m, char* topicName, int topicLen, MQTTAsync_message* mm, qEntry* qe);
+static void MQTTAsync_dispatchQueued(MQTTAsyncs* m);
+static void MQTTAsync_dispatchHeld(MQTTAsync_reactor* r);
+static int MQTTAsync_deliverQueued(MQTTAsyncs* m);
+static size_t MQTTAsync_qEntryLen(qEntry* qe);
+static void MQTTAsync_checkInbound(MQTTAsyncs* m);
+static void MQTTAsync_drainPaused(MQTTAsync_reactor* r);
+static int MQTTAsync_dispatchPublishResponse(MQTTAsyncs* m, int msgid, MQTTAsync_queuedCommand* command,
+		int ackrc, MQTTProperties* msgprops, int packet_type);
+static void MQTTAsync_callPublishResponse(MQTTAsyncs* m, MQTTAsync_deliveryComplete* dc, void* dcContext,
+		int msgid, MQTTAsync_queuedCommand* command, int ackrc, MQTTProperties* msgprops, int packet_type);
 static int MQTTAsync_disconnect_internal(MQTTAsync handle, int timeout);
 static int cmdMessageIDCompare(void* a, void* b);
-static void MQTTAsync_retry(void);
-static MQTTPacket* MQTTAsync_cycle(int* sock, unsigned long timeout, int* rc);
+static void MQTTAsync_retry(MQTTAsync_reactor* r);
+static MQTTPacket* MQTTAsync_cycle(MQTTAsync_reactor* r, int* sock, unsigned long timeout, int* rc);
 static int MQTTAsync_connecting(MQTTAsyncs* m);
+static void MQTTAsync_raceServerURIs(MQTTAsyncs* m, int current);
+#if defined(OPENSSL)
+static void MQTTAsync_cancelHandshake(int socket);
+static void MQTTAsync_stopHandshakes(void);
+#endif
 
-extern MQTTProtocol state; /* defined in MQTTAsync.c */
-extern ClientStates* bstate; /* defined in MQTTAsync.c */
-
-extern enum MQTTAsync_threadStates sendThread_state;
-extern enum MQTTAsync_threadStates receiveThread_state;
-extern thread_id_type sendThread_id,
-               receiveThread_id;
+extern THREAD_LOCAL MQTTProtocol* state; /* defined in MQTTAsync.c */
+extern THREAD_LOCAL ClientStates* bstate; /* defined in MQTTAsync.c */
 
 extern volatile int global_initialized;
-extern List* MQTTAsync_handles;
-extern List* MQTTAsync_commands;
 extern int MQTTAsync_tostop;
 
 #if defined(_WIN32) || defined(_WIN64)
@@ -80,9 +97,6 @@ extern int MQTTAsync_tostop;
 		#define snprintf _snprintf
 	#endif
 extern mutex_type mqttasync_mutex;
-extern mutex_type socket_mutex;
-extern mutex_type mqttcommand_mutex;
-extern sem_type send_sem;
 #if !defined(NO_HEAP_TRACKING)
 extern mutex_type stack_mutex;
 extern mutex_type heap_mutex;
@@ -90,11 +104,16 @@ extern mutex_type heap_mutex;
 extern mutex_type log_mutex;
 #else
 extern mutex_type mqttasync_mutex;
-extern mutex_type socket_mutex;
-extern mutex_type mqttcommand_mutex;
-extern cond_type send_cond;
 #endif
 
+static MQTTAsync_reactor* reactors[SOCKET_MAX_REACTORS];
+static int reactor_count = 0;    /* the number of reactors created */
+static int reactor_threads = 1;  /* the number of reactors to create */
+static THREAD_LOCAL MQTTAsync_reactor* locked_reactor = NULL; /* the reactor whose mutex this thread holds */
+static THREAD_LOCAL MQTTAsync_reactor* home_reactor = NULL;   /* the reactor this thread is one of the threads of */
+static THREAD_LOCAL MQTTAsync_reactor* lent_reactor = NULL;   /* the reactor this thread released, to take back later */
+static int callback_threads = 0;  /* the number of callback workers, 0 to call back on the receive threads */
+
 #if !defined(min)
 #define min(a, b) (((a) < (b)) ? (a) : (b))
 #endif
@@ -178,6 +197,396 @@ void MQTTAsync_unlock_mutex(mutex_type amutex)
 }
 
 
+/**
+ * Points the protocol and socket layers at the state of a reactor, for the calling thread.
+ * @param r the reactor, or NULL for the reactor of the thread, or the first reactor if
+ * the thread isn't a reactor thread
+ */
+static void MQTTAsync_useReactor(MQTTAsync_reactor* r)
+{
+	if (r == NULL)
+		r = (home_reactor) ? home_reactor : reactors[0];
+	if (r)
+	{
+		bstate = r->states;
+		state = r->protocol;
+		Socket_setReactor(r->index);
+	}
+}
+
+
+/**
+ * Locks the state of the clients of a reactor.  A thread holds one reactor at a time, so
+ * a reactor already held by the calling thread - as in a callback - is released first.
+ * @param r the reactor
+ * @return the reactor held before, to pass to MQTTAsync_unlockReactor
+ */
+MQTTAsync_reactor* MQTTAsync_lockReactor(MQTTAsync_reactor* r)
+{
+	MQTTAsync_reactor* previous = locked_reactor;
+
+	if (previous != r)
+	{
+		if (previous)
+		{
+			previous->lent++;
+			lent_reactor = previous;
+			MQTTAsync_unlock_mutex(previous->mutex);
+		}
+		MQTTAsync_lock_mutex(r->mutex);
+		locked_reactor = r;
+		MQTTAsync_useReactor(r);
+	}
+	return previous;
+}
+
+
+/**
+ * Unlocks a reactor locked by MQTTAsync_lockReactor, taking back the reactor held before.
+ * @param r the reactor
+ * @param previous the return value of MQTTAsync_lockReactor
+ */
+void MQTTAsync_unlockReactor(MQTTAsync_reactor* r, MQTTAsync_reactor* previous)
+{
+	if (previous == r)
+		return; /* it was already held when it was locked */
+	MQTTAsync_unlock_mutex(r->mutex);
+	locked_reactor = NULL;
+	if (previous)
+	{
+		MQTTAsync_lock_mutex(previous->mutex);
+		locked_reactor = previous;
+		previous->lent--;
+		lent_reactor = NULL;
+	}
+	MQTTAsync_useReactor(previous);
+}
+
+
+/**
+ * Locks the reactor of a client, as MQTTAsync_lockReactor.
+ * @param m the client, which may be NULL, in which case nothing is locked
+ * @return the reactor held before, to pass to MQTTAsync_unlockClient
+ */
+MQTTAsync_reactor* MQTTAsync_lockClient(MQTTAsyncs* m)
+{
+	return (m) ? MQTTAsync_lockReactor(m->reactor) : locked_reactor;
+}
+
+
+/**
+ * Unlocks the reactor of a client locked by MQTTAsync_lockClient.
+ * @param m the client
+ * @param previous the return value of MQTTAsync_lockClient
+ */
+void MQTTAsync_unlockClient(MQTTAsyncs* m, MQTTAsync_reactor* previous)
+{
+	if (m)
+		MQTTAsync_unlockReactor(m->reactor, previous);
+}
+
+
+/**
+ * Locks the global state - the reactors and the assignment of clients to them.  The global
+ * mutex is taken before any reactor's, so a reactor held by the calling thread is released first.
+ * @return the reactor held before, to pass to MQTTAsync_unlockGlobal
+ */
+MQTTAsync_reactor* MQTTAsync_lockGlobal(void)
+{
+	MQTTAsync_reactor* previous = locked_reactor;
+
+	if (previous)
+	{
+		previous->lent++;
+		lent_reactor = previous;
+		MQTTAsync_unlock_mutex(previous->mutex);
+		locked_reactor = NULL;
+	}
+	MQTTAsync_lock_mutex(mqttasync_mutex);
+	return previous;
+}
+
+
+/**
+ * Unlocks the global state, taking back the reactor held before it was locked.
+ * @param previous the return value of MQTTAsync_lockGlobal
+ */
+void MQTTAsync_unlockGlobal(MQTTAsync_reactor* previous)
+{
+	MQTTAsync_unlock_mutex(mqttasync_mutex);
+	if (previous)
+	{
+		MQTTAsync_lock_mutex(previous->mutex);
+		locked_reactor = previous;
+		previous->lent--;
+		lent_reactor = NULL;
+	}
+	MQTTAsync_useReactor(previous);
+}
+
+
+/**
+ * Locks a reactor, with the global state locked, once no other thread is away from it.  A
+ * thread which released the reactor to work on another - as a callback calling the API for a
+ * client of another reactor - still uses the reactor's clients when it takes it back, so they
+ * must not be freed in the meantime.
+ * @param r the reactor
+ * @return boolean, whether the calling thread itself released the reactor, to pass to
+ * MQTTAsync_unlockReactorUnlent
+ */
+int MQTTAsync_lockReactorUnlent(MQTTAsync_reactor* r)
+{
+	int own = 0;
+
+	MQTTAsync_lockReactor(r);
+	if (lent_reactor == r)
+	{
+		own = 1;
+		r->lent--; /* so that two threads doing this don't wait for each other */
+	}
+	while (r->lent > 0)
+	{
+		MQTTAsync_unlockReactor(r, NULL);
+		MQTTAsync_unlock_mutex(mqttasync_mutex);
+		MQTTAsync_sleep(1L);
+		MQTTAsync_lock_mutex(mqttasync_mutex);
+		MQTTAsync_lockReactor(r);
+	}
+	return own;
+}
+
+
+/**
+ * Unlocks a reactor locked by MQTTAsync_lockReactorUnlent.
+ * @param r the reactor
+ * @param own the return value of MQTTAsync_lockReactorUnlent
+ */
+void MQTTAsync_unlockReactorUnlent(MQTTAsync_reactor* r, int own)
+{
+	if (own)
+		r->lent++;
+	MQTTAsync_unlockReactor(r, NULL);
+}
+
+
+/**
+ * Locks a reactor for work by its own threads, once no other thread is away from it.  A
+ * callback which released the reactor to call the API for a client of another reactor takes
+ * it back with its client's state as it left it, so the reactor's commands and packets must
+ * wait until then.  API calls, which only queue commands, need not wait.
+ * @param r the reactor
+ * @return the reactor held before, to pass to MQTTAsync_unlockReactor
+ */
+static MQTTAsync_reactor* MQTTAsync_lockReactorIdle(MQTTAsync_reactor* r)
+{
+	MQTTAsync_reactor* previous = MQTTAsync_lockReactor(r);
+
+	while (previous != r && lent_reactor != r && r->lent > 0 && !MQTTAsync_tostop)
+	{
+		MQTTAsync_unlockReactor(r, previous);
+		MQTTAsync_sleep(1L);
+		previous = MQTTAsync_lockReactor(r);
+	}
+	return previous;
+}
+
+
+/**
+ * Sets the number of reactors created when the library is initialized.
+ * @param count the number of reactors, each with a send and a receive thread
+ */
+void MQTTAsync_setReactorThreads(int count)
+{
+	if (count < 1)
+		count = 1;
+	else if (count > SOCKET_MAX_REACTORS)
+		count = SOCKET_MAX_REACTORS;
+	reactor_threads = count;
+}
+
+
+/**
+ * Creates the reactors, before the socket layer is initialized.  Called with the global
+ * mutex held.
+ * @param states the client states of the first reactor
+ * @param protocol the protocol state of the first reactor
+ * @return 0 if success, otherwise failure
+ */
+int MQTTAsync_createReactors(ClientStates* states, MQTTProtocol* protocol)
+{
+	int rc = 0;
+
+	FUNC_ENTRY;
+	for (reactor_count = 0; reactor_count < reactor_threads; ++reactor_count)
+	{
+		MQTTAsync_reactor* r = NULL;
+
+		if ((r = malloc(sizeof(MQTTAsync_reactor))) == NULL)
+		{
+			rc = PAHO_MEMORY_ERROR;
+			goto exit;
+		}
+		memset(r, '\0', sizeof(MQTTAsync_reactor));
+		reactors[reactor_count] = r;
+		r->index = reactor_count;
+		if (r->index == 0)
+		{
+			r->states = states;
+			r->protocol = protocol;
+		}
+		else
+		{
+			if ((r->states = malloc(sizeof(ClientStates))) == NULL ||
+					(r->protocol = malloc(sizeof(MQTTProtocol))) == NULL)
+			{
+				rc = PAHO_MEMORY_ERROR;
+				goto exit;
+			}
+			r->states->version = states->version;
+			memset(r->protocol, '\0', sizeof(MQTTProtocol));
+		}
+		if ((r->states->clients = ListInitialize()) == NULL ||
+				(r->handles = ListInitialize()) == NULL ||
+				(r->commands = ListInitialize()) == NULL ||
+				(r->mutex = Thread_create_mutex(&rc)) == NULL ||
+				(r->command_mutex = Thread_create_mutex(&rc)) == NULL ||
+				(r->socket_mutex = Thread_create_mutex(&rc)) == NULL ||
+#if defined(_WIN32) || defined(_WIN64)
+				(r->send_sem = Thread_create_sem(&rc)) == NULL)
+#else
+				(r->send_cond = Thread_create_cond(&rc)) == NULL)
+#endif
+		{
+			rc = PAHO_MEMORY_ERROR;
+			goto exit;
+		}
+	}
+	Socket_setReactorCount(reactor_count);
+exit:
+	if (rc != 0)
+	{
+		if (reactor_count < reactor_threads)
+			reactor_count++; /* to free the one partly created */
+		MQTTAsync_freeReactors();
+	}
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/**
+ * Frees the reactors, once their threads have stopped.
+ */
+static void MQTTAsync_freeReactors(void)
+{
+	int i;
+
+	FUNC_ENTRY;
+	for (i = 0; i < reactor_count; ++i)
+	{
+		MQTTAsync_reactor* r = reactors[i];
+		ListElement* elem = NULL;
+
+		if (r == NULL)
+			continue;
+		if (r->commands)
+		{
+			while (ListNextElement(r->commands, &elem))
+				MQTTAsync_freeCommand1((MQTTAsync_queuedCommand*)(elem->content));
+			ListFree(r->commands);
+		}
+		if (r->handles)
+			ListFree(r->handles);
+		if (r->states && r->states->clients)
+			ListFree(r->states->clients);
+		if (r->index > 0)
+		{
+			if (r->states)
+				free(r->states);
+			if (r->protocol)
+				free(r->protocol);
+		}
+		if (r->mutex)
+			Thread_destroy_mutex(r->mutex);
+		if (r->command_mutex)
+			Thread_destroy_mutex(r->command_mutex);
+		if (r->socket_mutex)
+			Thread_destroy_mutex(r->socket_mutex);
+#if defined(_WIN32) || defined(_WIN64)
+		if (r->send_sem)
+			Thread_destroy_sem(r->send_sem);
+#else
+		if (r->send_cond)
+			Thread_destroy_cond(r->send_cond);
+#endif
+		free(r);
+		reactors[i] = NULL;
+	}
+	reactor_count = 0;
+	FUNC_EXIT;
+}
+
+
+/**
+ * Chooses the reactor for a new client: the one asked for, or the one with the fewest
+ * clients.  Called with the global mutex held.
+ * @param reactor the number of the reactor, taken modulo the number of reactors, or -1
+ * @return the reactor
+ */
+MQTTAsync_reactor* MQTTAsync_assignReactor(int reactor)
+{
+	MQTTAsync_reactor* r = reactors[0];
+	int i;
+
+	if (reactor >= 0)
+		return reactors[reactor % reactor_count];
+	for (i = 1; i < reactor_count; ++i)
+	{
+		if (reactors[i]->handles->count < r->handles->count)
+			r = reactors[i];
+	}
+	return r;
+}
+
+
+/**
+ * Gets the number of clients on all the reactors.  Called with the global mutex held, as
+ * clients are only added and removed with it held.
+ * @return the number of clients
+ */
+int MQTTAsync_getHandleCount(void)
+{
+	int count = 0;
+	int i;
+
+	for (i = 0; i < reactor_count; ++i)
+		count += reactors[i]->handles->count;
+	return count;
+}
+
+
+/**
+ * Starts the send and receive threads of a reactor, if they are not running.  Called with
+ * the reactor locked.
+ * @param r the reactor
+ */
+void MQTTAsync_startThreads(MQTTAsync_reactor* r)
+{
+	FUNC_ENTRY;
+	if (r->sendThread_state != STARTING && r->sendThread_state != RUNNING)
+	{
+		r->sendThread_state = STARTING;
+		Thread_start(MQTTAsync_sendThread, r);
+	}
+	if (r->receiveThread_state != STARTING && r->receiveThread_state != RUNNING)
+	{
+		r->receiveThread_state = STARTING;
+		Thread_start(MQTTAsync_receiveThread, r);
+	}
+	FUNC_EXIT;
+}
+
+
 /*
   Check whether there are any more connect options.  If not then we are finished
   with connect attempts.
@@ -200,13 +609,11 @@ void MQTTAsync_terminate(void)
 	MQTTAsync_stop();
 	if (global_initialized)
 	{
-		ListElement* elem = NULL;
-		ListFree(bstate->clients);
-		ListFree(MQTTAsync_handles);
-		while (ListNextElement(MQTTAsync_commands, &elem))
-			MQTTAsync_freeCommand1((MQTTAsync_queuedCommand*)(elem->content));
-		ListFree(MQTTAsync_commands);
-		MQTTAsync_handles = NULL;
+#if defined(OPENSSL)
+		MQTTAsync_stopHandshakes();
+#endif
+		MQTTAsync_useReactor(reactors[0]); /* the default states, which outlive the reactors */
+		MQTTAsync_freeReactors();
 		WebSocket_terminate();
 		#if !defined(NO_HEAP_TRACKING)
 			Heap_terminate();
@@ -235,7 +642,7 @@ static int MQTTAsync_unpersistCommand(MQTTAsync_queuedCommand* qcmd)
 		rc = MQTTASYNC_PERSISTENCE_ERROR;
 		Log(LOG_ERROR, 0, "Error writing %d chars with snprintf", chars);
 	}
-	else if ((rc = qcmd->client->c->persistence->premove(qcmd->client->c->phandle, key)) != 0)
+	else if ((rc = MQTTPersistence_removeKey(qcmd->client->c, key)) != 0)
 		Log(LOG_ERROR, 0, "Error %d removing command from persistence", rc);
 	FUNC_EXIT_RC(rc);
 	return rc;
@@ -404,7 +811,7 @@ static int MQTTAsync_persistCommand(MQTTAsync_queuedCommand* qcmd)
 		if (aclient->c->beforeWrite)
 			rc = aclient->c->beforeWrite(aclient->c->beforeWrite_context, nbufs, (char**)bufs, lens);
 
-		if ((rc = aclient->c->persistence->pput(aclient->c->phandle, key, nbufs, (char**)bufs, lens)) != 0)
+		if ((rc = MQTTPersistence_put(aclient->c, key, nbufs, (char**)bufs, lens)) != 0)
 			Log(LOG_ERROR, 0, "Error persisting command, rc %d", rc);
 		qcmd->seqno = aclient->command_seqno;
 	}
@@ -721,9 +1128,10 @@ int MQTTAsync_restoreCommands(MQTTAsyncs* client)
 			rc = PAHO_MEMORY_ERROR;
 			goto exit;
 		}
+		memset(sentinel, '\0', sizeof(MQTTAsync_queuedCommand));
 		sentinel->seqno = -1;
 		keyloc_array[0].seqno = -1;
-		keyloc_array[0].elem = ListAppend(MQTTAsync_commands, sentinel, sizeof(MQTTAsync_queuedCommand));
+		keyloc_array[0].elem = ListAppend(client->reactor->commands, sentinel, sizeof(MQTTAsync_queuedCommand));
 
 		while (rc == 0 && i < nkeys)
 		{
@@ -756,7 +1164,7 @@ int MQTTAsync_restoreCommands(MQTTAsyncs* client)
 
 					cmd->client = client;
 					cmd->seqno = atoi(strchr(msgkeys[i], '-')+1); /* key format is tag'-'seqno */
-					MQTTAsync_insertInOrder(MQTTAsync_commands, cmd, sizeof(MQTTAsync_queuedCommand), keyloc_array, i + 1);
+					MQTTAsync_insertInOrder(client->reactor->commands, cmd, sizeof(MQTTAsync_queuedCommand), keyloc_array, i + 1);
 					if (buffer)
 						free(buffer);
 					client->command_seqno = max(client->command_seqno, cmd->seqno);
@@ -773,8 +1181,8 @@ int MQTTAsync_restoreCommands(MQTTAsyncs* client)
 			free(msgkeys);
 
 		/*int j; for (j = 0; j < i + 1; ++j) printf("%d ", keyloc_array[j].seqno); printf("\n"); */
-		ListRemoveHead(MQTTAsync_commands); /* remove sentinel */
-		/*ListElement* pos = NULL; while (ListNextElement(MQTTAsync_commands, &pos)) printf("%d ", ((MQTTAsync_queuedCommand*)(pos->content))->seqno); printf("\n");*/
+		ListRemoveHead(client->reactor->commands); /* remove sentinel */
+		/*ListElement* pos = NULL; while (ListNextElement(client->reactor->commands, &pos)) printf("%d ", ((MQTTAsync_queuedCommand*)(pos->content))->seqno); printf("\n");*/
 
 		free(keyloc_array);
 	}
@@ -796,21 +1204,33 @@ int MQTTAsync_unpersistCommandsAndMessages(Clients* c)
 	FUNC_ENTRY;
 	if (c->persistence && (rc = c->persistence->pkeys(c->phandle, &msgkeys, &nkeys)) == 0)
 	{
-		while (rc == 0 && i < nkeys)
+		char** keys = NULL;
+		int count = 0;
+
+		if (nkeys > 0 && (keys = malloc(nkeys * sizeof(char*))) == NULL)
+			rc = PAHO_MEMORY_ERROR;
+		for (i = 0; keys && i < nkeys; i++)
 		{
 			if (strncmp(msgkeys[i], PERSISTENCE_COMMAND_KEY, strlen(PERSISTENCE_COMMAND_KEY)) == 0 ||
-				strncmp(msgkeys[i], PERSISTENCE_V5_COMMAND_KEY, strlen(PERSISTENCE_V5_COMMAND_KEY)) == 0 ||
-				strncmp(msgkeys[i], PERSISTENCE_QUEUE_KEY, strlen(PERSISTENCE_QUEUE_KEY)) == 0 ||
-				strncmp(msgkeys[i], PERSISTENCE_V5_QUEUE_KEY, strlen(PERSISTENCE_V5_QUEUE_KEY)) == 0)
-			{
-				if ((rc = c->persistence->premove(c->phandle, msgkeys[i])) == 0)
-					messages_deleted++;
-				else
-					Log(LOG_ERROR, 0, "Error %d removing queued message from persistence", rc);
-			}
+					strncmp(msgkeys[i], PERSISTENCE_V5_COMMAND_KEY, strlen(PERSISTENCE_V5_COMMAND_KEY)) == 0 ||
+					strncmp(msgkeys[i], PERSISTENCE_QUEUE_KEY, strlen(PERSISTENCE_QUEUE_KEY)) == 0 ||
+					strncmp(msgkeys[i], PERSISTENCE_V5_QUEUE_KEY, strlen(PERSISTENCE_V5_QUEUE_KEY)) == 0)
+				keys[count++] = msgkeys[i];
+		}
+		if (count > 0)
+		{
+			/* remove them all together */
+			if ((rc = MQTTPersistence_removeMany(c, count, keys)) == 0)
+				messages_deleted = count;
+			else
+				Log(LOG_ERROR, 0, "Error %d removing queued messages from persistence", rc);
+		}
+		if (keys)
+			free(keys);
+		for (i = 0; i < nkeys; i++)
+		{
 			if (msgkeys[i])
 				free(msgkeys[i]);
-			i++;
 		}
 		if (msgkeys != NULL)
 			free(msgkeys);
@@ -830,25 +1250,38 @@ static int MQTTAsync_unpersistInflightMessages(Clients* c)
 	int messages_deleted = 0;
 
 	FUNC_ENTRY;
+	MQTTPersistence_flushDeferred(c, 1); /* so that the keys are all listed */
 	if (c->persistence && (rc = c->persistence->pkeys(c->phandle, &msgkeys, &nkeys)) == 0)
 	{
-		while (rc == 0 && i < nkeys)
+		char** keys = NULL;
+		int count = 0;
+
+		if (nkeys > 0 && (keys = malloc(nkeys * sizeof(char*))) == NULL)
+			rc = PAHO_MEMORY_ERROR;
+		for (i = 0; keys && i < nkeys; i++)
 		{
 			if (strncmp(msgkeys[i], PERSISTENCE_PUBLISH_SENT, strlen(PERSISTENCE_PUBLISH_SENT)) == 0 ||
-				strncmp(msgkeys[i], PERSISTENCE_V5_PUBLISH_SENT, strlen(PERSISTENCE_V5_PUBLISH_SENT)) == 0 ||
-				strncmp(msgkeys[i], PERSISTENCE_PUBREL, strlen(PERSISTENCE_PUBREL)) == 0 ||
-				strncmp(msgkeys[i], PERSISTENCE_V5_PUBREL, strlen(PERSISTENCE_V5_PUBREL)) == 0 ||
-				strncmp(msgkeys[i], PERSISTENCE_PUBLISH_RECEIVED, strlen(PERSISTENCE_PUBLISH_RECEIVED)) == 0 ||
-				strncmp(msgkeys[i], PERSISTENCE_V5_PUBLISH_RECEIVED, strlen(PERSISTENCE_V5_PUBLISH_RECEIVED)) == 0)
-			{
-				if ((rc = c->persistence->premove(c->phandle, msgkeys[i])) == 0)
-					messages_deleted++;
-				else
-					Log(LOG_ERROR, 0, "Error %d removing inflight message from persistence", rc);
-			}
+					strncmp(msgkeys[i], PERSISTENCE_V5_PUBLISH_SENT, strlen(PERSISTENCE_V5_PUBLISH_SENT)) == 0 ||
+					strncmp(msgkeys[i], PERSISTENCE_PUBREL, strlen(PERSISTENCE_PUBREL)) == 0 ||
+					strncmp(msgkeys[i], PERSISTENCE_V5_PUBREL, strlen(PERSISTENCE_V5_PUBREL)) == 0 ||
+					strncmp(msgkeys[i], PERSISTENCE_PUBLISH_RECEIVED, strlen(PERSISTENCE_PUBLISH_RECEIVED)) == 0 ||
+					strncmp(msgkeys[i], PERSISTENCE_V5_PUBLISH_RECEIVED, strlen(PERSISTENCE_V5_PUBLISH_RECEIVED)) == 0)
+				keys[count++] = msgkeys[i];
+		}
+		if (count > 0)
+		{
+			/* remove them all together */
+			if ((rc = MQTTPersistence_removeMany(c, count, keys)) == 0)
+				messages_deleted = count;
+			else
+				Log(LOG_ERROR, 0, "Error %d removing inflight messages from persistence", rc);
+		}
+		if (keys)
+			free(keys);
+		for (i = 0; i < nkeys; i++)
+		{
 			if (msgkeys[i])
 				free(msgkeys[i]);
-			i++;
 		}
 		if (msgkeys != NULL)
 			free(msgkeys);
@@ -883,46 +1316,178 @@ static int clientCompareConnectCommand(void* a, void* b)
 }								   
 
 // comment by Clark:: 命令?  ::2020-12-22
-int MQTTAsync_addCommand(MQTTAsync_queuedCommand* command, int command_size)
+/**
+ * Adds a command to the queue of its reactor after all those of the same or a higher
+ * priority, so that commands of the same priority stay in the order they were made.
+ * The queue is kept in priority order, so most commands can just be appended.
+ * @param r the reactor
+ * @param command the command
+ * @param command_size the size of the command
+ */
+static void MQTTAsync_queueCommand(MQTTAsync_reactor* r, MQTTAsync_queuedCommand* command, int command_size)
 {
-	int rc = MQTTASYNC_SUCCESS;
+	ListElement* current = NULL;
 
-	FUNC_ENTRY;
-	MQTTAsync_lock_mutex(mqttcommand_mutex);
-	/* Don't set start time if the connect command is already in process #218 */
-	if ((command->command.type != CONNECT) || (command->client->c->connect_state == NOT_IN_PROGRESS))
-		command->command.start_time = MQTTTime_start_clock();
-		
-	if (command->command.type == CONNECT ||
-		(command->command.type == DISCONNECT && command->command.details.dis.internal))
+	if (r->commands->last == NULL ||
+			((MQTTAsync_queuedCommand*)(r->commands->last->content))->command.priority >= command->command.priority)
+		ListAppend(r->commands, command, command_size);
+	else
 	{
-		MQTTAsync_queuedCommand* head = NULL;
-
-		if (MQTTAsync_commands->first)
-			head = (MQTTAsync_queuedCommand*)(MQTTAsync_commands->first->content);
-
-		if (head != NULL && head->client == command->client && head->command.type == command->command.type)
-			MQTTAsync_freeCommand(command); /* ignore duplicate connect or disconnect command */
-		else
-		{ 
-			ListRemoveItem(MQTTAsync_commands, command, clientCompareConnectCommand); /* remove command from the list if already there */
-			ListInsert(MQTTAsync_commands, command, command_size, MQTTAsync_commands->first); /* add to the head of the list */
+		while (ListNextElement(r->commands, &current))
+		{
+			if (((MQTTAsync_queuedCommand*)(current->content))->command.priority < command->command.priority)
+				break;
 		}
+		ListInsert(r->commands, command, command_size, current);
 	}
-	else
+}
+
+
+/**
+ * Finds the publish command to drop when a client's buffer is full: the oldest of
+ * those with the lowest priority, if that is no higher than the priority of the new one.
+ * @param r the reactor
+ * @param command the publish command being added, not yet queued
+ * @return the command to drop, or NULL if the new command has the lowest priority, so
+ * is the one to drop
+ */
+static MQTTAsync_queuedCommand* MQTTAsync_findOldestPublish(MQTTAsync_reactor* r, MQTTAsync_queuedCommand* command)
+{
+	MQTTAsync_queuedCommand* found = NULL;
+	ListElement* current = NULL;
+
+	/* the queue is in priority order, so walk back to the first publish of the lowest priority */
+	while (ListPrevElement(r->commands, &current))
 	{
-		ListAppend(MQTTAsync_commands, command, command_size);
-#if !defined(NO_PERSISTENCE)
-		if (command->client->c->persistence)
+		MQTTAsync_queuedCommand* cmd = (MQTTAsync_queuedCommand*)(current->content);
+
+		if (found && cmd->command.priority > found->command.priority)
+			break;
+		if (cmd->client == command->client && cmd->command.type == PUBLISH)
 		{
-			if (command->command.type == PUBLISH &&
-				command->client->createOptions && command->client->createOptions->struct_version >= 2 &&
-				command->client->createOptions->persistQoS0 == 0 && command->command.details.pub.qos == 0)
-				; /* don't persist QoS0 if that create option is set to 0 */
-			else
-			{
+			if (cmd->command.priority > command->command.priority)
+				break; /* all the client's publishes are of a higher priority than the new one */
+			found = cmd;
+		}
+	}
+	return found;
+}
+
+
+/**
+ * Whether a client has a disconnect command queued, made by the application.  Such a command
+ * has the lowest priority, so it is looked for among the commands at the end of the queue.
+ * @param r the reactor
+ * @param m the client
+ * @return boolean, a disconnect command is queued
+ */
+static int MQTTAsync_disconnectQueued(MQTTAsync_reactor* r, MQTTAsyncs* m)
+{
+	ListElement* current = NULL;
+	int rc = 0;
+
+	while (rc == 0 && ListPrevElement(r->commands, &current))
+	{
+		MQTTAsync_queuedCommand* cmd = (MQTTAsync_queuedCommand*)(current->content);
+
+		if (cmd->command.priority > MQTTASYNC_PRIORITY_BULK)
+			break;
+		rc = (cmd->client == m && cmd->command.type == DISCONNECT);
+	}
+	return rc;
+}
+
+
+int MQTTAsync_addCommand(MQTTAsync_queuedCommand* command, int command_size)
+{
+	int rc = MQTTASYNC_SUCCESS;
+	MQTTAsync_reactor* r = command->client->reactor;
+
+	FUNC_ENTRY;
+	MQTTAsync_lock_mutex(r->command_mutex);
+	/* Don't set start time if the connect command is already in process #218, or if it is
+	   waiting for the server's name to be looked up, which counts against the connect timeout */
+	if ((command->command.type != CONNECT) ||
+			(command->client->c->connect_state == NOT_IN_PROGRESS && !command->client->dnsPending))
+		command->command.start_time = MQTTTime_start_clock();
+		
+	if (command->command.type == CONNECT ||
+		(command->command.type == DISCONNECT && command->command.details.dis.internal))
+	{
+		MQTTAsync_queuedCommand* head = NULL;
+
+		command->command.priority = INT_MAX; /* ahead of all other commands */
+		if (r->commands->first)
+			head = (MQTTAsync_queuedCommand*)(r->commands->first->content);
+
+		if (head != NULL && head->client == command->client && head->command.type == command->command.type)
+			MQTTAsync_freeCommand(command); /* ignore duplicate connect or disconnect command */
+		else
+		{ 
+			ListRemoveItem(r->commands, command, clientCompareConnectCommand); /* remove command from the list if already there */
+			ListInsert(r->commands, command, command_size, r->commands->first); /* add to the head of the list */
+		}
+	}
+	else
+	{
+		if (command->command.type == DISCONNECT || command->command.priority < MQTTASYNC_PRIORITY_BULK)
+			command->command.priority = MQTTASYNC_PRIORITY_BULK; /* disconnect after the commands already queued */
+		else if (command->command.priority > MQTTASYNC_PRIORITY_CONTROL)
+			command->command.priority = MQTTASYNC_PRIORITY_CONTROL;
+		if (command->command.priority > MQTTASYNC_PRIORITY_BULK && MQTTAsync_disconnectQueued(r, command->client))
+			command->command.priority = MQTTASYNC_PRIORITY_BULK; /* not ahead of a disconnect made before it */
+		if (command->command.type == PUBLISH && command->client->createOptions &&
+				command->client->noBufferedMessages >= command->client->createOptions->maxBufferedMessages)
+		{
+			/* the buffer is full, so drop the oldest publish of the lowest priority.  We wouldn't
+			 * be here if delete newest was in operation */
+			MQTTAsync_queuedCommand* first_publish = NULL;
+
+			if ((first_publish = MQTTAsync_findOldestPublish(r, command)) == NULL)
+			{
+				MQTTAsync_freeCommand(command); /* the new one has the lowest priority */
+				rc = MQTTASYNC_MAX_BUFFERED_MESSAGES;
+				goto exit;
+			}
+			ListDetach(r->commands, first_publish);
+#if !defined(NO_PERSISTENCE)
+			if (command->client->c->persistence)
+				MQTTAsync_unpersistCommand(first_publish);
+#endif
+			MQTTAsync_uncacheCommand(first_publish);
+			MQTTAsync_freeCommand(first_publish);
+		}
+		else if (command->command.type == PUBLISH)
+			command->client->noBufferedMessages++;
+		MQTTAsync_queueCommand(r, command, command_size);
+#if !defined(NO_PERSISTENCE)
+		if (command->client->c->persistence)
+		{
+			if (command->command.type == PUBLISH &&
+				command->client->createOptions && command->client->createOptions->struct_version >= 2 &&
+				command->client->createOptions->persistQoS0 == 0 && command->command.details.pub.qos == 0)
+				; /* don't persist QoS0 if that create option is set to 0 */
+			else
+			{
 				int rc = MQTTAsync_persistCommand(command);
+				MQTTAsyncs* m = command->client;
+				size_t cache_len = 0;
+
 				if (command->command.type == PUBLISH && rc == 0)
+					cache_len = command->command.details.pub.payloadlen +
+						strlen(command->command.details.pub.destinationName) + 1 +
+						MQTTProperties_len(&command->command.properties);
+
+				if (command->command.type == PUBLISH && rc == 0 &&
+					m->createOptions && m->createOptions->struct_version >= 3 &&
+					m->createOptions->maxCachedPayloadBytes > 0 &&
+					m->cachedPayloadBytes + cache_len <= (size_t)m->createOptions->maxCachedPayloadBytes)
+				{
+					/* within the memory budget, so keep the command as well as persisting it */
+					command->cached_len = cache_len;
+					m->cachedPayloadBytes += cache_len;
+				}
+				else if (command->command.type == PUBLISH && rc == 0)
 				{
 					char key[PERSISTENCE_MAX_KEY_LENGTH + 1];
 					int chars = 0;
@@ -938,7 +1503,7 @@ int MQTTAsync_addCommand(MQTTAsync_queuedCommand* command, int command_size)
 						Log(LOG_ERROR, 0, "Error writing %d chars with snprintf", chars);
 						goto exit;
 					}
-					command->key = malloc(strlen(key+1));
+					command->key = malloc(strlen(key) + 1);
 					strcpy(command->key, key);
 
 					free(command->command.details.pub.payload);
@@ -950,49 +1515,19 @@ int MQTTAsync_addCommand(MQTTAsync_queuedCommand* command, int command_size)
 			}
 		}
 #endif
-		if (command->command.type == PUBLISH)
-		{
-			/* delete oldest message if buffer is full.  We wouldn't be here if delete newest was in operation */
-			if (command->client->createOptions && (command->client->noBufferedMessages >= command->client->createOptions->maxBufferedMessages))
-			{
-				MQTTAsync_queuedCommand* first_publish = NULL;
-				ListElement* current = NULL;
-
-				/* Find first publish command for this client and detach it */
-				while (ListNextElement(MQTTAsync_commands, &current))
-				{
-					MQTTAsync_queuedCommand* cmd = (MQTTAsync_queuedCommand*)(current->content);
-
-					if (cmd->client == command->client && cmd->command.type == PUBLISH)
-					{
-						first_publish = cmd;
-						break;
-					}
-				}
-				if (first_publish)
-				{
-					ListDetach(MQTTAsync_commands, first_publish);
-
-					MQTTAsync_freeCommand(first_publish);
-	#if !defined(NO_PERSISTENCE)
-					if (command->client->c->persistence)
-						MQTTAsync_unpersistCommand(first_publish);
-	#endif
-				}
-			}
-			else
-				command->client->noBufferedMessages++;
-		}
 	}
 exit:
-	MQTTAsync_unlock_mutex(mqttcommand_mutex);
+	MQTTAsync_unlock_mutex(r->command_mutex);
+	if (rc == MQTTASYNC_SUCCESS)
+	{
 #if !defined(_WIN32) && !defined(_WIN64)
-	rc = Thread_signal_cond(send_cond);
-	if (rc != 0)
-		Log(LOG_ERROR, 0, "Error %d from signal cond", rc);
+		rc = Thread_signal_cond(r->send_cond);
+		if (rc != 0)
+			Log(LOG_ERROR, 0, "Error %d from signal cond", rc);
 #else
-	rc = Thread_post_sem(send_sem);
+		rc = Thread_post_sem(r->send_sem);
 #endif
+	}
 	FUNC_EXIT_RC(rc);
 	return rc;
 }
@@ -1060,12 +1595,12 @@ void MQTTAsync_checkDisconnect(MQTTAsync handle, MQTTAsync_command* command)
 /**
  * Call Socket_noPendingWrites(int socket) with protection by socket_mutex, see https://github.com/eclipse/paho.mqtt.c/issues/385
  */
-static int MQTTAsync_Socket_noPendingWrites(int socket)
+static int MQTTAsync_Socket_noPendingWrites(MQTTAsync_reactor* r, int socket)
 {
     int rc;
-    Thread_lock_mutex(socket_mutex);
+    Thread_lock_mutex(r->socket_mutex);
     rc = Socket_noPendingWrites(socket);
-    Thread_unlock_mutex(socket_mutex);
+    Thread_unlock_mutex(r->socket_mutex);
     return rc;
 }
 
@@ -1077,26 +1612,43 @@ static int MQTTAsync_Socket_noPendingWrites(int socket)
 static void MQTTProtocol_checkPendingWrites(void)
 {
 	FUNC_ENTRY;
-	if (state.pending_writes.count > 0)
+	if (state->pending_writes.count > 0)
 	{
-		ListElement* le = state.pending_writes.first;
+		ListElement* le = state->pending_writes.first;
 		while (le)
 		{
 			if (Socket_noPendingWrites(((pending_write*)(le->content))->socket))
 			{
 				MQTTProtocol_removePublication(((pending_write*)(le->content))->p);
-				state.pending_writes.current = le;
-				ListRemove(&(state.pending_writes), le->content); /* does NextElement itself */
-				le = state.pending_writes.current;
+				state->pending_writes.current = le;
+				ListRemove(&(state->pending_writes), le->content); /* does NextElement itself */
+				le = state->pending_writes.current;
 			}
 			else
-				ListNextElement(&(state.pending_writes), &le);
+				ListNextElement(&(state->pending_writes), &le);
 		}
 	}
 	FUNC_EXIT;
 }
 
 
+/**
+ * Releases one reference to a prepared publication, freeing it when it was the last.
+ * @param prepared the prepared publication
+ */
+void MQTTAsync_releasePrepared(MQTTAsync_preparedPublish* prepared)
+{
+	if (Thread_decrement(&prepared->refs) == 0)
+	{
+		free(prepared->topic);
+		if (prepared->encodedProperties)
+			free(prepared->encodedProperties);
+		MQTTProperties_free(&prepared->properties);
+		free(prepared);
+	}
+}
+
+
 static void MQTTAsync_freeCommand1(MQTTAsync_queuedCommand *command)
 {
 	if (command->command.type == SUBSCRIBE)
@@ -1130,10 +1682,27 @@ static void MQTTAsync_freeCommand1(MQTTAsync_queuedCommand *command)
 		if (command->command.details.pub.payload)
 			free(command->command.details.pub.payload);
 		command->command.details.pub.payload = NULL;
+		if (command->command.details.pub.prepared)
+			MQTTAsync_releasePrepared(command->command.details.pub.prepared);
+		command->command.details.pub.prepared = NULL;
 	}
 	MQTTProperties_free(&command->command.properties);
 	if (command->not_restored && command->key)
 		free(command->key);
+	MQTTAsync_uncacheCommand(command);
+}
+
+/**
+ * Releases the memory budget used by a buffered command, when it is no longer buffered.
+ * @param command the command
+ */
+static void MQTTAsync_uncacheCommand(MQTTAsync_queuedCommand *command)
+{
+	if (command->cached_len > 0)
+	{
+		command->client->cachedPayloadBytes -= command->cached_len;
+		command->cached_len = 0;
+	}
 }
 
 static void MQTTAsync_freeCommand(MQTTAsync_queuedCommand *command)
@@ -1146,14 +1715,15 @@ static void MQTTAsync_freeCommand(MQTTAsync_queuedCommand *command)
 void MQTTAsync_writeComplete(int socket, int rc)
 {
 	ListElement* found = NULL;
+	MQTTAsync_reactor* r = (locked_reactor) ? locked_reactor : home_reactor;
 
 	FUNC_ENTRY;
 	/* a partial write is now complete for a socket - this will be on a publish*/
 
 	MQTTProtocol_checkPendingWrites();
 
-	/* find the client using this socket */
-	if ((found = ListFindItem(MQTTAsync_handles, &socket, clientSockCompare)) != NULL)
+	/* find the client using this socket, among those of the reactor whose sockets are being written */
+	if (r && (found = ListFindItem(r->handles, &socket, clientSockCompare)) != NULL)
 	{
 		MQTTAsyncs* m = (MQTTAsyncs*)(found->content);
 
@@ -1254,16 +1824,191 @@ void MQTTAsync_writeComplete(int socket, int rc)
 }
 
 
-static int MQTTAsync_processCommand(void)
+/**
+ * The queueing delay, in milliseconds, below which the inflight window is not reduced,
+ * however much the round trip time has gone up, as millisecond timings can't tell more
+ * about links with sub-millisecond round trip times.
+ */
+#define MQTTASYNC_INFLIGHT_MIN_DELAY 5
+
+/**
+ * The inflight window a connection starts with, if the limit allows.
+ */
+#define MQTTASYNC_INFLIGHT_INITIAL 10
+
+/**
+ * Starts the inflight window of a client again, when it has connected.
+ * @param m the client
+ */
+static void MQTTAsync_resetInflight(MQTTAsyncs* m)
+{
+	m->inflightWindow = (m->c->maxInflightMessages < MQTTASYNC_INFLIGHT_INITIAL) ?
+			m->c->maxInflightMessages : MQTTASYNC_INFLIGHT_INITIAL;
+	if (m->inflightWindow < 1)
+		m->inflightWindow = 1;
+	m->inflightSlowStart = 1;
+	m->inflightAcks = 0;
+	m->inflightMinRTT = -1;
+	m->inflightSRTT8 = 0;
+}
+
+
+/**
+ * The most QoS 1 and 2 messages a client can have in flight: the adaptive window if it
+ * is on, otherwise the limit set on connect and lowered by the server's Receive Maximum.
+ * @param m the client
+ * @return the limit
+ */
+int MQTTAsync_inflightLimit(MQTTAsyncs* m)
+{
+	if (m->adaptiveInflight && m->inflightWindow > 0 && m->inflightWindow < m->c->maxInflightMessages)
+		return m->inflightWindow;
+	return m->c->maxInflightMessages;
+}
+
+
+/**
+ * Takes the round trip time of a publish which has been acknowledged, and adapts the inflight
+ * window once per window of acks.  While the smoothed round trip time stays near the lowest
+ * seen, the throughput rises with the window, which grows: doubling until it is first cut,
+ * then by one.  When the throughput is less than half of what the window would give at the
+ * lowest round trip time, the extra messages are only queueing, and the window is halved.
+ * @param m the client
+ * @param command the publish command
+ * @param retried boolean, the publish was resent, so its round trip time is not known and
+ * the ack only counts towards the window
+ */
+static void MQTTAsync_sampleInflight(MQTTAsyncs* m, MQTTAsync_queuedCommand* command, int retried)
+{
+	int rtt = (int)MQTTTime_elapsed(command->command.start_time);
+	int srtt = 0;
+
+	FUNC_ENTRY;
+	if (!retried) /* else the ack may be for the first send or the resend (Karn's algorithm) */
+	{
+		if (m->inflightSRTT8 == 0)
+			m->inflightSRTT8 = rtt * 8;
+		else
+			m->inflightSRTT8 += rtt - m->inflightSRTT8 / 8;
+		if (m->inflightMinRTT < 0 || rtt < m->inflightMinRTT)
+			m->inflightMinRTT = rtt;
+	}
+	if (!m->adaptiveInflight || ++m->inflightAcks < m->inflightWindow)
+		goto exit;
+
+	m->inflightAcks = 0;
+	srtt = m->inflightSRTT8 / 8;
+	if (srtt > 2 * m->inflightMinRTT && srtt - m->inflightMinRTT >= MQTTASYNC_INFLIGHT_MIN_DELAY)
+	{
+		m->inflightWindow = (m->inflightWindow > 1) ? m->inflightWindow / 2 : 1;
+		m->inflightSlowStart = 0;
+	}
+	else if (m->inflightSlowStart)
+		m->inflightWindow *= 2;
+	else
+		m->inflightWindow++;
+	if (m->inflightWindow > m->c->maxInflightMessages)
+		m->inflightWindow = m->c->maxInflightMessages;
+	Log(TRACE_MIN, -1, "Inflight window for client %s is %d, round trip %d ms, lowest %d ms",
+			m->c->clientID, m->inflightWindow, srtt, m->inflightMinRTT);
+exit:
+	/* the window is full much more often than the fixed limit, so don't leave the
+	 * publishes waiting for it to the send thread's next timeout */
+	if (m->adaptiveInflight && m->reactor->commands->count > 0)
+	{
+#if !defined(_WIN32) && !defined(_WIN64)
+		Thread_signal_cond(m->reactor->send_cond);
+#else
+		Thread_post_sem(m->reactor->send_sem);
+#endif
+	}
+	FUNC_EXIT;
+}
+
+
+/**
+ * Whether a client's next publish must wait for its rate limits: until the buckets have
+ * filled, and until the messages in flight on reconnect have been resent, so that they
+ * still go first.
+ * @param m the client
+ * @return boolean, the publish must wait
+ */
+static int MQTTAsync_paced(MQTTAsyncs* m)
+{
+	publishPacing* p = &m->c->pacing;
+
+	if (p->rate == 0 && p->byteRate == 0)
+		return 0;
+	if (p->resending || MQTTProtocol_pacingWait(m->c) > 0)
+		p->blocked = 1;
+	return p->blocked;
+}
+
+
+/**
+ * Carries on with the publications of a reactor's clients held back by their rate limits.
+ * Resends of the messages in flight on reconnect are made here, and the time until the
+ * next publication can be sent is found, so that the send thread can wait for exactly that.
+ * @param r the reactor
+ * @return the milliseconds to wait, 0 to process the commands again now, or -1 if no
+ * publications are being held back
+ */
+static int MQTTAsync_pace(MQTTAsync_reactor* r)
+{
+	ListElement* current = NULL;
+	MQTTAsync_reactor* previous = NULL;
+	int wait = -1;
+
+	FUNC_ENTRY;
+	previous = MQTTAsync_lockReactorIdle(r);
+	while (ListNextElement(r->handles, &current))
+	{
+		MQTTAsyncs* m = (MQTTAsyncs*)(current->content);
+		publishPacing* p = NULL;
+		int client_wait = 0;
+
+		if (m->c == NULL || !m->c->pacing.blocked)
+			continue;
+		p = &m->c->pacing;
+		if (p->resending)
+		{
+			p->blocked = 0;
+			MQTTProtocol_resumeRetries(m->c);
+			if (!p->blocked)
+			{
+				if (p->resending == 0)
+					wait = 0; /* all resent, so the new publications can go */
+				continue; /* otherwise the retry timer carries on, once the socket can be written */
+			}
+		}
+		if (!m->c->connected)
+		{
+			p->blocked = 0;
+			continue;
+		}
+		if ((client_wait = MQTTProtocol_pacingWait(m->c)) == 0)
+			p->blocked = 0; /* try the commands again */
+		if (wait < 0 || client_wait < wait)
+			wait = client_wait;
+	}
+	MQTTAsync_unlockReactor(r, previous);
+	FUNC_EXIT_RC(wait);
+	return wait;
+}
+
+
+static int MQTTAsync_processCommand(MQTTAsync_reactor* r)
 {
 	int rc = 0;
 	MQTTAsync_queuedCommand* command = NULL;
+	MQTTAsync_queuedCommand* lost = NULL;
 	ListElement* cur_command = NULL;
 	List* ignored_clients = NULL;
+	MQTTAsync_reactor* previous = NULL;
 
 	FUNC_ENTRY;
-	MQTTAsync_lock_mutex(mqttasync_mutex);
-	MQTTAsync_lock_mutex(mqttcommand_mutex);
+	previous = MQTTAsync_lockReactorIdle(r);
+	MQTTAsync_lock_mutex(r->command_mutex);
 
 	/* only the first command in the list must be processed for any particular client, so if we skip
 	   a command for a client, we must skip all following commands for that client.  Use a list of
@@ -1272,15 +2017,15 @@ static int MQTTAsync_processCommand(void)
 	ignored_clients = ListInitialize();
 
 	/* don't try a command until there isn't a pending write for that client, and we are not connecting */
-	while (ListNextElement(MQTTAsync_commands, &cur_command))
+	while (ListNextElement(r->commands, &cur_command))
 	{
 		MQTTAsync_queuedCommand* cmd = (MQTTAsync_queuedCommand*)(cur_command->content);
 
 		if (ListFind(ignored_clients, cmd->client))		// comment by Clark:: 忽略客户端列表  ::2020-12-22
 			continue;
 
-		if (cmd->command.type == CONNECT || cmd->command.type == DISCONNECT || (cmd->client->c->connected &&
-			cmd->client->c->connect_state == NOT_IN_PROGRESS && MQTTAsync_Socket_noPendingWrites(cmd->client->c->net.socket)))
+		if ((cmd->command.type == CONNECT && !cmd->client->dnsPending) || cmd->command.type == DISCONNECT || (cmd->client->c->connected &&
+			cmd->client->c->connect_state == NOT_IN_PROGRESS && MQTTAsync_Socket_noPendingWrites(r, cmd->client->c->net.socket)))
 		{
 			if ((cmd->command.type == PUBLISH || cmd->command.type == SUBSCRIBE || cmd->command.type == UNSUBSCRIBE) &&
 				cmd->client->c->outboundMsgs->count >= MAX_MSG_ID - 1)
@@ -1289,11 +2034,16 @@ static int MQTTAsync_processCommand(void)
 			}
 			else if (((cmd->command.type == PUBLISH && cmd->command.details.pub.qos > 0) ||
 						cmd->command.type == SUBSCRIBE || cmd->command.type == UNSUBSCRIBE) &&
-				(cmd->client->c->outboundMsgs->count >= cmd->client->c->maxInflightMessages))
+				(cmd->client->c->outboundMsgs->count >= ((cmd->command.type == PUBLISH) ?
+					MQTTAsync_inflightLimit(cmd->client) : cmd->client->c->maxInflightMessages)))
 			{
 				Log(TRACE_MIN, -1, "Blocking on server receive maximum for client %s",
 						cmd->client->c->clientID); /* flow control */
 			}
+			else if (cmd->command.type == PUBLISH && MQTTAsync_paced(cmd->client))
+			{
+				Log(TRACE_MIN, -1, "Pacing publications for client %s", cmd->client->c->clientID);
+			}
 			else
 			{
 				command = cmd;
@@ -1307,7 +2057,8 @@ static int MQTTAsync_processCommand(void)
 	{
 		if (command->command.type == PUBLISH)
 			command->client->noBufferedMessages--;
-		ListDetach(MQTTAsync_commands, command);
+		ListDetach(r->commands, command);
+		MQTTAsync_uncacheCommand(command);
 #if !defined(NO_PERSISTENCE)
 		/*printf("outboundmsgs count %d max inflight %d qos %d %d %d\n", command->client->c->outboundMsgs->count, command->client->c->maxInflightMessages,
 				command->command.details.pub.qos, command->client->c->MQTTVersion, command->command.type);*/
@@ -1318,7 +2069,7 @@ static int MQTTAsync_processCommand(void)
 				char* buffer = NULL;
 				int buflen = 0;
 
-				if ((rc = command->client->c->persistence->pget(command->client->c->phandle, command->key, &buffer, &buflen)) == 0
+				if ((rc = MQTTPersistence_get(command->client->c, command->key, &buffer, &buflen)) == 0
 						&& (command->client->c->afterRead == NULL ||
 					(rc = command->client->c->afterRead(command->client->c->afterRead_context, &buffer, &buflen)) == 0))
 				{
@@ -1331,13 +2082,44 @@ static int MQTTAsync_processCommand(void)
 						free(buffer);
 				}
 				else
+				{
+					/* the persisted command is gone, for instance overwritten in a full ring buffer */
 					Log(LOG_ERROR, -1, "Error restoring command: rc %d from pget\n", rc);
+					MQTTAsync_unpersistCommand(command);
+					lost = command; /* failed once the command mutex is released */
+					command = NULL;
+				}
 			}
-			MQTTAsync_unpersistCommand(command);
+			if (command)
+				MQTTAsync_unpersistCommand(command);
 		}
 #endif
 	}
-	MQTTAsync_unlock_mutex(mqttcommand_mutex);
+	MQTTAsync_unlock_mutex(r->command_mutex);
+
+	if (lost)
+	{
+		if (lost->command.onFailure)
+		{
+			MQTTAsync_failureData data;
+
+			data.token = lost->command.token;
+			data.code = MQTTASYNC_PERSISTENCE_ERROR;
+			data.message = NULL;
+			Log(TRACE_MIN, -1, "Calling command failure for client %s", lost->client->c->clientID);
+			(*(lost->command.onFailure))(lost->command.context, &data);
+		}
+		else if (lost->command.onFailure5)
+		{
+			MQTTAsync_failureData5 data = MQTTAsync_failureData5_initializer;
+
+			data.token = lost->command.token;
+			data.code = MQTTASYNC_PERSISTENCE_ERROR;
+			Log(TRACE_MIN, -1, "Calling command failure for client %s", lost->client->c->clientID);
+			(*(lost->command.onFailure5))(lost->command.context, &data);
+		}
+		MQTTAsync_freeCommand(lost);
+	}
 
 	if (!command)
 		goto exit; /* nothing to do */
@@ -1408,6 +2190,16 @@ static int MQTTAsync_processCommand(void)
 #endif
 #endif
 
+			if (rc == TCPSOCKET_RESOLVING)
+			{
+				/* put the connect back until the server's name has been looked up, to try the same URI again */
+				if (command->client->c->MQTTVersion == MQTTVERSION_DEFAULT)
+					command->command.details.conn.MQTTVersion = (command->command.details.conn.MQTTVersion == MQTTVERSION_3_1) ?
+							MQTTVERSION_3_1_1 : MQTTVERSION_DEFAULT;
+				command->client->dnsPending = 1;
+				MQTTAsync_addCommand(command, sizeof(command->command.details.conn));
+				goto exit;
+			}
 			if (command->client->c->connect_state == NOT_IN_PROGRESS)
 				rc = SOCKET_ERROR;
 
@@ -1416,7 +2208,12 @@ static int MQTTAsync_processCommand(void)
 			make sure we check for writeability as well as readability, otherwise we wait around longer than we need to
 			in Socket_getReadySocket() */
 			if (rc == EINPROGRESS)
+			{
 				Socket_addPendingWrite(command->client->c->net.socket);
+				if (command->client->raceServerURIs &&
+						command->command.details.conn.currentURI < command->client->serverURIcount)
+					MQTTAsync_raceServerURIs(command->client, command->command.details.conn.currentURI);
+			}
 		}
 	}
 	else if (command->command.type == SUBSCRIBE)
@@ -1465,6 +2262,7 @@ static int MQTTAsync_processCommand(void)
 	{
 		Messages* msg = NULL;
 		Publish* p = NULL;
+		MQTTAsync_preparedPublish* prepared = command->command.details.pub.prepared;
 		MQTTProperties initialized = MQTTProperties_initializer;
 
 		if ((p = malloc(sizeof(Publish))) == NULL)
@@ -1479,9 +2277,25 @@ static int MQTTAsync_processCommand(void)
 		p->msgId = command->command.token;
 		p->MQTTVersion = command->client->c->MQTTVersion;
 		p->properties = initialized;
+		p->encodedProperties = NULL;
+		p->encodedPropertiesLen = 0;
+		p->topicAlias = p->topicAliased = 0;
 		if (p->MQTTVersion >= MQTTVERSION_5)
+		{
 			p->properties = command->command.properties;
+			if (prepared && prepared->encodedProperties)
+			{
+				p->encodedProperties = prepared->encodedProperties;
+				p->encodedPropertiesLen = prepared->encodedPropertiesLen;
+			}
+		}
+
+		if (p->MQTTVersion >= MQTTVERSION_5 && command->client->topicAliasMaximum > 0)
+			MQTTAsync_aliasTopic(command->client, p);
 
+		if (command->command.details.pub.qos > 0)
+			command->command.start_time = MQTTTime_start_clock(); /* to time the ack */
+		MQTTProtocol_pace(command->client->c, p->payloadlen + (prepared ? prepared->topiclen : (int)strlen(p->topic)));
 		rc = MQTTProtocol_startPublish(command->client->c, p, command->command.details.pub.qos, command->command.details.pub.retained, &msg);
 
 		if (command->command.details.pub.qos == 0)
@@ -1647,13 +2461,41 @@ static int MQTTAsync_processCommand(void)
 		ListAppend(command->client->responses, command, sizeof(command));
 
 exit:
-	MQTTAsync_unlock_mutex(mqttasync_mutex);
-	rc = (command != NULL);
+	MQTTAsync_unlockReactor(r, previous);
+	rc = (command != NULL || lost != NULL);
 	FUNC_EXIT_RC(rc);
 	return rc;
 }
 
 
+/**
+ * Called on the resolver's helper thread when a host name lookup has completed, so that the
+ * connects waiting for one are tried again.  Those whose lookup is still going on wait again.
+ */
+void MQTTAsync_dnsResolved(void)
+{
+	MQTTAsync_reactor* previous = MQTTAsync_lockGlobal();
+	int i;
+
+	for (i = 0; i < reactor_count; ++i)
+	{
+		MQTTAsync_reactor* r = reactors[i];
+		ListElement* current = NULL;
+
+		MQTTAsync_lockReactor(r);
+		while (ListNextElement(r->handles, &current))
+			((MQTTAsyncs*)(current->content))->dnsPending = 0;
+		MQTTAsync_unlockReactor(r, NULL);
+#if !defined(_WIN32) && !defined(_WIN64)
+		Thread_signal_cond(r->send_cond);
+#else
+		Thread_post_sem(r->send_sem);
+#endif
+	}
+	MQTTAsync_unlockGlobal(previous);
+}
+
+
 static void nextOrClose(MQTTAsyncs* m, int rc, char* message)
 {
 	int was_connected = m->c->connected;
@@ -1731,19 +2573,67 @@ exit:
 }
 
 
-static void MQTTAsync_checkTimeouts(void)
+/**
+ * Checks whether a connect which is waiting for the server's name to be looked up has run out
+ * of time.  The lookup counts against the connect timeout, so if it has, the connect is taken
+ * off the command queue and the next server URI is tried, or the connect fails.  Called with
+ * the reactor locked.
+ * @param r the reactor
+ * @param m the client, whose dnsPending is set
+ * @return 1 if the connect timed out, 0 otherwise
+ */
+static int MQTTAsync_checkResolveTimeout(MQTTAsync_reactor* r, MQTTAsyncs* m)
+{
+	MQTTAsync_queuedCommand* conn = NULL;
+	ListElement* current = NULL;
+	int rc = 0;
+
+	FUNC_ENTRY;
+	MQTTAsync_lock_mutex(r->command_mutex);
+	while (ListNextElement(r->commands, &current))
+	{
+		MQTTAsync_queuedCommand* cmd = (MQTTAsync_queuedCommand*)(current->content);
+
+		if (cmd->client == m && cmd->command.type == CONNECT)
+		{
+			conn = cmd;
+			break;
+		}
+	}
+	if (conn && MQTTTime_elapsed(conn->command.start_time) > (ELAPSED_TIME_TYPE)(m->connectTimeout * 1000))
+	{
+		ListDetach(r->commands, conn);
+		m->connect = conn->command;
+		MQTTAsync_freeCommand(conn);
+		rc = 1;
+	}
+	MQTTAsync_unlock_mutex(r->command_mutex);
+	if (rc)
+	{
+		m->dnsPending = 0;
+		/* no other MQTT version is worth trying against a name that has not been looked up */
+		if (m->c->MQTTVersion == MQTTVERSION_DEFAULT)
+			m->connect.details.conn.MQTTVersion = MQTTVERSION_3_1;
+		nextOrClose(m, MQTTASYNC_FAILURE, "DNS lookup timeout");
+	}
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+static void MQTTAsync_checkTimeouts(MQTTAsync_reactor* r)
 {
 	ListElement* current = NULL;
-	static START_TIME_TYPE last = START_TIME_ZERO;
+	MQTTAsync_reactor* previous = NULL;
 	START_TIME_TYPE now;
 
 	FUNC_ENTRY;
-	MQTTAsync_lock_mutex(mqttasync_mutex);
+	previous = MQTTAsync_lockReactorIdle(r);
 	now = MQTTTime_now();
-	if (MQTTTime_difftime(now, last) < (DIFF_TIME_TYPE)3000)
+	if (MQTTTime_difftime(now, r->last_timeouts) < (DIFF_TIME_TYPE)3000)
 		goto exit;
-	last = now;
-	while (ListNextElement(MQTTAsync_handles, &current))		/* for each client */
+	r->last_timeouts = now;
+	while (ListNextElement(r->handles, &current))		/* for each client */
 	{
 		MQTTAsyncs* m = (MQTTAsyncs*)(current->content);
 
@@ -1757,6 +2647,8 @@ static void MQTTAsync_checkTimeouts(void)
 			nextOrClose(m, MQTTASYNC_FAILURE, "TCP connect timeout");
 			continue;
 		}
+		if (m->dnsPending && MQTTAsync_checkResolveTimeout(r, m))
+			continue;
 
 		/* There was a section here that removed timed-out responses.  But if the command had completed and
 		 * there was a response, then we may as well report it, no?
@@ -1825,42 +2717,53 @@ static void MQTTAsync_checkTimeouts(void)
 		}
 	}
 exit:
-	MQTTAsync_unlock_mutex(mqttasync_mutex);
+	MQTTAsync_unlockReactor(r, previous);
 	FUNC_EXIT;
 }
 
 
 thread_return_type WINAPI MQTTAsync_sendThread(void* n)
 {
+	MQTTAsync_reactor* r = (MQTTAsync_reactor*)n;
+
 	FUNC_ENTRY;
-	MQTTAsync_lock_mutex(mqttasync_mutex);
-	sendThread_state = RUNNING;
-	sendThread_id = Thread_getid();
-	MQTTAsync_unlock_mutex(mqttasync_mutex);
+	home_reactor = r;
+	MQTTAsync_lockReactor(r);
+	r->sendThread_state = RUNNING;
+	MQTTAsync_unlockReactor(r, NULL);
 	while (!MQTTAsync_tostop)
 	{
 		int rc;
 
-		while (MQTTAsync_commands->count > 0)
+		int pace_wait = -1;
+
+		while (r->commands->count > 0)
 		{
-			if (MQTTAsync_processCommand() == 0)
+			if (MQTTAsync_processCommand(r) == 0)
 				break;  /* no commands were processed, so go into a wait */
 		}
+		if ((pace_wait = MQTTAsync_pace(r)) == 0)
+			continue; /* publications held back by the rate limits can be sent now */
 #if !defined(_WIN32) && !defined(_WIN64)
-		if ((rc = Thread_wait_cond(send_cond, 1)) != 0 && rc != ETIMEDOUT)
+		if (pace_wait > 0 && pace_wait < 1000)
+			rc = Thread_wait_cond_ms(r->send_cond, pace_wait); /* wake when the buckets have filled */
+		else
+			rc = Thread_wait_cond(r->send_cond, 1);
+		if (rc != 0 && rc != ETIMEDOUT)
 			Log(LOG_ERROR, -1, "Error %d waiting for condition variable", rc);
 #else
-		if ((rc = Thread_wait_sem(send_sem, 1000)) != 0 && rc != ETIMEDOUT)
+		if ((rc = Thread_wait_sem(r->send_sem, (pace_wait > 0 && pace_wait < 1000) ? pace_wait : 1000)) != 0 && rc != ETIMEDOUT)
 			Log(LOG_ERROR, -1, "Error %d waiting for semaphore", rc);
 #endif
 
-		MQTTAsync_checkTimeouts();
+		MQTTAsync_checkTimeouts(r);
+		if (r->callbacks_done)
+			MQTTAsync_dispatchHeld(r);
 	}
-	sendThread_state = STOPPING;
-	MQTTAsync_lock_mutex(mqttasync_mutex);
-	sendThread_state = STOPPED;
-	sendThread_id = 0;
-	MQTTAsync_unlock_mutex(mqttasync_mutex);
+	r->sendThread_state = STOPPING;
+	MQTTAsync_lockReactor(r);
+	r->sendThread_state = STOPPED;
+	MQTTAsync_unlockReactor(r, NULL);
 	FUNC_EXIT;
 #if defined(_WIN32) || defined(_WIN64)
 	ExitThread(0);
@@ -1885,6 +2788,11 @@ void MQTTAsync_emptyMessageQueue(Clients* client)
 		}
 		ListEmpty(client->messageQueue);
 	}
+	if (client->context)
+	{
+		((MQTTAsyncs*)(client->context))->inboundBytes = 0;
+		MQTTAsync_checkInbound((MQTTAsyncs*)(client->context));
+	}
 	FUNC_EXIT;
 }
 
@@ -1945,15 +2853,15 @@ void MQTTAsync_freeCommands(MQTTAsyncs* m)
 
 	FUNC_ENTRY;
 	/* remove commands in the command queue relating to this client */
-	current = ListNextElement(MQTTAsync_commands, &next);
-	ListNextElement(MQTTAsync_commands, &next);
+	current = ListNextElement(m->reactor->commands, &next);
+	ListNextElement(m->reactor->commands, &next);
 	while (current)
 	{
 		MQTTAsync_queuedCommand* command = (MQTTAsync_queuedCommand*)(current->content);
 
 		if (command->client == m)
 		{
-			ListDetach(MQTTAsync_commands, command);
+			ListDetach(m->reactor->commands, command);
 
 			if (command->command.onFailure)
 			{
@@ -1984,27 +2892,141 @@ void MQTTAsync_freeCommands(MQTTAsyncs* m)
 			count++;
 		}
 		current = next;
-		ListNextElement(MQTTAsync_commands, &next);
+		ListNextElement(m->reactor->commands, &next);
 	}
 	Log(TRACE_MINIMUM, -1, "%d commands removed for client %s", count, m->c->clientID);
 	FUNC_EXIT;
 }
 
 
-static int MQTTAsync_completeConnection(MQTTAsyncs* m, Connack* connack)
+/**
+ * Compares the topics of two topic aliases, or of an alias and a topic.
+ * @param a the topic alias in the tree
+ * @param b the topic alias, or the topic if content is 0
+ * @param content whether b is a topic alias
+ */
+static int MQTTAsync_topicAliasCompare(void* a, void* b, int content)
 {
-	int rc = MQTTASYNC_FAILURE;
+	const char* topic = content ? ((MQTTAsync_topicAlias*)b)->topic : (const char*)b;
 
-	FUNC_ENTRY;
-	if (m->c->connect_state == WAIT_FOR_CONNACK) /* MQTT connect sent - wait for CONNACK */
+	return strcmp(((MQTTAsync_topicAlias*)a)->topic, topic);
+}
+
+
+/**
+ * Forgets the topic aliases assigned on a connection, when it is replaced by a new one or the
+ * client is destroyed.
+ * @param m the client
+ */
+void MQTTAsync_freeTopicAliases(MQTTAsyncs* m)
+{
+	if (m->topicAliases)
 	{
-		Log(LOG_PROTOCOL, 1, NULL, m->c->net.socket, m->c->clientID, connack->rc);
-		if ((rc = connack->rc) == MQTTASYNC_SUCCESS)
-		{
-			m->retrying = 0;
+		while (m->topicAliases->index[0].root != NULL)
+			free(TreeRemoveNodeIndex(m->topicAliases, m->topicAliases->index[0].root, 0));
+		TreeFree(m->topicAliases);
+		m->topicAliases = NULL;
+	}
+	m->newestAlias = m->oldestAlias = NULL;
+	m->topicAliasMaximum = 0;
+}
+
+
+/**
+ * Assigns a topic alias to the topic of a publication about to be sent, or uses the one
+ * already assigned, replacing the least recently used alias when they are all in use.
+ * @param m the client
+ * @param p the publication
+ */
+static void MQTTAsync_aliasTopic(MQTTAsyncs* m, Publish* p)
+{
+	MQTTAsync_topicAlias* entry = NULL;
+	Node* found = NULL;
+	int topiclen = (int)strlen(p->topic);
+
+	FUNC_ENTRY;
+	/* an alias takes 3 bytes of properties, so shorter topics are sent as they are */
+	if (topiclen <= 3 || MQTTProperties_hasProperty(&p->properties, MQTTPROPERTY_CODE_TOPIC_ALIAS))
+		goto exit;
+	if (m->topicAliases == NULL && (m->topicAliases = TreeInitialize(MQTTAsync_topicAliasCompare)) == NULL)
+		goto exit;
+
+	if ((found = TreeFind(m->topicAliases, p->topic)) != NULL)
+	{
+		entry = (MQTTAsync_topicAlias*)(found->content);
+		p->topicAliased = 1;
+		m->topicAliasBytesSaved += topiclen - 3;
+		if (entry == m->newestAlias)
+			goto set;
+		/* unlink the alias, to make it the newest */
+		entry->newer->older = entry->older;
+		if (entry->older)
+			entry->older->newer = entry->newer;
+		else
+			m->oldestAlias = entry->newer;
+	}
+	else
+	{
+		int alias = m->topicAliases->count + 1;
+
+		if (m->topicAliases->count >= m->topicAliasMaximum)
+		{
+			/* give the least recently used alias to the new topic */
+			MQTTAsync_topicAlias* oldest = m->oldestAlias;
+
+			alias = oldest->alias;
+			TreeRemove(m->topicAliases, oldest);
+			if ((m->oldestAlias = oldest->newer) != NULL)
+				m->oldestAlias->older = NULL;
+			else
+				m->newestAlias = NULL;
+			free(oldest);
+		}
+		if ((entry = malloc(sizeof(MQTTAsync_topicAlias) + topiclen + 1)) == NULL)
+			goto exit;
+		entry->alias = alias;
+		entry->topic = (char*)(entry + 1);
+		memcpy(entry->topic, p->topic, topiclen + 1);
+		TreeAdd(m->topicAliases, entry, sizeof(MQTTAsync_topicAlias) + topiclen + 1);
+		p->topicAliased = 0;
+		m->topicAliasBytesSaved -= 3;
+	}
+	entry->newer = NULL;
+	if ((entry->older = m->newestAlias) != NULL)
+		m->newestAlias->newer = entry;
+	else
+		m->oldestAlias = entry;
+	m->newestAlias = entry;
+set:
+	p->topicAlias = entry->alias;
+exit:
+	FUNC_EXIT;
+}
+
+
+static int MQTTAsync_completeConnection(MQTTAsyncs* m, Connack* connack)
+{
+	int rc = MQTTASYNC_FAILURE;
+
+	FUNC_ENTRY;
+	if (m->c->connect_state == WAIT_FOR_CONNACK) /* MQTT connect sent - wait for CONNACK */
+	{
+		Log(LOG_PROTOCOL, 1, NULL, m->c->net.socket, m->c->clientID, connack->rc);
+		if ((rc = connack->rc) == MQTTASYNC_SUCCESS)
+		{
+			m->retrying = 0;
 			m->c->connected = 1;
 			m->c->good = 1;
 			m->c->connect_state = NOT_IN_PROGRESS;
+			/* topic aliases only last as long as the connection, and the server sets how many there can be */
+			MQTTAsync_freeTopicAliases(m);
+			if (m->c->MQTTVersion >= MQTTVERSION_5 && m->createOptions && m->createOptions->struct_version >= 7 &&
+					MQTTProperties_hasProperty(&connack->properties, MQTTPROPERTY_CODE_TOPIC_ALIAS_MAXIMUM))
+			{
+				int server_max = MQTTProperties_getNumericValue(&connack->properties, MQTTPROPERTY_CODE_TOPIC_ALIAS_MAXIMUM);
+
+				m->topicAliasMaximum = min(m->createOptions->maxTopicAliases, server_max);
+			}
 			if (m->c->cleansession || m->c->cleanstart)
 				rc = MQTTAsync_cleanSession(m->c);
 			else if (m->c->MQTTVersion >= MQTTVERSION_3_1_1 && connack->flags.bits.sessionPresent == 0)
@@ -2029,9 +3051,9 @@ static int MQTTAsync_completeConnection(MQTTAsyncs* m, Connack* connack)
 		}
 		m->pack = NULL;
 #if !defined(_WIN32) && !defined(_WIN64)
-		Thread_signal_cond(send_cond);
+		Thread_signal_cond(m->reactor->send_cond);
 #else
-		Thread_post_sem(send_sem);
+		Thread_post_sem(m->reactor->send_sem);
 #endif
 	}
 	FUNC_EXIT_RC(rc);
@@ -2042,12 +3064,13 @@ static int MQTTAsync_completeConnection(MQTTAsyncs* m, Connack* connack)
 /* This is the thread function that handles the calling of callback functions if set */
 thread_return_type WINAPI MQTTAsync_receiveThread(void* n)
 {
+	MQTTAsync_reactor* r = (MQTTAsync_reactor*)n;
 	long timeout = 10L; /* first time in we have a small timeout.  Gets things started more quickly */
 
 	FUNC_ENTRY;
-	MQTTAsync_lock_mutex(mqttasync_mutex);
-	receiveThread_state = RUNNING;
-	receiveThread_id = Thread_getid();
+	home_reactor = r;
+	MQTTAsync_lockReactor(r);
+	r->receiveThread_state = RUNNING;
 	while (!MQTTAsync_tostop)
 	{
 		int rc = SOCKET_ERROR;
@@ -2055,23 +3078,25 @@ thread_return_type WINAPI MQTTAsync_receiveThread(void* n)
 		MQTTAsyncs* m = NULL;
 		MQTTPacket* pack = NULL;
 
-		MQTTAsync_unlock_mutex(mqttasync_mutex);
-		pack = MQTTAsync_cycle(&sock, timeout, &rc);
-		MQTTAsync_lock_mutex(mqttasync_mutex);
+		MQTTAsync_unlockReactor(r, NULL);
+		pack = MQTTAsync_cycle(r, &sock, timeout, &rc);
+		MQTTAsync_lockReactorIdle(r);
 		if (MQTTAsync_tostop)
 			break;
 		timeout = 1000L;
+		if (r->inbound_paused > 0)
+			MQTTAsync_drainPaused(r);
 
 		if (sock == 0)
 			continue;
 		/* find client corresponding to socket */
-		if (ListFindItem(MQTTAsync_handles, &sock, clientSockCompare) == NULL)
+		if (ListFindItem(r->handles, &sock, clientSockCompare) == NULL)
 		{
 			Log(TRACE_MINIMUM, -1, "Could not find client corresponding to socket %d", sock);
 			/* Socket_close(sock); - removing socket in this case is not necessary (Bug 442400) */
 			continue;
 		}
-		m = (MQTTAsyncs*)(MQTTAsync_handles->current->content);
+		m = (MQTTAsyncs*)(r->handles->current->content);
 		if (m == NULL)
 		{
 			Log(LOG_ERROR, -1, "Client structure was NULL for socket %d - removing socket", sock);
@@ -2085,26 +3110,11 @@ thread_return_type WINAPI MQTTAsync_receiveThread(void* n)
 		}
 		else
 		{
-			if (m->c->messageQueue->count > 0 && m->ma)
-			{
-				qEntry* qe = (qEntry*)(m->c->messageQueue->first->content);
-				int topicLen = qe->topicLen;
-
-				if (strlen(qe->topicName) == topicLen)
-					topicLen = 0;
-
-				if (MQTTAsync_deliverMessage(m, qe->topicName, topicLen, qe->msg))
-				{
-#if !defined(NO_PERSISTENCE)
-					if (m->c->persistence)
-						MQTTPersistence_unpersistQueueEntry(m->c, (MQTTPersistence_qEntry*)qe);
-#endif
-					ListRemove(m->c->messageQueue, qe); /* qe is freed here */
-				}
-				else
-					Log(TRACE_MIN, -1, "False returned from messageArrived for client %s, message remains on queue",
-						m->c->clientID);
-			}
+			if (m->c->messageQueue->count > 0 && m->ma && callback_threads > 0)
+				MQTTAsync_dispatchQueued(m);
+			else if (m->c->messageQueue->count > 0 && m->ma)
+				MQTTAsync_deliverQueued(m);
+			MQTTAsync_checkInbound(m);
 			if (pack)
 			{
 				if (pack->header.bits.type == CONNACK)
@@ -2173,6 +3183,7 @@ thread_return_type WINAPI MQTTAsync_receiveThread(void* n)
 									m->c->maxInflightMessages = recv_max;
 							}
 						}
+						MQTTAsync_resetInflight(m);
 					}
 					else
 					{
@@ -2345,15 +3356,14 @@ thread_return_type WINAPI MQTTAsync_receiveThread(void* n)
 			}
 		}
 	}
-	receiveThread_state = STOPPED;
-	receiveThread_id = 0;
-	MQTTAsync_unlock_mutex(mqttasync_mutex);
+	r->receiveThread_state = STOPPED;
+	MQTTAsync_unlockReactor(r, NULL);
 #if !defined(_WIN32) && !defined(_WIN64)
-	if (sendThread_state != STOPPED)
-		Thread_signal_cond(send_cond);
+	if (r->sendThread_state != STOPPED)
+		Thread_signal_cond(r->send_cond);
 #else
-	if (sendThread_state != STOPPED)
-		Thread_post_sem(send_sem);
+	if (r->sendThread_state != STOPPED)
+		Thread_post_sem(r->send_sem);
 #endif
 	FUNC_EXIT;
 #if defined(_WIN32) || defined(_WIN64)
@@ -2363,6 +3373,23 @@ thread_return_type WINAPI MQTTAsync_receiveThread(void* n)
 }
 
 
+/**
+ * Checks whether any reactor thread is running.  Called with the global mutex held.
+ * @return boolean indicating whether any thread is running
+ */
+static int MQTTAsync_threadsRunning(void)
+{
+	int i;
+
+	for (i = 0; i < reactor_count; ++i)
+	{
+		if (reactors[i]->sendThread_state != STOPPED || reactors[i]->receiveThread_state != STOPPED)
+			return 1;
+	}
+	return 0;
+}
+
+
 static void MQTTAsync_stop(void)
 {
 #if !defined(NOSTACKTRACE)
@@ -2370,28 +3397,32 @@ static void MQTTAsync_stop(void)
 #endif
 
 	FUNC_ENTRY;
-	if (sendThread_state != STOPPED || receiveThread_state != STOPPED)
+	if (MQTTAsync_threadsRunning())
 	{
 		int conn_count = 0;
-		ListElement* current = NULL;
+		int i;
 
-		if (MQTTAsync_handles != NULL)
+		/* find out how many handles are still connected */
+		for (i = 0; i < reactor_count; ++i)
 		{
-			/* find out how many handles are still connected */
-			while (ListNextElement(MQTTAsync_handles, &current))
+			ListElement* current = NULL;
+
+			MQTTAsync_lockReactor(reactors[i]);
+			while (ListNextElement(reactors[i]->handles, &current))
 			{
 				if (((MQTTAsyncs*)(current->content))->c->connect_state > NOT_IN_PROGRESS ||
 						((MQTTAsyncs*)(current->content))->c->connected)
 					++conn_count;
 			}
+			MQTTAsync_unlockReactor(reactors[i], NULL);
 		}
 		Log(TRACE_MIN, -1, "Conn_count is %d", conn_count);
-		/* stop the background thread, if we are the last one to be using it */
+		/* stop the background threads, if we are the last one to be using them */
 		if (conn_count == 0)
 		{
 			int count = 0;
 			MQTTAsync_tostop = 1;
-			while ((sendThread_state != STOPPED || receiveThread_state != STOPPED) && ++count < 100)
+			while (MQTTAsync_threadsRunning() && ++count < 100)
 			{
 				MQTTAsync_unlock_mutex(mqttasync_mutex);
 				Log(TRACE_MIN, -1, "sleeping");
@@ -2410,19 +3441,31 @@ static void MQTTAsync_stop(void)
 
 static void MQTTAsync_closeOnly(Clients* client, enum MQTTReasonCodes reasonCode, MQTTProperties* props)
 {
+	MQTTAsyncs* m = (MQTTAsyncs*)(client->context);
+	MQTTAsync_reactor* r = m->reactor;
+
 	FUNC_ENTRY;
+	if (m->inboundPaused)
+	{
+		m->inboundPaused = 0; /* the next connection's socket starts off being read */
+		r->inbound_paused--;
+	}
 	client->good = 0;
 	client->ping_outstanding = 0;
+#if !defined(NO_PERSISTENCE)
+	MQTTPersistence_flushDeferred(client, 1);
+#endif
 	if (client->net.socket > 0)
 	{
 		MQTTProtocol_checkPendingWrites();
 		if (client->connected && Socket_noPendingWrites(client->net.socket))
 			MQTTPacket_send_disconnect(client, reasonCode, props);
-		Thread_lock_mutex(socket_mutex);
+		Thread_lock_mutex(r->socket_mutex);
+#if defined(OPENSSL)
+		MQTTAsync_cancelHandshake(client->net.socket);
+#endif
 		WebSocket_close(&client->net, WebSocket_CLOSE_NORMAL, NULL);
 #if defined(OPENSSL)
-		SSL_SESSION_free(client->session); /* is a no-op if session is NULL */
-		client->session = NULL; /* show the session has been freed */
 		SSLSocket_close(&client->net);
 #endif
 		Socket_close(client->net.socket);
@@ -2430,7 +3473,7 @@ static void MQTTAsync_closeOnly(Clients* client, enum MQTTReasonCodes reasonCode
 #if defined(OPENSSL)
 		client->net.ssl = NULL;
 #endif
-		Thread_unlock_mutex(socket_mutex);
+		Thread_unlock_mutex(r->socket_mutex);
 	}
 	client->connected = 0;
 	client->connect_state = NOT_IN_PROGRESS;
@@ -2451,19 +3494,6 @@ void MQTTAsync_closeSession(Clients* client, enum MQTTReasonCodes reasonCode, MQ
 }
 
 
-/**
- * List callback function for comparing clients by client structure
- * @param a Async structure
- * @param b Client structure
- * @return boolean indicating whether a and b are equal
- */
-static int clientStructCompare(void* a, void* b)
-{
-	MQTTAsyncs* m = (MQTTAsyncs*)a;
-	return m->c == (Clients*)b;
-}
-
-
 /**
  * Clean the MQTT session data.  This includes the MQTT inflight messages, because
  * that is part of the MQTT state that will be cleared by the MQTT broker too.
@@ -2473,7 +3503,6 @@ static int clientStructCompare(void* a, void* b)
 static int MQTTAsync_cleanSession(Clients* client)
 {
 	int rc = 0;
-	ListElement* found = NULL;
 
 	FUNC_ENTRY;
 #if !defined(NO_PERSISTENCE)
@@ -2482,11 +3511,8 @@ static int MQTTAsync_cleanSession(Clients* client)
 	MQTTProtocol_emptyMessageList(client->inboundMsgs);
 	MQTTProtocol_emptyMessageList(client->outboundMsgs);
 	client->msgID = 0;
-	if ((found = ListFindItem(MQTTAsync_handles, client, clientStructCompare)) != NULL)
-	{
-		MQTTAsyncs* m = (MQTTAsyncs*)(found->content);
-		MQTTAsync_freeResponses(m);
-	}
+	if (client->context != NULL)
+		MQTTAsync_freeResponses((MQTTAsyncs*)(client->context));
 	else
 		Log(LOG_ERROR, -1, "cleanSession: did not find client structure in handles list");
 	FUNC_EXIT_RC(rc);
@@ -2517,6 +3543,37 @@ static int MQTTAsync_deliverMessage(MQTTAsyncs* m, char* topicName, size_t topic
 }
 
 
+/**
+ * Delivers the first message in a client's queue of undelivered messages.
+ * @param m the client
+ * @return boolean 1 means the message has been delivered and removed from the queue
+ */
+static int MQTTAsync_deliverQueued(MQTTAsyncs* m)
+{
+	qEntry* qe = (qEntry*)(m->c->messageQueue->first->content);
+	size_t len = MQTTAsync_qEntryLen(qe);
+	int topicLen = qe->topicLen;
+	int rc = 0;
+
+	if (strlen(qe->topicName) == topicLen)
+		topicLen = 0;
+
+	if ((rc = MQTTAsync_deliverMessage(m, qe->topicName, topicLen, qe->msg)) != 0)
+	{
+#if !defined(NO_PERSISTENCE)
+		if (m->c->persistence)
+			MQTTPersistence_unpersistQueueEntry(m->c, (MQTTPersistence_qEntry*)qe);
+#endif
+		ListRemove(m->c->messageQueue, qe); /* qe is freed here */
+		m->inboundBytes -= len;
+	}
+	else
+		Log(TRACE_MIN, -1, "False returned from messageArrived for client %s, message remains on queue",
+			m->c->clientID);
+	return rc;
+}
+
+
 void Protocol_processPublication(Publish* publish, Clients* client, int allocatePayload)
 {
 	MQTTAsync_message* mm = NULL;
@@ -2552,15 +3609,15 @@ void Protocol_processPublication(Publish* publish, Clients* client, int allocate
 
 	if (client->messageQueue->count == 0 && client->connected)
 	{
-		ListElement* found = NULL;
-
-		if ((found = ListFindItem(MQTTAsync_handles, client, clientStructCompare)) == NULL)
+		if (client->context == NULL)
 			Log(LOG_ERROR, -1, "processPublication: did not find client structure in handles list");
 		else
 		{
-			MQTTAsyncs* m = (MQTTAsyncs*)(found->content);
+			MQTTAsyncs* m = (MQTTAsyncs*)(client->context);
 
-			if (m->ma)
+			if (m->ma && callback_threads > 0)
+				rc = MQTTAsync_dispatchMessage(m, publish->topic, publish->topiclen, mm, NULL);
+			else if (m->ma)
 				rc = MQTTAsync_deliverMessage(m, publish->topic, publish->topiclen, mm);
 			else
 				Log(LOG_ERROR, -1, "Message arrived for client %s but can't deliver it. No messageArrived callback",
@@ -2578,6 +3635,8 @@ void Protocol_processPublication(Publish* publish, Clients* client, int allocate
 		qe->topicName = publish->topic;
 		qe->topicLen = publish->topiclen;
 		ListAppend(client->messageQueue, qe, sizeof(qe) + sizeof(mm) + mm->payloadlen + strlen(qe->topicName)+1);
+		if (client->context)
+			((MQTTAsyncs*)(client->context))->inboundBytes += MQTTAsync_qEntryLen(qe);
 #if !defined(NO_PERSISTENCE)
 		if (client->persistence)
 			MQTTPersistence_persistQueueEntry(client, (MQTTPersistence_qEntry*)qe);
@@ -2686,26 +3745,20 @@ int MQTTAsync_assignMsgId(MQTTAsyncs* m)
 {
 	int start_msgid;
 	int msgid;
-	thread_id_type thread_id = 0;
-	int locked = 0;
+	MQTTAsync_reactor* previous = NULL;
 
 	/* need to check: commands list and response list for a client */
 	FUNC_ENTRY;
-	/* We might be called in a callback. In which case, this mutex will be already locked. */
-	thread_id = Thread_getid();
-	if (thread_id != sendThread_id && thread_id != receiveThread_id)
-	{
-		MQTTAsync_lock_mutex(mqttasync_mutex);
-		locked = 1;
-	}
+	/* We might be called in a callback, in which case the reactor may be already locked. */
+	previous = MQTTAsync_lockReactor(m->reactor);
 
 	/* Fetch last message ID in locked state */
 	start_msgid = m->c->msgID;
 	msgid = start_msgid;
 
-	MQTTAsync_lock_mutex(mqttcommand_mutex);
+	MQTTAsync_lock_mutex(m->reactor->command_mutex);
 	msgid = (msgid == MAX_MSG_ID) ? 1 : msgid + 1;
-	while (ListFindItem(MQTTAsync_commands, &msgid, cmdMessageIDCompare) ||
+	while (ListFindItem(m->reactor->commands, &msgid, cmdMessageIDCompare) ||
 			ListFindItem(m->c->outboundMsgs, &msgid, messageIDCompare) ||
 			ListFindItem(m->responses, &msgid, cmdMessageIDCompare))
 	{
@@ -2716,112 +3769,1199 @@ int MQTTAsync_assignMsgId(MQTTAsyncs* m)
 			break;
 		}
 	}
-	MQTTAsync_unlock_mutex(mqttcommand_mutex);
+	MQTTAsync_unlock_mutex(m->reactor->command_mutex);
 	if (msgid != 0)
 		m->c->msgID = msgid;
-	if (locked)
-		MQTTAsync_unlock_mutex(mqttasync_mutex);
+	MQTTAsync_unlockReactor(m->reactor, previous);
 	FUNC_EXIT_RC(msgid);
 	return msgid;
 }
 
 
-static void MQTTAsync_retry(void)
+static void MQTTAsync_retry(MQTTAsync_reactor* r)
 {
-	static START_TIME_TYPE last = START_TIME_ZERO;
 	START_TIME_TYPE now;
 
 	FUNC_ENTRY;
 	now = MQTTTime_now();
-	if (MQTTTime_difftime(now, last) >= (DIFF_TIME_TYPE)(retryLoopIntervalms))
+	if (MQTTTime_difftime(now, r->last_retry) >= (DIFF_TIME_TYPE)(retryLoopIntervalms))
 	{
-		last = MQTTTime_now();
+		r->last_retry = MQTTTime_now();
 		MQTTProtocol_keepalive(now);
 		MQTTProtocol_retry(now, 1, 0);
 	}
 	else
 		MQTTProtocol_retry(now, 0, 0);
+#if !defined(NO_PERSISTENCE)
+	{
+		ListElement* current = NULL;
+
+		/* write the deferred records which have not been removed in time */
+		while (ListNextElement(bstate->clients, &current))
+		{
+			Clients* client = (Clients*)(current->content);
+
+			if (client->deferredPersistence && client->deferredPersistence->count > 0)
+				MQTTPersistence_flushDeferred(client, 0);
+		}
+	}
+#endif
 	FUNC_EXIT;
 }
 
 
-static int MQTTAsync_connecting(MQTTAsyncs* m)
-{
-	int rc = -1;
-	char* serverURI = m->serverURI;
 #if defined(OPENSSL)
-	int default_port = MQTT_DEFAULT_PORT;
-#endif
+/**
+ * A TLS handshake handed to a handshake worker.  The handshakes list holds a reference to it,
+ * as does a worker while it runs the handshake or gives the socket back.  Whichever thread
+ * drops the last reference frees it.
+ */
+typedef struct
+{
+	int socket;
+	SSL* ssl;
+	MQTTAsync_reactor* reactor; /**< the reactor whose socket set the socket is in */
+	int refcount;    /**< protected by handshake_mutex */
+	int busy;        /**< a worker is running the handshake */
+	int done;        /**< the worker has finished, and is returning the socket to select */
+	int cancelled;   /**< the connection is being closed */
+	sem_type stopped; /**< posted when the worker stops running a cancelled handshake */
+} MQTTAsync_handshake;
+
+static int handshake_threads = 0;    /* the size of the pool, 0 for none */
+static int handshake_stopping = 0;   /* the workers are to end */
+static List* handshake_pool = NULL;  /* the worker threads, protected by handshake_mutex */
+static List* handshakes = NULL;      /* protected by handshake_mutex */
+static mutex_type handshake_mutex = NULL;
+static sem_type handshake_sem = NULL;
+
+/**
+ * Sets the number of threads used to run TLS handshakes.
+ * @param count the number of threads, 0 to run handshakes on the receive thread
+ */
+void MQTTAsync_setHandshakeThreads(int count)
+{
+	handshake_threads = (count > 0) ? count : 0;
+}
+
+
+/**
+ * Drops a reference to a handshake, and frees it if that was the last.  Called with
+ * handshake_mutex held.
+ * @param hs the handshake
+ */
+static void MQTTAsync_releaseHandshake(MQTTAsync_handshake* hs)
+{
+	if (--hs->refcount == 0)
+		free(hs);
+}
+
+
+/**
+ * Runs a TLS handshake until it completes, fails or is cancelled.  The SSL errors are left
+ * for the receive thread to find when it calls SSL_connect again.
+ * @param hs the handshake
+ */
+static void MQTTAsync_runHandshake(MQTTAsync_handshake* hs)
+{
+	int rc = 0;
 
 	FUNC_ENTRY;
-	if (m->serverURIcount > 0)
+	while (!hs->cancelled)
 	{
-		serverURI = m->serverURIs[m->connect.details.conn.currentURI];
+		int err;
+		fd_set fds;
+		struct timeval tv = {0L, 50000L}; /* to check for cancellation */
 
-		/* skip URI scheme */
-		if (strncmp(URI_TCP, serverURI, strlen(URI_TCP)) == 0)
-			serverURI += strlen(URI_TCP);
-		else if (strncmp(URI_WS, serverURI, strlen(URI_WS)) == 0)
+		ERR_clear_error();
+		if ((rc = SSL_connect(hs->ssl)) == 1)
+			break;
+		err = SSL_get_error(hs->ssl, rc);
+		if (err != SSL_ERROR_WANT_READ && err != SSL_ERROR_WANT_WRITE)
 		{
-			serverURI += strlen(URI_WS);
-#if defined(OPENSSL)
-			default_port = WS_DEFAULT_PORT;
-#endif
+			Log(TRACE_MIN, -1, "TLS handshake on socket %d failed in worker, error %d", hs->socket, err);
+			break;
 		}
-#if defined(OPENSSL)
-		else if (strncmp(URI_SSL, serverURI, strlen(URI_SSL)) == 0)
+		FD_ZERO(&fds);
+		FD_SET(hs->socket, &fds);
+		select(hs->socket + 1, (err == SSL_ERROR_WANT_READ) ? &fds : NULL,
+				(err == SSL_ERROR_WANT_WRITE) ? &fds : NULL, NULL, &tv);
+	}
+	FUNC_EXIT_RC(rc);
+}
+
+
+static thread_return_type WINAPI MQTTAsync_handshakeThread(void* n)
+{
+	FUNC_ENTRY;
+	Thread_lock_mutex(handshake_mutex);
+	while (!handshake_stopping)
+	{
+		MQTTAsync_handshake* hs = NULL;
+		MQTTAsync_reactor* r = NULL;
+		ListElement* current = NULL;
+
+		while (ListNextElement(handshakes, &current))
 		{
-			serverURI += strlen(URI_SSL);
-			default_port = SECURE_MQTT_DEFAULT_PORT;
+			MQTTAsync_handshake* cur = (MQTTAsync_handshake*)(current->content);
+
+			if (!cur->busy && !cur->done)
+			{
+				hs = cur;
+				break;
+			}
 		}
-		else if (strncmp(URI_WSS, serverURI, strlen(URI_WSS)) == 0)
+		if (hs == NULL)
 		{
-			serverURI += strlen(URI_WSS);
-			default_port = WS_DEFAULT_PORT;
+			Thread_unlock_mutex(handshake_mutex);
+			Thread_wait_sem(handshake_sem, 1000);
+			Thread_lock_mutex(handshake_mutex);
+			continue;
 		}
-#endif
+
+		hs->busy = 1;
+		hs->refcount++;
+		Thread_unlock_mutex(handshake_mutex);
+		MQTTAsync_runHandshake(hs);
+		Thread_lock_mutex(handshake_mutex);
+		hs->busy = 0;
+		if (hs->cancelled)
+		{
+			if (hs->stopped)
+				Thread_post_sem(hs->stopped);
+			MQTTAsync_releaseHandshake(hs);
+			continue;
+		}
+		hs->done = 1;
+		r = hs->reactor;
+		Thread_unlock_mutex(handshake_mutex);
+
+		/* socket_mutex is taken before handshake_mutex, as when a connection is closed */
+		Thread_lock_mutex(r->socket_mutex);
+		Thread_lock_mutex(handshake_mutex);
+		if (!hs->cancelled) /* it was not cancelled while we weren't looking */
+		{
+			Socket_setReactor(r->index);
+			Socket_release(hs->socket);
+			ListDetach(handshakes, hs);
+			MQTTAsync_releaseHandshake(hs); /* the list's reference */
+		}
+		MQTTAsync_releaseHandshake(hs);
+		Thread_unlock_mutex(r->socket_mutex);
 	}
+	Thread_unlock_mutex(handshake_mutex);
+	FUNC_EXIT;
+#if defined(_WIN32) || defined(_WIN64)
+	ExitThread(0);
+#endif
+	return 0;
+}
 
-	if (m->c->connect_state == TCP_IN_PROGRESS) /* TCP connect started - check for completion */
-	{
-		int error;
-		socklen_t len = sizeof(error);
 
-		if ((rc = getsockopt(m->c->net.socket, SOL_SOCKET, SO_ERROR, (char*)&error, &len)) == 0)
-			rc = error;
+/**
+ * Hands a TLS handshake to the handshake workers.  The socket is not reported by select
+ * until the handshake is complete, when the receive thread calls MQTTAsync_connecting again.
+ * @param client the client whose connection is being made
+ * @return 0 if success, otherwise failure
+ */
+static int MQTTAsync_startHandshake(Clients* client)
+{
+	MQTTAsync_handshake* hs = NULL;
+	int rc = 0;
 
-		if (rc != 0)
+	FUNC_ENTRY;
+	if (handshake_mutex == NULL)
+	{
+		if ((handshake_mutex = Thread_create_mutex(&rc)) == NULL ||
+				(handshake_sem = Thread_create_sem(&rc)) == NULL ||
+				(handshakes = ListInitialize()) == NULL ||
+				(handshake_pool = ListInitialize()) == NULL)
+		{
+			rc = PAHO_MEMORY_ERROR;
 			goto exit;
+		}
+	}
+	if ((hs = malloc(sizeof(MQTTAsync_handshake))) == NULL)
+	{
+		rc = PAHO_MEMORY_ERROR;
+		goto exit;
+	}
+	memset(hs, '\0', sizeof(MQTTAsync_handshake));
+	hs->socket = client->net.socket;
+	hs->ssl = client->net.ssl;
+	hs->reactor = ((MQTTAsyncs*)(client->context))->reactor;
+	hs->refcount = 1; /* for the handshakes list */
+
+	Thread_lock_mutex(hs->reactor->socket_mutex);
+	Thread_lock_mutex(handshake_mutex);
+	Socket_hold(hs->socket);
+	ListAppend(handshakes, hs, sizeof(MQTTAsync_handshake));
+	while (handshake_pool->count < handshake_threads)
+	{
+		thread_type* thread = malloc(sizeof(thread_type));
 
-		Socket_clearPendingWrite(m->c->net.socket);
-
-#if defined(OPENSSL)
-		if (m->ssl)
+		if (thread == NULL)
+			break;
+		if ((*thread = Thread_start_joinable(MQTTAsync_handshakeThread, NULL)) == 0)
 		{
-			int port;
-			size_t hostname_len;
-			int setSocketForSSLrc = 0;
+			free(thread);
+			break;
+		}
+		ListAppend(handshake_pool, thread, sizeof(thread_type));
+	}
+	Thread_unlock_mutex(handshake_mutex);
+	Thread_unlock_mutex(hs->reactor->socket_mutex);
+	Thread_post_sem(handshake_sem);
+	Log(TRACE_MIN, -1, "TLS handshake for socket %d handed to a worker", hs->socket);
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
 
-			if (m->websocket && m->c->net.https_proxy) {
-				m->c->connect_state = PROXY_CONNECT_IN_PROGRESS;
-				if ((rc = WebSocket_proxy_connect( &m->c->net, 1, serverURI)) == SOCKET_ERROR )
-					goto exit;
-			}
 
-			hostname_len = MQTTProtocol_addressPort(serverURI, &port, NULL, default_port);
-			setSocketForSSLrc = SSLSocket_setSocketForSSL(&m->c->net, m->c->sslopts,
-					serverURI, hostname_len);
+/**
+ * Takes a socket back from the handshake workers, when its connection is being closed.
+ * If a worker is running the handshake, waits for it to stop.  Called with socket_mutex held.
+ * @param socket the socket
+ */
+static void MQTTAsync_cancelHandshake(int socket)
+{
+	ListElement* current = NULL;
+	MQTTAsync_handshake* hs = NULL;
 
-			if (setSocketForSSLrc != MQTTASYNC_SUCCESS)
+	FUNC_ENTRY;
+	if (handshake_mutex == NULL)
+		goto exit;
+	Thread_lock_mutex(handshake_mutex);
+	while (ListNextElement(handshakes, &current))
+	{
+		if (((MQTTAsync_handshake*)(current->content))->socket == socket)
+		{
+			hs = (MQTTAsync_handshake*)(current->content);
+			break;
+		}
+	}
+	if (hs)
+	{
+		ListDetach(handshakes, hs);
+		hs->cancelled = 1;
+		if (hs->busy)
+		{
+			int rc = 0;
+
+			/* the SSL structure is freed when the socket is closed, so wait until the worker has stopped using it */
+			hs->stopped = Thread_create_sem(&rc);
+			while (hs->busy)
 			{
-				if (m->c->session != NULL)
-					if ((rc = SSL_set_session(m->c->net.ssl, m->c->session)) != 1)
-						Log(TRACE_MIN, -1, "Failed to set SSL session with stored data, non critical");
-				rc = m->c->sslopts->struct_version >= 3 ?
-					SSLSocket_connect(m->c->net.ssl, m->c->net.socket, serverURI,
-						m->c->sslopts->verify, m->c->sslopts->ssl_error_cb, m->c->sslopts->ssl_error_context) :
-					SSLSocket_connect(m->c->net.ssl, m->c->net.socket, serverURI,
-						m->c->sslopts->verify, NULL, NULL);
+				Thread_unlock_mutex(handshake_mutex);
+				if (hs->stopped)
+					Thread_wait_sem(hs->stopped, 1000);
+				else
+					MQTTAsync_sleep(1L);
+				Thread_lock_mutex(handshake_mutex);
+			}
+			if (hs->stopped)
+			{
+				Thread_destroy_sem(hs->stopped);
+				hs->stopped = NULL;
+			}
+		}
+		MQTTAsync_releaseHandshake(hs); /* the list's reference */
+	}
+	Thread_unlock_mutex(handshake_mutex);
+exit:
+	FUNC_EXIT;
+}
+
+
+/**
+ * Ends the handshake workers, waiting for each to finish, and frees the pool.  Called when
+ * the library is terminated, after all the clients have been destroyed.
+ */
+static void MQTTAsync_stopHandshakes(void)
+{
+	ListElement* current = NULL;
+
+	FUNC_ENTRY;
+	if (handshake_mutex == NULL)
+		goto exit;
+	Thread_lock_mutex(handshake_mutex);
+	handshake_stopping = 1;
+	Thread_unlock_mutex(handshake_mutex);
+	while (ListNextElement(handshake_pool, &current))
+		Thread_post_sem(handshake_sem); /* wake each worker */
+	current = NULL;
+	while (ListNextElement(handshake_pool, &current))
+		Thread_join(*(thread_type*)(current->content));
+	ListFree(handshake_pool);
+	while (handshakes->first)
+		free(ListDetachHead(handshakes));
+	ListFree(handshakes);
+	Thread_destroy_sem(handshake_sem);
+	Thread_destroy_mutex(handshake_mutex);
+	handshake_pool = handshakes = NULL;
+	handshake_sem = NULL;
+	handshake_mutex = NULL;
+	handshake_stopping = 0;
+exit:
+	FUNC_EXIT;
+}
+#endif
+
+
+/**
+ * The most callback threads
+ */
+#define MQTTASYNC_MAX_CALLBACK_THREADS 64
+
+/**
+ * A callback handed to the callback workers: a message for messageArrived, or the
+ * completion of a publish for deliveryComplete and the publish's own callbacks.
+ */
+typedef struct
+{
+	MQTTAsyncs* client;
+	MQTTAsync_reactor* reactor;
+	MQTTAsync_messageArrived* ma;
+	void* maContext;
+	char* topicName;
+	int topicLen;
+	MQTTAsync_message* msg;
+	MQTTAsync_deliveryComplete* dc;
+	void* dcContext;
+	int msgid;
+	MQTTAsync_queuedCommand* command;
+	int ackrc;
+	int packet_type;
+	MQTTProperties properties;
+	int cancelled;   /**< the client is being destroyed */
+	unsigned int order;  /**< the hash of the client and topic: callbacks with the same one are run in order */
+	int persisted;   /**< the message is in the client's persistence, with seqno */
+	unsigned int seqno;
+	int retrying;    /**< messageArrived returned false, at retry_time */
+	START_TIME_TYPE retry_time;
+} MQTTAsync_callback;
+
+typedef struct
+{
+	List* callbacks;                 /**< the callbacks waiting for the worker, in order */
+	sem_type sem;
+	MQTTAsync_callback* running;     /**< the callback the worker is running */
+	int started;
+} MQTTAsync_callbackWorker;
+
+static int callback_queue_limit = 100;  /* the most messages of one client handed to the workers */
+static MQTTAsync_callbackWorker callback_workers[MQTTASYNC_MAX_CALLBACK_THREADS];
+static mutex_type callback_mutex = NULL;  /* protects the workers' lists and the clients' callbacksQueued */
+static THREAD_LOCAL MQTTAsync_callback* running_callback = NULL;
+
+/**
+ * Sets the number of threads used to call the message and publish completion callbacks.
+ * Called from MQTTAsync_global_init, before any client is created.
+ * @param count the number of threads, 0 to call back on the receive threads
+ * @param queue_limit the most messages of one client waiting for the threads
+ */
+void MQTTAsync_setCallbackThreads(int count, int queue_limit)
+{
+	int i;
+	int rc = 0;
+
+	FUNC_ENTRY;
+	if (callback_mutex != NULL)
+		goto exit; /* the workers have been set up already */
+	if (count > MQTTASYNC_MAX_CALLBACK_THREADS)
+		count = MQTTASYNC_MAX_CALLBACK_THREADS;
+	callback_queue_limit = (queue_limit > 0) ? queue_limit : 1;
+	if (count <= 0)
+		goto exit;
+	if ((callback_mutex = Thread_create_mutex(&rc)) == NULL)
+		goto exit;
+	for (i = 0; i < count; ++i)
+	{
+		memset(&callback_workers[i], '\0', sizeof(MQTTAsync_callbackWorker));
+		if ((callback_workers[i].callbacks = ListInitialize()) == NULL ||
+				(callback_workers[i].sem = Thread_create_sem(&rc)) == NULL)
+			goto exit;
+		callback_threads = i + 1;
+	}
+exit:
+	FUNC_EXIT;
+}
+
+
+/**
+ * Frees a callback which has not been run, with the message or command it holds.
+ * @param cb the callback
+ */
+static void MQTTAsync_freeCallback(MQTTAsync_callback* cb)
+{
+	if (cb->msg)
+	{
+		MQTTAsync_freeMessage(&cb->msg);
+		MQTTAsync_free(cb->topicName);
+	}
+	if (cb->command)
+		MQTTAsync_freeCommand(cb->command);
+	MQTTProperties_free(&cb->properties);
+	free(cb);
+}
+
+
+/**
+ * Calls deliveryComplete and the callbacks of a publish command, when the publish has completed.
+ * The command is freed.
+ * @param m the client
+ * @param dc the deliveryComplete callback, or NULL
+ * @param dcContext the context for deliveryComplete
+ * @param msgid the message id of the publish
+ * @param command the publish command, or NULL if it is not known
+ * @param ackrc the MQTT V5 reason code of the ack
+ * @param msgprops the MQTT V5 properties of the ack
+ * @param packet_type the type of the ack
+ */
+static void MQTTAsync_callPublishResponse(MQTTAsyncs* m, MQTTAsync_deliveryComplete* dc, void* dcContext,
+		int msgid, MQTTAsync_queuedCommand* command, int ackrc, MQTTProperties* msgprops, int packet_type)
+{
+	FUNC_ENTRY;
+	if (dc)
+	{
+		Log(TRACE_MIN, -1, "Calling deliveryComplete for client %s, msgid %d", m->c->clientID, msgid);
+		(*dc)(dcContext, msgid);
+	}
+	if (command == NULL)
+		goto exit;
+	if (command->command.onSuccess)
+	{
+		MQTTAsync_successData data;
+
+		data.token = command->command.token;
+		data.alt.pub.destinationName = command->command.details.pub.destinationName;
+		data.alt.pub.message.payload = command->command.details.pub.payload;
+		data.alt.pub.message.payloadlen = command->command.details.pub.payloadlen;
+		data.alt.pub.message.qos = command->command.details.pub.qos;
+		data.alt.pub.message.retained = command->command.details.pub.retained;
+		Log(TRACE_MIN, -1, "Calling publish success for client %s", m->c->clientID);
+		(*(command->command.onSuccess))(command->command.context, &data);
+	}
+	else if (command->command.onSuccess5 && ackrc < MQTTREASONCODE_UNSPECIFIED_ERROR)
+	{
+		MQTTAsync_successData5 data = MQTTAsync_successData5_initializer;
+
+		data.token = command->command.token;
+		data.alt.pub.destinationName = command->command.details.pub.destinationName;
+		data.alt.pub.message.payload = command->command.details.pub.payload;
+		data.alt.pub.message.payloadlen = command->command.details.pub.payloadlen;
+		data.alt.pub.message.qos = command->command.details.pub.qos;
+		data.alt.pub.message.retained = command->command.details.pub.retained;
+		data.properties = command->command.properties;
+		Log(TRACE_MIN, -1, "Calling publish success for client %s", m->c->clientID);
+		(*(command->command.onSuccess5))(command->command.context, &data);
+	}
+	else if (command->command.onFailure5 && ackrc >= MQTTREASONCODE_UNSPECIFIED_ERROR)
+	{
+		MQTTAsync_failureData5 data = MQTTAsync_failureData5_initializer;
+
+		data.token = command->command.token;
+		data.reasonCode = ackrc;
+		data.properties = *msgprops;
+		data.packet_type = packet_type;
+		Log(TRACE_MIN, -1, "Calling publish failure for client %s", m->c->clientID);
+		(*(command->command.onFailure5))(command->command.context, &data);
+	}
+	MQTTAsync_freeCommand(command);
+exit:
+	FUNC_EXIT;
+}
+
+
+/**
+ * The time before a message whose messageArrived returned false is offered again
+ */
+#define MQTTASYNC_CALLBACK_RETRY_INTERVAL 100
+
+/**
+ * Runs a callback on a callback worker.  A message accepted by messageArrived is removed
+ * from the client's persistence.
+ * @param cb the callback
+ * @return boolean 0 means messageArrived returned false, and the message is to be offered again
+ */
+static int MQTTAsync_runCallback(MQTTAsync_callback* cb)
+{
+	int rc = 1;
+
+	FUNC_ENTRY;
+	if (cb->msg)
+	{
+		if ((rc = (*(cb->ma))(cb->maContext, cb->topicName, cb->topicLen, cb->msg)) == 0)
+			goto exit; /* the message is offered again later */
+		cb->msg = NULL; /* the message now belongs to the application */
+#if !defined(NO_PERSISTENCE)
+		if (cb->persisted)
+		{
+			MQTTAsync_reactor* previous = MQTTAsync_lockReactor(cb->reactor);
+			MQTTPersistence_qEntry qe;
+
+			memset(&qe, '\0', sizeof(qe));
+			qe.seqno = cb->seqno;
+			if (cb->client->c->persistence)
+				MQTTPersistence_unpersistQueueEntry(cb->client->c, &qe);
+			MQTTAsync_unlockReactor(cb->reactor, previous);
+		}
+#endif
+	}
+	else
+	{
+		MQTTAsync_callPublishResponse(cb->client, cb->dc, cb->dcContext, cb->msgid, cb->command,
+				cb->ackrc, &cb->properties, cb->packet_type);
+		cb->command = NULL;
+	}
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/**
+ * The most topics whose callbacks a worker skips over, while their first message waits to be
+ * offered again
+ */
+#define MQTTASYNC_MAX_WAITING_ORDERS 16
+
+/**
+ * Finds the next callback a worker can run: the first one which is not waiting to be offered
+ * again, and not behind one for the same client and topic which is.  Called with callback_mutex held.
+ * @param w the worker
+ * @return the callback, still in the worker's list, or NULL if there is none to run now
+ */
+static MQTTAsync_callback* MQTTAsync_nextCallback(MQTTAsync_callbackWorker* w)
+{
+	unsigned int waiting[MQTTASYNC_MAX_WAITING_ORDERS];
+	int waiting_count = 0;
+	ListElement* current = NULL;
+	MQTTAsync_callback* next = NULL;
+
+	while (next == NULL && ListNextElement(w->callbacks, &current))
+	{
+		MQTTAsync_callback* cb = (MQTTAsync_callback*)(current->content);
+		int i;
+
+		for (i = 0; i < waiting_count; ++i)
+		{
+			if (waiting[i] == cb->order)
+				break;
+		}
+		if (i < waiting_count)
+			continue; /* behind one for the same topic */
+		if (cb->retrying && MQTTTime_elapsed(cb->retry_time) < MQTTASYNC_CALLBACK_RETRY_INTERVAL)
+		{
+			if (waiting_count == MQTTASYNC_MAX_WAITING_ORDERS)
+				break;
+			waiting[waiting_count++] = cb->order;
+		}
+		else
+			next = cb;
+	}
+	return next;
+}
+
+
+static thread_return_type WINAPI MQTTAsync_callbackThread(void* n)
+{
+	MQTTAsync_callbackWorker* w = (MQTTAsync_callbackWorker*)n;
+
+	FUNC_ENTRY;
+	Thread_lock_mutex(callback_mutex);
+	while (!MQTTAsync_tostop)
+	{
+		MQTTAsync_callback* cb = NULL;
+		int done = 0;
+
+		if ((cb = MQTTAsync_nextCallback(w)) == NULL)
+		{
+			Thread_unlock_mutex(callback_mutex);
+			Thread_wait_sem(w->sem, (w->callbacks->count > 0) ? MQTTASYNC_CALLBACK_RETRY_INTERVAL : 1000);
+			Thread_lock_mutex(callback_mutex);
+			continue;
+		}
+		ListDetach(w->callbacks, cb);
+		w->running = cb;
+		Thread_unlock_mutex(callback_mutex);
+		running_callback = cb;
+		done = MQTTAsync_runCallback(cb);
+		running_callback = NULL;
+		Thread_lock_mutex(callback_mutex);
+		w->running = NULL;
+		if (!done && !cb->cancelled)
+		{
+			/* offer it again later, ahead of the later messages for its topic, which wait for it */
+			cb->retrying = 1;
+			cb->retry_time = MQTTTime_now();
+			ListInsert(w->callbacks, cb, sizeof(MQTTAsync_callback), w->callbacks->first);
+			continue;
+		}
+		if (!cb->cancelled && cb->ma)
+		{
+			cb->client->callbacksQueued--;
+			if (cb->client->callbacksHeld)
+			{
+				/* wake the send thread to hand over the messages held back */
+				cb->client->callbacksHeld = 0;
+				cb->reactor->callbacks_done = 1;
+#if !defined(_WIN32) && !defined(_WIN64)
+				Thread_signal_cond(cb->reactor->send_cond);
+#else
+				Thread_post_sem(cb->reactor->send_sem);
+#endif
+			}
+		}
+		MQTTAsync_freeCallback(cb);
+	}
+	w->started = 0;
+	Thread_unlock_mutex(callback_mutex);
+	FUNC_EXIT;
+#if defined(_WIN32) || defined(_WIN64)
+	ExitThread(0);
+#endif
+	return 0;
+}
+
+
+/**
+ * Hands a callback to the worker for its client and topic, so that the callbacks for one
+ * client and topic are run in order.  Called with callback_mutex held.
+ * @param cb the callback
+ * @param topic the topic of the message or publish, or NULL
+ * @param topicLen the length of the topic
+ */
+static void MQTTAsync_queueCallback(MQTTAsync_callback* cb, const char* topic, size_t topicLen)
+{
+	MQTTAsync_callbackWorker* w = NULL;
+	size_t client = (size_t)cb->client;
+	unsigned int hash = 2166136261U; /* FNV-1a */
+	size_t i;
+
+	for (i = 0; i < sizeof(client); ++i)
+	{
+		hash ^= (unsigned char)(client >> (i * 8));
+		hash *= 16777619U;
+	}
+	for (i = 0; topic && i < topicLen; ++i)
+	{
+		hash ^= (unsigned char)topic[i];
+		hash *= 16777619U;
+	}
+	cb->order = hash;
+	w = &callback_workers[hash % callback_threads];
+	ListAppend(w->callbacks, cb, sizeof(MQTTAsync_callback));
+	if (!w->started)
+	{
+		w->started = 1;
+		Thread_start(MQTTAsync_callbackThread, w);
+	}
+	Thread_post_sem(w->sem);
+}
+
+
+/**
+ * Hands a message to the callback workers, if the client has not reached its limit.
+ * @param m the client
+ * @param topicName the topic of the message, which belongs to the workers if handed over
+ * @param topicLen the length of the topic, 0 if it is null terminated
+ * @param mm the message, which belongs to the workers if handed over
+ * @param qe the entry of the message in the client's queue, or NULL.  The worker removes
+ * it from persistence once the message has been accepted.
+ * @return boolean 1 means the message has been handed over, 0 that it has not
+ */
+static int MQTTAsync_dispatchMessage(MQTTAsyncs* m, char* topicName, int topicLen, MQTTAsync_message* mm,
+		qEntry* qe)
+{
+	MQTTAsync_callback* cb = NULL;
+	int rc = 0;
+
+	FUNC_ENTRY;
+	Thread_lock_mutex(callback_mutex);
+	if (m->callbacksClosed)
+		goto exit;
+	if (m->callbacksQueued >= callback_queue_limit)
+	{
+		m->callbacksHeld = 1; /* the message waits in the client's queue */
+		goto exit;
+	}
+	if ((cb = malloc(sizeof(MQTTAsync_callback))) == NULL)
+		goto exit;
+	memset(cb, '\0', sizeof(MQTTAsync_callback));
+	cb->client = m;
+	cb->reactor = m->reactor;
+	cb->ma = m->ma;
+	cb->maContext = m->maContext;
+	cb->topicName = topicName;
+	cb->topicLen = topicLen;
+	cb->msg = mm;
+	if (qe && m->c->persistence)
+	{
+		cb->persisted = 1;
+		cb->seqno = qe->seqno;
+	}
+	m->callbacksQueued++;
+	MQTTAsync_queueCallback(cb, topicName, (topicLen > 0) ? (size_t)topicLen : strlen(topicName));
+	rc = 1;
+exit:
+	Thread_unlock_mutex(callback_mutex);
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/**
+ * Hands the messages waiting in a client's queue to the callback workers, in order, as far
+ * as the client's limit allows.
+ * @param m the client
+ */
+static void MQTTAsync_dispatchQueued(MQTTAsyncs* m)
+{
+	FUNC_ENTRY;
+	while (m->c->messageQueue->count > 0)
+	{
+		qEntry* qe = (qEntry*)(m->c->messageQueue->first->content);
+		size_t len = MQTTAsync_qEntryLen(qe);
+		int topicLen = qe->topicLen;
+
+		if (strlen(qe->topicName) == topicLen)
+			topicLen = 0;
+		if (!MQTTAsync_dispatchMessage(m, qe->topicName, topicLen, qe->msg, qe))
+			break;
+		ListRemove(m->c->messageQueue, qe); /* qe is freed here */
+		m->inboundBytes -= len;
+	}
+	FUNC_EXIT;
+}
+
+
+/**
+ * Hands the messages held back for the clients of a reactor to the callback workers, when
+ * the workers have caught up.
+ * @param r the reactor
+ */
+static void MQTTAsync_dispatchHeld(MQTTAsync_reactor* r)
+{
+	MQTTAsync_reactor* previous = NULL;
+	ListElement* current = NULL;
+
+	FUNC_ENTRY;
+	previous = MQTTAsync_lockReactorIdle(r);
+	r->callbacks_done = 0;
+	while (ListNextElement(r->handles, &current))
+	{
+		MQTTAsyncs* m = (MQTTAsyncs*)(current->content);
+
+		if (m->c->messageQueue->count > 0 && m->ma)
+			MQTTAsync_dispatchQueued(m);
+	}
+	MQTTAsync_unlockReactor(r, previous);
+	FUNC_EXIT;
+}
+
+
+/**
+ * Hands the completion of a publish to the callback workers.
+ * @param m the client
+ * @param msgid the message id of the publish
+ * @param command the publish command, or NULL if it is not known, which belongs to the workers if handed over
+ * @param ackrc the MQTT V5 reason code of the ack
+ * @param msgprops the MQTT V5 properties of the ack, which are copied
+ * @param packet_type the type of the ack
+ * @return boolean 1 means the completion has been handed over, 0 that it has not
+ */
+static int MQTTAsync_dispatchPublishResponse(MQTTAsyncs* m, int msgid, MQTTAsync_queuedCommand* command,
+		int ackrc, MQTTProperties* msgprops, int packet_type)
+{
+	MQTTAsync_callback* cb = NULL;
+	char* topic = NULL;
+	int rc = 0;
+
+	FUNC_ENTRY;
+	if (callback_threads == 0 || (m->dc == NULL && command == NULL))
+		goto exit;
+	Thread_lock_mutex(callback_mutex);
+	if (!m->callbacksClosed && (cb = malloc(sizeof(MQTTAsync_callback))) != NULL)
+	{
+		memset(cb, '\0', sizeof(MQTTAsync_callback));
+		cb->client = m;
+		cb->reactor = m->reactor;
+		cb->dc = m->dc;
+		cb->dcContext = m->dcContext;
+		cb->msgid = msgid;
+		cb->command = command;
+		cb->ackrc = ackrc;
+		cb->packet_type = packet_type;
+		cb->properties = MQTTProperties_copy(msgprops);
+		if (command)
+		{
+			MQTTAsync_uncacheCommand(command);
+			topic = command->command.details.pub.destinationName;
+		}
+		MQTTAsync_queueCallback(cb, topic, topic ? strlen(topic) : 0);
+		rc = 1;
+	}
+	Thread_unlock_mutex(callback_mutex);
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/**
+ * Stops handing a client's callbacks to the workers, when it is being destroyed.  The callbacks
+ * not yet run are dropped, and one being run is waited for, unless it is the caller.
+ * Called with no reactor locked, or the one locked is released while waiting.
+ * @param m the client
+ */
+void MQTTAsync_cancelCallbacks(MQTTAsyncs* m)
+{
+	MQTTAsync_reactor* held = locked_reactor;
+	int i;
+
+	FUNC_ENTRY;
+	if (callback_mutex == NULL)
+		goto exit;
+	if (held)
+	{
+		held->lent++;
+		lent_reactor = held;
+		MQTTAsync_unlock_mutex(held->mutex); /* a callback being waited for may want it */
+		locked_reactor = NULL;
+	}
+	Thread_lock_mutex(callback_mutex);
+	m->callbacksClosed = 1;
+	for (i = 0; i < callback_threads; ++i)
+	{
+		MQTTAsync_callbackWorker* w = &callback_workers[i];
+		MQTTAsync_callback* running = w->running;
+		ListElement* current = NULL;
+
+		while (ListNextElement(w->callbacks, &current))
+		{
+			MQTTAsync_callback* cb = (MQTTAsync_callback*)(current->content);
+
+			if (cb->client == m)
+			{
+				ListDetach(w->callbacks, cb);
+				MQTTAsync_freeCallback(cb);
+				current = NULL; /* start again */
+			}
+		}
+		if (running && running->client == m)
+		{
+			running->cancelled = 1;
+			while (running != running_callback && w->running == running)
+			{
+				Thread_unlock_mutex(callback_mutex);
+				MQTTAsync_sleep(1L);
+				Thread_lock_mutex(callback_mutex);
+			}
+		}
+	}
+	Thread_unlock_mutex(callback_mutex);
+	if (held)
+	{
+		MQTTAsync_lock_mutex(held->mutex);
+		locked_reactor = held;
+		held->lent--;
+		lent_reactor = NULL;
+	}
+exit:
+	FUNC_EXIT;
+}
+
+
+static int inbound_limit_messages = 0;     /* the most messages queued over all clients, 0 for no limit */
+static size_t inbound_limit_bytes = 0;     /* the most bytes queued over all clients, 0 for no limit */
+static int inbound_messages = 0;           /* the messages queued over all clients */
+static size_t inbound_bytes = 0;           /* the bytes queued over all clients */
+static mutex_type inbound_mutex = NULL;    /* protects the totals, which are updated from all reactors */
+
+/**
+ * Sets the limits on the messages waiting for messageArrived over all the clients.
+ * Called from MQTTAsync_global_init, before any client is created.
+ * @param messages the most messages, 0 for no limit
+ * @param bytes the most bytes of payload and topic, 0 for no limit
+ */
+void MQTTAsync_setInboundLimits(int messages, int bytes)
+{
+	int rc = 0;
+
+	FUNC_ENTRY;
+	inbound_limit_messages = (messages > 0) ? messages : 0;
+	inbound_limit_bytes = (bytes > 0) ? (size_t)bytes : 0;
+	if ((inbound_limit_messages > 0 || inbound_limit_bytes > 0) && inbound_mutex == NULL)
+		inbound_mutex = Thread_create_mutex(&rc);
+	FUNC_EXIT;
+}
+
+
+/**
+ * The bytes counted against the inbound limits for a queued message.
+ * @param qe the queue entry
+ * @return the length of the payload and topic
+ */
+static size_t MQTTAsync_qEntryLen(qEntry* qe)
+{
+	return (size_t)qe->msg->payloadlen + strlen(qe->topicName);
+}
+
+
+/**
+ * Pauses the reads from a client's socket when its queue of undelivered messages, or the
+ * queues of all the clients, reach their limits, and resumes them when the queues have
+ * drained to half of the limits.  Called with the client's reactor locked.
+ * @param m the client
+ */
+static void MQTTAsync_checkInbound(MQTTAsyncs* m)
+{
+	int max_messages = 0;
+	size_t max_bytes = 0;
+	int count = m->c->messageQueue->count;
+	int over = 0;
+	int under = 1;
+
+	FUNC_ENTRY;
+	if (m->createOptions && m->createOptions->struct_version >= 5)
+	{
+		max_messages = m->createOptions->maxInboundMessages;
+		max_bytes = (m->createOptions->maxInboundBytes > 0) ? (size_t)m->createOptions->maxInboundBytes : 0;
+	}
+	if (max_messages > 0)
+	{
+		over = (count >= max_messages);
+		under = (count <= max_messages / 2);
+	}
+	if (max_bytes > 0)
+	{
+		over = over || (m->inboundBytes >= max_bytes);
+		under = under && (m->inboundBytes <= max_bytes / 2);
+	}
+	if (inbound_mutex)
+	{
+		Thread_lock_mutex(inbound_mutex);
+		inbound_messages += count - m->inboundCounted;
+		inbound_bytes = inbound_bytes + m->inboundBytes - m->inboundCountedBytes;
+		m->inboundCounted = count;
+		m->inboundCountedBytes = m->inboundBytes;
+		if (inbound_limit_messages > 0)
+		{
+			over = over || (inbound_messages >= inbound_limit_messages);
+			under = under && (inbound_messages <= inbound_limit_messages / 2);
+		}
+		if (inbound_limit_bytes > 0)
+		{
+			over = over || (inbound_bytes >= inbound_limit_bytes);
+			under = under && (inbound_bytes <= inbound_limit_bytes / 2);
+		}
+		Thread_unlock_mutex(inbound_mutex);
+	}
+
+	if (!m->inboundPaused && over && m->c->connected && m->c->net.socket > 0)
+	{
+		Log(TRACE_MIN, -1, "Pausing reads for client %s, %d messages of %lu bytes queued",
+				m->c->clientID, count, (unsigned long)m->inboundBytes);
+		Thread_lock_mutex(m->reactor->socket_mutex);
+		Socket_pauseReads(m->c->net.socket);
+		Thread_unlock_mutex(m->reactor->socket_mutex);
+		m->inboundPaused = 1;
+		m->reactor->inbound_paused++;
+	}
+	else if (m->inboundPaused && under)
+	{
+		Log(TRACE_MIN, -1, "Resuming reads for client %s, %d messages queued", m->c->clientID, count);
+		Thread_lock_mutex(m->reactor->socket_mutex);
+		Socket_resumeReads(m->c->net.socket);
+		Thread_unlock_mutex(m->reactor->socket_mutex);
+		m->inboundPaused = 0;
+		m->reactor->inbound_paused--;
+	}
+	FUNC_EXIT;
+}
+
+
+/**
+ * Counts the messages restored to a client's queue from persistence against the inbound limits.
+ * @param m the client
+ */
+void MQTTAsync_countInbound(MQTTAsyncs* m)
+{
+	ListElement* current = NULL;
+
+	FUNC_ENTRY;
+	m->inboundBytes = 0;
+	while (ListNextElement(m->c->messageQueue, &current))
+		m->inboundBytes += MQTTAsync_qEntryLen((qEntry*)(current->content));
+	MQTTAsync_checkInbound(m);
+	FUNC_EXIT;
+}
+
+
+/**
+ * Delivers the messages waiting for the clients of a reactor whose reads are paused, since
+ * their sockets are not reported by select, and resumes the reads once the queues have drained.
+ * @param r the reactor, which is locked
+ */
+static void MQTTAsync_drainPaused(MQTTAsync_reactor* r)
+{
+	ListElement* current = NULL;
+
+	FUNC_ENTRY;
+	while (ListNextElement(r->handles, &current))
+	{
+		MQTTAsyncs* m = (MQTTAsyncs*)(current->content);
+
+		if (!m->inboundPaused)
+			continue;
+		if (m->ma && callback_threads > 0)
+			MQTTAsync_dispatchQueued(m);
+		else if (m->ma)
+		{
+			while (m->c->messageQueue->count > 0 && MQTTAsync_deliverQueued(m))
+				;
+		}
+		/* a PINGRESP can't be read while paused, so don't let keepalive close the connection */
+		if (m->c->ping_outstanding)
+			m->c->net.lastPing = MQTTTime_now();
+		MQTTAsync_checkInbound(m);
+	}
+	FUNC_EXIT;
+}
+
+
+/**
+ * Add the serverURIs following the one being connected to to the race for the connect in
+ * progress, as far as the next with a different scheme.
+ * @param m the client
+ * @param current the index of the serverURI being connected to
+ */
+static void MQTTAsync_raceServerURIs(MQTTAsyncs* m, int current)
+{
+	const char* scheme = strstr(m->serverURIs[current], "://");
+	size_t scheme_len = scheme ? (size_t)(scheme - m->serverURIs[current]) + 3 : 0;
+	int default_port = MQTT_DEFAULT_PORT;
+	int i;
+
+	FUNC_ENTRY;
+	if (m->c->net.http_proxy
+#if defined(OPENSSL)
+			|| m->c->net.https_proxy
+#endif
+			)
+		goto exit; /* the TCP connect is to the proxy */
+	if (m->websocket)
+		default_port = WS_DEFAULT_PORT;
+#if defined(OPENSSL)
+	else if (m->ssl)
+		default_port = SECURE_MQTT_DEFAULT_PORT;
+#endif
+	for (i = current + 1; i < m->serverURIcount; ++i)
+	{
+		const char* address = m->serverURIs[i];
+		size_t addr_len;
+		int port;
+
+		if (strncmp(address, m->serverURIs[current], scheme_len) != 0 ||
+				(scheme_len == 0 && strstr(address, "://") != NULL))
+			break;
+		address += scheme_len;
+		addr_len = MQTTProtocol_addressPort(address, &port, NULL, default_port);
+		if (Socket_addRaceTarget(m->c->net.socket, address, addr_len, port, i, &m->c->sockopts) != 0)
+			break;
+		Log(TRACE_PROTOCOL, -1, "Racing connect to serverURI %s", m->serverURIs[i]);
+	}
+exit:
+	FUNC_EXIT;
+}
+
+
+static int MQTTAsync_connecting(MQTTAsyncs* m)
+{
+	int rc = -1;
+	char* serverURI = m->serverURI;
+#if defined(OPENSSL)
+	int default_port = MQTT_DEFAULT_PORT;
+#endif
+
+	FUNC_ENTRY;
+	if (m->c->connect_state == TCP_IN_PROGRESS && m->serverURIcount > 0)
+	{
+		/* if the serverURIs were raced, carry on with the one which connected */
+		int winner = Socket_raceResult(m->c->net.socket);
+
+		if (winner > m->connect.details.conn.currentURI && winner < m->serverURIcount)
+		{
+			Log(TRACE_PROTOCOL, -1, "Connected to serverURI %s", m->serverURIs[winner]);
+			m->connect.details.conn.currentURI = winner;
+		}
+	}
+	if (m->serverURIcount > 0)
+	{
+		serverURI = m->serverURIs[m->connect.details.conn.currentURI];
+
+		/* skip URI scheme */
+		if (strncmp(URI_TCP, serverURI, strlen(URI_TCP)) == 0)
+			serverURI += strlen(URI_TCP);
+		else if (strncmp(URI_WS, serverURI, strlen(URI_WS)) == 0)
+		{
+			serverURI += strlen(URI_WS);
+#if defined(OPENSSL)
+			default_port = WS_DEFAULT_PORT;
+#endif
+		}
+#if defined(OPENSSL)
+		else if (strncmp(URI_SSL, serverURI, strlen(URI_SSL)) == 0)
+		{
+			serverURI += strlen(URI_SSL);
+			default_port = SECURE_MQTT_DEFAULT_PORT;
+		}
+		else if (strncmp(URI_WSS, serverURI, strlen(URI_WSS)) == 0)
+		{
+			serverURI += strlen(URI_WSS);
+			default_port = WS_DEFAULT_PORT;
+		}
+#endif
+	}
+
+	if (m->c->connect_state == TCP_IN_PROGRESS) /* TCP connect started - check for completion */
+	{
+		int error;
+		socklen_t len = sizeof(error);
+
+		if ((rc = getsockopt(m->c->net.socket, SOL_SOCKET, SO_ERROR, (char*)&error, &len)) == 0)
+			rc = error;
+
+		if (rc != 0)
+			goto exit;
+
+		Socket_clearPendingWrite(m->c->net.socket);
+
+#if defined(OPENSSL)
+		if (m->ssl)
+		{
+			int port;
+			size_t hostname_len;
+			int setSocketForSSLrc = 0;
+
+			if (m->websocket && m->c->net.https_proxy) {
+				m->c->connect_state = PROXY_CONNECT_IN_PROGRESS;
+				if ((rc = WebSocket_proxy_connect( &m->c->net, 1, serverURI)) == SOCKET_ERROR )
+					goto exit;
+			}
+
+			hostname_len = MQTTProtocol_addressPort(serverURI, &port, NULL, default_port);
+			setSocketForSSLrc = SSLSocket_setSocketForSSL(m->c, serverURI, hostname_len);
+
+			if (setSocketForSSLrc != MQTTASYNC_SUCCESS)
+			{
+				rc = m->c->sslopts->struct_version >= 3 ?
+					SSLSocket_connect(m->c->net.ssl, m->c->net.socket, serverURI,
+						m->c->sslopts->verify, m->c->sslopts->ssl_error_cb, m->c->sslopts->ssl_error_context) :
+					SSLSocket_connect(m->c->net.ssl, m->c->net.socket, serverURI,
+						m->c->sslopts->verify, NULL, NULL);
 				if (rc == TCPSOCKET_INTERRUPTED)
 				{
 					rc = MQTTCLIENT_SUCCESS; /* the connect is still in progress */
@@ -2851,8 +4991,6 @@ static int MQTTAsync_connecting(MQTTAsyncs* m)
 							goto exit;
 						}
 					}
-					if (!m->c->cleansession && m->c->session == NULL)
-						m->c->session = SSL_get1_session(m->c->net.ssl);
 				}
 			}
 			else
@@ -2890,6 +5028,11 @@ static int MQTTAsync_connecting(MQTTAsyncs* m)
 #if defined(OPENSSL)
 	else if (m->c->connect_state == SSL_IN_PROGRESS) /* SSL connect sent - wait for completion */
 	{
+		if (handshake_threads > 0 && !SSL_is_init_finished(m->c->net.ssl))
+		{
+			rc = MQTTAsync_startHandshake(m->c);
+			goto exit;
+		}
 		rc = m->c->sslopts->struct_version >= 3 ?
 			SSLSocket_connect(m->c->net.ssl, m->c->net.socket, serverURI,
 				m->c->sslopts->verify, m->c->sslopts->ssl_error_cb, m->c->sslopts->ssl_error_context) :
@@ -2898,9 +5041,6 @@ static int MQTTAsync_connecting(MQTTAsyncs* m)
 		if (rc != 1)
 			goto exit;
 
-		if(!m->c->cleansession && m->c->session == NULL)
-			m->c->session = SSL_get1_session(m->c->net.ssl);
-
 		if ( m->websocket )
 		{
 			m->c->connect_state = WEBSOCKET_IN_PROGRESS;
@@ -2937,7 +5077,7 @@ exit:
 }
 
 
-static MQTTPacket* MQTTAsync_cycle(int* sock, unsigned long timeout, int* rc)
+static MQTTPacket* MQTTAsync_cycle(MQTTAsync_reactor* r, int* sock, unsigned long timeout, int* rc)
 {
 	struct timeval tp = {0L, 0L};
 	MQTTPacket* pack = NULL;
@@ -2955,19 +5095,19 @@ static MQTTPacket* MQTTAsync_cycle(int* sock, unsigned long timeout, int* rc)
 	{
 #endif
 		/* 0 from getReadySocket indicates no work to do, rc -1 == error */
-		*sock = Socket_getReadySocket(0, &tp,socket_mutex, &rc1);
+		*sock = Socket_getReadySocket(0, &tp, r->socket_mutex, &rc1);
 		*rc = rc1;
 		if (!MQTTAsync_tostop && *sock == 0 && (tp.tv_sec > 0L || tp.tv_usec > 0L))
 			MQTTAsync_sleep(100L);
 #if defined(OPENSSL)
 	}
 #endif
-	MQTTAsync_lock_mutex(mqttasync_mutex);
+	MQTTAsync_lockReactorIdle(r);
 	if (*sock > 0 && rc1 == 0)
 	{
 		MQTTAsyncs* m = NULL;
-		if (ListFindItem(MQTTAsync_handles, sock, clientSockCompare) != NULL)
-			m = (MQTTAsync)(MQTTAsync_handles->current->content);
+		if (ListFindItem(r->handles, sock, clientSockCompare) != NULL)
+			m = (MQTTAsync)(r->handles->current->content);
 		if (m != NULL)
 		{
 			Log(TRACE_MINIMUM, -1, "m->c->connect_state = %d", m->c->connect_state);
@@ -2994,12 +5134,13 @@ static MQTTPacket* MQTTAsync_cycle(int* sock, unsigned long timeout, int* rc)
 				int msgid = 0,
 					msgtype = 0,
 					ackrc = 0,
-					mqttversion = 0;
+					mqttversion = 0,
+					retried = 0;
 				MQTTProperties msgprops = MQTTProperties_initializer;
 
 				/* This block is so that the ack variable is local and isn't accidentally reused */
 				{
-					static Ack ack;
+					Ack ack;
 					ack = *(Ack*)pack;
 					/* these values are stored because the packet structure is freed in the handle functions */
 					msgid = ack.msgId;
@@ -3011,6 +5152,12 @@ static MQTTPacket* MQTTAsync_cycle(int* sock, unsigned long timeout, int* rc)
 						mqttversion = ack.MQTTVersion;
 					}
 				}
+				if (m)
+				{
+					ListElement* found = ListFindItem(m->c->outboundMsgs, &msgid, messageIDCompare);
+
+					retried = (found) ? ((Messages*)(found->content))->retried : 0;
+				}
 
 				if (pack->header.bits.type == PUBCOMP)
 					*rc = MQTTProtocol_handlePubcomps(pack, *sock);
@@ -3023,62 +5170,23 @@ static MQTTPacket* MQTTAsync_cycle(int* sock, unsigned long timeout, int* rc)
 				if (m && (msgtype != PUBREC || ackrc >= MQTTREASONCODE_UNSPECIFIED_ERROR))
 				{
 					ListElement* current = NULL;
+					MQTTAsync_queuedCommand* command = NULL;
 
-					if (m->dc)
-					{
-						Log(TRACE_MIN, -1, "Calling deliveryComplete for client %s, msgid %d", m->c->clientID, msgid);
-						(*(m->dc))(m->dcContext, msgid);
-					}
 					/* use the msgid to find the callback to be called */
 					while (ListNextElement(m->responses, &current))
 					{
-						MQTTAsync_queuedCommand* command = (MQTTAsync_queuedCommand*)(current->content);
-						if (command->command.token == msgid)
+						if (((MQTTAsync_queuedCommand*)(current->content))->command.token == msgid)
 						{
+							command = (MQTTAsync_queuedCommand*)(current->content);
 							if (!ListDetach(m->responses, command)) /* then remove the response from the list */
 								Log(LOG_ERROR, -1, "Publish command not removed from command list");
-							if (command->command.onSuccess)
-							{
-								MQTTAsync_successData data;
-
-								data.token = command->command.token;
-								data.alt.pub.destinationName = command->command.details.pub.destinationName;
-								data.alt.pub.message.payload = command->command.details.pub.payload;
-								data.alt.pub.message.payloadlen = command->command.details.pub.payloadlen;
-								data.alt.pub.message.qos = command->command.details.pub.qos;
-								data.alt.pub.message.retained = command->command.details.pub.retained;
-								Log(TRACE_MIN, -1, "Calling publish success for client %s", m->c->clientID);
-								(*(command->command.onSuccess))(command->command.context, &data);
-							}
-							else if (command->command.onSuccess5 && ackrc < MQTTREASONCODE_UNSPECIFIED_ERROR)
-							{
-								MQTTAsync_successData5 data = MQTTAsync_successData5_initializer;
-
-								data.token = command->command.token;
-								data.alt.pub.destinationName = command->command.details.pub.destinationName;
-								data.alt.pub.message.payload = command->command.details.pub.payload;
-								data.alt.pub.message.payloadlen = command->command.details.pub.payloadlen;
-								data.alt.pub.message.qos = command->command.details.pub.qos;
-								data.alt.pub.message.retained = command->command.details.pub.retained;
-								data.properties = command->command.properties;
-								Log(TRACE_MIN, -1, "Calling publish success for client %s", m->c->clientID);
-								(*(command->command.onSuccess5))(command->command.context, &data);
-							}
-							else if (command->command.onFailure5 && ackrc >= MQTTREASONCODE_UNSPECIFIED_ERROR)
-							{
-								MQTTAsync_failureData5 data = MQTTAsync_failureData5_initializer;
-
-								data.token = command->command.token;
-								data.reasonCode = ackrc;
-								data.properties = msgprops;
-								data.packet_type = pack->header.bits.type;
-								Log(TRACE_MIN, -1, "Calling publish failure for client %s", m->c->clientID);
-								(*(command->command.onFailure5))(command->command.context, &data);
-							}
-							MQTTAsync_freeCommand(command);
 							break;
 						}
 					}
+					if (command && msgtype != PUBREC)
+						MQTTAsync_sampleInflight(m, command, retried);
+					if (!MQTTAsync_dispatchPublishResponse(m, msgid, command, ackrc, &msgprops, msgtype))
+						MQTTAsync_callPublishResponse(m, m->dc, m->dcContext, msgid, command, ackrc, &msgprops, msgtype);
 					if (mqttversion >= MQTTVERSION_5)
 						MQTTProperties_free(&msgprops);
 				}
@@ -3093,8 +5201,8 @@ static MQTTPacket* MQTTAsync_cycle(int* sock, unsigned long timeout, int* rc)
 				pack = NULL;
 		}
 	}
-	MQTTAsync_retry();
-	MQTTAsync_unlock_mutex(mqttasync_mutex);
+	MQTTAsync_retry(r);
+	MQTTAsync_unlockReactor(r, NULL);
 	FUNC_EXIT_RC(*rc);
 	return pack;
 }
@@ -3104,8 +5212,8 @@ int MQTTAsync_getNoBufferedMessages(MQTTAsyncs* m)
 {
 	int count = 0;
 
-	MQTTAsync_lock_mutex(mqttcommand_mutex);
+	MQTTAsync_lock_mutex(m->reactor->command_mutex);
 	count = m->noBufferedMessages;
-	MQTTAsync_unlock_mutex(mqttcommand_mutex);
+	MQTTAsync_unlock_mutex(m->reactor->command_mutex);
 	return count;
 }
@@ -18,7 +18,9 @@
 #define MQTTASYNCUTILS_H_
 
 #include "MQTTPacket.h"
+#include "MQTTProtocol.h"
 #include "Thread.h"
+#include "Tree.h"
 
 #define URI_TCP "tcp://"
 #define URI_WS  "ws://"
@@ -37,6 +39,36 @@ typedef struct
 	unsigned int seqno; /* only used on restore */
 } qEntry;
 
+/**
+ * A publication prepared by MQTTAsync_preparePublish: the validated topic and the properties,
+ * both as a list and encoded as they are sent.  It is referred to by the application and by
+ * each publish command made from it, and freed when the last of them releases it.
+ */
+typedef struct
+{
+	volatile long refs;
+	struct MQTTAsync_struct* client; /**< the client it was prepared for */
+	char* topic;
+	int topiclen;
+	int qos;
+	int retained;
+	MQTTProperties properties;
+	char* encodedProperties; /**< the length and properties, as written in the packet */
+	int encodedPropertiesLen;
+} MQTTAsync_preparedPublish;
+
+/**
+ * A topic alias assigned by the client, in the list of those in use from the most to the
+ * least recently used.
+ */
+typedef struct MQTTAsync_topicAlias_struct
+{
+	struct MQTTAsync_topicAlias_struct* newer;
+	struct MQTTAsync_topicAlias_struct* older;
+	int alias;
+	char* topic; /**< held after the structure */
+} MQTTAsync_topicAlias;
+
 typedef struct
 {
 	int type;
@@ -47,6 +79,7 @@ typedef struct
 	MQTTAsync_token token;
 	void* context;
 	START_TIME_TYPE start_time;
+	int priority; /**< commands of a higher priority are sent first, see MQTTASYNC_PRIORITY_NORMAL */
 	MQTTProperties properties;
 	union
 	{
@@ -70,6 +103,7 @@ typedef struct
 			void* payload;
 			int qos;
 			int retained;
+			MQTTAsync_preparedPublish* prepared; /**< the prepared publication sent, if any */
 		} pub;
 		struct
 		{
@@ -85,9 +119,39 @@ typedef struct
 	} details;
 } MQTTAsync_command;
 
+/**
+ * A reactor: a send and a receive thread serving a share of the clients, with the socket set,
+ * timers and command queue of those clients.  Clients on different reactors are served in
+ * parallel.
+ */
+typedef struct
+{
+	int index;                 /**< the index of the reactor's socket data */
+	mutex_type mutex;          /**< protects the state of the reactor's clients */
+	mutex_type command_mutex;  /**< protects the command queue */
+	mutex_type socket_mutex;   /**< protects the socket set */
+#if defined(_WIN32) || defined(_WIN64)
+	sem_type send_sem;
+#else
+	cond_type send_cond;
+#endif
+	List* handles;             /**< the clients assigned to the reactor */
+	List* commands;            /**< the commands queued for those clients */
+	enum MQTTAsync_threadStates sendThread_state;
+	enum MQTTAsync_threadStates receiveThread_state;
+	START_TIME_TYPE last_timeouts; /**< when the timeouts of the clients were last checked */
+	START_TIME_TYPE last_retry;    /**< when keepalives were last checked */
+	ClientStates* states;      /**< the clients' protocol states */
+	MQTTProtocol* protocol;    /**< the publications and pending writes of the clients */
+	volatile int callbacks_done; /**< the callback workers have caught up with a client whose messages were held back */
+	int inbound_paused;        /**< the number of clients whose socket reads are paused */
+	int lent;                  /**< threads which released the mutex to work on another reactor, and will take it back */
+} MQTTAsync_reactor;
+
 typedef struct MQTTAsync_struct
 {
 	char* serverURI;
+	MQTTAsync_reactor* reactor; /* the reactor whose threads serve this client */
 	int ssl;
 	int websocket;
 	Clients* c;
@@ -124,6 +188,7 @@ typedef struct MQTTAsync_struct
 	MQTTAsync_createOptions* createOptions;
 	int shouldBeConnected;
 	int noBufferedMessages; /* the current number of buffered (publish) messages for this client */
+	size_t cachedPayloadBytes; /* bytes of persisted, buffered publish commands also held in memory */
 
 	/* added for automatic reconnect */
 	int automaticReconnect;
@@ -131,8 +196,36 @@ typedef struct MQTTAsync_struct
 	int maxRetryInterval;
 	int serverURIcount;
 	char** serverURIs;
+	int raceServerURIs; /* connect to the serverURIs in parallel */
+	int dnsPending; /* the connect is waiting for the server's name to be looked up */
 	int connectTimeout;
 
+	/* added for the callback workers */
+	int callbacksQueued; /* the messages handed to the callback workers and not yet delivered */
+	int callbacksHeld;   /* messages are waiting in the queue for the workers to catch up */
+	int callbacksClosed; /* no more callbacks are to be handed to the workers, as the client is being destroyed */
+
+	/* added for inbound flow control */
+	size_t inboundBytes;        /* the bytes of the messages in the queue of undelivered messages */
+	int inboundCounted;         /* the messages of the client counted in the totals over all clients */
+	size_t inboundCountedBytes; /* the bytes of the client counted in the totals over all clients */
+	int inboundPaused;          /* reads from the socket are paused until the queue drains */
+
+	/* added for the adaptive inflight window */
+	int adaptiveInflight;  /* adapt the inflight window to the round trip times of the acks */
+	int inflightWindow;    /* the current limit on the QoS 1 and 2 messages in flight */
+	int inflightSlowStart; /* the window doubles each round, until it is first cut */
+	int inflightAcks;      /* the acks since the window was last changed */
+	int inflightMinRTT;    /* the lowest ack round trip time on the connection in milliseconds, -1 for none */
+	int inflightSRTT8;     /* the smoothed ack round trip time in milliseconds, times 8 */
+
+	/* added for automatic topic aliases */
+	int topicAliasMaximum;             /* the most aliases which can be assigned on the current connection */
+	Tree* topicAliases;                /* the aliases assigned on the current connection, by topic */
+	MQTTAsync_topicAlias* newestAlias; /* the alias most recently used */
+	MQTTAsync_topicAlias* oldestAlias; /* the alias least recently used, given to the next new topic */
+	long topicAliasBytesSaved;         /* the bytes of topic not sent, less those of the aliases */
+
 	int currentInterval;
 	int currentIntervalBase;
 	START_TIME_TYPE lastConnectionFailedTime;
@@ -152,10 +245,24 @@ typedef struct
 	unsigned int seqno; /* only used on restore */
 	int not_restored;
 	char* key; /* if not_restored, this holds the key */
+	size_t cached_len; /* bytes counted in the client's cachedPayloadBytes, if persisted but kept in memory */
 } MQTTAsync_queuedCommand;
 
 void MQTTAsync_lock_mutex(mutex_type amutex);
 void MQTTAsync_unlock_mutex(mutex_type amutex);
+MQTTAsync_reactor* MQTTAsync_lockReactor(MQTTAsync_reactor* r);
+void MQTTAsync_unlockReactor(MQTTAsync_reactor* r, MQTTAsync_reactor* previous);
+MQTTAsync_reactor* MQTTAsync_lockClient(MQTTAsyncs* m);
+void MQTTAsync_unlockClient(MQTTAsyncs* m, MQTTAsync_reactor* previous);
+MQTTAsync_reactor* MQTTAsync_lockGlobal(void);
+void MQTTAsync_unlockGlobal(MQTTAsync_reactor* previous);
+int MQTTAsync_lockReactorUnlent(MQTTAsync_reactor* r);
+void MQTTAsync_unlockReactorUnlent(MQTTAsync_reactor* r, int own);
+void MQTTAsync_setReactorThreads(int count);
+int MQTTAsync_createReactors(ClientStates* states, MQTTProtocol* protocol);
+MQTTAsync_reactor* MQTTAsync_assignReactor(int reactor);
+int MQTTAsync_getHandleCount(void);
+void MQTTAsync_startThreads(MQTTAsync_reactor* r);
 void MQTTAsync_terminate(void);
 #if !defined(NO_PERSISTENCE)
 int MQTTAsync_restoreCommands(MQTTAsyncs* client);
@@ -164,13 +271,26 @@ int MQTTAsync_addCommand(MQTTAsync_queuedCommand* command, int command_size);
 void MQTTAsync_emptyMessageQueue(Clients* client);
 void MQTTAsync_freeResponses(MQTTAsyncs* m);
 void MQTTAsync_freeCommands(MQTTAsyncs* m);
+void MQTTAsync_releasePrepared(MQTTAsync_preparedPublish* prepared);
+void MQTTAsync_freeTopicAliases(MQTTAsyncs* m);
 int MQTTAsync_unpersistCommandsAndMessages(Clients* c);
 void MQTTAsync_closeSession(Clients* client, enum MQTTReasonCodes reasonCode, MQTTProperties* props);
 int MQTTAsync_disconnect1(MQTTAsync handle, const MQTTAsync_disconnectOptions* options, int internal);
+int MQTTAsync_createOnReactor(MQTTAsync* handle, const char* serverURI, const char* clientId,
+		int persistence_type, void* persistence_context, MQTTAsync_createOptions* options, int reactor);
 int MQTTAsync_assignMsgId(MQTTAsyncs* m);
 int MQTTAsync_getNoBufferedMessages(MQTTAsyncs* m);
 void MQTTAsync_writeComplete(int socket, int rc);
 void setRetryLoopInterval(int keepalive);
+void MQTTAsync_dnsResolved(void);
+void MQTTAsync_setCallbackThreads(int count, int queue_limit);
+void MQTTAsync_cancelCallbacks(MQTTAsyncs* m);
+void MQTTAsync_setInboundLimits(int messages, int bytes);
+void MQTTAsync_countInbound(MQTTAsyncs* m);
+int MQTTAsync_inflightLimit(MQTTAsyncs* m);
+#if defined(OPENSSL)
+void MQTTAsync_setHandshakeThreads(int count);
+#endif
 
 #if defined(_WIN32) || defined(_WIN64)
 #else
@@ -100,9 +100,10 @@ static ClientStates ClientState =
 	NULL /* client list */
 };
 
-ClientStates* bstate = &ClientState;
+THREAD_LOCAL ClientStates* bstate = &ClientState;
 
-MQTTProtocol state;
+static MQTTProtocol protocol_state;
+THREAD_LOCAL MQTTProtocol* state = &protocol_state;
 
 #if defined(_WIN32) || defined(_WIN64)
 static mutex_type mqttclient_mutex = NULL;
@@ -115,6 +116,8 @@ extern mutex_type stack_mutex;
 extern mutex_type heap_mutex;
 #endif
 extern mutex_type log_mutex;
+extern mutex_type resolver_mutex;
+extern mutex_type deferred_mutex;
 
 int MQTTClient_init(void)
 {
@@ -172,6 +175,18 @@ int MQTTClient_init(void)
 			printf("socket_mutex error %d\n", rc);
 			goto exit;
 		}
+		if ((resolver_mutex = CreateMutex(NULL, 0, NULL)) == NULL)
+		{
+			rc = GetLastError();
+			printf("resolver_mutex error %d\n", rc);
+			goto exit;
+		}
+		if ((deferred_mutex = CreateMutex(NULL, 0, NULL)) == NULL)
+		{
+			rc = GetLastError();
+			printf("deferred_mutex error %d\n", rc);
+			goto exit;
+		}
 	}
 exit:
 	return rc;
@@ -195,6 +210,10 @@ void MQTTClient_cleanup(void)
 		CloseHandle(log_mutex);
 	if (socket_mutex)
 		CloseHandle(socket_mutex);
+	if (resolver_mutex)
+		CloseHandle(resolver_mutex);
+	if (deferred_mutex)
+		CloseHandle(deferred_mutex);
 	if (mqttclient_mutex)
 		CloseHandle(mqttclient_mutex);
 }
@@ -392,7 +411,8 @@ int MQTTClient_createWithOptions(MQTTClient* handle, const char* serverURI, cons
 		goto exit;
 	}
 
-	if (strlen(clientId) == 0 && persistence_type == MQTTCLIENT_PERSISTENCE_DEFAULT)
+	if (strlen(clientId) == 0 && (persistence_type == MQTTCLIENT_PERSISTENCE_DEFAULT ||
+		persistence_type == MQTTCLIENT_PERSISTENCE_RING))
 	{
 		rc = MQTTCLIENT_PERSISTENCE_ERROR;
 		goto exit;
@@ -405,6 +425,9 @@ int MQTTClient_createWithOptions(MQTTClient* handle, const char* serverURI, cons
 #if defined(OPENSSL)
             && strncmp(URI_SSL, serverURI, strlen(URI_SSL)) != 0
 		 && strncmp(URI_WSS, serverURI, strlen(URI_WSS)) != 0
+#endif
+#if defined(UNIXSOCK)
+		 && strncmp(URI_UNIX, serverURI, strlen(URI_UNIX)) != 0
 #endif
 			)
 		{
@@ -959,8 +982,6 @@ static thread_return_type WINAPI MQTTClient_run(void* n)
 						m->c->sslopts->verify, NULL, NULL);
 				if (rc == 1 || rc == SSL_FATAL)
 				{
-					if (rc == 1 && (m->c->cleansession == 0 && m->c->cleanstart == 0) && m->c->session == NULL)
-						m->c->session = SSL_get1_session(m->c->net.ssl);
 					m->rc = rc;
 					Log(TRACE_MIN, -1, "Posting connect semaphore for SSL client %s rc %d", m->c->clientID, m->rc);
 					m->c->connect_state = NOT_IN_PROGRESS;
@@ -1073,8 +1094,6 @@ static void MQTTClient_closeSession(Clients* client, enum MQTTReasonCodes reason
 		WebSocket_close(&client->net, WebSocket_CLOSE_NORMAL, NULL);
 
 #if defined(OPENSSL)
-		SSL_SESSION_free(client->session); /* is a no-op if session is NULL */
-		client->session = NULL; /* show the session has been freed */
 		SSLSocket_close(&client->net);
 #endif
 		Socket_close(client->net.socket);
@@ -1238,14 +1257,10 @@ static MQTTResponse MQTTClient_connectURIVersion(MQTTClient handle, MQTTClient_c
 			}
 
 			hostname_len = MQTTProtocol_addressPort(serverURI, &port1, &topic, MQTT_DEFAULT_PORT);
-			setSocketForSSLrc = SSLSocket_setSocketForSSL(&m->c->net, m->c->sslopts,
-				serverURI, hostname_len);
+			setSocketForSSLrc = SSLSocket_setSocketForSSL(m->c, serverURI, hostname_len);
 
 			if (setSocketForSSLrc != MQTTCLIENT_SUCCESS)
 			{
-				if (m->c->session != NULL)
-					if ((rc = SSL_set_session(m->c->net.ssl, m->c->session)) != 1)
-						Log(TRACE_MIN, -1, "Failed to set SSL session with stored data, non critical");
 				rc = m->c->sslopts->struct_version >= 3 ?
 					SSLSocket_connect(m->c->net.ssl, m->c->net.socket, serverURI,
 						m->c->sslopts->verify, m->c->sslopts->ssl_error_cb, m->c->sslopts->ssl_error_context) :
@@ -1276,8 +1291,6 @@ static MQTTResponse MQTTClient_connectURIVersion(MQTTClient handle, MQTTClient_c
 							rc = SOCKET_ERROR;
 							goto exit;
 						}
-						if ((m->c->cleansession == 0 && m->c->cleanstart == 0) && m->c->session == NULL)
-							m->c->session = SSL_get1_session(m->c->net.ssl);
 					}
 				}
 			}
@@ -1325,8 +1338,6 @@ static MQTTResponse MQTTClient_connectURIVersion(MQTTClient handle, MQTTClient_c
 			rc = SOCKET_ERROR;
 			goto exit;
 		}
-		if((m->c->cleansession == 0 && m->c->cleanstart == 0) && m->c->session == NULL)
-			m->c->session = SSL_get1_session(m->c->net.ssl);
 
 		if ( m->websocket )
 		{
@@ -1487,6 +1498,25 @@ static MQTTResponse MQTTClient_connectURI(MQTTClient handle, MQTTClient_connectO
 		if (options->httpsProxy)
 			m->c->httpsProxy = MQTTStrdup(options->httpsProxy);
 	}
+	memset(&m->c->sockopts, '\0', sizeof(m->c->sockopts));
+	if (options->struct_version >= 9 && options->socketOptions)
+	{
+		m->c->sockopts.noDelay = options->socketOptions->noDelay;
+		m->c->sockopts.sendBufferSize = options->socketOptions->sendBufferSize;
+		m->c->sockopts.receiveBufferSize = options->socketOptions->receiveBufferSize;
+		m->c->sockopts.userTimeout = options->socketOptions->userTimeout;
+		m->c->sockopts.busyPoll = options->socketOptions->busyPoll;
+		m->c->sockopts.quickAck = options->socketOptions->quickAck;
+		m->c->sockopts.tos = options->socketOptions->tos;
+		m->c->sockopts.priority = options->socketOptions->priority;
+		if (options->socketOptions->struct_version >= 1)
+			m->c->sockopts.connectAttemptDelay = options->socketOptions->connectAttemptDelay;
+		if (options->socketOptions->struct_version >= 2)
+		{
+			m->c->sockopts.dnsCacheTTL = options->socketOptions->dnsCacheTTL;
+			m->c->sockopts.dnsNegativeTTL = options->socketOptions->dnsNegativeTTL;
+		}
+	}
 
 	if (m->c->will)
 	{
@@ -1601,6 +1631,10 @@ static MQTTResponse MQTTClient_connectURI(MQTTClient handle, MQTTClient_connectO
 		    m->c->sslopts->protos = options->ssl->protos;
 		    m->c->sslopts->protos_len = options->ssl->protos_len;
 		}
+		if (m->c->sslopts->struct_version >= 6)
+			m->c->sslopts->shareSessions = options->ssl->shareSessions;
+		if (m->c->sslopts->struct_version >= 7)
+			m->c->sslopts->enableKernelTLS = options->ssl->enableKernelTLS;
 	}
 #endif
 
@@ -1706,7 +1740,7 @@ MQTTResponse MQTTClient_connectAll(MQTTClient handle, MQTTClient_connectOptions*
 		goto exit;
 	}
 
-	if (strncmp(options->struct_id, "MQTC", 4) != 0 || options->struct_version < 0 || options->struct_version > 8)
+	if (strncmp(options->struct_id, "MQTC", 4) != 0 || options->struct_version < 0 || options->struct_version > 9)
 	{
 		rc.reasonCode = MQTTCLIENT_BAD_STRUCTURE;
 		goto exit;
@@ -1747,7 +1781,7 @@ MQTTResponse MQTTClient_connectAll(MQTTClient handle, MQTTClient_connectOptions*
 #if defined(OPENSSL)
 	if (options->struct_version != 0 && options->ssl) /* check validity of SSL options structure */
 	{
-		if (strncmp(options->ssl->struct_id, "MQTS", 4) != 0 || options->ssl->struct_version < 0 || options->ssl->struct_version > 5)
+		if (strncmp(options->ssl->struct_id, "MQTS", 4) != 0 || options->ssl->struct_version < 0 || options->ssl->struct_version > 7)
 		{
 			rc.reasonCode = MQTTCLIENT_BAD_STRUCTURE;
 			goto exit;
@@ -1755,6 +1789,16 @@ MQTTResponse MQTTClient_connectAll(MQTTClient handle, MQTTClient_connectOptions*
 	}
 #endif
 
+	if (options->struct_version >= 9 && options->socketOptions) /* check validity of socket options structure */
+	{
+		if (strncmp(options->socketOptions->struct_id, "MQSO", 4) != 0 ||
+				options->socketOptions->struct_version < 0 || options->socketOptions->struct_version > 2)
+		{
+			rc.reasonCode = MQTTCLIENT_BAD_STRUCTURE;
+			goto exit;
+		}
+	}
+
 	if ((options->username && !UTF8_validateString(options->username)) ||
 		(options->password && !UTF8_validateString(options->password)))
 	{
@@ -2312,6 +2356,8 @@ MQTTResponse MQTTClient_publish5(MQTTClient handle, const char* topicName, int p
 		goto exit_and_free;
 	}
 	memset(p->mask, '\0', sizeof(p->mask));
+	p->encodedProperties = NULL;
+	p->topicAlias = p->topicAliased = 0;
 	p->payload = NULL;
 	p->payloadlen = payloadlen;
 	if (payloadlen > 0)
@@ -2640,11 +2686,7 @@ static MQTTPacket* MQTTClient_waitfor(MQTTClient handle, int packet_type, int* r
 					if (*rc == SSL_FATAL)
 						break;
 					else if (*rc == 1) /* rc == 1 means SSL connect has finished and succeeded */
-					{
-						if ((m->c->cleansession == 0 && m->c->cleanstart == 0) && m->c->session == NULL)
-							m->c->session = SSL_get1_session(m->c->net.ssl);
 						break;
-					}
 				}
 #endif
 				else if (m->c->connect_state == WEBSOCKET_IN_PROGRESS )
@@ -2986,20 +3028,20 @@ const char* MQTTClient_strerror(int code)
 static void MQTTProtocol_checkPendingWrites(void)
 {
 	FUNC_ENTRY;
-	if (state.pending_writes.count > 0)
+	if (state->pending_writes.count > 0)
 	{
-		ListElement* le = state.pending_writes.first;
+		ListElement* le = state->pending_writes.first;
 		while (le)
 		{
 			if (Socket_noPendingWrites(((pending_write*)(le->content))->socket))
 			{
 				MQTTProtocol_removePublication(((pending_write*)(le->content))->p);
-				state.pending_writes.current = le;
-				ListRemove(&(state.pending_writes), le->content); /* does NextElement itself */
-				le = state.pending_writes.current;
+				state->pending_writes.current = le;
+				ListRemove(&(state->pending_writes), le->content); /* does NextElement itself */
+				le = state->pending_writes.current;
 			}
 			else
-				ListNextElement(&(state.pending_writes), &le);
+				ListNextElement(&(state->pending_writes), &le);
 		}
 	}
 	FUNC_EXIT;
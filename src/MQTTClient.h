@@ -179,7 +179,7 @@
   */
  #define MQTTCLIENT_BAD_MQTT_VERSION -11
 /**
- * Return code: protocol prefix in serverURI should be tcp://, ssl://, ws:// or wss://
+ * Return code: protocol prefix in serverURI should be tcp://, ssl://, ws://, wss:// or unix://
  * The TLS enabled prefixes (ssl, wss) are only valid if a TLS version of the library
  * is linked with.
  */
@@ -501,6 +501,9 @@ LIBMQTT_API int MQTTClient_setPublished(MQTTClient handle, void* context, MQTTCl
  * specify either an IP address or a host name. For instance, to connect to
  * a server running on the local machines with the default MQTT port, specify
  * <i>tcp://localhost:1883</i>.
+ * A server on the same machine can also be reached through a Unix domain socket
+ * (not on Windows), with <i>unix:///path/to/socket</i>.  On Linux,
+ * <i>unix://@name</i> names a socket in the abstract namespace.
  * @param clientId The client identifier passed to the server when the
  * client connects to it. It is a null-terminated UTF-8 encoded string.
  * @param persistence_type The type of persistence to be used by the client:
@@ -515,6 +518,9 @@ LIBMQTT_API int MQTTClient_setPublished(MQTTClient handle, void* context, MQTTCl
  * storage and provides some protection against message loss in the case of
  * unexpected failure.
  * <br>
+ * ::MQTTCLIENT_PERSISTENCE_RING: Use a single preallocated, memory-mapped file
+ * per client, which holds the persisted data in a ring buffer of fixed size.
+ * <br>
  * ::MQTTCLIENT_PERSISTENCE_USER: Use an application-specific persistence
  * implementation. Using this type of persistence gives control of the
  * persistence mechanism to the application. The application has to implement
@@ -524,6 +530,8 @@ LIBMQTT_API int MQTTClient_setPublished(MQTTClient handle, void* context, MQTTCl
  * be set to NULL. For ::MQTTCLIENT_PERSISTENCE_DEFAULT persistence, it
  * should be set to the location of the persistence directory (if set
  * to NULL, the persistence directory used is the working directory).
+ * For ::MQTTCLIENT_PERSISTENCE_RING persistence, it must point to a valid
+ * MQTTClient_ringPersistenceOptions structure.
  * Applications that use ::MQTTCLIENT_PERSISTENCE_USER persistence set this
  * argument to point to a valid MQTTClient_persistence structure.
  * @return ::MQTTCLIENT_SUCCESS if the client is successfully created, otherwise
@@ -564,6 +572,9 @@ typedef struct
  * specify either an IP address or a host name. For instance, to connect to
  * a server running on the local machines with the default MQTT port, specify
  * <i>tcp://localhost:1883</i>.
+ * A server on the same machine can also be reached through a Unix domain socket
+ * (not on Windows), with <i>unix:///path/to/socket</i>.  On Linux,
+ * <i>unix://@name</i> names a socket in the abstract namespace.
  * @param clientId The client identifier passed to the server when the
  * client connects to it. It is a null-terminated UTF-8 encoded string.
  * @param persistence_type The type of persistence to be used by the client:
@@ -578,6 +589,9 @@ typedef struct
  * storage and provides some protection against message loss in the case of
  * unexpected failure.
  * <br>
+ * ::MQTTCLIENT_PERSISTENCE_RING: Use a single preallocated, memory-mapped file
+ * per client, which holds the persisted data in a ring buffer of fixed size.
+ * <br>
  * ::MQTTCLIENT_PERSISTENCE_USER: Use an application-specific persistence
  * implementation. Using this type of persistence gives control of the
  * persistence mechanism to the application. The application has to implement
@@ -587,6 +601,8 @@ typedef struct
  * be set to NULL. For ::MQTTCLIENT_PERSISTENCE_DEFAULT persistence, it
  * should be set to the location of the persistence directory (if set
  * to NULL, the persistence directory used is the working directory).
+ * For ::MQTTCLIENT_PERSISTENCE_RING persistence, it must point to a valid
+ * MQTTClient_ringPersistenceOptions structure.
  * Applications that use ::MQTTCLIENT_PERSISTENCE_USER persistence set this
  * argument to point to a valid MQTTClient_persistence structure.
  * @param options additional options for the create.
@@ -661,12 +677,14 @@ typedef struct
 	/** The eyecatcher for this structure.  Must be MQTS */
 	char struct_id[4];
 
-	/** The version number of this structure. Must be 0, 1, 2, 3, 4 or 5.
+	/** The version number of this structure. Must be 0, 1, 2, 3, 4, 5, 6 or 7.
 	 * 0 means no sslVersion
 	 * 1 means no verify, CApath
 	 * 2 means no ssl_error_context, ssl_error_cb
 	 * 3 means no ssl_psk_cb, ssl_psk_context, disableDefaultTrustStore
 	 * 4 means no protos, protos_len
+	 * 5 means no shareSessions
+	 * 6 means no enableKernelTLS
 	 */
 	int struct_version;
 
@@ -765,9 +783,26 @@ typedef struct
 	 * Exists only if struct_version >= 5
 	 */
 	unsigned int protos_len;
+
+	/**
+	 * TLS sessions are always resumed when the client reconnects.  Set this to 1 to also
+	 * resume sessions established by other clients in this process which connect to the
+	 * same server with the same SSL options, saving a full handshake on their first connect.
+	 * Exists only if struct_version >= 6
+	 */
+	int shareSessions;
+
+	/**
+	 * Set this to 1 to hand encryption to the kernel (Linux kTLS) once the handshake is
+	 * complete, so that data is written straight from the message buffers.  This needs
+	 * OpenSSL 3 built with kTLS support and the kernel tls module.  If either is missing,
+	 * or the negotiated cipher is not supported by the kernel, OpenSSL is used as usual.
+	 * Exists only if struct_version >= 7
+	 */
+	int enableKernelTLS;
 } MQTTClient_SSLOptions;
 
-#define MQTTClient_SSLOptions_initializer { {'M', 'Q', 'T', 'S'}, 5, NULL, NULL, NULL, NULL, NULL, 1, MQTT_SSL_VERSION_DEFAULT, 0, NULL, NULL, NULL, NULL, NULL, 0, NULL, 0 }
+#define MQTTClient_SSLOptions_initializer { {'M', 'Q', 'T', 'S'}, 7, NULL, NULL, NULL, NULL, NULL, 1, MQTT_SSL_VERSION_DEFAULT, 0, NULL, NULL, NULL, NULL, NULL, 0, NULL, 0, 0, 0 }
 
 /**
   * MQTTClient_libraryInfo is used to store details relating to the currently used
@@ -789,6 +824,79 @@ typedef struct
   */
 LIBMQTT_API MQTTClient_nameValue* MQTTClient_getVersionInfo(void);
 
+/**
+ * MQTTClient_socketOptions sets options on the TCP socket before it is connected.  All the
+ * members default to 0, which leaves the operating system's setting in place.  An option
+ * which is not available on the platform is ignored, and an option the operating system
+ * refuses is logged, but does not stop the connect.
+ */
+typedef struct
+{
+	/** The eyecatcher for this structure.  Must be MQSO. */
+	char struct_id[4];
+	/** The version number of this structure.  Must be 0, 1 or 2.
+	 * 0 signifies no connectAttemptDelay
+	 * 1 signifies no dnsCacheTTL, dnsNegativeTTL or asyncDNS
+	 */
+	int struct_version;
+	/**
+	 * Set to 1 to disable Nagle's algorithm (TCP_NODELAY), so that small packets such as
+	 * acknowledgements and control messages are not held back behind earlier unacknowledged data.
+	 */
+	int noDelay;
+	/** The size of the socket send buffer in bytes (SO_SNDBUF) */
+	int sendBufferSize;
+	/** The size of the socket receive buffer in bytes (SO_RCVBUF) */
+	int receiveBufferSize;
+	/**
+	 * The time in milliseconds that sent data may remain unacknowledged before the
+	 * connection is closed (TCP_USER_TIMEOUT, Linux only).  This detects a dead connection
+	 * sooner than the keepalive interval when there is data outstanding.
+	 */
+	int userTimeout;
+	/** The time in microseconds to busy poll the device queue for incoming data (SO_BUSY_POLL, Linux only) */
+	int busyPoll;
+	/**
+	 * Set to 1 to send acknowledgements immediately rather than delaying them (TCP_QUICKACK,
+	 * Linux only).  This is best effort: the option is set once, when the socket is created,
+	 * and Linux may turn delayed acknowledgements back on later in the connection.
+	 */
+	int quickAck;
+	/**
+	 * The IP type of service byte (IP_TOS, or IPV6_TCLASS for IPv6).  The DSCP value goes in
+	 * the top six bits, so for example 0xB8 marks packets as expedited forwarding.
+	 */
+	int tos;
+	/** The priority of packets sent on the socket (SO_PRIORITY, Linux only) */
+	int priority;
+	/**
+	 * When a server's host name resolves to more than one address, and the connect to the
+	 * first has not completed after this many milliseconds, a connect to the next address is
+	 * started alongside it, and so on through the addresses.  The first address is the one
+	 * the system prefers, and after it the addresses alternate between IPv4 and IPv6
+	 * (RFC 8305 "Happy Eyeballs").  The first to connect is used and the others are
+	 * abandoned.  0 means the default of 250 milliseconds, -1 means only the first address
+	 * is tried.  Not available on Windows, where the first address is always used.
+	 */
+	int connectAttemptDelay;
+	/**
+	 * The number of seconds the addresses a server's host name resolves to are kept and
+	 * reused by later connects, by this client or any other in the process.  getaddrinfo
+	 * does not report the DNS record's own TTL, so this should be no longer than it.
+	 * 0 means the name is looked up on every connect.
+	 */
+	int dnsCacheTTL;
+	/** The number of seconds a failure to look a host name up is kept for, 0 for none */
+	int dnsNegativeTTL;
+	/**
+	 * Used by the MQTTAsync library only, where it looks the server's host name up on a
+	 * helper thread.  MQTTClient_connect always looks the name up itself.
+	 */
+	int asyncDNS;
+} MQTTClient_socketOptions;
+
+#define MQTTClient_socketOptions_initializer { {'M', 'Q', 'S', 'O'}, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 }
+
 /**
  * MQTTClient_connectOptions defines several settings that control the way the
  * client connects to an MQTT server.
@@ -807,7 +915,7 @@ typedef struct
 {
 	/** The eyecatcher for this structure.  must be MQTC. */
 	char struct_id[4];
-	/** The version number of this structure.  Must be 0, 1, 2, 3, 4, 5, 6, 7 or 8.
+	/** The version number of this structure.  Must be 0, 1, 2, 3, 4, 5, 6, 7, 8 or 9.
 	 * 0 signifies no SSL options and no serverURIs
 	 * 1 signifies no serverURIs
 	 * 2 signifies no MQTTVersion
@@ -816,6 +924,7 @@ typedef struct
 	 * 5 signifies no maxInflightMessages and cleanstart
 	 * 6 signifies no HTTP headers option
 	 * 7 signifies no HTTP proxy and HTTPS proxy options
+	 * 8 signifies no socket options
 	 */
 	int struct_version;
 	/** The "keep alive" interval, measured in seconds, defines the maximum time
@@ -902,7 +1011,7 @@ typedef struct
 	/**
    * An optional array of null-terminated strings specifying the servers to
    * which the client will connect. Each string takes the form <i>protocol://host:port</i>.
-   * <i>protocol</i> must be <i>tcp</i>, <i>ssl</i>, <i>ws</i> or <i>wss</i>.
+   * <i>protocol</i> must be <i>tcp</i>, <i>ssl</i>, <i>ws</i>, <i>wss</i> or <i>unix</i>.
    * The TLS enabled prefixes (ssl, wss) are only valid if a TLS version of the library
    * is linked with.
    * For <i>host</i>, you can
@@ -958,19 +1067,23 @@ typedef struct
 	 * HTTPS proxy for websockets
 	 */
 	const char* httpsProxy;
+	/**
+	 * Options for the TCP socket, or NULL to use the operating system defaults
+	 */
+	const MQTTClient_socketOptions* socketOptions;
 } MQTTClient_connectOptions;
 
-#define MQTTClient_connectOptions_initializer { {'M', 'Q', 'T', 'C'}, 8, 60, 1, 1, NULL, NULL, NULL, 30, 0, NULL,\
-0, NULL, MQTTVERSION_DEFAULT, {NULL, 0, 0}, {0, NULL}, -1, 0, NULL, NULL}
+#define MQTTClient_connectOptions_initializer { {'M', 'Q', 'T', 'C'}, 9, 60, 1, 1, NULL, NULL, NULL, 30, 0, NULL,\
+0, NULL, MQTTVERSION_DEFAULT, {NULL, 0, 0}, {0, NULL}, -1, 0, NULL, NULL, NULL, NULL}
 
-#define MQTTClient_connectOptions_initializer5 { {'M', 'Q', 'T', 'C'}, 8, 60, 0, 1, NULL, NULL, NULL, 30, 0, NULL,\
-0, NULL, MQTTVERSION_5, {NULL, 0, 0}, {0, NULL}, -1, 1, NULL, NULL, NULL}
+#define MQTTClient_connectOptions_initializer5 { {'M', 'Q', 'T', 'C'}, 9, 60, 0, 1, NULL, NULL, NULL, 30, 0, NULL,\
+0, NULL, MQTTVERSION_5, {NULL, 0, 0}, {0, NULL}, -1, 1, NULL, NULL, NULL, NULL}
 
-#define MQTTClient_connectOptions_initializer_ws { {'M', 'Q', 'T', 'C'}, 8, 45, 1, 1, NULL, NULL, NULL, 30, 0, NULL,\
-0, NULL, MQTTVERSION_DEFAULT, {NULL, 0, 0}, {0, NULL}, -1, 0, NULL, NULL, NULL}
+#define MQTTClient_connectOptions_initializer_ws { {'M', 'Q', 'T', 'C'}, 9, 45, 1, 1, NULL, NULL, NULL, 30, 0, NULL,\
+0, NULL, MQTTVERSION_DEFAULT, {NULL, 0, 0}, {0, NULL}, -1, 0, NULL, NULL, NULL, NULL}
 
-#define MQTTClient_connectOptions_initializer5_ws { {'M', 'Q', 'T', 'C'}, 8, 45, 0, 1, NULL, NULL, NULL, 30, 0, NULL,\
-0, NULL, MQTTVERSION_5, {NULL, 0, 0}, {0, NULL}, -1, 1, NULL, NULL, NULL}
+#define MQTTClient_connectOptions_initializer5_ws { {'M', 'Q', 'T', 'C'}, 9, 45, 0, 1, NULL, NULL, NULL, 30, 0, NULL,\
+0, NULL, MQTTVERSION_5, {NULL, 0, 0}, {0, NULL}, -1, 1, NULL, NULL, NULL, NULL}
 
 /**
   * This function attempts to connect a previously-created client (see
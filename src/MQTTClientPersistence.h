@@ -84,6 +84,14 @@
   */
 #define MQTTCLIENT_PERSISTENCE_USER 2
 
+/**
+  * This <i>persistence_type</i> value specifies a persistence mechanism which
+  * keeps all the data for a client in one preallocated, memory-mapped file used
+  * as a ring buffer (see MQTTClient_create()).  The <i>persistence_context</i>
+  * is a pointer to an ::MQTTClient_ringPersistenceOptions structure.
+  */
+#define MQTTCLIENT_PERSISTENCE_RING 3
+
 /** 
   * Application-specific persistence functions must return this error code if 
   * there is a problem executing the function. 
@@ -213,6 +221,44 @@ typedef int (*Persistence_clear)(void* handle);
   */
 typedef int (*Persistence_containskey)(void* handle, char* key);
 
+/**
+  * @brief Put the data for several keys into the persistent store, as one operation.
+  *
+  * This is optional.  If it is set (see MQTTAsync_setPersistenceBatch()), the
+  * client uses it instead of a series of Persistence_put() calls when it has
+  * more than one record to write, so that the store can write them together,
+  * for instance in one transaction.  Buffered commands are written one at a
+  * time as they are queued, unless MQTTAsync_createOptions.deferPersistenceInterval
+  * is set, so only deferred persistence batches the writes of a burst of publishes.
+  *
+  * @param handle The handle pointer from a successful call to 
+  * Persistence_open().
+  * @param count The number of keys.
+  * @param keys An array of the keys, as for Persistence_put().
+  * @param bufcounts An array of the number of buffers for each key.
+  * @param buffers An array of the arrays of pointers to the data buffers for each key.
+  * @param buflens An array of the arrays of lengths of the data buffers for each key.
+  * @return Return 0 if the function completes successfully, otherwise return
+  * ::MQTTCLIENT_PERSISTENCE_ERROR.
+  */
+typedef int (*Persistence_putMany)(void* handle, int count, char* keys[], int bufcounts[], char** buffers[], int* buflens[]);
+
+/**
+  * @brief Remove the data for several keys from the store, as one operation.
+  *
+  * This is optional.  If it is set (see MQTTAsync_setPersistenceBatch()), the
+  * client uses it instead of a series of Persistence_remove() calls when it has
+  * more than one key to remove.  Keys which are not in the store are ignored.
+  *
+  * @param handle The handle pointer from a successful call to 
+  * Persistence_open().
+  * @param count The number of keys.
+  * @param keys An array of the keys to be removed.
+  * @return Return 0 if the function completes successfully, otherwise return
+  * ::MQTTCLIENT_PERSISTENCE_ERROR.
+  */
+typedef int (*Persistence_removeMany)(void* handle, int count, char* keys[]);
+
 /**
   * @brief A structure containing the function pointers to a persistence 
   * implementation and the context or state that will be shared across all 
@@ -258,6 +304,35 @@ typedef struct {
 } MQTTClient_persistence;
 
 
+/**
+ * Options for the ring buffer persistence (::MQTTCLIENT_PERSISTENCE_RING).
+ *
+ * One file of a fixed size is created for each client ID and server URI, in which records
+ * are appended and removed in place.  A buffer sized for the client's maxBufferedMessages
+ * means that a client which deletes the oldest messages when full reuses the space of the
+ * records it removes, without the file growing or any file being created or deleted.
+ */
+typedef struct
+{
+	/** The eyecatcher for this structure.  Must be MQRP */
+	char struct_id[4];
+	/** The version number of this structure.  Must be 0 */
+	int struct_version;
+	/** The directory in which the ring file is created.  NULL means the working directory. */
+	const char* directory;
+	/** The size of the ring buffer in bytes.  An existing ring file keeps the size it was created with. */
+	int size;
+	/**
+	 * When the ring buffer is full, whether to overwrite the oldest buffered commands to make
+	 * space for a new record (1), or to fail the write (0).  The state of messages in flight
+	 * is never overwritten: if the oldest record is not a buffered command, the write fails.
+	 */
+	int overwriteOldest;
+} MQTTClient_ringPersistenceOptions;
+
+#define MQTTClient_ringPersistenceOptions_initializer { {'M', 'Q', 'R', 'P'}, 0, NULL, 1024*1024, 0 }
+
+
 /**
  * A callback which is invoked just before a write to persistence.  This can be
  * used to transform the data, for instance to encrypt it.  If the buffers are
@@ -34,6 +34,7 @@
 #include "StackTrace.h"
 #include "WebSocket.h"
 #include "MQTTTime.h"
+#include "Thread.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -103,7 +104,7 @@ static int MQTTPacket_send_ack(int MQTTVersion, int type, int msgid, int dup, ne
 void* MQTTPacket_Factory(int MQTTVersion, networkHandles* net, int* error)
 {
 	char* data = NULL;
-	static Header header;
+	static THREAD_LOCAL Header header;
 	size_t remaining_length;
 	int ptype;
 	void* pack = NULL;
@@ -494,7 +495,7 @@ void writeData(char** pptr, const void* data, int datalen)
  */
 void* MQTTPacket_header_only(int MQTTVersion, unsigned char aHeader, char* data, size_t datalen)
 {
-	static unsigned char header = 0;
+	static THREAD_LOCAL unsigned char header = 0;
 	header = aHeader;
 	return &header;
 }
@@ -849,10 +850,15 @@ int MQTTPacket_send_publish(Publish* pack, int dup, int qos, int retained, netwo
 	header.bits.retain = retained;
 	if (qos > 0 || pack->MQTTVersion >= 5)
 	{
-		int buflen = ((qos > 0) ? 2 : 0) + ((pack->MQTTVersion >= 5) ? MQTTProperties_len(&pack->properties) : 0);
+		int encoded = (pack->MQTTVersion >= 5 && pack->encodedProperties != NULL);
+		/* a topic alias is added at the end of the properties, whose length may then need another byte */
+		int aliaslen = (pack->MQTTVersion >= 5 && pack->topicAlias > 0) ? 3 +
+				MQTTPacket_VBIlen(pack->properties.length + 3) - MQTTPacket_VBIlen(pack->properties.length) : 0;
+		int buflen = ((qos > 0) ? 2 : 0) + aliaslen + ((pack->MQTTVersion >= 5) ?
+				(encoded ? pack->encodedPropertiesLen : MQTTProperties_len(&pack->properties)) : 0);
 		char *ptr = NULL;
 		char* bufs[4] = {topiclen, pack->topic, NULL, pack->payload};
-		size_t lens[4] = {2, strlen(pack->topic), buflen, pack->payloadlen};
+		size_t lens[4] = {2, (aliaslen > 0 && pack->topicAliased) ? 0 : strlen(pack->topic), buflen, pack->payloadlen};
 		int frees[4] = {1, 0, 1, 0};
 		PacketBuffers packetbufs = {4, bufs, lens, frees, {pack->mask[0], pack->mask[1], pack->mask[2], pack->mask[3]}};
 
@@ -861,8 +867,21 @@ int MQTTPacket_send_publish(Publish* pack, int dup, int qos, int retained, netwo
 			goto exit_free;
 		if (qos > 0)
 			writeInt(&ptr, pack->msgId);
-		if (pack->MQTTVersion >= 5)
+		if (aliaslen > 0)
+			ptr += aliaslen - 3; /* so that the longer length can be written over the old one */
+		if (encoded)
+		{
+			memcpy(ptr, pack->encodedProperties, pack->encodedPropertiesLen);
+			ptr += pack->encodedPropertiesLen;
+		}
+		else if (pack->MQTTVersion >= 5)
 			MQTTProperties_write(&ptr, &pack->properties);
+		if (aliaslen > 0)
+		{
+			MQTTPacket_encode(bufs[2] + ((qos > 0) ? 2 : 0), pack->properties.length + 3);
+			writeChar(&ptr, MQTTPROPERTY_CODE_TOPIC_ALIAS);
+			writeInt(&ptr, pack->topicAlias);
+		}
 
 		ptr = topiclen;
 		writeInt(&ptr, (int)lens[1]);
@@ -1037,7 +1056,7 @@ exit:
 }
 
 
-static char* bufptr;
+static THREAD_LOCAL char* bufptr;
 
 int bufchar(char* c, int count)
 {
@@ -205,6 +205,10 @@ typedef struct
 	int MQTTVersion;  /**< the version of MQTT */
 	MQTTProperties properties; /**< MQTT 5.0 properties.  Not used for MQTT < 5.0 */
 	uint8_t mask[4]; /**< the websockets mask the payload is masked with, if any */
+	const char* encodedProperties; /**< the properties already encoded, with their length, or NULL */
+	int encodedPropertiesLen; /**< the length of encodedProperties */
+	int topicAlias; /**< a topic alias to add to the properties sent, or 0 */
+	int topicAliased; /**< the server already has the topic alias, so the topic is sent empty */
 } Publish;
 
 
@@ -322,10 +322,9 @@ void* MQTTPacket_suback(int MQTTVersion, unsigned char aHeader, char* data, size
 		newint = malloc(sizeof(unsigned int));
 		if (newint == NULL)
 		{
-			if (pack->properties.array)
-				free(pack->properties.array);
-			if (pack)
-				free(pack);
+			MQTTProperties_free(&pack->properties);
+			ListFree(pack->qoss);
+			free(pack);
 			pack = NULL; /* signal protocol error */
 			goto exit;
 		}
@@ -334,11 +333,9 @@ void* MQTTPacket_suback(int MQTTVersion, unsigned char aHeader, char* data, size
 	}
 	if (pack->qoss->count == 0)
 	{
-		if (pack->properties.array)
-			free(pack->properties.array);
-		if (pack)
-			free(pack);
+		MQTTProperties_free(&pack->properties);
 		ListFree(pack->qoss);
+		free(pack);
 		pack = NULL;
 	}
 exit:
@@ -438,10 +435,9 @@ void* MQTTPacket_unsuback(int MQTTVersion, unsigned char aHeader, char* data, si
 			newrc = malloc(sizeof(enum MQTTReasonCodes));
 			if (newrc == NULL)
 			{
-				if (pack->properties.array)
-					free(pack->properties.array);
-				if (pack)
-					free(pack);
+				MQTTProperties_free(&pack->properties);
+				ListFree(pack->reasonCodes);
+				free(pack);
 				pack = NULL; /* signal protocol error */
 				goto exit;
 			}
@@ -451,10 +447,8 @@ void* MQTTPacket_unsuback(int MQTTVersion, unsigned char aHeader, char* data, si
 		if (pack->reasonCodes->count == 0)
 		{
 			ListFree(pack->reasonCodes);
-			if (pack->properties.array)
-				free(pack->properties.array);
-			if (pack)
-				free(pack);
+			MQTTProperties_free(&pack->properties);
+			free(pack);
 			pack = NULL;
 		}
 	}
@@ -28,16 +28,46 @@
 
 #include "MQTTPersistence.h"
 #include "MQTTPersistenceDefault.h"
+#include "MQTTPersistenceRing.h"
 #include "MQTTProtocolClient.h"
+#include "MQTTTime.h"
+#include "Thread.h"
 #include "Heap.h"
 
 #if defined(_WIN32) || defined(_WIN64)
 	#define snprintf _snprintf
 #endif
 
+/* the deferred records are reached both from the command queue and from the protocol,
+ * which hold different locks, so they have their own */
+#if defined(_WIN32) || defined(_WIN64)
+mutex_type deferred_mutex;
+#else
+static pthread_mutex_t deferred_mutex_store = PTHREAD_MUTEX_INITIALIZER;
+static mutex_type deferred_mutex = &deferred_mutex_store;
+#endif
+static unsigned int deferred_seqno = 0; /* protected by deferred_mutex */
+
 
 static MQTTPersistence_qEntry* MQTTPersistence_restoreQueueEntry(char* buffer, size_t buflen, int MQTTVersion);
 static void MQTTPersistence_insertInSeqOrder(List* list, MQTTPersistence_qEntry* qEntry, size_t size);
+static void MQTTPersistence_freeDeferred(Clients* c);
+static int MQTTPersistence_dropDeferred(Clients* c, char* key, int* written);
+
+/**
+ * An outbound record held in memory until it is either removed, or has been
+ * outstanding for longer than the client's deferPersistenceInterval.  The deferred
+ * records are indexed by when they were deferred, and by key.
+ */
+typedef struct
+{
+	char key[PERSISTENCE_MAX_KEY_LENGTH + 1]; /**< the persistence key, first for the key index */
+	char* buffer;                             /**< the record, already passed through beforeWrite */
+	int buflen;                               /**< the length of the record */
+	START_TIME_TYPE start;                    /**< when the record was deferred */
+	unsigned int seqno;                       /**< the order in which the records were deferred */
+	int written;                              /**< an earlier version of the record is in persistence */
+} MQTTPersistence_deferred;
 
 /**
  * Creates a ::MQTTClient_persistence structure representing a persistence implementation.
@@ -87,6 +117,42 @@ int MQTTPersistence_create(MQTTClient_persistence** persistence, int type, void*
 			else
 				rc = PAHO_MEMORY_ERROR;
 			break;
+		case MQTTCLIENT_PERSISTENCE_RING :
+		{
+			MQTTClient_ringPersistenceOptions* opts = pcontext;
+			const char* dir = NULL;
+
+			if (opts == NULL || strncmp(opts->struct_id, "MQRP", 4) != 0 || opts->struct_version != 0 || opts->size <= 0)
+			{
+				rc = MQTTCLIENT_PERSISTENCE_ERROR;
+				goto exit;
+			}
+			dir = (opts->directory) ? opts->directory : "."; /* working directory */
+			if ((per = malloc(sizeof(MQTTClient_persistence))) == NULL)
+			{
+				rc = PAHO_MEMORY_ERROR;
+				goto exit;
+			}
+			/* copy the options and the directory name into one allocation */
+			if ((per->context = malloc(sizeof(MQTTClient_ringPersistenceOptions) + strlen(dir) + 1)) == NULL)
+			{
+				free(per);
+				per = NULL;
+				rc = PAHO_MEMORY_ERROR;
+				goto exit;
+			}
+			opts = memcpy(per->context, opts, sizeof(MQTTClient_ringPersistenceOptions));
+			opts->directory = strcpy((char*)(opts + 1), dir);
+			per->popen        = ringopen;
+			per->pclose       = ringclose;
+			per->pput         = ringput;
+			per->pget         = ringget;
+			per->premove      = ringremove;
+			per->pkeys        = ringkeys;
+			per->pclear       = ringclear;
+			per->pcontainskey = ringcontainskey;
+			break;
+		}
 		case MQTTCLIENT_PERSISTENCE_USER :
 			per = (MQTTClient_persistence *)pcontext;
 			if ( per == NULL || (per != NULL && (per->context == NULL || per->pclear == NULL ||
@@ -120,6 +186,11 @@ int MQTTPersistence_initialize(Clients *c, const char *serverURI)
 	FUNC_ENTRY;
 	if ( c->persistence != NULL )
 	{
+		if (c->persistence->popen == pstopen)
+		{
+			c->pputMany = pstputMany;
+			c->premoveMany = pstremoveMany;
+		}
 		rc = c->persistence->popen(&(c->phandle), c->clientID, serverURI, c->persistence->context);
 		if ( rc == 0 )
 			rc = MQTTPersistence_restorePackets(c);// comment by Clark:: 恢复到内存中  ::2020-12-22
@@ -143,11 +214,13 @@ int MQTTPersistence_close(Clients *c)
 #if !defined(NO_PERSISTENCE)
 	if (c->persistence != NULL)
 	{
+		MQTTPersistence_flushDeferred(c, 1);
+		MQTTPersistence_freeDeferred(c);
 		rc = c->persistence->pclose(c->phandle);
 
 		if (c->persistence->context)
 			free(c->persistence->context);
-		if (c->persistence->popen == pstopen)
+		if (c->persistence->popen == pstopen || c->persistence->popen == ringopen)
 			free(c->persistence);
 
 		c->phandle = NULL;
@@ -169,13 +242,372 @@ int MQTTPersistence_clear(Clients *c)
 
 	FUNC_ENTRY;
 	if (c->persistence != NULL)
+	{
+		MQTTPersistence_freeDeferred(c);
 		rc = c->persistence->pclear(c->phandle);
+	}
+
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/**
+ * Orders deferred records by when they were deferred.  The clock is not used for this as
+ * its millisecond differences do not give a consistent order to records deferred close
+ * together.  As with ::TreeIntCompare, the result is reversed so that the tree walk is in
+ * ascending order.
+ */
+static int deferredStartCompare(void* a, void* b, int content)
+{
+	unsigned int i = ((MQTTPersistence_deferred*)a)->seqno;
+	unsigned int j = ((MQTTPersistence_deferred*)b)->seqno;
+
+	return (i > j) ? -1 : (i == j) ? 0 : 1;
+}
+
+
+/**
+ * Writes an outbound record to persistence.  If the client has a deferPersistenceInterval,
+ * the record is held in memory instead, and is only written if it is still there when the
+ * interval has passed, so that records which are removed quickly never reach persistence.
+ * @param c the client
+ * @param key the persistence key
+ * @param nbufs the number of buffers making up the record
+ * @param bufs the buffers
+ * @param lens the lengths of the buffers
+ * @return 0 if success, an error code otherwise
+ */
+int MQTTPersistence_put(Clients* c, char* key, int nbufs, char** bufs, int* lens)
+{
+	int rc = 0;
+	MQTTPersistence_deferred* d = NULL;
+	int i, buflen = 0;
+	int written = 0;
+
+	FUNC_ENTRY;
+	if (c->deferPersistenceInterval <= 0 || strlen(key) > PERSISTENCE_MAX_KEY_LENGTH)
+	{
+		rc = c->persistence->pput(c->phandle, key, nbufs, bufs, lens);
+		goto exit;
+	}
+
+	Thread_lock_mutex(deferred_mutex);
+	if (c->deferredPersistence == NULL)
+	{
+		if ((c->deferredPersistence = TreeInitialize(deferredStartCompare)) == NULL)
+		{
+			rc = PAHO_MEMORY_ERROR;
+			goto unlock;
+		}
+		TreeAddIndex(c->deferredPersistence, TreeStringCompare);
+	}
+	/* a record rewritten before it has been flushed replaces the earlier one.  One which has
+	 * been flushed stays in persistence until the new record is flushed over it */
+	if (!MQTTPersistence_dropDeferred(c, key, &written))
+		written = (c->persistence->pcontainskey(c->phandle, key) == 0);
+
+	for (i = 0; i < nbufs; ++i)
+		buflen += lens[i];
+	if ((d = malloc(sizeof(MQTTPersistence_deferred))) == NULL)
+	{
+		rc = PAHO_MEMORY_ERROR;
+		goto unlock;
+	}
+	if ((d->buffer = malloc(buflen > 0 ? buflen : 1)) == NULL)
+	{
+		free(d);
+		rc = PAHO_MEMORY_ERROR;
+		goto unlock;
+	}
+	d->buflen = 0;
+	for (i = 0; i < nbufs; ++i)
+	{
+		memcpy(&d->buffer[d->buflen], bufs[i], lens[i]);
+		d->buflen += lens[i];
+	}
+	strcpy(d->key, key);
+	d->start = MQTTTime_start_clock();
+	d->seqno = ++deferred_seqno;
+	d->written = written;
+	if (TreeAdd(c->deferredPersistence, d, sizeof(MQTTPersistence_deferred) + buflen) == NULL)
+	{
+		TreeRemove(c->deferredPersistence, d); /* from an index it was added to */
+		free(d->buffer);
+		free(d);
+		rc = PAHO_MEMORY_ERROR;
+	}
+unlock:
+	Thread_unlock_mutex(deferred_mutex);
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/**
+ * Drops the deferred copy of a record, if there is one.  A record already written to
+ * persistence is left there.
+ * @param c the client
+ * @param key the persistence key
+ * @param written set to whether an earlier version of the record is in persistence
+ * @return boolean, whether a deferred copy was dropped.  Called with deferred_mutex locked.
+ */
+static int MQTTPersistence_dropDeferred(Clients* c, char* key, int* written)
+{
+	Node* found = NULL;
+	MQTTPersistence_deferred* d = NULL;
+
+	if (c->deferredPersistence == NULL || (found = TreeFindIndex(c->deferredPersistence, key, 1)) == NULL)
+		return 0;
+	d = (MQTTPersistence_deferred*)(found->content);
+	*written = d->written;
+	TreeRemove(c->deferredPersistence, d);
+	free(d->buffer);
+	free(d);
+	return 1;
+}
+
+
+/**
+ * Reads a record from persistence, or from the deferred records if it has not been written yet.
+ * @param c the client
+ * @param key the persistence key
+ * @param buffer set to the record, which the caller must free
+ * @param buflen set to the length of the record
+ * @return 0 if success, an error code otherwise
+ */
+int MQTTPersistence_get(Clients* c, char* key, char** buffer, int* buflen)
+{
+	int rc = 0;
+	Node* found = NULL;
+
+	FUNC_ENTRY;
+	Thread_lock_mutex(deferred_mutex);
+	if (c->deferredPersistence &&
+		(found = TreeFindIndex(c->deferredPersistence, key, 1)) != NULL)
+	{
+		MQTTPersistence_deferred* d = (MQTTPersistence_deferred*)(found->content);
+
+		if ((*buffer = malloc(d->buflen > 0 ? d->buflen : 1)) == NULL)
+			rc = PAHO_MEMORY_ERROR;
+		else
+		{
+			memcpy(*buffer, d->buffer, d->buflen);
+			*buflen = d->buflen;
+		}
+	}
+	Thread_unlock_mutex(deferred_mutex);
+	if (found == NULL)
+		rc = c->persistence->pget(c->phandle, key, buffer, buflen);
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/**
+ * Removes a record from persistence.  If the record is still deferred, it is just discarded,
+ * unless an earlier version of it was written before it was deferred.
+ * @param c the client
+ * @param key the persistence key
+ * @return 0 if success, an error code otherwise
+ */
+int MQTTPersistence_removeKey(Clients* c, char* key)
+{
+	int rc = 0;
+	int written = 1;
+
+	FUNC_ENTRY;
+	Thread_lock_mutex(deferred_mutex);
+	MQTTPersistence_dropDeferred(c, key, &written);
+	Thread_unlock_mutex(deferred_mutex);
+	if (written)
+		rc = c->persistence->premove(c->phandle, key);
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/**
+ * Writes several records to persistence, with one call if the persistence implementation
+ * has a Persistence_putMany function, otherwise one call for each record.
+ * @param c the client
+ * @param count the number of records
+ * @param keys the persistence keys
+ * @param bufcounts the number of buffers making up each record
+ * @param buffers the buffers of each record
+ * @param buflens the lengths of the buffers of each record
+ * @return 0 if success, an error code otherwise
+ */
+int MQTTPersistence_putMany(Clients* c, int count, char* keys[], int bufcounts[], char** buffers[], int* buflens[])
+{
+	int rc = 0;
+
+	FUNC_ENTRY;
+	if (count > 1 && c->pputMany)
+		rc = c->pputMany(c->phandle, count, keys, bufcounts, buffers, buflens);
+	else
+	{
+		int i;
+
+		for (i = 0; i < count; ++i)
+		{
+			int rc1 = c->persistence->pput(c->phandle, keys[i], bufcounts[i], buffers[i], buflens[i]);
+
+			if (rc1 != 0)
+				rc = rc1;
+		}
+	}
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/**
+ * Removes several records from persistence.  Records which are still deferred, and were
+ * never written, are just discarded, and the rest are removed with one call if the persistence implementation has
+ * a Persistence_removeMany function, otherwise one call for each key.
+ * @param c the client
+ * @param count the number of keys
+ * @param keys the persistence keys.  The order of the array may be changed.
+ * @return 0 if success, an error code otherwise
+ */
+int MQTTPersistence_removeMany(Clients* c, int count, char* keys[])
+{
+	int rc = 0;
+	int i = 0;
+
+	FUNC_ENTRY;
+	Thread_lock_mutex(deferred_mutex);
+	while (c->deferredPersistence && i < count)
+	{
+		int written = 1;
+
+		if (MQTTPersistence_dropDeferred(c, keys[i], &written) && !written)
+			keys[i] = keys[--count]; /* only the remaining keys need removing from persistence */
+		else
+			++i;
+	}
+	Thread_unlock_mutex(deferred_mutex);
+	if (count > 1 && c->premoveMany)
+		rc = c->premoveMany(c->phandle, count, keys);
+	else
+	{
+		for (i = 0; i < count; ++i)
+		{
+			int rc1 = c->persistence->premove(c->phandle, keys[i]);
+
+			if (rc1 != 0)
+				rc = rc1;
+		}
+	}
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/**
+ * Writes deferred records to persistence.
+ * @param c the client
+ * @param all if true, write all the deferred records, otherwise only those which have
+ * been outstanding for the client's deferPersistenceInterval
+ * @return 0 if success, an error code otherwise
+ */
+int MQTTPersistence_flushDeferred(Clients* c, int all)
+{
+	int rc = 0;
+	Node* current = NULL;
+	MQTTPersistence_deferred** due = NULL;
+	char** keys = NULL;
+	char*** buffers = NULL;
+	int** buflens = NULL;
+	int* bufcounts = NULL;
+	int count = 0, i;
+
+	FUNC_ENTRY;
+	Thread_lock_mutex(deferred_mutex);
+	if (c->persistence == NULL || c->deferredPersistence == NULL || c->deferredPersistence->count == 0)
+		goto exit;
+	current = TreeNextElement(c->deferredPersistence, NULL);
+	if (!all && MQTTTime_elapsed(((MQTTPersistence_deferred*)(current->content))->start)
+			< (ELAPSED_TIME_TYPE)c->deferPersistenceInterval)
+		goto exit; /* nothing is due yet */
+	due = malloc(sizeof(MQTTPersistence_deferred*) * c->deferredPersistence->count);
+	keys = malloc(sizeof(char*) * c->deferredPersistence->count);
+	buffers = malloc(sizeof(char**) * c->deferredPersistence->count);
+	buflens = malloc(sizeof(int*) * c->deferredPersistence->count);
+	bufcounts = malloc(sizeof(int) * c->deferredPersistence->count);
+	if (due == NULL || keys == NULL || buffers == NULL || buflens == NULL || bufcounts == NULL)
+	{
+		rc = PAHO_MEMORY_ERROR;
+		goto exit;
+	}
+	/* the records are walked in the order they were deferred, so stop at the first one which is not due */
+	for (; current != NULL; current = TreeNextElement(c->deferredPersistence, current))
+	{
+		MQTTPersistence_deferred* d = (MQTTPersistence_deferred*)(current->content);
 
+		if (!all && MQTTTime_elapsed(d->start) < (ELAPSED_TIME_TYPE)c->deferPersistenceInterval)
+			break;
+		due[count] = d;
+		keys[count] = d->key;
+		buffers[count] = &d->buffer;
+		buflens[count] = &d->buflen;
+		bufcounts[count++] = 1;
+	}
+	if (count == 0)
+		goto exit;
+	/* write the due records in one batch */
+	if ((rc = MQTTPersistence_putMany(c, count, keys, bufcounts, buffers, buflens)) != 0)
+		Log(LOG_ERROR, 0, "Error %d persisting deferred records", rc);
+	for (i = 0; i < count; ++i)
+	{
+		TreeRemove(c->deferredPersistence, due[i]);
+		free(due[i]->buffer);
+		free(due[i]);
+	}
+	Log(TRACE_MINIMUM, -1, "%d deferred records persisted for client %s", count, c->clientID);
+exit:
+	Thread_unlock_mutex(deferred_mutex);
+	if (due)
+		free(due);
+	if (keys)
+		free(keys);
+	if (buffers)
+		free(buffers);
+	if (buflens)
+		free(buflens);
+	if (bufcounts)
+		free(bufcounts);
 	FUNC_EXIT_RC(rc);
 	return rc;
 }
 
 
+/**
+ * Discards any deferred records without writing them.
+ * @param c the client
+ */
+static void MQTTPersistence_freeDeferred(Clients* c)
+{
+	Thread_lock_mutex(deferred_mutex);
+	if (c->deferredPersistence)
+	{
+		while (c->deferredPersistence->index[0].root != NULL)
+		{
+			MQTTPersistence_deferred* d = (MQTTPersistence_deferred*)(c->deferredPersistence->index[0].root->content);
+
+			TreeRemove(c->deferredPersistence, d);
+			free(d->buffer);
+			free(d);
+		}
+		TreeFree(c->deferredPersistence);
+		c->deferredPersistence = NULL;
+	}
+	Thread_unlock_mutex(deferred_mutex);
+}
+
+
 /**
  * Restores the persisted records to the outbound and inbound message queues of the
  * client.
@@ -404,13 +836,18 @@ void MQTTPersistence_insertInOrder(List* list, void* content, size_t size)
 	ListElement* current = NULL;
 
 	FUNC_ENTRY;
-	while(ListNextElement(list, &current) != NULL && index == NULL)
+	/* keys are normally restored in message id order, so check the end of the list first */
+	if (list->last == NULL || ((Messages*)content)->msgid >= ((Messages*)list->last->content)->msgid)
+		ListAppend(list, content, size);
+	else
 	{
-		if ( ((Messages*)content)->msgid < ((Messages*)current->content)->msgid )
-			index = current;
+		while(ListNextElement(list, &current) != NULL && index == NULL)
+		{
+			if ( ((Messages*)content)->msgid < ((Messages*)current->content)->msgid )
+				index = current;
+		}
+		ListInsert(list, content, size, index);
 	}
-
-	ListInsert(list, content, size, index);
 	FUNC_EXIT;
 }
 
@@ -435,7 +872,7 @@ int MQTTPersistence_putPacket(int socket, char* buf0, size_t buf0len, int count,
 						char** buffers, size_t* buflens, int htype, int msgId, int scr, int MQTTVersion)
 {
 	int rc = 0;
-	extern ClientStates* bstate;
+	extern THREAD_LOCAL ClientStates* bstate;
 	int nbufs, i;
 	int* lens = NULL;
 	char** bufs = NULL;
@@ -507,7 +944,9 @@ int MQTTPersistence_putPacket(int socket, char* buf0, size_t buf0len, int count,
 		if (rc == 0 && client->beforeWrite)
 			rc = client->beforeWrite(client->beforeWrite_context, nbufs, bufs, lens);
 
-		if (rc == 0)
+		if (rc == 0 && scr == 0)
+			rc = MQTTPersistence_put(client, key, nbufs, bufs, lens);
+		else if (rc == 0)
 			rc = client->persistence->pput(client->phandle, key, nbufs, bufs, lens);
 
 		free(key);
@@ -537,58 +976,37 @@ int MQTTPersistence_remove(Clients* c, char *type, int qos, int msgId)
 	FUNC_ENTRY;
 	if (c->persistence != NULL)
 	{
-		const size_t keysize = MESSAGE_FILENAME_LENGTH + 1;
-		char *key = malloc(keysize);
+		char keybufs[4][MESSAGE_FILENAME_LENGTH + 1];
+		char* keys[4];
+		char* stems[4];
+		int count = 0, i;
 		int chars = 0;
 
-		if (!key)
-		{
-			rc = PAHO_MEMORY_ERROR;
-			goto exit;
-		}
 		if (strcmp(type, PERSISTENCE_PUBLISH_SENT) == 0 ||
 				strcmp(type, PERSISTENCE_V5_PUBLISH_SENT) == 0)
 		{
-			if ((chars = snprintf(key, keysize, "%s%d", PERSISTENCE_V5_PUBLISH_SENT, msgId)) >= keysize)
-				rc = MQTTCLIENT_PERSISTENCE_ERROR;
-			else
-			{
-				rc = c->persistence->premove(c->phandle, key);
-				if ((chars = snprintf(key, keysize, "%s%d", PERSISTENCE_V5_PUBREL, msgId)) >= keysize)
-					rc = MQTTCLIENT_PERSISTENCE_ERROR;
-				else
-				{
-					rc += c->persistence->premove(c->phandle, key);
-					if ((chars = snprintf(key, keysize, "%s%d", PERSISTENCE_PUBLISH_SENT, msgId)) >= keysize)
-						rc = MQTTCLIENT_PERSISTENCE_ERROR;
-					else
-					{
-						rc += c->persistence->premove(c->phandle, key);
-						if ((chars = snprintf(key, keysize, "%s%d", PERSISTENCE_PUBREL, msgId)) >= keysize)
-							rc = MQTTCLIENT_PERSISTENCE_ERROR;
-						else
-							rc += c->persistence->premove(c->phandle, key);
-					}
-				}
-			}
+			stems[count++] = PERSISTENCE_V5_PUBLISH_SENT;
+			stems[count++] = PERSISTENCE_V5_PUBREL;
+			stems[count++] = PERSISTENCE_PUBLISH_SENT;
+			stems[count++] = PERSISTENCE_PUBREL;
 		}
 		else /* PERSISTENCE_PUBLISH_SENT && qos == 1 */
 		{    /* or PERSISTENCE_PUBLISH_RECEIVED */
-
-			if ((chars = snprintf(key, keysize, "%s%d", PERSISTENCE_V5_PUBLISH_RECEIVED, msgId)) >= keysize)
-				rc = MQTTCLIENT_PERSISTENCE_ERROR;
-			else
+			stems[count++] = PERSISTENCE_V5_PUBLISH_RECEIVED;
+			stems[count++] = PERSISTENCE_PUBLISH_RECEIVED;
+		}
+		for (i = 0; i < count; ++i)
+		{
+			keys[i] = keybufs[i];
+			if ((chars = snprintf(keys[i], sizeof(keybufs[i]), "%s%d", stems[i], msgId)) >= sizeof(keybufs[i]))
 			{
-				rc = c->persistence->premove(c->phandle, key);
-				if ((chars = snprintf(key, keysize, "%s%d", PERSISTENCE_PUBLISH_RECEIVED, msgId)) >= keysize)
-					rc = MQTTCLIENT_PERSISTENCE_ERROR;
-				else
-					rc += c->persistence->premove(c->phandle, key);
+				rc = MQTTCLIENT_PERSISTENCE_ERROR;
+				Log(LOG_ERROR, 0, "Error writing %d chars with snprintf", chars);
+				goto exit;
 			}
 		}
-		if (rc == MQTTCLIENT_PERSISTENCE_ERROR)
-			Log(LOG_ERROR, 0, "Error writing %d chars with snprintf", chars);
-		free(key);
+		/* remove all the records for this message ID together */
+		rc = MQTTPersistence_removeMany(c, count, keys);
 	}
 
 exit:
@@ -838,12 +1256,18 @@ static void MQTTPersistence_insertInSeqOrder(List* list, MQTTPersistence_qEntry*
 	ListElement* current = NULL;
 
 	FUNC_ENTRY;
-	while (ListNextElement(list, &current) != NULL && index == NULL)
+	/* keys are normally restored in sequence number order, so check the end of the list first */
+	if (list->last == NULL || qEntry->seqno >= ((MQTTPersistence_qEntry*)list->last->content)->seqno)
+		ListAppend(list, qEntry, size);
+	else
 	{
-		if (qEntry->seqno < ((MQTTPersistence_qEntry*)current->content)->seqno)
-			index = current;
+		while (ListNextElement(list, &current) != NULL && index == NULL)
+		{
+			if (qEntry->seqno < ((MQTTPersistence_qEntry*)current->content)->seqno)
+				index = current;
+		}
+		ListInsert(list, qEntry, size, index);
 	}
-	ListInsert(list, qEntry, size, index);
 	FUNC_EXIT;
 }
 
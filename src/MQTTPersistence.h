@@ -67,6 +67,12 @@ int MQTTPersistence_putPacket(int socket, char* buf0, size_t buf0len, int count,
 						char** buffers, size_t* buflens, int htype, int msgId, int scr, int MQTTVersion);
 int MQTTPersistence_remove(Clients* c, char* type, int qos, int msgId);
 void MQTTPersistence_wrapMsgID(Clients *c);
+int MQTTPersistence_put(Clients* c, char* key, int nbufs, char** bufs, int* lens);
+int MQTTPersistence_get(Clients* c, char* key, char** buffer, int* buflen);
+int MQTTPersistence_removeKey(Clients* c, char* key);
+int MQTTPersistence_putMany(Clients* c, int count, char* keys[], int bufcounts[], char** buffers[], int* buflens[]);
+int MQTTPersistence_removeMany(Clients* c, int count, char* keys[]);
+int MQTTPersistence_flushDeferred(Clients* c, int all);
 
 typedef struct
 {
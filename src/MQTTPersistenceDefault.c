@@ -26,6 +26,10 @@
  * particular client ID and connection key. This allows one persistence base directory to
  * be shared by multiple clients.
  *
+ * The directory is scanned once when the persistence is opened, to build an in-memory index
+ * of the keys it contains.  The index is kept up to date by put, remove and clear, so that
+ * listing keys and checking for a key do not need to read the directory again.
+ *
  */
 
 #if !defined(NO_PERSISTENCE)
@@ -41,23 +45,43 @@
 	/* Windows doesn't have strtok_r, so remap it to strtok */
 	#define strtok_r( A, B, C ) strtok( A, B )
 	#define snprintf _snprintf
-	int keysWin32(char *, char ***, int *);
-	int clearWin32(char *);
-	int containskeyWin32(char *, char *);
+	#define DIRSIZE MAX_PATH+1
 #else
 	#include <sys/stat.h>
 	#include <dirent.h>
 	#include <unistd.h>
-	int keysUnix(char *, char ***, int *);
-	int clearUnix(char *);
-	int containskeyUnix(char *, char *);
 #endif
 
 #include "MQTTClientPersistence.h"
 #include "MQTTPersistenceDefault.h"
+#include "Tree.h"
 #include "StackTrace.h"
 #include "Heap.h"
 
+/**
+ * The handle returned by ::pstopen: the client persistence directory and the index of the
+ * keys persisted in it.
+ */
+typedef struct
+{
+	char* clientDir; /**< the client persistence directory */
+	Tree* keys;      /**< the keys (file names without the extension) in the directory */
+} pstHandle;
+
+#if defined(_WIN32) || defined(_WIN64)
+	int indexWin32(char *, Tree *);
+	int clearWin32(char *);
+#else
+	int indexUnix(char *, Tree *);
+	int clearUnix(char *);
+#endif
+
+static int pstIndex(pstHandle* h);
+static int pstKeyCompare(void* a, void* b, int value);
+static int pstIndexAdd(Tree* index, const char* key);
+static void pstIndexEmpty(Tree* index);
+static char* pstFileNames(pstHandle* h, int count, char* keys[], size_t* prefixlen);
+
 /** Create persistence directory for the client: context/clientID-serverURI.
  *  See ::Persistence_open
  */
@@ -67,6 +91,7 @@ int pstopen(void **handle, const char* clientID, const char* serverURI, void* co
 	int rc = 0;
 	char *dataDir = context;
 	char *clientDir;
+	pstHandle *h = NULL;
 	char *pToken = NULL;
 	char *save_ptr = NULL;
 	char *pCrtDirName = NULL;
@@ -148,12 +173,43 @@ int pstopen(void **handle, const char* clientID, const char* serverURI, void* co
 		pToken = strtok_r( NULL, "\\/", &save_ptr );
 	}
 
-	*handle = clientDir;
-
 	free(pTokDirName);
 	free(pCrtDirName);
 	free(perserverURI);
 
+	if (rc != 0)
+	{
+		free(clientDir);
+		goto exit;
+	}
+
+	if ((h = malloc(sizeof(pstHandle))) == NULL)
+	{
+		free(clientDir);
+		rc = PAHO_MEMORY_ERROR;
+		goto exit;
+	}
+	h->clientDir = clientDir;
+	if ((h->keys = TreeInitialize(pstKeyCompare)) == NULL)
+	{
+		free(clientDir);
+		free(h);
+		rc = PAHO_MEMORY_ERROR;
+		goto exit;
+	}
+
+	/* read the directory once, from now on the index is kept up to date as keys are added and removed */
+	if ((rc = pstIndex(h)) != 0)
+	{
+		pstIndexEmpty(h->keys);
+		TreeFree(h->keys);
+		free(clientDir);
+		free(h);
+		goto exit;
+	}
+
+	*handle = h;
+
 exit:
 	FUNC_EXIT_RC(rc);
 	return rc;
@@ -193,62 +249,69 @@ int pstmkdir( char *pPathname )
  *  See ::Persistence_put
  */
 int pstput(void* handle, char* key, int bufcount, char* buffers[], int buflens[])
+{
+	return pstputMany(handle, 1, &key, &bufcount, &buffers, &buflens);
+}
+
+
+/** Write several wire messages to files in the client persistence directory,
+ *  building the file names in one buffer.
+ *  See ::Persistence_putMany
+ */
+int pstputMany(void* handle, int count, char* keys[], int bufcounts[], char** buffers[], int* buflens[])
 {
 	int rc = 0;
-	char *clientDir = handle;
-	char *file;
-	FILE *fp;
-	size_t bytesWritten = 0,
-	       bytesTotal = 0;
-	int i;
-	size_t alloclen = 0;
+	pstHandle *h = handle;
+	char *file = NULL;
+	size_t prefixlen = 0;
+	int k;
 
 	FUNC_ENTRY;
-	if (clientDir == NULL)
+	if (h == NULL || h->clientDir == NULL)
 	{
 		rc = MQTTCLIENT_PERSISTENCE_ERROR;
 		goto exit;
 	}
-
-	/* consider '/' + '\0' */
-	alloclen = strlen(clientDir) + strlen(key) + strlen(MESSAGE_FILENAME_EXTENSION) + 2;
-	file = malloc(alloclen);
-	if (!file)
+	if ((file = pstFileNames(h, count, keys, &prefixlen)) == NULL)
 	{
 		rc = PAHO_MEMORY_ERROR;
 		goto exit;
 	}
-	if (snprintf(file, alloclen, "%s/%s%s", clientDir, key, MESSAGE_FILENAME_EXTENSION) >= alloclen)
-	{
-		rc = MQTTCLIENT_PERSISTENCE_ERROR;
-		goto free_exit;
-	}
 
-	fp = fopen(file, "wb");
-	if ( fp != NULL )
+	for (k = 0; k < count && rc == 0; k++)
 	{
-		for(i=0; i<bufcount; i++)
+		FILE *fp;
+		size_t bytesWritten = 0,
+		       bytesTotal = 0;
+		int i;
+
+		sprintf(&file[prefixlen], "%s%s", keys[k], MESSAGE_FILENAME_EXTENSION);
+		fp = fopen(file, "wb");
+		if ( fp != NULL )
 		{
-			bytesTotal += buflens[i];
-			bytesWritten += fwrite(buffers[i], sizeof(char), buflens[i], fp );
-		}
-		fclose(fp);
-		fp = NULL;
-	} else
-		rc = MQTTCLIENT_PERSISTENCE_ERROR;
+			for(i=0; i<bufcounts[k]; i++)
+			{
+				bytesTotal += buflens[k][i];
+				bytesWritten += fwrite(buffers[k][i], sizeof(char), buflens[k][i], fp );
+			}
+			fclose(fp);
+			fp = NULL;
+			rc = pstIndexAdd(h->keys, keys[k]); /* the file exists now, even if the write failed */
+		} else
+			rc = MQTTCLIENT_PERSISTENCE_ERROR;
 
-	if (bytesWritten != bytesTotal)
-	{
-		pstremove(handle, key);
-		rc = MQTTCLIENT_PERSISTENCE_ERROR;
+		if (bytesWritten != bytesTotal)
+		{
+			pstremove(handle, keys[k]);
+			rc = MQTTCLIENT_PERSISTENCE_ERROR;
+		}
 	}
 
-free_exit:
 	free(file);
 exit:
 	FUNC_EXIT_RC(rc);
 	return rc;
-};
+}
 
 
 /** Retrieve a wire message from the client persistence directory.
@@ -258,7 +321,8 @@ int pstget(void* handle, char* key, char** buffer, int* buflen)
 {
 	int rc = 0;
 	FILE *fp = NULL;
-	char *clientDir = handle;
+	pstHandle *h = handle;
+	char *clientDir;
 	char *filename = NULL;
 	char *buf = NULL;
 	unsigned long fileLen = 0;
@@ -266,7 +330,7 @@ int pstget(void* handle, char* key, char** buffer, int* buflen)
 	size_t alloclen = 0;
 
 	FUNC_ENTRY;
-	if (clientDir == NULL)
+	if (h == NULL || (clientDir = h->clientDir) == NULL)
 	{
 		rc = MQTTCLIENT_PERSISTENCE_ERROR;
 		goto exit;
@@ -320,42 +384,48 @@ exit:
  *  See ::Persistence_remove
  */
 int pstremove(void* handle, char* key)
+{
+	return pstremoveMany(handle, 1, &key);
+}
+
+
+/** Delete several persisted messages from the client persistence directory,
+ *  building the file names in one buffer.
+ *  See ::Persistence_removeMany
+ */
+int pstremoveMany(void* handle, int count, char* keys[])
 {
 	int rc = 0;
-	char *clientDir = handle;
-	char *file;
-	size_t alloclen = 0;
+	pstHandle *h = handle;
+	char *file = NULL;
+	size_t prefixlen = 0;
+	int k;
 
 	FUNC_ENTRY;
-	if (clientDir == NULL)
+	if (h == NULL || h->clientDir == NULL)
 	{
 		rc = MQTTCLIENT_PERSISTENCE_ERROR;
 		goto exit;
 	}
-
-	/* consider '/' + '\0' */
-	/* consider '/' + '\0' */
-	alloclen = strlen(clientDir) + strlen(key) + strlen(MESSAGE_FILENAME_EXTENSION) + 2;
-	file = malloc(alloclen);
-	if (!file)
+	if ((file = pstFileNames(h, count, keys, &prefixlen)) == NULL)
 	{
 		rc = PAHO_MEMORY_ERROR;
 		goto exit;
 	}
-	if (snprintf(file, alloclen, "%s/%s%s", clientDir, key, MESSAGE_FILENAME_EXTENSION) >= alloclen)
-		rc = MQTTCLIENT_PERSISTENCE_ERROR;
-	else
+
+	for (k = 0; k < count; k++)
 	{
+		if (TreeFind(h->keys, keys[k]) == NULL)
+			continue; /* not persisted, so there is no file to remove */
+		sprintf(&file[prefixlen], "%s%s", keys[k], MESSAGE_FILENAME_EXTENSION);
 #if defined(_WIN32) || defined(_WIN64)
-		if ( _unlink(file) != 0 )
-		{
+		if ( _unlink(file) != 0 && errno != ENOENT )
 #else
-		if ( unlink(file) != 0 )
-		{
+		if ( unlink(file) != 0 && errno != ENOENT )
 #endif
-			if ( errno != ENOENT )
-				rc = MQTTCLIENT_PERSISTENCE_ERROR;
-		}
+			rc = MQTTCLIENT_PERSISTENCE_ERROR; /* carry on with the rest */
+		else
+			free(TreeRemoveKey(h->keys, keys[k]));
 	}
 
 	free(file);
@@ -365,16 +435,44 @@ exit:
 }
 
 
+/**
+ * Allocates a buffer big enough for the file name of any of the keys, starting with the
+ * client persistence directory.
+ * @param h the persistence handle
+ * @param count the number of keys
+ * @param keys the keys
+ * @param prefixlen set to the length of the directory part of the name, where the key goes
+ * @return the buffer, or NULL if it could not be allocated
+ */
+static char* pstFileNames(pstHandle* h, int count, char* keys[], size_t* prefixlen)
+{
+	size_t keylen = 0;
+	char* file = NULL;
+	int k;
+
+	for (k = 0; k < count; k++)
+	{
+		if (strlen(keys[k]) > keylen)
+			keylen = strlen(keys[k]);
+	}
+	/* consider '/' + '\0' */
+	if ((file = malloc(strlen(h->clientDir) + keylen + strlen(MESSAGE_FILENAME_EXTENSION) + 2)) != NULL)
+		*prefixlen = sprintf(file, "%s/", h->clientDir);
+	return file;
+}
+
+
 /** Delete client persistence directory (if empty).
  *  See ::Persistence_close
  */
 int pstclose(void* handle)
 {
 	int rc = 0;
-	char *clientDir = handle;
+	pstHandle *h = handle;
+	char *clientDir;
 
 	FUNC_ENTRY;
-	if (clientDir == NULL)
+	if (h == NULL || (clientDir = h->clientDir) == NULL)
 	{
 		rc = MQTTCLIENT_PERSISTENCE_ERROR;
 		goto exit;
@@ -391,7 +489,10 @@ int pstclose(void* handle)
 			rc = MQTTCLIENT_PERSISTENCE_ERROR;
 	}
 
+	pstIndexEmpty(h->keys);
+	TreeFree(h->keys);
 	free(clientDir);
+	free(h);
 
 exit:
 	FUNC_EXIT_RC(rc);
@@ -405,20 +506,16 @@ exit:
 int pstcontainskey(void *handle, char *key)
 {
 	int rc = 0;
-	char *clientDir = handle;
+	pstHandle *h = handle;
 
 	FUNC_ENTRY;
-	if (clientDir == NULL)
+	if (h == NULL || h->keys == NULL)
 	{
 		rc = MQTTCLIENT_PERSISTENCE_ERROR;
 		goto exit;
 	}
 
-#if defined(_WIN32) || defined(_WIN64)
-	rc = containskeyWin32(clientDir, key);
-#else
-	rc = containskeyUnix(clientDir, key);
-#endif
+	rc = (TreeFind(h->keys, key) != NULL) ? 0 : MQTTCLIENT_PERSISTENCE_ERROR;
 
 exit:
 	FUNC_EXIT_RC(rc);
@@ -426,127 +523,17 @@ exit:
 }
 
 
-#if defined(_WIN32) || defined(_WIN64)
-int containskeyWin32(char *dirname, char *key)
-{
-	int notFound = MQTTCLIENT_PERSISTENCE_ERROR;
-	int fFinished = 0;
-	char *filekey, *ptraux;
-#if defined(_WIN32) || defined(_WIN64)
-#define DIRSIZE MAX_PATH+1
-#else
-	const size_t DIRSIZE = MAX_PATH+1;
-#endif
-	char dir[DIRSIZE];
-	WIN32_FIND_DATAA FileData;
-	HANDLE hDir;
-
-	FUNC_ENTRY;
-	if (snprintf(dir, DIRSIZE, "%s/*", dirname) >= DIRSIZE)
-		goto exit;
-
-	hDir = FindFirstFileA(dir, &FileData);
-	if (hDir != INVALID_HANDLE_VALUE)
-	{
-		while (!fFinished)
-		{
-			if (FileData.dwFileAttributes & FILE_ATTRIBUTE_ARCHIVE)
-			{
-				if ((filekey = malloc(strlen(FileData.cFileName) + 1)) == NULL)
-				{
-					notFound = PAHO_MEMORY_ERROR;
-					goto exit;
-				}
-				strcpy(filekey, FileData.cFileName);
-				ptraux = strstr(filekey, MESSAGE_FILENAME_EXTENSION);
-				if ( ptraux != NULL )
-					*ptraux = '\0' ;
-				if(strcmp(filekey, key) == 0)
-				{
-					notFound = 0;
-					fFinished = 1;
-				}
-				free(filekey);
-			}
-			if (!FindNextFileA(hDir, &FileData))
-			{
-				if (GetLastError() == ERROR_NO_MORE_FILES)
-					fFinished = 1;
-			}
-		}
-		FindClose(hDir);
-	}
-exit:
-	FUNC_EXIT_RC(notFound);
-	return notFound;
-}
-#else
-int containskeyUnix(char *dirname, char *key)
-{
-	int notFound = MQTTCLIENT_PERSISTENCE_ERROR;
-	char *filekey, *ptraux;
-	DIR *dp = NULL;
-	struct dirent *dir_entry;
-	struct stat stat_info;
-
-	FUNC_ENTRY;
-	if((dp = opendir(dirname)) != NULL)
-	{
-		while((dir_entry = readdir(dp)) != NULL && notFound)
-		{
-			const size_t allocsize = strlen(dirname) + strlen(dir_entry->d_name) + 2;
-			char* filename = malloc(allocsize);
-
-			if (!filename)
-			{
-				notFound = PAHO_MEMORY_ERROR;
-				goto exit;
-			}
-			if (snprintf(filename, allocsize, "%s/%s", dirname, dir_entry->d_name) >= allocsize)
-			{
-				free(filename);
-				notFound = MQTTCLIENT_PERSISTENCE_ERROR;
-				goto exit;
-			}
-			lstat(filename, &stat_info);
-			free(filename);
-			if(S_ISREG(stat_info.st_mode))
-			{
-				if ((filekey = malloc(strlen(dir_entry->d_name) + 1)) == NULL)
-				{
-					notFound = PAHO_MEMORY_ERROR;
-					goto exit;
-				}
-				strcpy(filekey, dir_entry->d_name);
-				ptraux = strstr(filekey, MESSAGE_FILENAME_EXTENSION);
-				if ( ptraux != NULL )
-					*ptraux = '\0' ;
-				if(strcmp(filekey, key) == 0)
-					notFound = 0;
-				free(filekey);
-			}
-		}
-	}
-
-exit:
-	if (dp)
-		closedir(dp);
-	FUNC_EXIT_RC(notFound);
-	return notFound;
-}
-#endif
-
-
 /** Delete all the persisted message in the client persistence directory.
  * See ::Persistence_clear
  */
 int pstclear(void *handle)
 {
 	int rc = 0;
-	char *clientDir = handle;
+	pstHandle *h = handle;
+	char *clientDir;
 
 	FUNC_ENTRY;
-	if (clientDir == NULL)
+	if (h == NULL || (clientDir = h->clientDir) == NULL)
 	{
 		rc = MQTTCLIENT_PERSISTENCE_ERROR;
 		goto exit;
@@ -557,6 +544,9 @@ int pstclear(void *handle)
 #else
 	rc = clearUnix(clientDir);
 #endif
+	pstIndexEmpty(h->keys);
+	if (rc != 0) /* some files may not have been removed, so read the directory again */
+		pstIndex(h);
 
 exit:
 	FUNC_EXIT_RC(rc);
@@ -637,11 +627,22 @@ int clearUnix(char *dirname)
 	{
 		while((dir_entry = readdir(dp)) != NULL && rc == 0)
 		{
-			if (lstat(dir_entry->d_name, &stat_info) == 0 && S_ISREG(stat_info.st_mode))
+			size_t allocsize = strlen(dirname) + strlen(dir_entry->d_name) + 2;
+			char* file = malloc(allocsize);
+
+			if (!file)
+			{
+				rc = PAHO_MEMORY_ERROR;
+				break;
+			}
+			if (snprintf(file, allocsize, "%s/%s", dirname, dir_entry->d_name) >= allocsize)
+				rc = MQTTCLIENT_PERSISTENCE_ERROR;
+			else if (lstat(file, &stat_info) == 0 && S_ISREG(stat_info.st_mode))
 			{
-				if (remove(dir_entry->d_name) != 0 && errno != ENOENT)
+				if (remove(file) != 0 && errno != ENOENT)
 					rc = MQTTCLIENT_PERSISTENCE_ERROR;
 			}
+			free(file);
 		}
 		closedir(dp);
 	} else
@@ -659,39 +660,167 @@ int clearUnix(char *dirname)
 int pstkeys(void *handle, char ***keys, int *nkeys)
 {
 	int rc = 0;
-	char *clientDir = handle;
+	pstHandle *h = handle;
+	char **fkeys = NULL;
+	int nfkeys = 0;
+	Node *current = NULL;
 
 	FUNC_ENTRY;
-	if (clientDir == NULL)
+	if (h == NULL || h->keys == NULL)
 	{
 		rc = MQTTCLIENT_PERSISTENCE_ERROR;
 		goto exit;
 	}
 
+	if (h->keys->count > 0)
+	{
+		if ((fkeys = (char **)malloc(h->keys->count * sizeof(char *))) == NULL)
+		{
+			rc = PAHO_MEMORY_ERROR;
+			goto exit;
+		}
+
+		/* copy the keys, which the index holds in stem and then numeric order */
+		while ((current = TreeNextElement(h->keys, current)) != NULL)
+		{
+			if ((fkeys[nfkeys] = malloc(strlen((char*)current->content) + 1)) == NULL)
+			{
+				while (--nfkeys >= 0)
+					free(fkeys[nfkeys]);
+				free(fkeys);
+				rc = PAHO_MEMORY_ERROR;
+				goto exit;
+			}
+			strcpy(fkeys[nfkeys++], (char*)current->content);
+		}
+	}
+
+	*nkeys = nfkeys;
+	*keys = fkeys;
+	/* the caller must free keys */
+
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/**
+ * Returns the length of the stem of a persistence key, up to and including its last '-', which
+ * the sequence number or message id follows.  The stems of the MQTT V5 keys, such as "c5-" and
+ * "sc5-", themselves contain digits.
+ */
+static size_t pstKeyStem(const char* key)
+{
+	const char* dash = strrchr(key, '-');
+
+	return (dash == NULL) ? strlen(key) : (size_t)(dash - key) + 1;
+}
+
+
+/**
+ * Orders persistence keys by the stem, then by the number following it, so that the keys
+ * of each type are listed in message id or sequence number order: "s-9" before "s-10", and
+ * "c5-9" before "c5-10".
+ * As with ::TreeIntCompare, the result is reversed so that the tree walk is in ascending order.
+ */
+static int pstKeyCompare(void* a, void* b, int value)
+{
+	const char* key1 = b;
+	const char* key2 = a;
+	size_t stem1 = pstKeyStem(key1);
+	size_t stem2 = pstKeyStem(key2);
+	size_t digits1, digits2;
+	int rc = 0;
+
+	if ((rc = strncmp(key1, key2, (stem1 < stem2) ? stem1 : stem2)) != 0)
+		goto exit;
+	if (stem1 != stem2)
+	{
+		rc = (stem1 < stem2) ? -1 : 1;
+		goto exit;
+	}
+	/* same stem, so a longer number is a larger one */
+	digits1 = strspn(&key1[stem1], "0123456789");
+	digits2 = strspn(&key2[stem2], "0123456789");
+	if (digits1 != digits2)
+		rc = (digits1 < digits2) ? -1 : 1;
+	else
+		rc = strcmp(&key1[stem1], &key2[stem2]);
+exit:
+	return rc;
+}
+
+
+/**
+ * Adds a key to the index, if it is not already there.
+ * @param index the key index
+ * @param key the key to add, which is copied
+ * @return 0 if success, #PAHO_MEMORY_ERROR otherwise
+ */
+static int pstIndexAdd(Tree* index, const char* key)
+{
+	int rc = 0;
+	char* copy = NULL;
+
+	if (TreeFind(index, (void*)key) != NULL)
+		goto exit;
+	if ((copy = malloc(strlen(key) + 1)) == NULL)
+	{
+		rc = PAHO_MEMORY_ERROR;
+		goto exit;
+	}
+	strcpy(copy, key);
+	if (TreeAdd(index, copy, strlen(copy) + 1) == NULL)
+	{
+		free(copy);
+		rc = PAHO_MEMORY_ERROR;
+	}
+exit:
+	return rc;
+}
+
+
+/**
+ * Removes and frees all the keys in the index.
+ * @param index the key index
+ */
+static void pstIndexEmpty(Tree* index)
+{
+	while (index->index[0].root != NULL)
+		free(TreeRemoveNodeIndex(index, index->index[0].root, 0));
+}
+
+
+/**
+ * Reads the client persistence directory to add the keys it contains to the index.
+ * @param h the persistence handle
+ * @return 0 if success, #MQTTCLIENT_PERSISTENCE_ERROR or #PAHO_MEMORY_ERROR otherwise
+ */
+static int pstIndex(pstHandle* h)
+{
+	int rc = 0;
+
+	FUNC_ENTRY;
 #if defined(_WIN32) || defined(_WIN64)
-	rc = keysWin32(clientDir, keys, nkeys);
+	rc = indexWin32(h->clientDir, h->keys);
 #else
-	rc = keysUnix(clientDir, keys, nkeys);
+	rc = indexUnix(h->clientDir, h->keys);
 #endif
-
-exit:
 	FUNC_EXIT_RC(rc);
 	return rc;
 }
 
 
 #if defined(_WIN32) || defined(_WIN64)
-int keysWin32(char *dirname, char ***keys, int *nkeys)
+int indexWin32(char *dirname, Tree *index)
 {
 	int rc = 0;
-	char **fkeys = NULL;
-	int nfkeys = 0;
 	char dir[DIRSIZE];
 	WIN32_FIND_DATAA FileData;
 	HANDLE hDir;
 	int fFinished = 0;
 	char *ptraux;
-	int i;
 
 	FUNC_ENTRY;
 	if (snprintf(dir, DIRSIZE, "%s/*", dirname) >= DIRSIZE)
@@ -700,56 +829,17 @@ int keysWin32(char *dirname, char ***keys, int *nkeys)
 		goto exit;
 	}
 
-	/* get number of keys */
 	hDir = FindFirstFileA(dir, &FileData);
 	if (hDir != INVALID_HANDLE_VALUE)
 	{
-		while (!fFinished)
+		while (!fFinished && rc == 0)
 		{
 			if (FileData.dwFileAttributes & FILE_ATTRIBUTE_ARCHIVE)
-				nfkeys++;
-			if (!FindNextFileA(hDir, &FileData))
 			{
-				if (GetLastError() == ERROR_NO_MORE_FILES)
-					fFinished = 1;
-			}
-		}
-		FindClose(hDir);
-	} else
-	{
-		rc = MQTTCLIENT_PERSISTENCE_ERROR;
-		goto exit;
-	}
-
-	if (nfkeys != 0)
-	{
-		if ((fkeys = (char **)malloc(nfkeys * sizeof(char *))) == NULL)
-		{
-			rc = PAHO_MEMORY_ERROR;
-			goto exit;
-		}
-	}
-
-	/* copy the keys */
-	hDir = FindFirstFileA(dir, &FileData);
-	if (hDir != INVALID_HANDLE_VALUE)
-	{
-		fFinished = 0;
-		i = 0;
-		while (!fFinished)
-		{
-			if (FileData.dwFileAttributes & FILE_ATTRIBUTE_ARCHIVE)
-			{
-				if ((fkeys[i] = malloc(strlen(FileData.cFileName) + 1)) == NULL)
-				{
-					rc = PAHO_MEMORY_ERROR;
-					goto exit;
-				}
-				strcpy(fkeys[i], FileData.cFileName);
-				ptraux = strstr(fkeys[i], MESSAGE_FILENAME_EXTENSION);
+				ptraux = strstr(FileData.cFileName, MESSAGE_FILENAME_EXTENSION);
 				if ( ptraux != NULL )
 					*ptraux = '\0' ;
-				i++;
+				rc = pstIndexAdd(index, FileData.cFileName);
 			}
 			if (!FindNextFileA(hDir, &FileData))
 			{
@@ -759,138 +849,61 @@ int keysWin32(char *dirname, char ***keys, int *nkeys)
 		}
 		FindClose(hDir);
 	} else
-	{
 		rc = MQTTCLIENT_PERSISTENCE_ERROR;
-		goto exit;
-	}
-
-	*nkeys = nfkeys;
-	*keys = fkeys;
-	/* the caller must free keys */
 
 exit:
 	FUNC_EXIT_RC(rc);
 	return rc;
 }
 #else
-int keysUnix(char *dirname, char ***keys, int *nkeys)
+int indexUnix(char *dirname, Tree *index)
 {
 	int rc = 0;
-	char **fkeys = NULL;
-	int nfkeys = 0;
 	char *ptraux;
-	int i;
 	DIR *dp = NULL;
 	struct dirent *dir_entry;
 	struct stat stat_info;
 
 	FUNC_ENTRY;
-	/* get number of keys */
 	if((dp = opendir(dirname)) != NULL)
 	{
-		while((dir_entry = readdir(dp)) != NULL)
+		while(rc == 0 && (dir_entry = readdir(dp)) != NULL)
 		{
-			size_t allocsize = strlen(dirname)+strlen(dir_entry->d_name)+2;
-			char* temp = malloc(allocsize);
+			int regular = 0;
 
-			if (!temp)
-			{
-				rc = PAHO_MEMORY_ERROR;
-				goto exit;
-			}
-			if (snprintf(temp, allocsize, "%s/%s", dirname, dir_entry->d_name) >= allocsize)
-			{
-				free(temp);
-				rc = MQTTCLIENT_PERSISTENCE_ERROR;
-				goto exit;
-			}
-			if (lstat(temp, &stat_info) == 0 && S_ISREG(stat_info.st_mode))
-				nfkeys++;
-			free(temp);
-		}
-		closedir(dp);
-		dp = NULL;
-	} else
-	{
-		rc = MQTTCLIENT_PERSISTENCE_ERROR;
-		goto exit;
-	}
-
-	if (nfkeys != 0)
-	{
-		if ((fkeys = (char **)malloc(nfkeys * sizeof(char *))) == NULL)
-		{
-			rc = PAHO_MEMORY_ERROR;
-			goto exit;
-		}
-
-		/* copy the keys */
-		if((dp = opendir(dirname)) != NULL)
-		{
-			i = 0;
-			while((dir_entry = readdir(dp)) != NULL)
+#if defined(DT_REG)
+			/* most file systems give us the type, saving a stat per file */
+			if (dir_entry->d_type != DT_UNKNOWN)
+				regular = (dir_entry->d_type == DT_REG);
+			else
+#endif
 			{
 				size_t allocsize = strlen(dirname)+strlen(dir_entry->d_name)+2;
 				char* temp = malloc(allocsize);
 
 				if (!temp)
 				{
-					free(fkeys);
 					rc = PAHO_MEMORY_ERROR;
-					goto exit;
+					break;
 				}
 				if (snprintf(temp, allocsize, "%s/%s", dirname, dir_entry->d_name) >= allocsize)
-				{
-					free(temp);
-					free(fkeys);
 					rc = MQTTCLIENT_PERSISTENCE_ERROR;
-					goto exit;
-				}
-				// comment by Clark:: S_ISREG: 是否一个常规文件         ::2020-12-22
-				/**
-				 *  S_ISLNK(st_mode)：是否是一个连接.
-				 *	S_ISREG(st_mode)：是否是一个常规文件.
-				 *	S_ISDIR(st_mode)：是否是一个目录
-				 *	S_ISCHR(st_mode)：是否是一个字符设备.
-				 *	S_ISBLK(st_mode)：是否是一个块设备
-				 *	S_ISFIFO(st_mode)：是否 是一个FIFO文件.
-				 *	S_ISSOCK(st_mode)：是否是一个SOCKET文件 
-				*/
-
-				// comment by Clark:: temp构造出来只是为了判断此文件是否为一个普通文件            ::2020-12-22
-				if (lstat(temp, &stat_info) == 0 && S_ISREG(stat_info.st_mode))
-				{
-					if ((fkeys[i] = malloc(strlen(dir_entry->d_name) + 1)) == NULL)
-					{
-						free(temp);
-						free(fkeys);
-						rc = PAHO_MEMORY_ERROR;
-						goto exit;
-					}
-					strcpy(fkeys[i], dir_entry->d_name);
-
-					// comment by Clark:: 去掉文件结尾的后缀.msg  ::2020-12-22
-					ptraux = strstr(fkeys[i], MESSAGE_FILENAME_EXTENSION);
-					if ( ptraux != NULL )
-						*ptraux = '\0' ;
-					i++;
-				}
+				else
+					regular = (lstat(temp, &stat_info) == 0 && S_ISREG(stat_info.st_mode));
 				free(temp);
 			}
-		} else
-		{
-			rc = MQTTCLIENT_PERSISTENCE_ERROR;
-			goto exit;
+			if (regular)
+			{
+				ptraux = strstr(dir_entry->d_name, MESSAGE_FILENAME_EXTENSION);
+				if ( ptraux != NULL )
+					*ptraux = '\0' ;
+				rc = pstIndexAdd(index, dir_entry->d_name);
+			}
 		}
-	}
-
-	*nkeys = nfkeys;
-	*keys = fkeys;
-	/* the caller must free keys */
-
-exit:
-	if (dp)
 		closedir(dp);
+	} else
+		rc = MQTTCLIENT_PERSISTENCE_ERROR;
+
 	FUNC_EXIT_RC(rc);
 	return rc;
 }
@@ -908,7 +921,7 @@ int main (int argc, char *argv[])
 #define RC !rc ? "(Success)" : "(Failed) "
 
 	int rc;
-	char *handle;
+	pstHandle *handle;
 	char *perdir = ".";
 	const char *clientID = "TheUTClient";
 	const char *serverURI = "127.0.0.1:1883";
@@ -932,7 +945,7 @@ int main (int argc, char *argv[])
 	/* open */
 	/* printf("Persistence directory : %s\n", perdir); */
 	rc = pstopen((void**)&handle, clientID, serverURI, perdir);
-	printf("%s Persistence directory for client %s : %s\n", RC, clientID, handle);
+	printf("%s Persistence directory for client %s : %s\n", RC, clientID, handle->clientDir);
 
 	/* put */
 	for(msgId=0;msgId<NMSGS;msgId++)
@@ -946,7 +959,7 @@ int main (int argc, char *argv[])
 
 	/* keys ,ie, list keys added */
 	rc = pstkeys(handle, &keys, &nkeys);
-	printf("%s Found %d messages persisted in %s\n", RC, nkeys, handle);
+	printf("%s Found %d messages persisted in %s\n", RC, nkeys, handle->clientDir);
 	for(i=0;i<nkeys;i++)
 		printf("%13s\n", keys[i]);
 
@@ -992,7 +1005,7 @@ int main (int argc, char *argv[])
 
 	/* keys ,ie, list keys added */
 	rc = pstkeys(handle, &keys, &nkeys);
-	printf("%s Found %d messages persisted in %s\n", RC, nkeys, handle);
+	printf("%s Found %d messages persisted in %s\n", RC, nkeys, handle->clientDir);
 	for(i=0;i<nkeys;i++)
 		printf("%13s\n", keys[i]);
 
@@ -1000,17 +1013,13 @@ int main (int argc, char *argv[])
 		free(keys);
 
 
-	/* close -> it will fail, since client persistence directory is not empty */
-	rc = pstclose(&handle);
-	printf("%s Closing client persistence directory for client %s\n", RC, clientID);
-
 	/* clear */
 	rc = pstclear(handle);
-	printf("%s Deleting all persisted messages in %s\n", RC, handle);
+	printf("%s Deleting all persisted messages in %s\n", RC, handle->clientDir);
 
 	/* keys ,ie, list keys added */
 	rc = pstkeys(handle, &keys, &nkeys);
-	printf("%s Found %d messages persisted in %s\n", RC, nkeys, handle);
+	printf("%s Found %d messages persisted in %s\n", RC, nkeys, handle->clientDir);
 	for(i=0;i<nkeys;i++)
 		printf("%13s\n", keys[i]);
 
@@ -1018,7 +1027,7 @@ int main (int argc, char *argv[])
 		free(keys);
 
 	/* close */
-	rc = pstclose(&handle);
+	rc = pstclose(handle);
 	printf("%s Closing client persistence directory for client %s\n", RC, clientID);
 }
 #endif
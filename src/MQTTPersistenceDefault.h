@@ -31,6 +31,8 @@ int pstremove(void* handle, char* key);
 int pstkeys(void* handle, char*** keys, int* nkeys); 
 int pstclear(void* handle); 
 int pstcontainskey(void* handle, char* key);
+int pstputMany(void* handle, int count, char* keys[], int bufcounts[], char** buffers[], int* buflens[]);
+int pstremoveMany(void* handle, int count, char* keys[]);
 
 int pstmkdir(char *pPathname);
 
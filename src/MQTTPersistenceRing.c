@@ -0,0 +1,952 @@
+/*******************************************************************************
+ * Copyright (c) 2026 Contributors to the Eclipse Foundation
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v2.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    https://www.eclipse.org/legal/epl-2.0/
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *******************************************************************************/
+
+/**
+ * @file
+ * \brief A ring buffer persistence implementation, in one memory-mapped file per client.
+ *
+ * The file is created at a fixed size when the persistence is opened, and is named
+ * directory/clientID-serverURI.ring.  It starts with a header holding the head and tail
+ * offsets of the ring, and the number of bytes in use between them.  Records are appended
+ * at the tail, and removed by marking them dead in place.  The head moves past dead records,
+ * so a client which removes records in roughly the order it added them reuses the space
+ * without any file being created or deleted.
+ *
+ * A record is written and flushed to disk before the tail is moved past it, and the header
+ * is flushed after every change, so a record which was being written when the process stopped
+ * is ignored on restore.  A record which replaces or moves another is on disk before the other
+ * is marked dead, and if both are found on restore, the later one is kept.  Restoring reads only the records between the head and the tail, to
+ * rebuild the in-memory index of keys.
+ *
+ * If there is no space for a new record, live records at the head are moved to the tail
+ * to reclaim the dead space behind them.  If the buffer is full of live records, or there
+ * is no space at the tail to move the head to, and overwriteOldest is set, the oldest buffered commands (keys starting "c-" or "c5-") are
+ * overwritten, as deleteOldestMessages does for the command queue.  The state of messages
+ * in flight is never overwritten, so the write fails if the oldest record is not a command.
+ */
+
+#if !defined(NO_PERSISTENCE)
+
+#include "OsWrapper.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+
+#if defined(_WIN32) || defined(_WIN64)
+	#include <windows.h>
+	#define snprintf _snprintf
+#else
+	#include <sys/types.h>
+	#include <sys/stat.h>
+	#include <sys/mman.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+
+#include "MQTTClientPersistence.h"
+#include "MQTTPersistenceDefault.h"
+#include "MQTTPersistence.h"
+#include "MQTTPersistenceRing.h"
+#include "Tree.h"
+#include "Log.h"
+#include "StackTrace.h"
+#include "Heap.h"
+
+#define RING_EYECATCHER "MQRF"
+#define RING_FORMAT_VERSION 1
+#define RING_HEADER_SIZE 64            /**< space reserved for the file header */
+#define RING_RECORD_MAGIC 0x4D515252   /**< "MQRR" */
+#define RING_KEY_LENGTH 16             /**< including the terminating null */
+
+#define RING_LIVE 1
+#define RING_DEAD 2
+#define RING_WRAP 3                    /**< the rest of the ring to the end is unused */
+
+#define RING_ALIGN(x) (((uint64_t)(x) + 7) & ~((uint64_t)7))
+#define RING_RECORD_SIZE(len) RING_ALIGN(sizeof(ringRecord) + (len))
+
+/** The file header */
+typedef struct
+{
+	char eyecatcher[4];
+	uint32_t version;
+	uint64_t capacity;      /**< the number of bytes in the ring, following the header */
+	uint64_t head;          /**< offset of the oldest record */
+	uint64_t tail;          /**< offset at which the next record will be written */
+	uint64_t used;          /**< bytes from head to tail, including any unused space at a wrap */
+	uint64_t seqno;         /**< the sequence number of the next record */
+} ringHeader;
+
+/** The header of each record in the ring, followed by the data */
+typedef struct
+{
+	uint32_t magic;
+	uint32_t state;         /**< RING_LIVE, RING_DEAD or RING_WRAP */
+	uint32_t len;           /**< the length of the data following this header */
+	uint32_t reserved;
+	uint64_t seqno;         /**< the later of two live records with the same key is current */
+	char key[RING_KEY_LENGTH];
+} ringRecord;
+
+/** An entry in the in-memory index of the live records */
+typedef struct
+{
+	char key[RING_KEY_LENGTH]; /**< must be first, so that entries can be found with TreeStringCompare */
+	uint64_t offset;
+} ringEntry;
+
+/** The handle returned by ::ringopen */
+typedef struct
+{
+#if defined(_WIN32) || defined(_WIN64)
+	HANDLE file;
+	HANDLE mapping;
+#else
+	int fd;
+#endif
+	char* base;             /**< the start of the mapped file */
+	size_t mapsize;         /**< the size of the mapped file */
+	ringHeader* header;
+	char* data;             /**< the start of the ring */
+	Tree* index;            /**< ringEntry by key */
+	uint64_t live;          /**< bytes used by live records */
+	int overwriteOldest;
+} ringHandle;
+
+static int ringMap(ringHandle* r, const char* filename, uint64_t capacity);
+static void ringUnmap(ringHandle* r);
+static void ringFlush(ringHandle* r, void* from, uint64_t len);
+static int ringScan(ringHandle* r);
+static void ringAdvanceHead(ringHandle* r);
+static int ringReserve(ringHandle* r, uint64_t size, uint64_t* offset);
+static void ringFreeIndex(Tree* index);
+
+
+static ringRecord* ringRecordAt(ringHandle* r, uint64_t offset)
+{
+	return (ringRecord*)&r->data[offset];
+}
+
+
+/**
+ * Whether the ring from this offset to the end is unused, because the next record did not fit.
+ */
+static int ringIsWrap(ringHandle* r, uint64_t offset)
+{
+	return (r->header->capacity - offset < sizeof(ringRecord) || ringRecordAt(r, offset)->state == RING_WRAP);
+}
+
+
+/** Open the ring buffer file for the client: context->directory/clientID-serverURI.ring
+ *  See ::Persistence_open
+ */
+int ringopen(void** handle, const char* clientID, const char* serverURI, void* context)
+{
+	int rc = 0;
+	MQTTClient_ringPersistenceOptions* opts = context;
+	const char* dataDir = (opts->directory) ? opts->directory : ".";
+	char* filename = NULL;
+	char* ptraux;
+	ringHandle* r = NULL;
+	size_t alloclen = 0;
+
+	FUNC_ENTRY;
+	/* consider '/'  +  '-'  +  '\0' */
+	alloclen = strlen(dataDir) + strlen(clientID) + strlen(serverURI) + strlen(RING_FILENAME_EXTENSION) + 3;
+	if ((filename = malloc(alloclen)) == NULL)
+	{
+		rc = PAHO_MEMORY_ERROR;
+		goto exit;
+	}
+	if (snprintf(filename, alloclen, "%s/%s-", dataDir, clientID) >= alloclen)
+	{
+		rc = MQTTCLIENT_PERSISTENCE_ERROR;
+		goto exit;
+	}
+	/* the server URI is part of the file name, so ':' and '/' can't be used */
+	ptraux = &filename[strlen(filename)];
+	strcpy(ptraux, serverURI);
+	while ((ptraux = strpbrk(ptraux, ":/\\")) != NULL)
+		*ptraux = '-';
+	strcat(filename, RING_FILENAME_EXTENSION);
+
+	if ((rc = pstmkdir((char*)dataDir)) != 0)
+		goto exit;
+
+	if ((r = malloc(sizeof(ringHandle))) == NULL)
+	{
+		rc = PAHO_MEMORY_ERROR;
+		goto exit;
+	}
+	memset(r, '\0', sizeof(ringHandle));
+	r->overwriteOldest = opts->overwriteOldest;
+	if ((r->index = TreeInitialize(TreeStringCompare)) == NULL)
+	{
+		free(r);
+		r = NULL;
+		rc = PAHO_MEMORY_ERROR;
+		goto exit;
+	}
+
+	if ((rc = ringMap(r, filename, RING_ALIGN(opts->size))) == 0)
+		rc = ringScan(r);
+	if (rc != 0)
+	{
+		ringUnmap(r);
+		ringFreeIndex(r->index);
+		free(r);
+		r = NULL;
+		goto exit;
+	}
+	Log(TRACE_MINIMUM, -1, "Ring persistence %s opened with %u records, %u of %u bytes used", filename,
+			(unsigned int)r->index->count, (unsigned int)r->header->used, (unsigned int)r->header->capacity);
+	*handle = r;
+
+exit:
+	if (filename)
+		free(filename);
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/**
+ * Opens and maps the ring file, creating it at the requested size if it is not already
+ * a valid ring file.
+ * @param r the ring handle to fill in
+ * @param filename the name of the ring file
+ * @param capacity the size of the ring for a new file
+ * @return 0 if success, #MQTTCLIENT_PERSISTENCE_ERROR otherwise
+ */
+static int ringMap(ringHandle* r, const char* filename, uint64_t capacity)
+{
+	int rc = 0;
+	ringHeader header;
+	int existing = 0;
+
+	FUNC_ENTRY;
+	memset(&header, '\0', sizeof(header));
+#if defined(_WIN32) || defined(_WIN64)
+	{
+		LARGE_INTEGER size;
+		DWORD bytesRead = 0;
+
+		r->file = CreateFileA(filename, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (r->file == INVALID_HANDLE_VALUE)
+		{
+			r->file = NULL;
+			rc = MQTTCLIENT_PERSISTENCE_ERROR;
+			goto exit;
+		}
+		if (GetFileSizeEx(r->file, &size) && size.QuadPart > RING_HEADER_SIZE &&
+			ReadFile(r->file, &header, sizeof(header), &bytesRead, NULL) && bytesRead == sizeof(header) &&
+			memcmp(header.eyecatcher, RING_EYECATCHER, 4) == 0 && header.version == RING_FORMAT_VERSION &&
+			header.capacity + RING_HEADER_SIZE == (uint64_t)size.QuadPart)
+			existing = 1;
+		else
+		{
+			size.QuadPart = RING_HEADER_SIZE + capacity;
+			if (!SetFilePointerEx(r->file, size, NULL, FILE_BEGIN) || !SetEndOfFile(r->file))
+			{
+				rc = MQTTCLIENT_PERSISTENCE_ERROR;
+				goto exit;
+			}
+		}
+		r->mapsize = (size_t)(RING_HEADER_SIZE + (existing ? header.capacity : capacity));
+		r->mapping = CreateFileMappingA(r->file, NULL, PAGE_READWRITE, 0, 0, NULL);
+		if (r->mapping == NULL ||
+			(r->base = MapViewOfFile(r->mapping, FILE_MAP_ALL_ACCESS, 0, 0, r->mapsize)) == NULL)
+		{
+			rc = MQTTCLIENT_PERSISTENCE_ERROR;
+			goto exit;
+		}
+	}
+#else
+	{
+		struct stat st;
+		void* base = NULL;
+
+		if ((r->fd = open(filename, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR)) < 0)
+		{
+			rc = MQTTCLIENT_PERSISTENCE_ERROR;
+			goto exit;
+		}
+		if (fstat(r->fd, &st) == 0 && st.st_size > RING_HEADER_SIZE &&
+			pread(r->fd, &header, sizeof(header), 0) == sizeof(header) &&
+			memcmp(header.eyecatcher, RING_EYECATCHER, 4) == 0 && header.version == RING_FORMAT_VERSION &&
+			header.capacity + RING_HEADER_SIZE == (uint64_t)st.st_size)
+			existing = 1;
+		else
+		{
+			if (ftruncate(r->fd, 0) != 0 || ftruncate(r->fd, (off_t)(RING_HEADER_SIZE + capacity)) != 0)
+			{
+				rc = MQTTCLIENT_PERSISTENCE_ERROR;
+				goto exit;
+			}
+#if defined(__linux__)
+			/* allocate the blocks now, so that writes can't fail later for lack of space */
+			posix_fallocate(r->fd, 0, (off_t)(RING_HEADER_SIZE + capacity));
+#endif
+		}
+		r->mapsize = (size_t)(RING_HEADER_SIZE + (existing ? header.capacity : capacity));
+		base = mmap(NULL, r->mapsize, PROT_READ | PROT_WRITE, MAP_SHARED, r->fd, 0);
+		if (base == MAP_FAILED)
+		{
+			rc = MQTTCLIENT_PERSISTENCE_ERROR;
+			goto exit;
+		}
+		r->base = base;
+	}
+#endif
+	r->header = (ringHeader*)r->base;
+	r->data = &r->base[RING_HEADER_SIZE];
+	if (!existing)
+	{
+		memset(r->header, '\0', sizeof(ringHeader));
+		memcpy(r->header->eyecatcher, RING_EYECATCHER, 4);
+		r->header->version = RING_FORMAT_VERSION;
+		r->header->capacity = capacity;
+	}
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/**
+ * Writes the mapped file to disk, and unmaps and closes it.
+ */
+static void ringUnmap(ringHandle* r)
+{
+	FUNC_ENTRY;
+#if defined(_WIN32) || defined(_WIN64)
+	if (r->base)
+	{
+		FlushViewOfFile(r->base, r->mapsize);
+		UnmapViewOfFile(r->base);
+	}
+	if (r->mapping)
+		CloseHandle(r->mapping);
+	if (r->file)
+		CloseHandle(r->file);
+	r->mapping = r->file = NULL;
+#else
+	if (r->base)
+	{
+		msync(r->base, r->mapsize, MS_SYNC);
+		munmap(r->base, r->mapsize);
+	}
+	if (r->fd > 0)
+		close(r->fd);
+	r->fd = 0;
+#endif
+	r->base = NULL;
+	r->header = NULL;
+	r->data = NULL;
+	FUNC_EXIT;
+}
+
+
+/**
+ * Writes part of the mapped file to disk.  Any part of the ring can be flushed, but the
+ * start of the range is rounded down to a page boundary for msync.
+ */
+static void ringFlush(ringHandle* r, void* from, uint64_t len)
+{
+#if defined(_WIN32) || defined(_WIN64)
+	FlushViewOfFile(from, (SIZE_T)len);
+#else
+	static long pagesize = 0;
+	char* start = NULL;
+
+	if (pagesize == 0)
+		pagesize = sysconf(_SC_PAGESIZE);
+	start = r->base + (((char*)from - r->base) / pagesize) * pagesize;
+	msync(start, (size_t)((char*)from + len - start), MS_SYNC);
+#endif
+}
+
+
+/**
+ * Reads the records between the head and the tail to build the index of live records.
+ * Anything after an incomplete record is discarded.
+ */
+static int ringScan(ringHandle* r)
+{
+	int rc = 0;
+	ringHeader* h = r->header;
+	uint64_t pos, remaining;
+
+	FUNC_ENTRY;
+	if (h->head > h->capacity || h->tail > h->capacity || h->used > h->capacity)
+	{
+		Log(LOG_ERROR, -1, "Ring persistence header is not valid, discarding the contents");
+		h->head = h->tail = h->used = 0;
+	}
+	pos = h->head;
+	remaining = h->used;
+	while (remaining > 0 && rc == 0)
+	{
+		ringRecord* rec = NULL;
+		uint64_t size = 0;
+
+		if (ringIsWrap(r, pos))
+		{
+			if (h->capacity - pos > remaining)
+				break; /* inconsistent, so stop here */
+			remaining -= h->capacity - pos;
+			pos = 0;
+			continue;
+		}
+		rec = ringRecordAt(r, pos);
+		size = RING_RECORD_SIZE(rec->len);
+		if (rec->magic != RING_RECORD_MAGIC || size > remaining || pos + size > h->capacity)
+			break;
+		if (rec->state == RING_LIVE)
+		{
+			Node* found = NULL;
+
+			rec->key[RING_KEY_LENGTH - 1] = '\0';
+			if ((found = TreeFind(r->index, rec->key)) != NULL)
+			{
+				/* an earlier write of the same key was not marked dead before the process stopped */
+				ringEntry* entry = (ringEntry*)(found->content);
+				ringRecord* other = ringRecordAt(r, entry->offset);
+
+				if (other->seqno < rec->seqno)
+				{
+					other->state = RING_DEAD;
+					r->live -= RING_RECORD_SIZE(other->len);
+					entry->offset = pos;
+					r->live += size;
+				}
+				else
+					rec->state = RING_DEAD;
+			}
+			else
+			{
+				ringEntry* entry = malloc(sizeof(ringEntry));
+
+				if (entry == NULL)
+					rc = PAHO_MEMORY_ERROR;
+				else
+				{
+					strcpy(entry->key, rec->key);
+					entry->offset = pos;
+					TreeAdd(r->index, entry, sizeof(ringEntry));
+					r->live += size;
+				}
+			}
+		}
+		pos += size;
+		remaining -= size;
+	}
+	if (remaining > 0)
+	{
+		Log(LOG_ERROR, -1, "Ring persistence discarding %u bytes after an incomplete record", (unsigned int)remaining);
+		h->used -= remaining;
+		h->tail = pos;
+	}
+	ringAdvanceHead(r);
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/**
+ * Moves the head past dead records and unused space.
+ */
+static void ringAdvanceHead(ringHandle* r)
+{
+	ringHeader* h = r->header;
+
+	while (h->used > 0)
+	{
+		if (ringIsWrap(r, h->head))
+		{
+			h->used -= h->capacity - h->head;
+			h->head = 0;
+		}
+		else
+		{
+			ringRecord* rec = ringRecordAt(r, h->head);
+			uint64_t size = RING_RECORD_SIZE(rec->len);
+
+			if (rec->state != RING_DEAD)
+				break;
+			h->head += size;
+			h->used -= size;
+		}
+	}
+	if (h->used == 0)
+		h->head = h->tail = 0;
+}
+
+
+/**
+ * Whether there is contiguous space for a record of this size at the tail, or at the start
+ * of the ring if the rest of the ring after the tail has to be skipped.
+ * @param padding set to the number of bytes to skip at the end of the ring
+ */
+static int ringFits(ringHandle* r, uint64_t size, uint64_t* padding)
+{
+	ringHeader* h = r->header;
+
+	*padding = 0;
+	if (h->used == 0)
+		h->head = h->tail = 0;
+	if (h->tail > h->head || h->used == 0)
+	{
+		if (h->capacity - h->tail >= size)
+			return 1;
+		*padding = h->capacity - h->tail;
+		return (h->head >= size);
+	}
+	return (h->head - h->tail >= size);
+}
+
+
+/**
+ * Claims space at the tail for a record of the given size, which must fit.
+ * The tail is not moved until the record has been written.
+ */
+static uint64_t ringClaim(ringHandle* r, uint64_t padding)
+{
+	ringHeader* h = r->header;
+
+	if (padding > 0 || h->tail == h->capacity)
+	{
+		if (padding >= sizeof(ringRecord))
+		{
+			ringRecord* rec = ringRecordAt(r, h->tail);
+
+			rec->magic = RING_RECORD_MAGIC;
+			rec->len = 0;
+			rec->state = RING_WRAP;
+		}
+		h->used += padding;
+		h->tail = 0;
+	}
+	return h->tail;
+}
+
+
+/**
+ * Whether a record is a buffered command, which may be overwritten when the ring is full.
+ */
+static int ringIsCommand(ringRecord* rec)
+{
+	return (strncmp(rec->key, PERSISTENCE_COMMAND_KEY, strlen(PERSISTENCE_COMMAND_KEY)) == 0 ||
+			strncmp(rec->key, PERSISTENCE_V5_COMMAND_KEY, strlen(PERSISTENCE_V5_COMMAND_KEY)) == 0);
+}
+
+
+/**
+ * Marks the record at the head dead and removes it from the index.
+ * @return 0 if success, #MQTTCLIENT_PERSISTENCE_ERROR if the record is not a buffered command
+ */
+static int ringDropHead(ringHandle* r)
+{
+	ringRecord* rec = ringRecordAt(r, r->header->head);
+
+	if (!ringIsCommand(rec))
+	{
+		Log(TRACE_MINIMUM, -1, "Ring persistence full, %s can't be overwritten", rec->key);
+		return MQTTCLIENT_PERSISTENCE_ERROR;
+	}
+	Log(TRACE_MINIMUM, -1, "Ring persistence full, overwriting %s", rec->key);
+	free(TreeRemoveKey(r->index, rec->key));
+	r->live -= RING_RECORD_SIZE(rec->len);
+	rec->state = RING_DEAD;
+	ringFlush(r, rec, sizeof(ringRecord));
+	ringAdvanceHead(r);
+	ringFlush(r, r->header, sizeof(ringHeader));
+	return 0;
+}
+
+
+/**
+ * Moves the live record at the head to the tail, so that the space behind it can be reused.
+ * The copy and the header are written to disk before the original is marked dead, so the
+ * record is on disk throughout.
+ * @return 0 if success, #MQTTCLIENT_PERSISTENCE_ERROR if there is no space at the tail for
+ * the copy
+ */
+static int ringMoveHead(ringHandle* r)
+{
+	int rc = 0;
+	ringHeader* h = r->header;
+	ringRecord* rec = ringRecordAt(r, h->head);
+	uint64_t size = RING_RECORD_SIZE(rec->len);
+	uint64_t padding = 0, offset;
+	Node* found = TreeFind(r->index, rec->key);
+	ringRecord* copy = NULL;
+
+	FUNC_ENTRY;
+	if (!ringFits(r, size, &padding))
+	{
+		rc = MQTTCLIENT_PERSISTENCE_ERROR;
+		goto exit;
+	}
+	if ((copy = malloc((size_t)size)) == NULL)
+	{
+		rc = PAHO_MEMORY_ERROR;
+		goto exit;
+	}
+	memcpy(copy, rec, (size_t)size);
+	offset = ringClaim(r, padding);
+	copy->seqno = h->seqno++;
+	memcpy(ringRecordAt(r, offset), copy, (size_t)size);
+	ringFlush(r, ringRecordAt(r, offset), size);
+	h->tail = offset + size;
+	h->used += size;
+	ringFlush(r, h, sizeof(ringHeader));
+	rec->state = RING_DEAD;
+	ringFlush(r, rec, sizeof(ringRecord));
+	if (found)
+		((ringEntry*)(found->content))->offset = offset;
+	ringAdvanceHead(r);
+	ringFlush(r, h, sizeof(ringHeader));
+	free(copy);
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/**
+ * Makes space for a record of the given size at the tail.
+ * @param offset set to the offset at which to write the record
+ * @return 0 if success, #MQTTCLIENT_PERSISTENCE_ERROR if the ring is full
+ */
+static int ringReserve(ringHandle* r, uint64_t size, uint64_t* offset)
+{
+	int rc = 0;
+	ringHeader* h = r->header;
+	uint64_t padding = 0, moved = 0;
+
+	FUNC_ENTRY;
+	if (size > h->capacity)
+	{
+		rc = MQTTCLIENT_PERSISTENCE_ERROR;
+		goto exit;
+	}
+	ringAdvanceHead(r);
+	while (rc == 0 && !ringFits(r, size, &padding))
+	{
+		/* the head is a live record, which is either moved out of the way or overwritten */
+		uint64_t headsize = RING_RECORD_SIZE(ringRecordAt(r, h->head)->len);
+
+		if (r->live + size <= h->capacity && moved < h->capacity && ringMoveHead(r) == 0)
+			moved += headsize;
+		else if (r->overwriteOldest)
+			rc = ringDropHead(r);
+		else
+			rc = MQTTCLIENT_PERSISTENCE_ERROR;
+	}
+	if (rc == 0)
+		*offset = ringClaim(r, padding);
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/** Append a record to the ring.
+ *  See ::Persistence_put
+ */
+int ringput(void* handle, char* key, int bufcount, char* buffers[], int buflens[])
+{
+	int rc = 0;
+	ringHandle* r = handle;
+	ringHeader* h = NULL;
+	ringRecord* rec = NULL;
+	uint64_t len = 0, size, offset = 0;
+	char* ptr = NULL;
+	Node* found = NULL;
+	int i;
+
+	FUNC_ENTRY;
+	if (r == NULL || strlen(key) >= RING_KEY_LENGTH)
+	{
+		rc = MQTTCLIENT_PERSISTENCE_ERROR;
+		goto exit;
+	}
+	h = r->header;
+	for (i = 0; i < bufcount; i++)
+		len += buflens[i];
+	size = RING_RECORD_SIZE(len);
+	if ((rc = ringReserve(r, size, &offset)) != 0)
+		goto exit;
+
+	/* write the record completely before moving the tail past it */
+	rec = ringRecordAt(r, offset);
+	ptr = (char*)(rec + 1);
+	for (i = 0; i < bufcount; i++)
+	{
+		memcpy(ptr, buffers[i], buflens[i]);
+		ptr += buflens[i];
+	}
+	memset(rec->key, '\0', sizeof(rec->key));
+	strcpy(rec->key, key);
+	rec->len = (uint32_t)len;
+	rec->reserved = 0;
+	rec->seqno = h->seqno++;
+	rec->state = RING_LIVE;
+	rec->magic = RING_RECORD_MAGIC;
+	ringFlush(r, rec, size);
+	h->tail = offset + size;
+	h->used += size;
+	r->live += size;
+	ringFlush(r, h, sizeof(ringHeader));
+
+	if ((found = TreeFind(r->index, key)) != NULL)
+	{
+		/* replacing an existing record, which is only marked dead now that the new one is
+		 * on disk.  Until then, a restore finds both, and keeps the one with the later seqno */
+		ringEntry* entry = (ringEntry*)(found->content);
+		ringRecord* old = ringRecordAt(r, entry->offset);
+
+		old->state = RING_DEAD;
+		ringFlush(r, old, sizeof(ringRecord));
+		r->live -= RING_RECORD_SIZE(old->len);
+		entry->offset = offset;
+		ringAdvanceHead(r);
+		ringFlush(r, h, sizeof(ringHeader));
+	}
+	else
+	{
+		ringEntry* entry = malloc(sizeof(ringEntry));
+
+		if (entry == NULL)
+		{
+			rec->state = RING_DEAD;
+			r->live -= size;
+			rc = PAHO_MEMORY_ERROR;
+			goto exit;
+		}
+		strcpy(entry->key, key);
+		entry->offset = offset;
+		TreeAdd(r->index, entry, sizeof(ringEntry));
+	}
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/** Retrieve a record from the ring.
+ *  See ::Persistence_get
+ */
+int ringget(void* handle, char* key, char** buffer, int* buflen)
+{
+	int rc = 0;
+	ringHandle* r = handle;
+	Node* found = NULL;
+	ringRecord* rec = NULL;
+	char* buf = NULL;
+
+	FUNC_ENTRY;
+	if (r == NULL || (found = TreeFind(r->index, key)) == NULL)
+	{
+		rc = MQTTCLIENT_PERSISTENCE_ERROR;
+		goto exit;
+	}
+	rec = ringRecordAt(r, ((ringEntry*)(found->content))->offset);
+	if ((buf = malloc(rec->len > 0 ? rec->len : 1)) == NULL)
+	{
+		rc = PAHO_MEMORY_ERROR;
+		goto exit;
+	}
+	memcpy(buf, rec + 1, rec->len);
+	*buffer = buf;
+	*buflen = (int)rec->len;
+	/* the caller must free buf */
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/** Remove a record from the ring, by marking it dead.
+ *  See ::Persistence_remove
+ */
+int ringremove(void* handle, char* key)
+{
+	int rc = 0;
+	ringHandle* r = handle;
+	ringEntry* entry = NULL;
+
+	FUNC_ENTRY;
+	if (r == NULL)
+	{
+		rc = MQTTCLIENT_PERSISTENCE_ERROR;
+		goto exit;
+	}
+	if ((entry = TreeRemoveKey(r->index, key)) != NULL)
+	{
+		ringRecord* rec = ringRecordAt(r, entry->offset);
+
+		rec->state = RING_DEAD;
+		ringFlush(r, rec, sizeof(ringRecord));
+		r->live -= RING_RECORD_SIZE(rec->len);
+		free(entry);
+		ringAdvanceHead(r);
+		ringFlush(r, r->header, sizeof(ringHeader));
+	}
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/** Returns the keys of the live records, oldest first.
+ *  See ::Persistence_keys
+ */
+int ringkeys(void* handle, char*** keys, int* nkeys)
+{
+	int rc = 0;
+	ringHandle* r = handle;
+	char** fkeys = NULL;
+	int nfkeys = 0;
+	uint64_t pos, remaining;
+
+	FUNC_ENTRY;
+	if (r == NULL)
+	{
+		rc = MQTTCLIENT_PERSISTENCE_ERROR;
+		goto exit;
+	}
+	if (r->index->count > 0 && (fkeys = malloc(r->index->count * sizeof(char*))) == NULL)
+	{
+		rc = PAHO_MEMORY_ERROR;
+		goto exit;
+	}
+	pos = r->header->head;
+	remaining = r->header->used;
+	while (remaining > 0 && nfkeys < r->index->count)
+	{
+		ringRecord* rec = NULL;
+		uint64_t size;
+
+		if (ringIsWrap(r, pos))
+		{
+			remaining -= r->header->capacity - pos;
+			pos = 0;
+			continue;
+		}
+		rec = ringRecordAt(r, pos);
+		size = RING_RECORD_SIZE(rec->len);
+		if (rec->state == RING_LIVE)
+		{
+			Node* found = TreeFind(r->index, rec->key);
+
+			if (found && ((ringEntry*)(found->content))->offset == pos)
+			{
+				if ((fkeys[nfkeys] = malloc(strlen(rec->key) + 1)) == NULL)
+				{
+					while (--nfkeys >= 0)
+						free(fkeys[nfkeys]);
+					free(fkeys);
+					rc = PAHO_MEMORY_ERROR;
+					goto exit;
+				}
+				strcpy(fkeys[nfkeys++], rec->key);
+			}
+		}
+		pos += size;
+		remaining -= size;
+	}
+	*nkeys = nfkeys;
+	*keys = fkeys;
+	/* the caller must free keys */
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/** Remove all the records.
+ *  See ::Persistence_clear
+ */
+int ringclear(void* handle)
+{
+	int rc = 0;
+	ringHandle* r = handle;
+
+	FUNC_ENTRY;
+	if (r == NULL)
+	{
+		rc = MQTTCLIENT_PERSISTENCE_ERROR;
+		goto exit;
+	}
+	r->header->head = r->header->tail = r->header->used = 0;
+	ringFlush(r, r->header, sizeof(ringHeader));
+	r->live = 0;
+	while (r->index->index[0].root != NULL)
+		free(TreeRemoveNodeIndex(r->index, r->index->index[0].root, 0));
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/** Returns whether a live record with this key is in the ring.
+ *  See ::Persistence_containskey
+ */
+int ringcontainskey(void* handle, char* key)
+{
+	int rc = 0;
+	ringHandle* r = handle;
+
+	FUNC_ENTRY;
+	if (r == NULL || TreeFind(r->index, key) == NULL)
+		rc = MQTTCLIENT_PERSISTENCE_ERROR;
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/** Write the ring to disk and close it.  The file is kept, for reuse.
+ *  See ::Persistence_close
+ */
+int ringclose(void* handle)
+{
+	int rc = 0;
+	ringHandle* r = handle;
+
+	FUNC_ENTRY;
+	if (r == NULL)
+	{
+		rc = MQTTCLIENT_PERSISTENCE_ERROR;
+		goto exit;
+	}
+	ringUnmap(r);
+	ringFreeIndex(r->index);
+	free(r);
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+static void ringFreeIndex(Tree* index)
+{
+	while (index->index[0].root != NULL)
+		free(TreeRemoveNodeIndex(index, index->index[0].root, 0));
+	TreeFree(index);
+}
+
+#endif /* NO_PERSISTENCE */
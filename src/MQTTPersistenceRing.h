@@ -0,0 +1,30 @@
+/*******************************************************************************
+ * Copyright (c) 2026 Contributors to the Eclipse Foundation
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v2.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    https://www.eclipse.org/legal/epl-2.0/
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *******************************************************************************/
+
+#if !defined(MQTTPERSISTENCERING_H)
+#define MQTTPERSISTENCERING_H
+
+/** Extension of the ring buffer filename */
+#define RING_FILENAME_EXTENSION ".ring"
+
+/* prototypes of the functions for the ring buffer persistence */
+int ringopen(void** handle, const char* clientID, const char* serverURI, void* context);
+int ringclose(void* handle);
+int ringput(void* handle, char* key, int bufcount, char* buffers[], int buflens[]);
+int ringget(void* handle, char* key, char** buffer, int* buflen);
+int ringremove(void* handle, char* key);
+int ringkeys(void* handle, char*** keys, int* nkeys);
+int ringclear(void* handle);
+int ringcontainskey(void* handle, char* key);
+
+#endif
@@ -18,6 +18,7 @@
 
 #include "MQTTPacket.h"
 #include "MQTTProtocolClient.h"
+#include "Thread.h"
 #include "Heap.h"
 #include "StackTrace.h"
 
@@ -70,6 +71,96 @@ static char* datadup(const MQTTLenString* str)
 }
 
 
+/**
+ * The header of a property list allocated in one block: the array of properties, followed
+ * by the data of their strings.  Such a list, marked by a max_count of MQTTPROPERTIES_SHARED,
+ * is shared by its copies, and is copied on write by MQTTProperties_add.
+ */
+typedef union
+{
+	volatile long refs;  /**< the number of property lists sharing the block */
+	MQTTLenString align; /**< so that the properties which follow are aligned */
+} MQTTProperties_block;
+
+#define MQTTPROPERTIES_SHARED -1
+
+static int MQTTProperties_unshare(MQTTProperties* props);
+
+
+/**
+ * Allocate a block for a property list.
+ * @param count the number of properties
+ * @param datalen the total length of the data of their strings
+ * @return the array of properties in the block, or NULL if there is no memory
+ */
+static MQTTProperty* MQTTProperties_allocate(int count, size_t datalen)
+{
+	MQTTProperties_block* block = malloc(sizeof(MQTTProperties_block) + sizeof(MQTTProperty) * count + datalen);
+
+	if (block == NULL)
+		return NULL;
+	block->refs = 1;
+	return (MQTTProperty*)(block + 1);
+}
+
+
+/**
+ * The length of the data of the strings of a property.
+ * @param prop the property
+ * @return the length in bytes
+ */
+static size_t MQTTProperty_dataLen(const MQTTProperty* prop)
+{
+	size_t len = 0;
+
+	switch (MQTTProperty_getType(prop->identifier))
+	{
+		case MQTTPROPERTY_TYPE_UTF_8_STRING_PAIR:
+			len = prop->value.value.len;
+			/* FALLTHRU */
+		case MQTTPROPERTY_TYPE_BINARY_DATA:
+		case MQTTPROPERTY_TYPE_UTF_8_ENCODED_STRING:
+			len += prop->value.data.len;
+			break;
+	}
+	return len;
+}
+
+
+/**
+ * Copy the data of the strings of the properties in a block to the end of the block,
+ * after the array, and point the properties at it.
+ * @param array the array of properties in the block
+ * @param count the number of properties
+ */
+static void MQTTProperties_packData(MQTTProperty* array, int count)
+{
+	char* ptr = (char*)&array[count];
+	int i;
+
+	for (i = 0; i < count; ++i)
+	{
+		int type = MQTTProperty_getType(array[i].identifier);
+
+		if (type == MQTTPROPERTY_TYPE_BINARY_DATA || type == MQTTPROPERTY_TYPE_UTF_8_ENCODED_STRING ||
+			type == MQTTPROPERTY_TYPE_UTF_8_STRING_PAIR)
+		{
+			if (array[i].value.data.len > 0)
+				memcpy(ptr, array[i].value.data.data, array[i].value.data.len);
+			array[i].value.data.data = ptr;
+			ptr += array[i].value.data.len;
+		}
+		if (type == MQTTPROPERTY_TYPE_UTF_8_STRING_PAIR)
+		{
+			if (array[i].value.value.len > 0)
+				memcpy(ptr, array[i].value.value.data, array[i].value.value.len);
+			array[i].value.value.data = ptr;
+			ptr += array[i].value.value.len;
+		}
+	}
+}
+
+
 int MQTTProperty_getType(enum MQTTPropertyCodes value)
 {
   int i, rc = -1;
@@ -109,7 +200,10 @@ int MQTTProperties_add(MQTTProperties* props, const MQTTProperty* prop)
     rc = MQTT_INVALID_PROPERTY_ID;
     goto exit;
   }
-  else if (props->array == NULL)
+  else if (props->max_count == MQTTPROPERTIES_SHARED && (rc = MQTTProperties_unshare(props)) != 0)
+    goto exit;
+
+  if (props->array == NULL)
   {
     props->max_count = 10;
     props->array = malloc(sizeof(MQTTProperty) * props->max_count);
@@ -235,7 +329,15 @@ int MQTTProperties_write(char** pptr, const MQTTProperties* properties)
 }
 
 
-int MQTTProperty_read(MQTTProperty* prop, char** pptr, char* enddata)
+/**
+ * Read a property from a buffer.  The data of its strings is not copied: they point into
+ * the buffer.
+ * @param prop the property to read into
+ * @param pptr pointer to the buffer, moved past the property
+ * @param enddata pointer to the end of the buffer
+ * @return the length of the property read, or -1 on error
+ */
+static int MQTTProperty_read(MQTTProperty* prop, char** pptr, char* enddata)
 {
   int type = -1,
     len = -1;
@@ -267,11 +369,6 @@ int MQTTProperty_read(MQTTProperty* prop, char** pptr, char* enddata)
       case MQTTPROPERTY_TYPE_UTF_8_STRING_PAIR:
         if ((len = MQTTLenStringRead(&prop->value.data, pptr, enddata)) == -1)
           break; /* error */
-        if ((prop->value.data.data = datadup(&prop->value.data)) == NULL)
-        {
-          len = -1;
-          break; /* error */
-        }
         if (type == MQTTPROPERTY_TYPE_UTF_8_STRING_PAIR)
         {
           int proplen = MQTTLenStringRead(&prop->value.value, pptr, enddata);
@@ -279,16 +376,9 @@ int MQTTProperty_read(MQTTProperty* prop, char** pptr, char* enddata)
           if (proplen == -1)
           {
             len = -1;
-            free(prop->value.data.data);
             break;
           }
           len += proplen;
-          if ((prop->value.value.data = datadup(&prop->value.value)) == NULL)
-          {
-            len = -1;
-            free(prop->value.data.data);
-            break;
-          }
         }
         break;
     }
@@ -306,39 +396,44 @@ int MQTTProperties_read(MQTTProperties* properties, char** pptr, char* enddata)
   /* we assume an initialized properties structure */
   if (enddata - (*pptr) > 0) /* enough length to read the VBI? */
   {
-    int proplen = 0;
+    MQTTProperty prop;
+    char* curdata = NULL;
+    size_t datalen = 0;
+    int count = 0, proplen = 0, i;
 
     *pptr += MQTTPacket_decodeBuf(*pptr, &remlength);
     properties->length = remlength;
+    /* find the number of properties and the length of their data, to allocate them in one block */
+    curdata = *pptr;
     while (remlength > 0)
     {
-      if (properties->count == properties->max_count)
-      {
-    	properties->max_count += 10;
-    	if (properties->max_count == 10)
-    	  properties->array = malloc(sizeof(MQTTProperty) * properties->max_count);
-    	else
-    	  properties->array = realloc(properties->array, sizeof(MQTTProperty) * properties->max_count);
-      }
-      if (properties->array == NULL)
+      if ((proplen = MQTTProperty_read(&prop, &curdata, enddata)) <= 0 || (unsigned int)proplen > remlength)
+        break;
+      remlength -= proplen;
+      datalen += MQTTProperty_dataLen(&prop);
+      count++;
+    }
+    if (remlength != 0)
+      goto exit;
+    if (count > 0)
+    {
+      if ((properties->array = MQTTProperties_allocate(count, datalen)) == NULL)
       {
-    	rc = PAHO_MEMORY_ERROR;
+        rc = PAHO_MEMORY_ERROR;
         goto exit;
       }
-      if ((proplen = MQTTProperty_read(&properties->array[properties->count], pptr, enddata)) > 0)
-          remlength -= proplen;
-      else
-          break;
-      properties->count++;
+      for (i = 0; i < count; ++i)
+        MQTTProperty_read(&properties->array[i], pptr, enddata);
+      MQTTProperties_packData(properties->array, count);
+      properties->count = count;
+      properties->max_count = MQTTPROPERTIES_SHARED;
     }
-    if (remlength == 0)
-        rc = 1; /* data read successfully */
+    rc = 1; /* data read successfully */
   }
 
-  if (rc != 1 && properties->array != NULL)
-      MQTTProperties_free(properties);
-
 exit:
+  if (rc != 1)
+    memset(properties, '\0', sizeof(MQTTProperties));
   FUNC_EXIT_RC(rc);
   return rc;
 }
@@ -401,6 +496,15 @@ void MQTTProperties_free(MQTTProperties* props)
   FUNC_ENTRY;
   if (props == NULL)
     goto exit;
+  if (props->max_count == MQTTPROPERTIES_SHARED)
+  {
+    MQTTProperties_block* block = ((MQTTProperties_block*)props->array) - 1;
+
+    if (Thread_decrement(&block->refs) == 0)
+      free(block);
+    memset(props, '\0', sizeof(MQTTProperties));
+    goto exit;
+  }
   for (i = 0; i < props->count; ++i)
   {
     int id = props->array[i].identifier;
@@ -425,25 +529,70 @@ exit:
 }
 
 
+/**
+ * Copy a property list.  A list already in one block is shared with the copy, any other
+ * is copied into one block, so that each copy costs at most one allocation.
+ * @param props pointer to the property list
+ * @return the copy
+ */
 MQTTProperties MQTTProperties_copy(const MQTTProperties* props)
 {
-  int i = 0;
   MQTTProperties result = MQTTProperties_initializer;
+  size_t datalen = 0;
+  int i = 0;
 
   FUNC_ENTRY;
+  if (props->count == 0)
+    goto exit;
+  if (props->max_count == MQTTPROPERTIES_SHARED)
+  {
+    Thread_increment(&(((MQTTProperties_block*)props->array) - 1)->refs);
+    result = *props;
+    goto exit;
+  }
   for (i = 0; i < props->count; ++i)
+    datalen += MQTTProperty_dataLen(&props->array[i]);
+  if ((result.array = MQTTProperties_allocate(props->count, datalen)) == NULL)
   {
-	int rc = 0;
-
-	if ((rc = MQTTProperties_add(&result, &props->array[i])) != 0)
-		Log(LOG_ERROR, -1, "Error from MQTTProperties add %d", rc);
+    Log(LOG_ERROR, -1, "Error from MQTTProperties copy %d", PAHO_MEMORY_ERROR);
+    goto exit;
   }
+  memcpy(result.array, props->array, sizeof(MQTTProperty) * props->count);
+  MQTTProperties_packData(result.array, props->count);
+  result.count = props->count;
+  result.max_count = MQTTPROPERTIES_SHARED;
+  result.length = props->length;
 
+exit:
   FUNC_EXIT;
   return result;
 }
 
 
+/**
+ * Give a property list which shares a block its own copy of its properties, with
+ * separately allocated strings, so that it can be added to.
+ * @param props the property list
+ * @return code 0 is success
+ */
+static int MQTTProperties_unshare(MQTTProperties* props)
+{
+  MQTTProperties copy = MQTTProperties_initializer;
+  int i = 0, rc = 0;
+
+  for (i = 0; i < props->count && rc == 0; ++i)
+    rc = MQTTProperties_add(&copy, &props->array[i]);
+  if (rc == 0)
+  {
+    MQTTProperties_free(props);
+    *props = copy;
+  }
+  else
+    MQTTProperties_free(&copy);
+  return rc;
+}
+
+
 int MQTTProperties_hasProperty(MQTTProperties *props, enum MQTTPropertyCodes propid)
 {
 	int i = 0;
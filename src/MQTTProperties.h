@@ -158,7 +158,10 @@ int MQTTProperties_read(MQTTProperties* properties, char** pptr, char* enddata);
 LIBMQTT_API void MQTTProperties_free(MQTTProperties* properties);
 
 /**
- * Copy the contents of a property list, allocating additional memory if needed.
+ * Copy the contents of a property list.  The copy is made in a single allocation, which
+ * the copies of the copy share, so that passing a property list from a command to a message
+ * and on to a callback does not copy each of its strings.  The copies are independent: one
+ * which is added to gets its own properties first.
  * @param props pointer to the property list.
  * @return the duplicated property list.
  */
@@ -38,14 +38,15 @@
 #endif
 #include "SocketBuffer.h"
 #include "StackTrace.h"
+#include "Thread.h"
 #include "Heap.h"
 
 #if !defined(min)
 #define min(A,B) ( (A) < (B) ? (A):(B))
 #endif
 
-extern MQTTProtocol state;
-extern ClientStates* bstate;
+extern THREAD_LOCAL MQTTProtocol* state;
+extern THREAD_LOCAL ClientStates* bstate;
 
 static void MQTTProtocol_storeQoS0(Clients* pubclient, Publish* publish);
 static int MQTTProtocol_startPublishCommon(
@@ -114,7 +115,7 @@ static void MQTTProtocol_storeQoS0(Clients* pubclient, Publish* publish)
 		goto exit;
 	}
 	pw->socket = pubclient->net.socket;
-	if (!ListAppend(&(state.pending_writes), pw, sizeof(pending_write)+len))
+	if (!ListAppend(&(state->pending_writes), pw, sizeof(pending_write)+len))
 	{
 		free(pw->p);
 		free(pw);
@@ -237,6 +238,7 @@ Messages* MQTTProtocol_createMessage(Publish* publish, Messages **mm, int qos, i
 	if (m->MQTTVersion >= 5)
 		m->properties = MQTTProperties_copy(&publish->properties);
 	m->lastTouch = MQTTTime_now();
+	m->retried = 0;
 	if (qos == 2)
 		m->nextMessageType = PUBREC;
 exit:
@@ -270,7 +272,7 @@ Publications* MQTTProtocol_storePublication(Publish* publish, int* len)
 	*len += publish->payloadlen;
 	memcpy(p->mask, publish->mask, sizeof(p->mask));
 
-	if ((ListAppend(&(state.publications), p, *len)) == NULL)
+	if ((ListAppend(&(state->publications), p, *len)) == NULL)
 	{
 		free(p);
 		p = NULL;
@@ -293,7 +295,7 @@ void MQTTProtocol_removePublication(Publications* p)
 		p->payload = NULL;
 		free(p->topic);
 		p->topic = NULL;
-		ListRemove(&(state.publications), p);
+		ListRemove(&(state->publications), p);
 	}
 	FUNC_EXIT;
 }
@@ -353,6 +355,7 @@ int MQTTProtocol_handlePublishes(void* pack, int sock)
 		if (m->MQTTVersion >= MQTTVERSION_5)
 			m->properties = MQTTProperties_copy(&publish->properties);
 		m->nextMessageType = PUBREL;
+		m->retried = 0;
 		if ((listElem = ListFindItem(client->inboundMsgs, &(m->msgid), messageIDCompare)) != NULL)
 		{   /* discard queued publication with same msgID that the current incoming message */
 			Messages* msg = (Messages*)(listElem->content);
@@ -380,7 +383,7 @@ int MQTTProtocol_handlePublishes(void* pack, int sock)
 			publish1.properties = m->properties;
 
 			Protocol_processPublication(&publish1, client, 1);
-			ListRemove(&(state.publications), m->publish);
+			ListRemove(&(state->publications), m->publish);
 			m->publish = NULL;
 		} else
 		{	/* allocate and copy payload data as it's needed for pubrel.
@@ -499,7 +502,7 @@ int MQTTProtocol_handlePubrecs(void* pack, int sock)
 				if (m->MQTTVersion >= MQTTVERSION_5)
 					MQTTProperties_free(&m->properties);
 				ListRemove(client->outboundMsgs, m);
-				(++state.msgs_sent);
+				(++state->msgs_sent);
 			}
 			else
 			{
@@ -583,9 +586,9 @@ int MQTTProtocol_handlePubrels(void* pack, int sock)
 			if (m->MQTTVersion >= MQTTVERSION_5)
 				MQTTProperties_free(&m->properties);
 			if (m->publish)
-				ListRemove(&(state.publications), m->publish);
+				ListRemove(&(state->publications), m->publish);
 			ListRemove(client->inboundMsgs, m);
-			++(state.msgs_received);
+			++(state->msgs_received);
 		}
 	}
 	if (pubrel->MQTTVersion >= MQTTVERSION_5)
@@ -641,7 +644,7 @@ int MQTTProtocol_handlePubcomps(void* pack, int sock)
 				if (m->MQTTVersion >= MQTTVERSION_5)
 					MQTTProperties_free(&m->properties);
 				ListRemove(client->outboundMsgs, m);
-				(++state.msgs_sent);
+				(++state->msgs_sent);
 			}
 		}
 	}
@@ -713,7 +716,14 @@ static void MQTTProtocol_retries(START_TIME_TYPE now, Clients* client, int regar
 
 	FUNC_ENTRY;
 
-	if (!regardless && client->retryInterval <= 0) /* 0 or -ive retryInterval turns off retry except on reconnect */
+	if (regardless)
+	{
+		/* the messages touched before now are resent, over several calls if the pacing or
+		   pending writes stop this one */
+		client->pacing.resending = 1;
+		client->pacing.resendStart = MQTTTime_now();
+	}
+	else if (!client->pacing.resending && client->retryInterval <= 0) /* 0 or -ive retryInterval turns off retry except on reconnect */
 		goto exit;
 
 	while (client && ListNextElement(client->outboundMsgs, &outcurrent) &&
@@ -721,13 +731,21 @@ static void MQTTProtocol_retries(START_TIME_TYPE now, Clients* client, int regar
 		   Socket_noPendingWrites(client->net.socket)) /* there aren't any previous packets still stacked up on the socket */
 	{
 		Messages* m = (Messages*)(outcurrent->content);
-		if (regardless || MQTTTime_difftime(now, m->lastTouch) > (DIFF_TIME_TYPE)(max(client->retryInterval, 10) * 1000))
+		if ((client->pacing.resending && MQTTTime_difftime(m->lastTouch, client->pacing.resendStart) < 0) ||
+			(client->retryInterval > 0 &&
+			 MQTTTime_difftime(now, m->lastTouch) > (DIFF_TIME_TYPE)(max(client->retryInterval, 10) * 1000)))
 		{
 			if (m->qos == 1 || (m->qos == 2 && m->nextMessageType == PUBREC))
 			{
 				Publish publish;
 				int rc;
 
+				if (MQTTProtocol_pacingWait(client) > 0)
+				{
+					client->pacing.blocked = 1;
+					break; /* carry on when the buckets have filled */
+				}
+				MQTTProtocol_pace(client, m->publish->payloadlen + m->publish->topiclen);
 				Log(TRACE_MIN, 7, NULL, "PUBLISH", client->clientID, client->net.socket, m->msgid);
 				publish.msgId = m->msgid;
 				publish.topic = m->publish->topic;
@@ -735,6 +753,8 @@ static void MQTTProtocol_retries(START_TIME_TYPE now, Clients* client, int regar
 				publish.payloadlen = m->publish->payloadlen;
 				publish.properties = m->properties;
 				publish.MQTTVersion = m->MQTTVersion;
+				publish.encodedProperties = NULL;
+				publish.topicAlias = publish.topicAliased = 0; /* the aliases are reset on reconnect */
 				memcpy(publish.mask, m->publish->mask, sizeof(publish.mask));
 				rc = MQTTPacket_send_publish(&publish, 1, m->qos, m->retain, &client->net, client->clientID);
 				memcpy(m->publish->mask, publish.mask, sizeof(m->publish->mask)); /* store websocket mask used in send */
@@ -751,6 +771,7 @@ static void MQTTProtocol_retries(START_TIME_TYPE now, Clients* client, int regar
 					if (m->qos == 0 && rc == TCPSOCKET_INTERRUPTED)
 						MQTTProtocol_storeQoS0(client, &publish);
 					m->lastTouch = MQTTTime_now();
+					m->retried = 1;
 				}
 			}
 			else if (m->qos && m->nextMessageType == PUBCOMP)
@@ -765,11 +786,16 @@ static void MQTTProtocol_retries(START_TIME_TYPE now, Clients* client, int regar
 					client = NULL;
 				}
 				else
+				{
 					m->lastTouch = MQTTTime_now();
+					m->retried = 1;
+				}
 			}
 			/* break; why not do all retries at once? */
 		}
 	}
+	if (client && outcurrent == NULL)
+		client->pacing.resending = 0; /* all resent */
 exit:
 	FUNC_EXIT;
 }
@@ -808,6 +834,98 @@ void MQTTProtocol_retry(START_TIME_TYPE now, int doRetry, int regardless)
 }
 
 
+/**
+ * Carry on resending the messages in flight on reconnect, which were stopped by the
+ * pacing or by pending writes.
+ * @param client the client
+ */
+void MQTTProtocol_resumeRetries(Clients* client)
+{
+	FUNC_ENTRY;
+	if (client->pacing.resending && client->connected && client->good &&
+			Socket_noPendingWrites(client->net.socket))
+		MQTTProtocol_retries(MQTTTime_now(), client, 0);
+	FUNC_EXIT;
+}
+
+
+/**
+ * Set the limits on the rate at which a client sends publications.  The buckets start full.
+ * @param client the client
+ * @param rate publications per second, 0 for no limit
+ * @param burst the most publications which can be sent at once, 0 for one second's worth
+ * @param byteRate bytes of payload and topic per second, 0 for no limit
+ * @param byteBurst the most bytes which can be sent at once, 0 for one second's worth
+ */
+void MQTTProtocol_setPacing(Clients* client, int rate, int burst, int byteRate, int byteBurst)
+{
+	publishPacing* p = &client->pacing;
+
+	FUNC_ENTRY;
+	p->rate = (rate > 0) ? rate : 0;
+	p->burst = (burst > 0) ? burst : ((p->rate > 0) ? p->rate : 1);
+	p->byteRate = (byteRate > 0) ? byteRate : 0;
+	p->byteBurst = (byteBurst > 0) ? byteBurst : ((p->byteRate > 0) ? p->byteRate : 1);
+	p->tokens = (int64_t)p->burst * 1000;
+	p->byteTokens = (int64_t)p->byteBurst * 1000;
+	p->filled = MQTTTime_now();
+	FUNC_EXIT;
+}
+
+
+/**
+ * Fill the buckets for the time since they were last filled, and find how long it is until
+ * a publication can be sent.  A publication needs a whole token in the message bucket and
+ * any bytes in the byte bucket, so one larger than the byte burst can still be sent, and is
+ * paid for by the following ones.
+ * @param client the client
+ * @return the number of milliseconds to wait, 0 if a publication can be sent now
+ */
+int MQTTProtocol_pacingWait(Clients* client)
+{
+	publishPacing* p = &client->pacing;
+	DIFF_TIME_TYPE elapsed = 0;
+	int64_t wait = 0;
+
+	if (p->rate == 0 && p->byteRate == 0)
+		goto exit;
+	elapsed = (DIFF_TIME_TYPE)MQTTTime_elapsed(p->filled);
+	if (elapsed > 0)
+	{
+		p->filled = MQTTTime_now();
+		if (p->rate > 0 && (p->tokens += elapsed * p->rate) > (int64_t)p->burst * 1000)
+			p->tokens = (int64_t)p->burst * 1000;
+		if (p->byteRate > 0 && (p->byteTokens += elapsed * p->byteRate) > (int64_t)p->byteBurst * 1000)
+			p->byteTokens = (int64_t)p->byteBurst * 1000;
+	}
+	if (p->rate > 0 && p->tokens < 1000)
+		wait = (1000 - p->tokens + p->rate - 1) / p->rate;
+	if (p->byteRate > 0 && p->byteTokens <= 0)
+	{
+		int64_t byteWait = (1 - p->byteTokens + p->byteRate - 1) / p->byteRate;
+
+		if (byteWait > wait)
+			wait = byteWait;
+	}
+exit:
+	return (int)wait;
+}
+
+
+/**
+ * Take the tokens for a publication from a client's buckets.
+ * @param client the client
+ * @param bytes the length of the payload and topic
+ */
+void MQTTProtocol_pace(Clients* client, int bytes)
+{
+	if (client->pacing.rate > 0)
+		client->pacing.tokens -= 1000;
+	if (client->pacing.byteRate > 0)
+		client->pacing.byteTokens -= (int64_t)bytes * 1000;
+}
+
+
 /**
  * Free a client structure
  * @param client the client data to free
@@ -861,6 +979,11 @@ void MQTTProtocol_freeClient(Clients* client)
 		free(client->sslopts);
                 client->sslopts = NULL;
 	}
+	if (client->session)
+	{
+		SSL_SESSION_free(client->session);
+		client->session = NULL;
+	}
 #endif
 	/* don't free the client structure itself... this is done elsewhere */
 	FUNC_EXIT;
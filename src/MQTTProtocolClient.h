@@ -48,6 +48,10 @@ int MQTTProtocol_handlePubcomps(void* pack, int sock);
 void MQTTProtocol_closeSession(Clients* c, int sendwill);
 void MQTTProtocol_keepalive(START_TIME_TYPE);
 void MQTTProtocol_retry(START_TIME_TYPE, int, int);
+void MQTTProtocol_resumeRetries(Clients* client);
+void MQTTProtocol_setPacing(Clients* client, int rate, int burst, int byteRate, int byteBurst);
+int MQTTProtocol_pacingWait(Clients* client);
+void MQTTProtocol_pace(Clients* client, int bytes);
 void MQTTProtocol_freeClient(Clients* client);
 void MQTTProtocol_emptyMessageList(List* msgList);
 void MQTTProtocol_freeMessageList(List* msgList);
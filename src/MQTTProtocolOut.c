@@ -36,16 +36,18 @@
 
 #include "MQTTProtocolOut.h"
 #include "StackTrace.h"
+#include "Thread.h"
 #include "Heap.h"
 #include "WebSocket.h"
 #include "Base64.h"
 
-extern ClientStates* bstate;
+extern THREAD_LOCAL ClientStates* bstate;
 
 
 
 /**
- * Separates an address:port into two separate values
+ * Separates an address:port into two separate values.  A unix:// socket path is returned
+ * whole, as it has no port, and may contain ':'.
  * @param[in] uri the input string - hostname:port
  * @param[out] port the returned port integer
  * @param[out] topic optional topic portion of the address starting with '/'
@@ -59,6 +61,15 @@ size_t MQTTProtocol_addressPort(const char* uri, int* port, const char **topic,
 	size_t len;
 
 	FUNC_ENTRY;
+	if (strncmp(uri, URI_UNIX, strlen(URI_UNIX)) == 0)
+	{
+		*port = 0;
+		if (topic)
+			*topic = NULL;
+		len = strlen(uri);
+		goto exit;
+	}
+
 	if (uri[0] == '[')
 	{  /* ip v6 */
 		if (colon_pos < strrchr(uri, ']'))
@@ -90,6 +101,7 @@ size_t MQTTProtocol_addressPort(const char* uri, int* port, const char **topic,
 		/* we are stripping off the final ], so length is 1 shorter */
 		--len;
 	}
+exit:
 	FUNC_EXIT;
 	return len;
 }
@@ -191,7 +203,7 @@ exit:
 
 /**
  * MQTT outgoing connect processing for a client
- * @param ip_address the TCP address:port to connect to
+ * @param ip_address the TCP address:port to connect to, or a unix:// socket path
  * @param aClient a structure with all MQTT data needed
  * @param int ssl
  * @param int MQTTVersion the MQTT version to connect with (3 or 4)
@@ -262,9 +274,9 @@ int MQTTProtocol_connect(const char* ip_address, Clients* aClient, int websocket
 		if (timeout < 0)
 			rc = -1;
 		else
-			rc = Socket_new(aClient->net.http_proxy, addr_len, port, &(aClient->net.socket), timeout);
+			rc = Socket_new(aClient->net.http_proxy, addr_len, port, &(aClient->net.socket), &aClient->sockopts, timeout);
 #else
-		rc = Socket_new(aClient->net.http_proxy, addr_len, port, &(aClient->net.socket));
+		rc = Socket_new(aClient->net.http_proxy, addr_len, port, &(aClient->net.socket), &aClient->sockopts);
 #endif
 	}
 #if defined(OPENSSL)
@@ -274,9 +286,9 @@ int MQTTProtocol_connect(const char* ip_address, Clients* aClient, int websocket
 		if (timeout < 0)
 			rc = -1;
 		else
-			rc = Socket_new(aClient->net.https_proxy, addr_len, port, &(aClient->net.socket), timeout);
+			rc = Socket_new(aClient->net.https_proxy, addr_len, port, &(aClient->net.socket), &aClient->sockopts, timeout);
 #else
-		rc = Socket_new(aClient->net.https_proxy, addr_len, port, &(aClient->net.socket));
+		rc = Socket_new(aClient->net.https_proxy, addr_len, port, &(aClient->net.socket), &aClient->sockopts);
 #endif
 	}
 #endif
@@ -290,9 +302,9 @@ int MQTTProtocol_connect(const char* ip_address, Clients* aClient, int websocket
 		if (timeout < 0)
 			rc = -1;
 		else
-			rc = Socket_new(ip_address, addr_len, port, &(aClient->net.socket), timeout);
+			rc = Socket_new(ip_address, addr_len, port, &(aClient->net.socket), &aClient->sockopts, timeout);
 #else
-		rc = Socket_new(ip_address, addr_len, port, &(aClient->net.socket));
+		rc = Socket_new(ip_address, addr_len, port, &(aClient->net.socket), &aClient->sockopts);
 #endif
 	}
 	if (rc == EINPROGRESS || rc == EWOULDBLOCK)
@@ -306,7 +318,7 @@ int MQTTProtocol_connect(const char* ip_address, Clients* aClient, int websocket
 				aClient->connect_state = PROXY_CONNECT_IN_PROGRESS;
 				rc = WebSocket_proxy_connect( &aClient->net, 1, ip_address);
 			}
-			if (rc == 0 && SSLSocket_setSocketForSSL(&aClient->net, aClient->sslopts, ip_address, addr_len) == 1)
+			if (rc == 0 && SSLSocket_setSocketForSSL(aClient, ip_address, addr_len) == 1)
 			{
 				rc = aClient->sslopts->struct_version >= 3 ?
 					SSLSocket_connect(aClient->net.ssl, aClient->net.socket, ip_address,
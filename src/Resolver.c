@@ -0,0 +1,401 @@
+/*******************************************************************************
+ * Copyright (c) 2026 Contributors to the Eclipse Foundation
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v2.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    https://www.eclipse.org/legal/epl-2.0/
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *******************************************************************************/
+
+/**
+ * @file
+ * \brief Host name resolution with a cache of results.
+ *
+ * Connecting many clients to the same server would otherwise look up its name once for each
+ * client, and each lookup blocks the thread making it for as long as DNS takes to answer.
+ * Results are kept for a number of seconds chosen by the caller, failures for a (usually
+ * shorter) number of seconds of their own, as getaddrinfo does not return the DNS TTL.
+ * A lookup can also be started on a helper thread, so that the caller can carry on and
+ * come back for the result, which is kept long enough for that whatever the TTLs.
+ */
+
+#include "Resolver.h"
+#include "LinkedList.h"
+#include "Thread.h"
+#include "MQTTTime.h"
+#include "Log.h"
+#include "StackTrace.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "Heap.h"
+
+typedef struct
+{
+	char* host;               /**< the host name looked up */
+	struct addrinfo* result;  /**< the addresses returned by getaddrinfo */
+	int rc;                   /**< the return code from getaddrinfo */
+	START_TIME_TYPE resolved; /**< when the lookup completed */
+	int valid;                /**< whether result and rc hold the outcome of a lookup */
+	int resolving;            /**< whether a helper thread is looking the name up */
+	int background;           /**< whether the lookup was made on a helper thread */
+	int orphaned;             /**< whether the cache has been emptied while resolving */
+} Resolver_entry;
+
+#if defined(_WIN32) || defined(_WIN64)
+mutex_type resolver_mutex;
+#else
+static pthread_mutex_t resolver_mutex_store = PTHREAD_MUTEX_INITIALIZER;
+static mutex_type resolver_mutex = &resolver_mutex_store;
+#define WINAPI
+#endif
+
+static List* entries = NULL; /* protected by resolver_mutex */
+static Resolver_resolved* resolved = NULL;
+
+
+/**
+ * Set the function called by a helper thread when its lookup has completed.
+ * @param callback the function
+ */
+void Resolver_setCallback(Resolver_resolved* callback)
+{
+	Thread_lock_mutex(resolver_mutex);
+	resolved = callback;
+	Thread_unlock_mutex(resolver_mutex);
+}
+
+
+static int Resolver_entryCompare(void* a, void* b)
+{
+	return strcmp(((Resolver_entry*)a)->host, (char*)b) == 0;
+}
+
+
+static void Resolver_freeEntry(Resolver_entry* entry)
+{
+	if (entry->result)
+		freeaddrinfo(entry->result);
+	free(entry->host);
+	free(entry);
+}
+
+
+/**
+ * Find the cache entry for a host name.  Called with resolver_mutex held.
+ * @param host the host name
+ * @return the entry, or NULL
+ */
+static Resolver_entry* Resolver_find(const char* host)
+{
+	ListElement* found = NULL;
+
+	if (entries && (found = ListFindItem(entries, (void*)host, Resolver_entryCompare)) != NULL)
+		return (Resolver_entry*)(found->content);
+	return NULL;
+}
+
+
+/**
+ * Whether a cache entry holds a result which can be used.  Called with resolver_mutex held.
+ * @param entry the cache entry
+ * @param ttl the number of seconds a successful lookup is used for
+ * @param negative_ttl the number of seconds a failed lookup is used for
+ * @return boolean
+ */
+static int Resolver_isFresh(Resolver_entry* entry, int ttl, int negative_ttl)
+{
+	ELAPSED_TIME_TYPE limit = (ELAPSED_TIME_TYPE)((entry->rc == 0) ? ttl : negative_ttl) * 1000;
+
+	if (!entry->valid || entry->resolving)
+		return 0;
+	if (entry->background && limit < RESOLVER_COLLECT_TIME)
+		limit = RESOLVER_COLLECT_TIME;
+	return MQTTTime_elapsed(entry->resolved) < limit;
+}
+
+
+/**
+ * Add an empty entry for a host name to the cache, making room for it by removing the
+ * oldest entry if necessary.  Called with resolver_mutex held.
+ * @param host the host name
+ * @return the new entry, or NULL if there is no memory
+ */
+static Resolver_entry* Resolver_add(const char* host)
+{
+	Resolver_entry* entry = NULL;
+
+	if (entries == NULL && (entries = ListInitialize()) == NULL)
+		goto exit;
+	if (entries->count >= RESOLVER_CACHE_SIZE)
+	{
+		ListElement* current = NULL;
+
+		while (ListNextElement(entries, &current) != NULL)
+		{
+			Resolver_entry* oldest = (Resolver_entry*)(current->content);
+
+			if (!oldest->resolving)
+			{
+				ListDetach(entries, oldest);
+				Resolver_freeEntry(oldest);
+				break;
+			}
+		}
+	}
+	if ((entry = malloc(sizeof(Resolver_entry))) == NULL)
+		goto exit;
+	memset(entry, '\0', sizeof(Resolver_entry));
+	if ((entry->host = malloc(strlen(host) + 1)) == NULL ||
+			ListAppend(entries, entry, sizeof(Resolver_entry) + strlen(host) + 1) == NULL)
+	{
+		if (entry->host)
+			free(entry->host);
+		free(entry);
+		entry = NULL;
+	}
+	else
+		strcpy(entry->host, host);
+exit:
+	return entry;
+}
+
+
+/**
+ * Record the outcome of a lookup in a cache entry.  Called with resolver_mutex held.
+ */
+static void Resolver_store(Resolver_entry* entry, int rc, struct addrinfo* result)
+{
+	if (entry->result)
+		freeaddrinfo(entry->result);
+	entry->result = result;
+	entry->rc = rc;
+	entry->resolved = MQTTTime_start_clock();
+	entry->valid = 1;
+	entry->background = 0;
+}
+
+
+/**
+ * Copy the results of getaddrinfo into memory which can be freed with Resolver_free.
+ * Only the members used to connect are copied.
+ * @param from the results of getaddrinfo
+ * @param to returns the copy
+ * @return 0 if successful, EAI_MEMORY otherwise
+ */
+static int Resolver_copy(struct addrinfo* from, struct addrinfo** to)
+{
+	struct addrinfo** next = to;
+	int rc = 0;
+
+	*to = NULL;
+	for (; from != NULL; from = from->ai_next)
+	{
+		struct addrinfo* copy = NULL;
+
+		if ((copy = malloc(sizeof(struct addrinfo) + from->ai_addrlen)) == NULL)
+		{
+			Resolver_free(*to);
+			*to = NULL;
+			rc = EAI_MEMORY;
+			break;
+		}
+		memcpy(copy, from, sizeof(struct addrinfo));
+		copy->ai_addr = (struct sockaddr*)(copy + 1);
+		memcpy(copy->ai_addr, from->ai_addr, from->ai_addrlen);
+		copy->ai_canonname = NULL;
+		copy->ai_next = NULL;
+		*next = copy;
+		next = &copy->ai_next;
+	}
+	return rc;
+}
+
+
+/**
+ * Free the results returned by Resolver_getaddrinfo.
+ * @param result the results
+ */
+void Resolver_free(struct addrinfo* result)
+{
+	while (result)
+	{
+		struct addrinfo* next = result->ai_next;
+
+		free(result);
+		result = next;
+	}
+}
+
+
+static int Resolver_lookup(const char* host, struct addrinfo** result)
+{
+	struct addrinfo hints = {0, AF_UNSPEC, SOCK_STREAM, IPPROTO_TCP, 0, NULL, NULL, NULL};
+
+	return getaddrinfo(host, NULL, &hints, result);
+}
+
+
+/**
+ * Look up the addresses of a host name, using the cache if it has a recent enough result.
+ * A result from a helper thread is used for at least #RESOLVER_COLLECT_TIME milliseconds.
+ * @param host the host name
+ * @param ttl the number of seconds a successful lookup is kept for.  0 means the cache is
+ * not used.
+ * @param negative_ttl the number of seconds a failed lookup is kept for
+ * @param result returns the addresses, to be freed with Resolver_free
+ * @return 0 if successful, otherwise the getaddrinfo error code
+ */
+int Resolver_getaddrinfo(const char* host, int ttl, int negative_ttl, struct addrinfo** result)
+{
+	Resolver_entry* entry = NULL;
+	struct addrinfo* found = NULL;
+	int rc = 0;
+
+	FUNC_ENTRY;
+	*result = NULL;
+	Thread_lock_mutex(resolver_mutex);
+	if ((entry = Resolver_find(host)) != NULL && Resolver_isFresh(entry, ttl, negative_ttl))
+	{
+		if ((rc = entry->rc) == 0)
+			rc = Resolver_copy(entry->result, result);
+		Thread_unlock_mutex(resolver_mutex);
+		Log(TRACE_MIN, -1, "Using cached addresses for %s", host);
+		goto exit;
+	}
+	Thread_unlock_mutex(resolver_mutex);
+
+	rc = Resolver_lookup(host, &found);
+	if (rc == 0)
+		rc = Resolver_copy(found, result);
+
+	Thread_lock_mutex(resolver_mutex);
+	if ((ttl > 0 || negative_ttl > 0) && rc != EAI_MEMORY &&
+			((entry = Resolver_find(host)) != NULL || (entry = Resolver_add(host)) != NULL) &&
+			!entry->resolving)
+	{
+		Resolver_store(entry, rc, found);
+		found = NULL;
+	}
+	Thread_unlock_mutex(resolver_mutex);
+	if (found)
+		freeaddrinfo(found);
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+static thread_return_type WINAPI Resolver_thread(void* n)
+{
+	Resolver_entry* entry = (Resolver_entry*)n;
+	Resolver_resolved* callback = NULL;
+	struct addrinfo* result = NULL;
+	int rc = 0;
+
+	/* the host name is not changed or freed while the entry is resolving */
+	rc = Resolver_lookup(entry->host, &result);
+
+	Thread_lock_mutex(resolver_mutex);
+	entry->resolving = 0;
+	if (entry->orphaned)
+	{
+		if (result)
+			freeaddrinfo(result);
+		Resolver_freeEntry(entry);
+	}
+	else
+	{
+		Resolver_store(entry, rc, result);
+		entry->background = 1;
+		callback = resolved;
+	}
+	Thread_unlock_mutex(resolver_mutex);
+
+	if (callback)
+		(*callback)();
+	return 0;
+}
+
+
+static int Resolver_isNumeric(const char* host)
+{
+	struct in6_addr addr;
+
+	return inet_pton(AF_INET, host, &addr) == 1 || inet_pton(AF_INET6, host, &addr) == 1;
+}
+
+
+/**
+ * Start a lookup of a host name on a helper thread, unless the cache already has a result
+ * or a lookup is in progress.  When the lookup completes the callback is called, and the
+ * result is kept for the callers waiting for it to collect with Resolver_getaddrinfo,
+ * whatever the TTLs.
+ * @param host the host name
+ * @param ttl the number of seconds a successful lookup is kept for
+ * @param negative_ttl the number of seconds a failed lookup is kept for
+ * @return #RESOLVER_IN_PROGRESS if the lookup is in progress, 0 if Resolver_getaddrinfo
+ * should be called now
+ */
+int Resolver_start(const char* host, int ttl, int negative_ttl)
+{
+	Resolver_entry* entry = NULL;
+	int rc = 0;
+
+	FUNC_ENTRY;
+	if (Resolver_isNumeric(host))
+		goto exit_unlocked; /* nothing to wait for */
+	Thread_lock_mutex(resolver_mutex);
+	if ((entry = Resolver_find(host)) == NULL && (entry = Resolver_add(host)) == NULL)
+		goto exit; /* no memory, so look the name up in place */
+	if (entry->resolving)
+		rc = RESOLVER_IN_PROGRESS;
+	else if (!Resolver_isFresh(entry, ttl, negative_ttl))
+	{
+		entry->resolving = 1;
+		if (Thread_start(Resolver_thread, entry))
+		{
+			Log(TRACE_MIN, -1, "Looking up %s on a helper thread", host);
+			rc = RESOLVER_IN_PROGRESS;
+		}
+		else
+			entry->resolving = 0;
+	}
+exit:
+	Thread_unlock_mutex(resolver_mutex);
+exit_unlocked:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/**
+ * Empty the cache.  Entries whose lookup is still in progress are freed by their helper
+ * thread when it completes.
+ */
+void Resolver_terminate(void)
+{
+	Resolver_entry* entry = NULL;
+
+	FUNC_ENTRY;
+	Thread_lock_mutex(resolver_mutex);
+	if (entries)
+	{
+		while ((entry = ListDetachHead(entries)) != NULL)
+		{
+			if (entry->resolving)
+				entry->orphaned = 1;
+			else
+				Resolver_freeEntry(entry);
+		}
+		ListFree(entries);
+		entries = NULL;
+	}
+	Thread_unlock_mutex(resolver_mutex);
+	FUNC_EXIT;
+}
@@ -0,0 +1,34 @@
+/*******************************************************************************
+ * Copyright (c) 2026 Contributors to the Eclipse Foundation
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v2.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    https://www.eclipse.org/legal/epl-2.0/
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *******************************************************************************/
+
+#if !defined(RESOLVER_H)
+#define RESOLVER_H
+
+#include "Socket.h"
+
+/** a lookup of the host name has been started on a helper thread */
+#define RESOLVER_IN_PROGRESS 1
+/** the most host names for which results are kept */
+#define RESOLVER_CACHE_SIZE 64
+/** the milliseconds a result from a helper thread is kept for the connects waiting for it */
+#define RESOLVER_COLLECT_TIME 1000
+
+typedef void Resolver_resolved(void);
+void Resolver_setCallback(Resolver_resolved*);
+
+int Resolver_getaddrinfo(const char* host, int ttl, int negative_ttl, struct addrinfo** result);
+void Resolver_free(struct addrinfo* result);
+int Resolver_start(const char* host, int ttl, int negative_ttl);
+void Resolver_terminate(void);
+
+#endif
@@ -35,16 +35,19 @@
 #include "Log.h"
 #include "StackTrace.h"
 #include "Socket.h"
+#include "Thread.h"
 
 #include "Heap.h"
 
 #include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 #include <openssl/ssl.h>
 #include <openssl/err.h>
 #include <openssl/crypto.h>
 #include <openssl/x509v3.h>
 
-extern Sockets mod_s;
+#define mod_s (*Socket_getSockets()) /* the socket data of the calling thread's reactor */
 
 static int SSLSocket_error(char* aString, SSL* ssl, int sock, int rc, int (*cb)(const char *str, size_t len, void *u), void* u);
 char* SSL_get_verify_result_string(int rc);
@@ -68,17 +71,84 @@ extern unsigned long SSLThread_id(void);
 #endif
 extern void SSLLocks_callback(int mode, int n, const char *file, int line);
 int SSLSocket_createContext(networkHandles* net, MQTTClient_SSLOptions* opts);
+static int SSLSocket_newContext(networkHandles* net, MQTTClient_SSLOptions* opts);
 void SSLSocket_destroyContext(networkHandles* net);
 void SSLSocket_addPendingRead(int sock);
 
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+/** OpenSSL can hand the encryption of a connection to the kernel */
+#define SSLSOCKET_KTLS
+#endif
+
+/** The files an SSL context is loaded from: keyStore, privateKey, trustStore and CApath */
+#define SSL_CTX_FILES 4
+
+/** Enough of the state of a file to tell whether it has changed */
+typedef struct
+{
+	int exists;
+	time_t mtime;
+	long long size;
+	long long inode;
+} SSLSocket_fileStamp;
+
+/**
+ * An SSL context shared by all the connections with the same effective TLS options, so that
+ * the certificates and keys are loaded once rather than for every connection.
+ */
+typedef struct
+{
+	SSL_CTX* ctx;
+	int refs;                    /**< the number of connections using the context */
+	int stale;                   /**< a file has changed since the context was created, so it is not shared again */
+	MQTTClient_SSLOptions opts;  /**< a copy of the options the context was created with */
+	SSLSocket_fileStamp stamps[SSL_CTX_FILES]; /**< the state of the files when they were loaded */
+	List* sessions;              /**< the last session for each server, for clients which share sessions */
+} SSLSocket_sharedContext;
+
+/** A TLS session which clients connecting to the same server can resume */
+typedef struct
+{
+	char* key;                   /**< the server address */
+	SSL_SESSION* session;
+} SSLSocket_sharedSession;
+
+/** The state of a connection, set as ex data on its SSL structure */
+typedef struct
+{
+	Clients* client;
+	char* key;                   /**< the server address */
+	int share;                   /**< whether the client shares sessions with other clients */
+	int counted;                 /**< whether the handshake has been added to the client statistics */
+	START_TIME_TYPE start;       /**< when the handshake was started */
+	char* readbuf;               /**< decrypted data read from the connection but not yet returned */
+	int readpos;                 /**< the offset of the next byte to return from readbuf */
+	int readlen;                 /**< the number of bytes in readbuf */
+	int kernelSend;              /**< whether the kernel encrypts the data we send */
+} SSLSocket_connection;
+
+/** The size of the decrypted data buffer: the most data one TLS record can hold */
+#define SSL_READ_BUFFER_SIZE 16384
+
+static void SSLSocket_freeSharedContext(SSLSocket_sharedContext* shared);
+static SSLSocket_sharedContext* SSLSocket_findSharedContext(SSL_CTX* ctx);
+static int SSLSocket_newSession(SSL* ssl, SSL_SESSION* session);
+
 /* 1 ~ we are responsible for initializing openssl; 0 ~ openssl init is done externally */
 static int handle_openssl_init = 1;
 static ssl_mutex_type* sslLocks = NULL;
 static ssl_mutex_type sslCoreMutex;
+static ssl_mutex_type sslContextsMutex;
+
+/* The shared SSL contexts, protected by sslContextsMutex */
+static List ssl_contexts = {NULL, NULL, NULL, 0, 0};
 
 /* Used to store MQTTClient_SSLOptions for TLS-PSK callback */
 static int tls_ex_index_ssl_opts;
 
+/* Used to store the SSLSocket_connection for each SSL structure */
+static int tls_ex_index_connection;
+
 #if defined(_WIN32) || defined(_WIN64)
 #define iov_len len
 #define iov_base buf
@@ -109,7 +179,7 @@ static int SSLSocket_error(char* aString, SSL* ssl, int sock, int rc, int (*cb)(
     }
     else
     {
-        static char buf[120];
+        static THREAD_LOCAL char buf[120];
 
         if (strcmp(aString, "shutdown") != 0)
         	Log(TRACE_MIN, -1, "SSLSocket error %s(%d) in %s for socket %d rc %d errno %d %s\n", buf, error, aString, sock, rc, errno, strerror(errno));
@@ -254,7 +324,7 @@ void SSL_CTX_info_callback(const SSL* ssl, int where, int ret)
 char* SSLSocket_get_version_string(int version)
 {
 	int i;
-	static char buf[20];
+	static THREAD_LOCAL char buf[20];
 	char* retstring = NULL;
 	static struct
 	{
@@ -488,8 +558,10 @@ int SSLSocket_initialize(void)
 	}
 
 	SSL_create_mutex(&sslCoreMutex);
+	SSL_create_mutex(&sslContextsMutex);
 
 	tls_ex_index_ssl_opts = SSL_get_ex_new_index(0, "paho ssl options", NULL, NULL, NULL);
+	tls_ex_index_connection = SSL_get_ex_new_index(0, "paho connection", NULL, NULL, NULL);
 
 exit:
 	FUNC_EXIT_RC(rc);
@@ -519,6 +591,16 @@ void SSLSocket_terminate(void)
 
 	SSL_destroy_mutex(&sslCoreMutex);
 
+	if (ssl_contexts.count > 0)
+	{
+		ListElement* current = NULL;
+
+		while (ListNextElement(&ssl_contexts, &current))
+			SSLSocket_freeSharedContext((SSLSocket_sharedContext*)(current->content));
+		ListEmpty(&ssl_contexts);
+	}
+	SSL_destroy_mutex(&sslContextsMutex);
+
 	FUNC_EXIT;
 }
 
@@ -543,7 +625,13 @@ exit:
 	return rc;
 }
 
-int SSLSocket_createContext(networkHandles* net, MQTTClient_SSLOptions* opts)
+/**
+ * Creates a new SSL context, loading the certificates and keys named in the options.
+ * @param net the network handle, in which the context is set
+ * @param opts the SSL options
+ * @return 1 if success, otherwise failure
+ */
+static int SSLSocket_newContext(networkHandles* net, MQTTClient_SSLOptions* opts)
 {
 	int rc = 1;
 
@@ -683,7 +771,20 @@ int SSLSocket_createContext(networkHandles* net, MQTTClient_SSLOptions* opts)
 	}
 #endif
 
+	SSL_CTX_set_info_callback(net->ctx, SSL_CTX_info_callback);
+	SSL_CTX_set_msg_callback(net->ctx, SSL_CTX_msg_callback);
+	if (opts->enableServerCertAuth)
+		SSL_CTX_set_verify(net->ctx, SSL_VERIFY_PEER, NULL);
+
 	SSL_CTX_set_mode(net->ctx, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+#if defined(SSLSOCKET_KTLS)
+	if (opts->struct_version >= 7 && opts->enableKernelTLS)
+		SSL_CTX_set_options(net->ctx, SSL_OP_ENABLE_KTLS);
+#endif
+
+	/* new sessions are kept by the client, and optionally shared, rather than in the context */
+	SSL_CTX_set_session_cache_mode(net->ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+	SSL_CTX_sess_set_new_cb(net->ctx, SSLSocket_newSession);
 
 	goto exit;
 free_ctx:
@@ -696,25 +797,383 @@ exit:
 }
 
 
-int SSLSocket_setSocketForSSL(networkHandles* net, MQTTClient_SSLOptions* opts,
-	const char* hostname, size_t hostname_len)
+/**
+ * Records the state of a file, so that a change to it can be detected.
+ * @param filename the file or directory name, which can be NULL
+ * @param stamp the state of the file, returned
+ */
+static void SSLSocket_stampFile(const char* filename, SSLSocket_fileStamp* stamp)
+{
+	struct stat st;
+
+	memset(stamp, '\0', sizeof(SSLSocket_fileStamp));
+	if (filename && stat(filename, &st) == 0)
+	{
+		stamp->exists = 1;
+		stamp->mtime = st.st_mtime;
+		stamp->size = (long long)st.st_size;
+		stamp->inode = (long long)st.st_ino;
+	}
+}
+
+
+static void SSLSocket_stampFiles(MQTTClient_SSLOptions* opts, SSLSocket_fileStamp stamps[])
+{
+	SSLSocket_stampFile(opts->keyStore, &stamps[0]);
+	SSLSocket_stampFile(opts->privateKey, &stamps[1]);
+	SSLSocket_stampFile(opts->trustStore, &stamps[2]);
+	SSLSocket_stampFile(opts->CApath, &stamps[3]);
+}
+
+
+static int SSLSocket_strcmp(const char* a, const char* b)
+{
+	if (a == NULL || b == NULL)
+		return (a == b) ? 0 : 1;
+	return strcmp(a, b);
+}
+
+
+/**
+ * Whether a shared context was created with options which give the same context as these.
+ */
+static int SSLSocket_sameOptions(MQTTClient_SSLOptions* a, MQTTClient_SSLOptions* b)
+{
+	return SSLSocket_strcmp(a->trustStore, b->trustStore) == 0 &&
+		SSLSocket_strcmp(a->keyStore, b->keyStore) == 0 &&
+		SSLSocket_strcmp(a->privateKey, b->privateKey) == 0 &&
+		SSLSocket_strcmp(a->privateKeyPassword, b->privateKeyPassword) == 0 &&
+		SSLSocket_strcmp(a->enabledCipherSuites, b->enabledCipherSuites) == 0 &&
+		SSLSocket_strcmp(a->CApath, b->CApath) == 0 &&
+		a->enableServerCertAuth == b->enableServerCertAuth &&
+		a->sslVersion == b->sslVersion &&
+		a->disableDefaultTrustStore == b->disableDefaultTrustStore &&
+		a->enableKernelTLS == b->enableKernelTLS &&
+		a->protos_len == b->protos_len &&
+		(a->protos_len == 0 || memcmp(a->protos, b->protos, a->protos_len) == 0);
+}
+
+
+static void SSLSocket_freeSharedContext(SSLSocket_sharedContext* shared)
+{
+	if (shared->opts.trustStore)
+		free((void*)shared->opts.trustStore);
+	if (shared->opts.keyStore)
+		free((void*)shared->opts.keyStore);
+	if (shared->opts.privateKey)
+		free((void*)shared->opts.privateKey);
+	if (shared->opts.privateKeyPassword)
+		free((void*)shared->opts.privateKeyPassword);
+	if (shared->opts.enabledCipherSuites)
+		free((void*)shared->opts.enabledCipherSuites);
+	if (shared->opts.CApath)
+		free((void*)shared->opts.CApath);
+	if (shared->opts.protos)
+		free((void*)shared->opts.protos);
+	if (shared->sessions)
+	{
+		ListElement* current = NULL;
+
+		while (ListNextElement(shared->sessions, &current))
+		{
+			SSLSocket_sharedSession* entry = (SSLSocket_sharedSession*)(current->content);
+
+			free(entry->key);
+			SSL_SESSION_free(entry->session);
+		}
+		ListFree(shared->sessions);
+	}
+	if (shared->ctx)
+		SSL_CTX_free(shared->ctx);
+}
+
+
+/**
+ * Creates a shared context entry for a new context, copying the options it was created with.
+ * @return the entry, or NULL if there was not enough memory
+ */
+static SSLSocket_sharedContext* SSLSocket_addSharedContext(SSL_CTX* ctx, MQTTClient_SSLOptions* opts,
+	SSLSocket_fileStamp stamps[])
+{
+	SSLSocket_sharedContext* shared = NULL;
+	int ok = 1;
+
+	if ((shared = malloc(sizeof(SSLSocket_sharedContext))) == NULL)
+		goto exit;
+	memset(shared, '\0', sizeof(SSLSocket_sharedContext));
+	shared->opts.enableServerCertAuth = opts->enableServerCertAuth;
+	shared->opts.sslVersion = opts->sslVersion;
+	shared->opts.disableDefaultTrustStore = opts->disableDefaultTrustStore;
+	shared->opts.enableKernelTLS = opts->enableKernelTLS;
+	if (opts->trustStore)
+		ok &= (shared->opts.trustStore = MQTTStrdup(opts->trustStore)) != NULL;
+	if (opts->keyStore)
+		ok &= (shared->opts.keyStore = MQTTStrdup(opts->keyStore)) != NULL;
+	if (opts->privateKey)
+		ok &= (shared->opts.privateKey = MQTTStrdup(opts->privateKey)) != NULL;
+	if (opts->privateKeyPassword)
+		ok &= (shared->opts.privateKeyPassword = MQTTStrdup(opts->privateKeyPassword)) != NULL;
+	if (opts->enabledCipherSuites)
+		ok &= (shared->opts.enabledCipherSuites = MQTTStrdup(opts->enabledCipherSuites)) != NULL;
+	if (opts->CApath)
+		ok &= (shared->opts.CApath = MQTTStrdup(opts->CApath)) != NULL;
+	ok &= (shared->sessions = ListInitialize()) != NULL;
+	if (opts->protos && opts->protos_len > 0)
+	{
+		if ((shared->opts.protos = malloc(opts->protos_len)) != NULL)
+		{
+			memcpy((void*)shared->opts.protos, opts->protos, opts->protos_len);
+			shared->opts.protos_len = opts->protos_len;
+		}
+		else
+			ok = 0;
+	}
+	if (!ok)
+	{
+		SSLSocket_freeSharedContext(shared);
+		free(shared);
+		shared = NULL;
+		goto exit;
+	}
+	memcpy(shared->stamps, stamps, sizeof(shared->stamps));
+	if (shared->opts.privateKeyPassword)  /* the client's copy may be freed before the context */
+		SSL_CTX_set_default_passwd_cb_userdata(ctx, (void*)shared->opts.privateKeyPassword);
+	shared->ctx = ctx;
+	shared->refs = 1;
+	ListAppend(&ssl_contexts, shared, sizeof(SSLSocket_sharedContext));
+exit:
+	return shared;
+}
+
+
+/**
+ * Sets the SSL context for a connection.  Connections with the same effective options share
+ * one context, which is only created again if one of the files it was loaded from changes.
+ * Contexts which use a TLS-PSK callback are not shared, as the callback is found from the
+ * options of the client.
+ * @param net the network handle, in which the context is set
+ * @param opts the SSL options
+ * @return 1 if success, otherwise failure
+ */
+int SSLSocket_createContext(networkHandles* net, MQTTClient_SSLOptions* opts)
 {
 	int rc = 1;
+	ListElement* current = NULL;
+	SSLSocket_fileStamp stamps[SSL_CTX_FILES];
+	MQTTClient_SSLOptions effective;
+
+	FUNC_ENTRY;
+	if (opts->ssl_psk_cb != NULL)
+	{
+		rc = SSLSocket_newContext(net, opts);
+		goto exit;
+	}
+
+	/* the private key is in the keyStore if not set separately */
+	effective = *opts;
+	if (effective.privateKey == NULL)
+		effective.privateKey = effective.keyStore;
+
+	SSL_lock_mutex(&sslContextsMutex);
+	SSLSocket_stampFiles(&effective, stamps);
+	while (ListNextElement(&ssl_contexts, &current))
+	{
+		SSLSocket_sharedContext* shared = (SSLSocket_sharedContext*)(current->content);
+
+		if (shared->stale || !SSLSocket_sameOptions(&shared->opts, &effective))
+			continue;
+		if (memcmp(shared->stamps, stamps, sizeof(stamps)) != 0)
+		{
+			/* the connections using it keep it, but new connections get a new context */
+			Log(TRACE_MIN, -1, "SSL context files have changed, so creating a new context");
+			shared->stale = 1;
+			continue;
+		}
+		shared->refs++;
+		net->ctx = shared->ctx;
+		Log(TRACE_MIN, -1, "Sharing SSL context with %d other connections", shared->refs - 1);
+		goto unlock;
+	}
+
+	/* load the files while holding the lock, so that connections which are waiting for the
+	same context don't load them as well */
+	if ((rc = SSLSocket_newContext(net, opts)) == 1 &&
+			SSLSocket_addSharedContext(net->ctx, &effective, stamps) == NULL)
+	{
+		SSL_CTX_free(net->ctx);
+		net->ctx = NULL;
+		rc = PAHO_MEMORY_ERROR;
+	}
+unlock:
+	SSL_unlock_mutex(&sslContextsMutex);
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/**
+ * Finds the shared context entry for an SSL context.  The contexts mutex must be held.
+ * @param ctx the SSL context
+ * @return the entry, or NULL if the context is not shared
+ */
+static SSLSocket_sharedContext* SSLSocket_findSharedContext(SSL_CTX* ctx)
+{
+	ListElement* current = NULL;
+	SSLSocket_sharedContext* shared = NULL;
+
+	while (ListNextElement(&ssl_contexts, &current))
+	{
+		if (((SSLSocket_sharedContext*)(current->content))->ctx == ctx)
+		{
+			shared = (SSLSocket_sharedContext*)(current->content);
+			break;
+		}
+	}
+	return shared;
+}
+
+
+static int sharedSessionKeyCompare(void* a, void* b)
+{
+	return strcmp(((SSLSocket_sharedSession*)a)->key, (char*)b) == 0;
+}
+
+
+/**
+ * Called by OpenSSL when the server gives us a session we can resume, either at the end of
+ * the handshake or, for TLS 1.3, when a session ticket arrives afterwards.  The session
+ * replaces the one kept by the client and, if the client shares sessions, the one kept for
+ * the server in the shared context.
+ * @return 1 to show we have taken the reference to the session, 0 otherwise
+ */
+static int SSLSocket_newSession(SSL* ssl, SSL_SESSION* session)
+{
+	SSLSocket_connection* conn = SSL_get_ex_data(ssl, tls_ex_index_connection);
+	int rc = 0;
+
+	FUNC_ENTRY;
+	if (conn == NULL)
+		goto exit;
+
+#if (OPENSSL_VERSION_NUMBER >= 0x10100000L)
+	if (conn->share)
+	{
+		SSLSocket_sharedContext* shared = NULL;
+
+		SSL_lock_mutex(&sslContextsMutex);
+		if ((shared = SSLSocket_findSharedContext(SSL_get_SSL_CTX(ssl))) != NULL)
+		{
+			ListElement* elem = ListFindItem(shared->sessions, conn->key, sharedSessionKeyCompare);
+
+			if (elem)
+			{
+				SSLSocket_sharedSession* entry = (SSLSocket_sharedSession*)(elem->content);
+
+				SSL_SESSION_free(entry->session);
+				SSL_SESSION_up_ref(session);
+				entry->session = session;
+			}
+			else
+			{
+				SSLSocket_sharedSession* entry = malloc(sizeof(SSLSocket_sharedSession));
+
+				if (entry && (entry->key = MQTTStrdup(conn->key)) != NULL)
+				{
+					SSL_SESSION_up_ref(session);
+					entry->session = session;
+					ListAppend(shared->sessions, entry, sizeof(SSLSocket_sharedSession));
+				}
+				else if (entry)
+					free(entry);
+			}
+		}
+		SSL_unlock_mutex(&sslContextsMutex);
+	}
+#endif
+
+	if (conn->client->session)
+		SSL_SESSION_free(conn->client->session);
+	conn->client->session = session;
+	rc = 1;
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/**
+ * Sets the session to try to resume on a new connection: the client's own last session,
+ * or else, if the client shares sessions, the last session any client had with the server.
+ * @param ssl the SSL structure of the new connection
+ * @param conn the state of the connection
+ */
+static void SSLSocket_resumeSession(SSL* ssl, SSLSocket_connection* conn)
+{
+	SSL_SESSION* session = conn->client->session;
+	SSLSocket_sharedContext* shared = NULL;
+
+	if (session == NULL && conn->share)
+	{
+		SSL_lock_mutex(&sslContextsMutex);
+		if ((shared = SSLSocket_findSharedContext(SSL_get_SSL_CTX(ssl))) != NULL)
+		{
+			ListElement* elem = ListFindItem(shared->sessions, conn->key, sharedSessionKeyCompare);
+
+			if (elem)
+				session = ((SSLSocket_sharedSession*)(elem->content))->session;
+		}
+		if (session && SSL_set_session(ssl, session) != 1)
+			Log(TRACE_MIN, -1, "Failed to set shared SSL session, non critical");
+		SSL_unlock_mutex(&sslContextsMutex);
+	}
+	else if (session && SSL_set_session(ssl, session) != 1)
+		Log(TRACE_MIN, -1, "Failed to set SSL session with stored data, non critical");
+}
+
+
+/**
+ * Creates the SSL structure for a connection, ready for the handshake.
+ * @param client the client, whose network handle and SSL options are used
+ * @param hostname the server address
+ * @param hostname_len the length of the host name part of the address
+ * @return 1 if success, otherwise failure
+ */
+int SSLSocket_setSocketForSSL(Clients* client, const char* hostname, size_t hostname_len)
+{
+	networkHandles* net = &client->net;
+	MQTTClient_SSLOptions* opts = client->sslopts;
+	int rc = 1;
 
 	FUNC_ENTRY;
 
 	if (net->ctx != NULL || (rc = SSLSocket_createContext(net, opts)) == 1)
 	{
 		char *hostname_plus_null;
+		SSLSocket_connection* conn = NULL;
 		int i;
 
-		SSL_CTX_set_info_callback(net->ctx, SSL_CTX_info_callback);
-		SSL_CTX_set_msg_callback(net->ctx, SSL_CTX_msg_callback);
-   		if (opts->enableServerCertAuth)
-			SSL_CTX_set_verify(net->ctx, SSL_VERIFY_PEER, NULL);
-
 		net->ssl = SSL_new(net->ctx);
 
+		if ((conn = malloc(sizeof(SSLSocket_connection))) == NULL ||
+				(conn->key = MQTTStrdup(hostname)) == NULL)
+		{
+			if (conn)
+				free(conn);
+			rc = PAHO_MEMORY_ERROR;
+			goto exit;
+		}
+		conn->client = client;
+		conn->share = (opts->struct_version >= 6) ? opts->shareSessions : 0;
+		conn->counted = 0;
+		conn->start = MQTTTime_start_clock();
+		conn->readbuf = NULL;
+		conn->readpos = conn->readlen = 0;
+		conn->kernelSend = 0;
+		client->tlsKernelSend = client->tlsKernelReceive = 0;
+		SSL_set_ex_data(net->ssl, tls_ex_index_connection, conn);
+		SSLSocket_resumeSession(net->ssl, conn);
+
 		/* Log all ciphers available to the SSL sessions (loaded in ctx) */
 		for (i = 0; ;i++)
 		{
@@ -745,10 +1204,44 @@ int SSLSocket_setSocketForSSL(networkHandles* net, MQTTClient_SSLOptions* opts,
 			rc = PAHO_MEMORY_ERROR;
 	}
 
+exit:
 	FUNC_EXIT_RC(rc);
 	return rc;
 }
 
+/**
+ * Called when the handshake of a connection is complete, to add it to the statistics of the
+ * client and find out whether the kernel has taken over the encryption.
+ * @param ssl the SSL structure of the connection
+ */
+static void SSLSocket_handshakeComplete(SSL* ssl)
+{
+	SSLSocket_connection* conn = SSL_get_ex_data(ssl, tls_ex_index_connection);
+
+	if (conn && !conn->counted)
+	{
+		Clients* client = conn->client;
+		int resumed = SSL_session_reused(ssl);
+
+		client->tlsLastHandshakeTime = MQTTTime_elapsed(conn->start);
+		client->tlsHandshakeTime += client->tlsLastHandshakeTime;
+		client->tlsHandshakes++;
+		if (resumed)
+			client->tlsResumedHandshakes++;
+		conn->counted = 1;
+		Log(TRACE_MIN, -1, "TLS handshake %s in %d ms", resumed ? "resumed a session" : "completed",
+			(int)client->tlsLastHandshakeTime);
+#if defined(SSLSOCKET_KTLS)
+		client->tlsKernelSend = conn->kernelSend = (BIO_get_ktls_send(SSL_get_wbio(ssl)) == 1);
+		client->tlsKernelReceive = (BIO_get_ktls_recv(SSL_get_rbio(ssl)) == 1);
+		if (client->sslopts->struct_version >= 7 && client->sslopts->enableKernelTLS)
+			Log(TRACE_MIN, -1, "Kernel TLS send %s, receive %s",
+				client->tlsKernelSend ? "on" : "off", client->tlsKernelReceive ? "on" : "off");
+#endif
+	}
+}
+
+
 /*
  * Return value: 1 - success, TCPSOCKET_INTERRUPTED - try again, anything else is failure
  */
@@ -760,6 +1253,8 @@ int SSLSocket_connect(SSL* ssl, int sock, const char* hostname, int verify, int
 
 	ERR_clear_error();
 	rc = SSL_connect(ssl);
+	if (rc == 1)
+		SSLSocket_handshakeComplete(ssl);
 	if (rc != 1)
 	{
 		int error;
@@ -820,6 +1315,53 @@ int SSLSocket_connect(SSL* ssl, int sock, const char* hostname, int verify, int
 
 
 
+/**
+ * Reads decrypted data from a connection.  Data is read from OpenSSL a record at a time into
+ * a buffer for the connection, so that the bytes of a packet header and the small packets
+ * following it in the same record don't each need an SSL_read call.  Large reads into an
+ * empty buffer go straight to the caller's memory.
+ * @param ssl the SSL structure of the connection
+ * @param dest the memory to read into
+ * @param len the maximum number of bytes to read
+ * @return the number of bytes read, or else the SSL_read return code
+ */
+static int SSLSocket_read(SSL* ssl, char* dest, int len)
+{
+	SSLSocket_connection* conn = SSL_get_ex_data(ssl, tls_ex_index_connection);
+	int rc = 0;
+
+	if (conn == NULL || (conn->readpos == conn->readlen && len >= SSL_READ_BUFFER_SIZE))
+		return SSL_read(ssl, dest, len);
+
+	if (conn->readpos == conn->readlen)
+	{
+		if (conn->readbuf == NULL && (conn->readbuf = malloc(SSL_READ_BUFFER_SIZE)) == NULL)
+			return SSL_read(ssl, dest, len);
+		if ((rc = SSL_read(ssl, conn->readbuf, SSL_READ_BUFFER_SIZE)) <= 0)
+			return rc;
+		conn->readpos = 0;
+		conn->readlen = rc;
+	}
+	rc = (len < conn->readlen - conn->readpos) ? len : conn->readlen - conn->readpos;
+	memcpy(dest, &conn->readbuf[conn->readpos], rc);
+	conn->readpos += rc;
+	return rc;
+}
+
+
+/**
+ * Whether there is decrypted data for a connection that select won't tell us about.
+ * @param ssl the SSL structure of the connection
+ * @return boolean
+ */
+static int SSLSocket_hasBufferedData(SSL* ssl)
+{
+	SSLSocket_connection* conn = SSL_get_ex_data(ssl, tls_ex_index_connection);
+
+	return (conn && conn->readpos < conn->readlen) || SSL_pending(ssl) > 0;
+}
+
+
 /**
  *  Reads one byte from a socket
  *  @param socket the socket to read from
@@ -835,7 +1377,7 @@ int SSLSocket_getch(SSL* ssl, int socket, char* c)
 		goto exit;
 
 	ERR_clear_error();
-	if ((rc = SSL_read(ssl, c, (size_t)1)) < 0)
+	if ((rc = SSLSocket_read(ssl, c, 1)) < 0)
 	{
 		int err = SSLSocket_error("SSL_read - getch", ssl, socket, rc, NULL, NULL);
 		if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE)
@@ -874,13 +1416,21 @@ char *SSLSocket_getdata(SSL* ssl, int socket, size_t bytes, size_t* actual_len,
 	if (bytes == 0)
 	{
 		buf = SocketBuffer_complete(socket);
+		if (SSLSocket_hasBufferedData(ssl))
+			SSLSocket_addPendingRead(socket);
 		goto exit;
 	}
 
 	buf = SocketBuffer_getQueuedData(socket, bytes, actual_len);
 
 	ERR_clear_error();
-	if ((*rc = SSL_read(ssl, buf + (*actual_len), (int)(bytes - (*actual_len)))) < 0)
+	while ((*rc = SSLSocket_read(ssl, buf + (*actual_len), (int)(bytes - (*actual_len)))) > 0)
+	{
+		*actual_len += *rc;
+		if (*actual_len == bytes)
+			break;
+	}
+	if (*rc < 0)
 	{
 		*rc = SSLSocket_error("SSL_read - getdata", ssl, socket, *rc, NULL, NULL);
 		if (*rc != SSL_ERROR_WANT_READ && *rc != SSL_ERROR_WANT_WRITE)
@@ -894,17 +1444,15 @@ char *SSLSocket_getdata(SSL* ssl, int socket, size_t bytes, size_t* actual_len,
 		buf = NULL;
 		goto exit;
 	}
-	else
-		*actual_len += *rc;
 
 	if (*actual_len == bytes)
 	{
 		SocketBuffer_complete(socket);
-		/* if we read the whole packet, there might still be data waiting in the SSL buffer, which
-		isn't picked up by select.  So here we should check for any data remaining in the SSL buffer, and
+		/* if we read the whole packet, there might still be data waiting in our buffer or the SSL buffer,
+		which isn't picked up by select.  So here we should check for any data remaining, and
 		if so, add this socket to a new "pending SSL reads" list.
 		*/
-		if (SSL_pending(ssl) > 0) /* return no of bytes pending */
+		if (SSLSocket_hasBufferedData(ssl))
 			SSLSocket_addPendingRead(socket);
 	}
 	else /* we didn't read the whole packet */
@@ -917,16 +1465,34 @@ exit:
 	return buf;
 }
 
+/**
+ * Releases the SSL context of a connection.  A shared context is freed when the last
+ * connection using it is closed.
+ * @param net the network handle
+ */
 void SSLSocket_destroyContext(networkHandles* net)
 {
 	FUNC_ENTRY;
 	if (net->ctx)
-		SSL_CTX_free(net->ctx);
+	{
+		SSLSocket_sharedContext* shared = NULL;
+
+		SSL_lock_mutex(&sslContextsMutex);
+		if ((shared = SSLSocket_findSharedContext(net->ctx)) == NULL)
+			SSL_CTX_free(net->ctx);
+		else if (--shared->refs == 0)
+		{
+			SSLSocket_freeSharedContext(shared);
+			ListRemove(&ssl_contexts, shared);
+		}
+		SSL_unlock_mutex(&sslContextsMutex);
+	}
 	net->ctx = NULL;
 	FUNC_EXIT;
 }
 
-static List pending_reads = {NULL, NULL, NULL, 0, 0};
+static List reactor_pending_reads[SOCKET_MAX_REACTORS];
+#define pending_reads (reactor_pending_reads[Socket_getReactor()])
 
 int SSLSocket_close(networkHandles* net)
 {
@@ -939,6 +1505,16 @@ int SSLSocket_close(networkHandles* net)
 
 	if (net->ssl)
 	{
+		SSLSocket_connection* conn = SSL_get_ex_data(net->ssl, tls_ex_index_connection);
+
+		if (conn)
+		{
+			SSL_set_ex_data(net->ssl, tls_ex_index_connection, NULL);
+			if (conn->readbuf)
+				free(conn->readbuf);
+			free(conn->key);
+			free(conn);
+		}
 		ERR_clear_error();
 		rc = SSL_shutdown(net->ssl);
 		SSL_free(net->ssl);
@@ -958,8 +1534,15 @@ int SSLSocket_putdatas(SSL* ssl, int socket, char* buf0, size_t buf0len, PacketB
 	char *ptr;
 	iobuf iovec;
 	int sslerror;
+	SSLSocket_connection* conn = SSL_get_ex_data(ssl, tls_ex_index_connection);
 
 	FUNC_ENTRY;
+	if (conn && conn->kernelSend)
+	{
+		/* the kernel encrypts what we write to the socket, so we don't need to copy the buffers */
+		rc = Socket_putdatas(socket, buf0, buf0len, bufs);
+		goto exit;
+	}
 	iovec.iov_len = (ULONG)buf0len;
 	for (i = 0; i < bufs.count; i++)
 		iovec.iov_len += (ULONG)bufs.buflens[i];
@@ -33,6 +33,9 @@
 #include "SocketBuffer.h"
 #include "Messages.h"
 #include "StackTrace.h"
+#include "MQTTTime.h"
+#include "Resolver.h"
+#include "Thread.h"
 #if defined(OPENSSL)
 #include "SSLSocket.h"
 #endif
@@ -41,6 +44,10 @@
 #include <string.h>
 #include <signal.h>
 #include <ctype.h>
+#if defined(UNIXSOCK)
+#include <stddef.h>
+#include <sys/un.h>
+#endif
 
 #include "Heap.h"
 
@@ -62,10 +69,74 @@ int Socket_abortWrite(int socket);
 #endif
 
 /**
- * Structure to hold all socket data for this module
+ * Structure to hold all socket data for this module, one for each reactor thread.  mod_s is
+ * that of the reactor which the calling thread is working for, see Socket_setReactor.
+ */
+static Sockets reactor_sockets[SOCKET_MAX_REACTORS];
+static int reactor_count = 1;
+static THREAD_LOCAL int current_reactor = 0;
+#define mod_s (reactor_sockets[current_reactor])
+#define wset (mod_s.wset)
+
+/**
+ * An address to connect to, from the resolution of a host name
+ */
+typedef struct
+{
+	struct sockaddr_storage addr; /**< the address, with the port set */
+	socklen_t addrlen;            /**< the length of addr */
+	int tag;                      /**< which of the caller's servers the address belongs to */
+} Socket_target;
+
+#if !defined(_WIN32) && !defined(_WIN64)
+/* Connection races hand the winning connection to the caller's socket number with dup2 */
+#define SOCKET_RACES
+
+/** The default time in milliseconds to wait for a connect before starting the next (RFC 8305) */
+#define SOCKET_CONNECT_ATTEMPT_DELAY 250
+/** The milliseconds between checks for the lookups of a race's servers to complete */
+#define SOCKET_LOOKUP_INTERVAL 20
+
+/**
+ * A server of a connection race whose host name is being looked up on a helper thread
+ */
+typedef struct
+{
+	char* host; /**< the host name */
+	int port;   /**< the TCP port */
+	int tag;    /**< the tag to give the server's addresses */
+} Socket_lookup;
+
+/**
+ * A connect in progress to one address of a connection race
+ */
+typedef struct
+{
+	int socket; /**< the socket, not known to the caller or select */
+	int tag;    /**< the tag of the target */
+} Socket_attempt;
+
+/**
+ * Connects to the addresses of a server, started at intervals until one of them succeeds,
+ * so that an unreachable address does not hold up the connection for the whole timeout.
  */
-Sockets mod_s;
-static fd_set wset;
+typedef struct
+{
+	int socket;             /**< the socket returned by Socket_new, which the winner is moved to */
+	int primary;            /**< whether the connect started on socket by Socket_new is in progress */
+	List* targets;          /**< the addresses not yet tried */
+	List* lookups;          /**< the servers whose addresses are still being looked up */
+	List* attempts;         /**< the other connects in progress */
+	START_TIME_TYPE last;   /**< when the last attempt was started */
+	int delay;              /**< milliseconds to wait for an attempt before starting the next */
+	int tag;                /**< the tag of the winner, or the last to fail */
+	int done;               /**< the race is over, and the socket handed back to select */
+	MQTTClient_socketOptions opts; /**< the options to set on the sockets of the attempts */
+} Socket_race;
+
+static void Socket_freeRace(Socket_race* race);
+static int Socket_continueRaces(fd_set* pwset, int* nfds, struct timeval* timeout);
+#endif
 
 /**
  * Set a socket non-blocking, OS independently
@@ -117,11 +188,69 @@ int Socket_error(char* aString, int sock)
 }
 
 
+/**
+ * Sets the number of reactor threads, each of which has a set of sockets of its own.
+ * Must be called before Socket_outInitialize.
+ * @param count the number of reactors, from 1 to SOCKET_MAX_REACTORS
+ */
+void Socket_setReactorCount(int count)
+{
+	if (count < 1)
+		count = 1;
+	else if (count > SOCKET_MAX_REACTORS)
+		count = SOCKET_MAX_REACTORS;
+	reactor_count = count;
+}
+
+
+/**
+ * Gets the number of reactor threads which have sets of sockets.
+ * @return the number of reactors
+ */
+int Socket_getReactorCount(void)
+{
+	return reactor_count;
+}
+
+
+/**
+ * Sets the reactor whose sockets the calling thread works on, until it is set again.  The
+ * buffers of the SocketBuffer, WebSocket and SSLSocket modules are those of that reactor too.
+ * Threads start with reactor 0.
+ * @param reactor the number of the reactor
+ */
+void Socket_setReactor(int reactor)
+{
+	current_reactor = reactor;
+}
+
+
+/**
+ * Gets the reactor whose sockets the calling thread works on.
+ * @return the number of the reactor
+ */
+int Socket_getReactor(void)
+{
+	return current_reactor;
+}
+
+
+/**
+ * Gets the socket data of the reactor which the calling thread works on.
+ * @return the socket data
+ */
+Sockets* Socket_getSockets(void)
+{
+	return &mod_s;
+}
+
+
 /**
  * Initialize the socket module
  */
 void Socket_outInitialize(void)
 {
+	int saved = current_reactor;
 #if defined(_WIN32) || defined(_WIN64)
 	WORD    winsockVer = 0x0202;
 	WSADATA wsd;
@@ -133,15 +262,20 @@ void Socket_outInitialize(void)
 	signal(SIGPIPE, SIG_IGN);
 #endif
 
-	SocketBuffer_initialize();
-	mod_s.clientsds = ListInitialize();
-	mod_s.connect_pending = ListInitialize();
-	mod_s.write_pending = ListInitialize();
-	mod_s.cur_clientsds = NULL;
-	FD_ZERO(&(mod_s.rset));														/* Initialize the descriptor set */
-	FD_ZERO(&(mod_s.pending_wset));
-	mod_s.maxfdp1 = 0;
-	memcpy((void*)&(mod_s.rset_saved), (void*)&(mod_s.rset), sizeof(mod_s.rset_saved));
+	for (current_reactor = 0; current_reactor < reactor_count; ++current_reactor)
+	{
+		SocketBuffer_initialize();
+		mod_s.clientsds = ListInitialize();
+		mod_s.connect_pending = ListInitialize();
+		mod_s.write_pending = ListInitialize();
+		mod_s.races = ListInitialize();
+		mod_s.cur_clientsds = NULL;
+		FD_ZERO(&(mod_s.rset));														/* Initialize the descriptor set */
+		FD_ZERO(&(mod_s.pending_wset));
+		mod_s.maxfdp1 = 0;
+		memcpy((void*)&(mod_s.rset_saved), (void*)&(mod_s.rset), sizeof(mod_s.rset_saved));
+	}
+	current_reactor = saved;
 	FUNC_EXIT;
 }
 
@@ -151,11 +285,23 @@ void Socket_outInitialize(void)
  */
 void Socket_outTerminate(void)
 {
+	int saved = current_reactor;
+
 	FUNC_ENTRY;
-	ListFree(mod_s.connect_pending);
-	ListFree(mod_s.write_pending);
-	ListFree(mod_s.clientsds);
-	SocketBuffer_terminate();
+	Resolver_terminate();
+	for (current_reactor = 0; current_reactor < reactor_count; ++current_reactor)
+	{
+#if defined(SOCKET_RACES)
+		while (mod_s.races->first)
+			Socket_freeRace((Socket_race*)(mod_s.races->first->content));
+#endif
+		ListFree(mod_s.races);
+		ListFree(mod_s.connect_pending);
+		ListFree(mod_s.write_pending);
+		ListFree(mod_s.clientsds);
+		SocketBuffer_terminate();
+	}
+	current_reactor = saved;
 #if defined(_WIN32) || defined(_WIN64)
 	WSACleanup();
 #endif
@@ -270,12 +416,17 @@ int Socket_getReadySocket(int more_work, struct timeval *tp, mutex_type mutex, i
 	{
 		int rc1;
 		fd_set pwset;
+		int nfds = mod_s.maxfdp1;
 
 		memcpy((void*)&(mod_s.rset), (void*)&(mod_s.rset_saved), sizeof(mod_s.rset));
 		memcpy((void*)&(pwset), (void*)&(mod_s.pending_wset), sizeof(pwset));
+#if defined(SOCKET_RACES)
+		if (Socket_continueRaces(&pwset, &nfds, &timeout) > 0)
+			timeout = zero; /* a finished race's socket is ready to be reported */
+#endif
 		/* Prevent performance issue by unlocking the socket_mutex while waiting for a ready socket. */
 		Thread_unlock_mutex(mutex);
-		*rc = select(mod_s.maxfdp1, &(mod_s.rset), &pwset, NULL, &timeout);
+		*rc = select(nfds, &(mod_s.rset), &pwset, NULL, &timeout);
 		Thread_lock_mutex(mutex);
 		if (*rc == SOCKET_ERROR)
 		{
@@ -289,6 +440,9 @@ int Socket_getReadySocket(int more_work, struct timeval *tp, mutex_type mutex, i
 			*rc = SOCKET_ERROR;
 			goto exit;
 		}
+#if defined(SOCKET_RACES)
+		Socket_continueRaces(NULL, NULL, NULL); /* so that a race just won is reported now */
+#endif
 
 		memcpy((void*)&wset, (void*)&(mod_s.rset_saved), sizeof(wset));
 		if ((rc1 = select(mod_s.maxfdp1, NULL, &(wset), NULL, &zero)) == SOCKET_ERROR)
@@ -598,6 +752,74 @@ void Socket_clearPendingWrite(int socket)
 }
 
 
+/**
+ *  Stop select reporting a socket while another thread is using it.  The caller must hold
+ *  the same mutex as is passed to Socket_getReadySocket.
+ *  @param socket the socket to hold
+ */
+void Socket_hold(int socket)
+{
+	FD_CLR(socket, &(mod_s.rset_saved));
+	FD_CLR(socket, &(mod_s.rset)); /* in case it is in the results of the last select */
+}
+
+
+/**
+ *  Stop select reporting a socket as readable, so that the data waiting for it is left to
+ *  TCP flow control to slow the sender.  The caller must hold the same mutex as is passed
+ *  to Socket_getReadySocket.
+ *  @param socket the socket whose reads are to be paused
+ */
+void Socket_pauseReads(int socket)
+{
+	FD_CLR(socket, &(mod_s.rset_saved));
+	FD_CLR(socket, &(mod_s.rset)); /* in case it is in the results of the last select */
+}
+
+
+/**
+ *  Let select report a socket whose reads were paused as readable again.  The caller must
+ *  hold the same mutex as is passed to Socket_getReadySocket.
+ *  @param socket the socket whose reads are to be resumed
+ */
+void Socket_resumeReads(int socket)
+{
+	FD_SET(socket, &(mod_s.rset_saved));
+}
+
+
+/**
+ *  Return a held socket to select.  The socket will be reported once it is writeable, as
+ *  for a socket whose connect has just completed.  The caller must hold the same mutex as
+ *  is passed to Socket_getReadySocket.
+ *  @param socket the socket to release
+ *  @return completion code
+ */
+int Socket_release(int socket)
+{
+	int rc = 0;
+
+	FD_SET(socket, &(mod_s.rset_saved));
+	if (ListFindItem(mod_s.connect_pending, &socket, intcompare) == NULL)
+	{
+		int* pnewSd = (int*)malloc(sizeof(int));
+
+		if (!pnewSd)
+			rc = PAHO_MEMORY_ERROR;
+		else
+		{
+			*pnewSd = socket;
+			if (!ListAppend(mod_s.connect_pending, pnewSd, sizeof(int)))
+			{
+				free(pnewSd);
+				rc = PAHO_MEMORY_ERROR;
+			}
+		}
+	}
+	return rc;
+}
+
+
 /**
  *  Close a socket without removing it from the select list.
  *  @param socket the socket to close
@@ -634,6 +856,14 @@ int Socket_close_only(int socket)
 void Socket_close(int socket)
 {
 	FUNC_ENTRY;
+#if defined(SOCKET_RACES)
+	{
+		ListElement* race = ListFindItem(mod_s.races, &socket, intcompare);
+
+		if (race)
+			Socket_freeRace((Socket_race*)(race->content));
+	}
+#endif
 	Socket_close_only(socket);
 	FD_CLR(socket, &(mod_s.rset_saved));
 	if (FD_ISSET(socket, &(mod_s.pending_wset)))
@@ -665,130 +895,172 @@ void Socket_close(int socket)
 
 
 /**
- *  Create a new socket and TCP connect to an address/port
- *  @param addr the address string
- *  @param port the TCP port
- *  @param sock returns the new socket
- *  @param timeout the timeout in milliseconds
- *  @return completion code
+ *  Set a socket option, logging a failure.  Failures are not fatal, the socket is just
+ *  left with the operating system's setting.
+ *  @param sock the socket
+ *  @param level the protocol level of the option
+ *  @param name the option
+ *  @param value the value to set
+ *  @param text the name of the option, for the log
  */
-#if defined(__GNUC__) && defined(__linux__)
-int Socket_new(const char* addr, size_t addr_len, int port, int* sock, long timeout)
-#else
-int Socket_new(const char* addr, size_t addr_len, int port, int* sock)
-#endif
+static void Socket_setIntOption(int sock, int level, int name, int value, const char* text)
 {
-	int type = SOCK_STREAM;
-	char *addr_mem;
-	struct sockaddr_in address;
-#if defined(AF_INET6)
-	struct sockaddr_in6 address6;
-#endif
-	int rc = SOCKET_ERROR;
-#if defined(_WIN32) || defined(_WIN64)
-	short family;
-#else
-	sa_family_t family = AF_INET;
-#endif
-	struct addrinfo *result = NULL;
-	struct addrinfo hints = {0, AF_UNSPEC, SOCK_STREAM, IPPROTO_TCP, 0, NULL, NULL, NULL};
-
-	FUNC_ENTRY;
-	*sock = -1;
-	memset(&address6, '\0', sizeof(address6));
+	if (setsockopt(sock, level, name, (void*)&value, sizeof(value)) != 0)
+		Log(LOG_ERROR, -1, "Could not set %s to %d for socket %d", text, value, sock);
+}
 
-	if (addr[0] == '[')
-	{
-		++addr;
-		--addr_len;
-	}
 
-	if ((addr_mem = malloc( addr_len + 1u )) == NULL)
+/**
+ *  Apply the application's socket options to a new socket, before it is connected.
+ *  Options not available on this platform are ignored.
+ *  @param sock the socket
+ *  @param family the address family of the socket
+ *  @param opts the socket options
+ */
+static void Socket_setOptions(int sock, int family, const MQTTClient_socketOptions* opts)
+{
+	FUNC_ENTRY;
+	if (opts->sendBufferSize > 0)
+		Socket_setIntOption(sock, SOL_SOCKET, SO_SNDBUF, opts->sendBufferSize, "SO_SNDBUF");
+	if (opts->receiveBufferSize > 0) /* before connect, so that the window scale is negotiated to suit */
+		Socket_setIntOption(sock, SOL_SOCKET, SO_RCVBUF, opts->receiveBufferSize, "SO_RCVBUF");
+#if defined(UNIXSOCK)
+	if (family == AF_UNIX)
+		goto exit; /* the rest are TCP and IP options */
+#endif
+	if (opts->noDelay)
+		Socket_setIntOption(sock, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+#if defined(TCP_USER_TIMEOUT)
+	if (opts->userTimeout > 0)
+		Socket_setIntOption(sock, IPPROTO_TCP, TCP_USER_TIMEOUT, opts->userTimeout, "TCP_USER_TIMEOUT");
+#endif
+#if defined(SO_BUSY_POLL)
+	if (opts->busyPoll > 0)
+		Socket_setIntOption(sock, SOL_SOCKET, SO_BUSY_POLL, opts->busyPoll, "SO_BUSY_POLL");
+#endif
+#if defined(TCP_QUICKACK)
+	/* best effort: TCP_QUICKACK is not sticky, and Linux may go back to delaying acknowledgements.
+	 * Setting it again after every read would cost a system call per read, so it is only set here. */
+	if (opts->quickAck)
+		Socket_setIntOption(sock, IPPROTO_TCP, TCP_QUICKACK, 1, "TCP_QUICKACK");
+#endif
+	if (opts->tos > 0)
 	{
-		rc = PAHO_MEMORY_ERROR;
-		goto exit;
+#if defined(AF_INET6) && defined(IPV6_TCLASS)
+		if (family == AF_INET6)
+			Socket_setIntOption(sock, IPPROTO_IPV6, IPV6_TCLASS, opts->tos, "IPV6_TCLASS");
+		else
+#endif
+#if defined(IP_TOS)
+			Socket_setIntOption(sock, IPPROTO_IP, IP_TOS, opts->tos, "IP_TOS");
+#endif
 	}
-	memcpy( addr_mem, addr, addr_len );
-	addr_mem[addr_len] = '\0';
-
-#if 0 /*defined(__GNUC__) && defined(__linux__)*/
-	/* Commented out because the CI tests get intermittent ECONNABORTED return values
-	 * and I don't know why yet.
-	 */
-	/* set getaddrinfo timeout if available */
-	struct gaicb ar = {addr_mem, NULL, &hints, NULL};
-	struct gaicb *reqs[] = {&ar};
+#if defined(SO_PRIORITY)
+	if (opts->priority > 0)
+		Socket_setIntOption(sock, SOL_SOCKET, SO_PRIORITY, opts->priority, "SO_PRIORITY");
+#endif
+#if defined(UNIXSOCK)
+exit:
+#endif
+	FUNC_EXIT;
+}
 
-	unsigned long int seconds = timeout / 1000L;
-	unsigned long int nanos = (timeout - (seconds * 1000L)) * 1000000L;
-	struct timespec timeoutspec = {seconds, nanos};
 
-	rc = getaddrinfo_a(GAI_NOWAIT, reqs, 1, NULL);
-	if (rc == 0)
-		rc = gai_suspend((const struct gaicb* const *) reqs, 1, &timeoutspec);
+/**
+ *  Add the addresses a host name resolved to onto a list of connection targets.  The first
+ *  address getaddrinfo returns, which is in the order of preference of RFC 6724, stays first.
+ *  After it IPv4 and IPv6 addresses are interleaved, so that if one family is unreachable
+ *  the next connection attempt uses the other (RFC 8305 section 4).
+ *  @param targets the list of targets to add to
+ *  @param result the results of getaddrinfo
+ *  @param port the TCP port
+ *  @param tag the tag to give the targets, returned by Socket_raceResult
+ *  @return completion code
+ */
+static int Socket_addTargets(List* targets, struct addrinfo* result, int port, int tag)
+{
+	struct addrinfo* res4 = result;
+	struct addrinfo* res6 = result;
+	int ipv4 = 1;
+	int rc = 0;
 
-	if (rc == 0)
+	FUNC_ENTRY;
+	/* start with the family of the most preferred address */
+	while (res6 && res6->ai_family != AF_INET && res6->ai_family != AF_INET6)
+		res6 = res6->ai_next;
+	if (res6 && res6->ai_family == AF_INET6)
+		ipv4 = 0;
+	while (res4 || res6)
 	{
-		rc = gai_error(reqs[0]);
-		result = ar.ar_result;
-	}
-#else
-	rc = getaddrinfo(addr_mem, NULL, &hints, &result);
-#endif
+		struct addrinfo** res = ipv4 ? &res4 : &res6;
+		int family = ipv4 ? AF_INET : AF_INET6;
 
-	if (rc == 0)
-	{
-		struct addrinfo* res = result;
+		while (*res && (*res)->ai_family != family)
+			*res = (*res)->ai_next;
+		if (*res)
+		{
+			Socket_target* target = NULL;
 
-		while (res)
-		{	/* prefer ip4 addresses */
-			if (res->ai_family == AF_INET || res->ai_next == NULL)
+			if ((*res)->ai_addrlen > sizeof(target->addr) ||
+					(target = malloc(sizeof(Socket_target))) == NULL)
+			{
+				rc = PAHO_MEMORY_ERROR;
 				break;
-			res = res->ai_next;
-		}
-
-		if (res == NULL)
-			rc = -1;
-		else
+			}
+			memset(target, '\0', sizeof(Socket_target));
+			memcpy(&target->addr, (*res)->ai_addr, (*res)->ai_addrlen);
+			target->addrlen = (socklen_t)(*res)->ai_addrlen;
+			target->tag = tag;
+			if (family == AF_INET)
+				((struct sockaddr_in*)&target->addr)->sin_port = htons(port);
 #if defined(AF_INET6)
-		if (res->ai_family == AF_INET6)
-		{
-			address6.sin6_port = htons(port);
-			address6.sin6_family = family = AF_INET6;
-			memcpy(&address6.sin6_addr, &((struct sockaddr_in6*)(res->ai_addr))->sin6_addr, sizeof(address6.sin6_addr));
-		}
-		else
+			else
+				((struct sockaddr_in6*)&target->addr)->sin6_port = htons(port);
 #endif
-		if (res->ai_family == AF_INET)
-		{
-			memset(&address.sin_zero, 0, sizeof(address.sin_zero));
-			address.sin_port = htons(port);
-			address.sin_family = family = AF_INET;
-			address.sin_addr = ((struct sockaddr_in*)(res->ai_addr))->sin_addr;
+			if (!ListAppend(targets, target, sizeof(Socket_target)))
+			{
+				free(target);
+				rc = PAHO_MEMORY_ERROR;
+				break;
+			}
+			*res = (*res)->ai_next;
 		}
-		else
-			rc = -1;
-
-		freeaddrinfo(result);
+		ipv4 = !ipv4;
 	}
-	else
-	  	Log(LOG_ERROR, -1, "getaddrinfo failed for addr %s with rc %d", addr_mem, rc);
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
 
-	if (rc != 0)
-		Log(LOG_ERROR, -1, "%s is not a valid IP address", addr_mem);
-	else
+
+/**
+ *  Open a non-blocking socket and start a TCP connect to one address.
+ *  @param target the address to connect to
+ *  @param opts options to set on the socket before connecting, or NULL
+ *  @param sock returns the new socket, or -1 if the connect failed
+ *  @return 0 if connected, EINPROGRESS or EWOULDBLOCK if the connect is in progress, otherwise failure
+ */
+static int Socket_open(Socket_target* target, const MQTTClient_socketOptions* opts, int* sock)
+{
+	int rc = 0;
+
+	FUNC_ENTRY;
+	*sock =	(int)socket(target->addr.ss_family, SOCK_STREAM, 0);
+	if (*sock == INVALID_SOCKET)
 	{
-		*sock =	(int)socket(family, type, 0);
-		if (*sock == INVALID_SOCKET)
-			rc = Socket_error("socket", *sock);
-		else
-		{
+		rc = Socket_error("socket", *sock);
+		*sock = -1;
+		goto exit;
+	}
 #if defined(NOSIGPIPE)
-			int opt = 1;
+	{
+		int opt = 1;
 
-			if (setsockopt(*sock, SOL_SOCKET, SO_NOSIGPIPE, (void*)&opt, sizeof(opt)) != 0)
-				Log(LOG_ERROR, -1, "Could not set SO_NOSIGPIPE for socket %d", *sock);
+		if (setsockopt(*sock, SOL_SOCKET, SO_NOSIGPIPE, (void*)&opt, sizeof(opt)) != 0)
+			Log(LOG_ERROR, -1, "Could not set SO_NOSIGPIPE for socket %d", *sock);
+	}
 #endif
+	if (opts)
+		Socket_setOptions(*sock, target->addr.ss_family, opts);
 /*#define SMALL_TCP_BUFFER_TESTING
   This section sets the TCP send buffer to a small amount to provoke TCPSOCKET_INTERRUPTED
 	return codes from send, for testing only!
@@ -802,83 +1074,778 @@ int Socket_new(const char* addr, size_t addr_len, int port, int* sock)
 						Log(LOG_ERROR, -1, "Could not set SO_SNDBUF for socket %d", *sock);
 				}
 #endif
-			Log(TRACE_MIN, -1, "New socket %d for %s, port %d",	*sock, addr, port);
-			if (Socket_addSocket(*sock) == SOCKET_ERROR)
-				rc = Socket_error("addSocket", *sock);
-			else
-			{
-				/* this could complete immmediately, even though we are non-blocking */
-				if (family == AF_INET)
-					rc = connect(*sock, (struct sockaddr*)&address, sizeof(address));
-	#if defined(AF_INET6)
-				else
-					rc = connect(*sock, (struct sockaddr*)&address6, sizeof(address6));
-	#endif
-				if (rc == SOCKET_ERROR)
-					rc = Socket_error("connect", *sock);
-				if (rc == EINPROGRESS || rc == EWOULDBLOCK)
-				{
-					int* pnewSd = (int*)malloc(sizeof(int));
-
-					if (!pnewSd)
-					{
-						rc = PAHO_MEMORY_ERROR;
-						goto exit;
-					}
-					*pnewSd = *sock;
-					if (!ListAppend(mod_s.connect_pending, pnewSd, sizeof(int)))
-					{
-						free(pnewSd);
-						rc = PAHO_MEMORY_ERROR;
-						goto exit;
-					}
-					Log(TRACE_MIN, 15, "Connect pending");
-				}
-			}
-            /* Prevent socket leak by closing unusable sockets,
-               as reported in https://github.com/eclipse/paho.mqtt.c/issues/135 */
-            if (rc != 0 && (rc != EINPROGRESS) && (rc != EWOULDBLOCK))
-            {
-            	Socket_close(*sock); /* close socket and remove from our list of sockets */
-                *sock = -1; /* as initialized before */
-            }
-		}
+	if (Socket_setnonblocking(*sock) == SOCKET_ERROR)
+		rc = Socket_error("setnonblocking", *sock);
+	/* this could complete immmediately, even though we are non-blocking */
+	else if ((rc = connect(*sock, (struct sockaddr*)&target->addr, target->addrlen)) == SOCKET_ERROR)
+		rc = Socket_error("connect", *sock);
+
+#if defined(UNIXSOCK)
+	if (rc == EAGAIN && target->addr.ss_family == AF_UNIX)
+		rc = ECONNREFUSED; /* the listen backlog is full, and the connect does not carry on in the background */
+#endif
+	if (rc != 0 && rc != EINPROGRESS && rc != EWOULDBLOCK)
+	{
+#if defined(_WIN32) || defined(_WIN64)
+		closesocket(*sock);
+#else
+		close(*sock);
+#endif
+		*sock = -1;
 	}
-
 exit:
-	if (addr_mem)
-		free(addr_mem);
-
 	FUNC_EXIT_RC(rc);
 	return rc;
 }
 
 
-static Socket_writeComplete* writecomplete = NULL;
-
-void Socket_setWriteCompleteCallback(Socket_writeComplete* mywritecomplete)
-{
-	writecomplete = mywritecomplete;
-}
-
-
-
+#if defined(UNIXSOCK)
 /**
- *  Continue an outstanding write for a particular socket
- *  @param socket that socket
- *  @return completion code: 0=incomplete, 1=complete, -1=socket error
+ *  Add the address of a Unix domain socket onto a list of connection targets.  On Linux, a
+ *  path starting with '@' names a socket in the abstract namespace rather than a file.
+ *  @param targets the list of targets to add to
+ *  @param path the socket path, without the unix:// scheme
+ *  @param path_len the length of the path
+ *  @return completion code
  */
-int Socket_continueWrite(int socket)
+static int Socket_addUnixTarget(List* targets, const char* path, size_t path_len)
 {
+	struct sockaddr_un* address = NULL;
+	Socket_target* target = NULL;
 	int rc = 0;
-	pending_writes* pw;
-	unsigned long curbuflen = 0L, /* cumulative total of buffer lengths */
-		bytes = 0L;
-	int curbuf = -1, i;
-	iobuf iovecs1[5];
 
 	FUNC_ENTRY;
-	pw = SocketBuffer_getWrite(socket);
+	if (path_len == 0 || path_len >= sizeof(address->sun_path))
+	{
+		Log(LOG_ERROR, -1, "%.*s is not a valid Unix domain socket path", (int)path_len, path);
+		rc = SOCKET_ERROR;
+		goto exit;
+	}
+	if ((target = malloc(sizeof(Socket_target))) == NULL)
+	{
+		rc = PAHO_MEMORY_ERROR;
+		goto exit;
+	}
+	memset(target, '\0', sizeof(Socket_target));
+	address = (struct sockaddr_un*)&target->addr;
+	address->sun_family = AF_UNIX;
+	memcpy(address->sun_path, path, path_len);
+	target->addrlen = sizeof(struct sockaddr_un);
+#if defined(__linux__)
+	if (path[0] == '@')
+	{
+		/* the name is all the bytes given, with no terminating null */
+		address->sun_path[0] = '\0';
+		target->addrlen = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + path_len);
+	}
+#endif
+	if (!ListAppend(targets, target, sizeof(Socket_target)))
+	{
+		free(target);
+		rc = PAHO_MEMORY_ERROR;
+	}
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+#endif
+
+
+#if defined(SOCKET_RACES)
+/**
+ *  Start racing connection attempts to further addresses against the connect in progress
+ *  on a socket.  The socket is hidden from select until the race is over.
+ *  @param sock the socket returned by Socket_new
+ *  @param targets the addresses not yet tried.  The race takes ownership of the list.
+ *  @param opts options to set on the sockets of the attempts, or NULL
+ *  @return the race, or NULL if there was no memory for it
+ */
+static Socket_race* Socket_startRace(int sock, List* targets, const MQTTClient_socketOptions* opts)
+{
+	Socket_race* race = NULL;
+
+	FUNC_ENTRY;
+	if ((race = malloc(sizeof(Socket_race))) == NULL)
+		goto exit;
+	memset(race, '\0', sizeof(Socket_race));
+	race->socket = sock;
+	race->primary = 1;
+	if ((race->attempts = ListInitialize()) == NULL)
+	{
+		free(race);
+		race = NULL;
+		goto exit;
+	}
+	if ((race->lookups = ListInitialize()) == NULL)
+	{
+		ListFree(race->attempts);
+		free(race);
+		race = NULL;
+		goto exit;
+	}
+	race->targets = targets;
+	if (opts)
+		race->opts = *opts;
+	race->delay = (opts && opts->connectAttemptDelay > 0) ? opts->connectAttemptDelay : SOCKET_CONNECT_ATTEMPT_DELAY;
+	race->last = MQTTTime_start_clock();
+	if (!ListAppend(mod_s.races, race, sizeof(Socket_race)))
+	{
+		ListFree(race->lookups);
+		ListFree(race->attempts);
+		free(race);
+		race = NULL;
+		goto exit;
+	}
+	/* the connect is reported to the caller when the race is over */
+	ListRemoveItem(mod_s.connect_pending, &sock, intcompare);
+	Socket_hold(sock);
+	Log(TRACE_MIN, -1, "Racing %d more addresses for socket %d", targets->count, sock);
+exit:
+	FUNC_EXIT;
+	return race;
+}
+
+
+/**
+ *  Free the servers of a race still being looked up.  The lookups themselves carry on, and
+ *  their results are left in the resolver cache.
+ *  @param lookups the list of lookups, which is emptied
+ */
+static void Socket_emptyLookups(List* lookups)
+{
+	Socket_lookup* lookup = NULL;
+
+	while ((lookup = ListDetachHead(lookups)) != NULL)
+	{
+		free(lookup->host);
+		free(lookup);
+	}
+}
+
+
+/**
+ *  Free a race, closing the sockets of any attempts still in progress.
+ *  @param race the race
+ */
+static void Socket_freeRace(Socket_race* race)
+{
+	ListElement* current = NULL;
+
+	while (ListNextElement(race->attempts, &current))
+		close(((Socket_attempt*)(current->content))->socket);
+	ListFree(race->attempts);
+	ListFree(race->targets);
+	Socket_emptyLookups(race->lookups);
+	ListFree(race->lookups);
+	ListRemove(mod_s.races, race);
+}
+
+
+/**
+ *  End a race: the connect on the race socket has succeeded, or all the attempts have failed.
+ *  The attempts still in progress are cancelled and the socket is handed back to select, to
+ *  be reported once it is writeable as for any other completed connect.
+ *  @param race the race
+ *  @param tag the tag of the target of the winning attempt, or of the last attempt to fail
+ */
+static void Socket_endRace(Socket_race* race, int tag)
+{
+	ListElement* current = NULL;
+
+	FUNC_ENTRY;
+	while (ListNextElement(race->attempts, &current))
+		close(((Socket_attempt*)(current->content))->socket);
+	ListEmpty(race->attempts);
+	ListEmpty(race->targets);
+	Socket_emptyLookups(race->lookups);
+	race->tag = tag;
+	race->done = 1;
+	Socket_release(race->socket);
+	Log(TRACE_MIN, -1, "Connection race for socket %d finished, tag %d", race->socket, tag);
+	FUNC_EXIT;
+}
+
+
+/**
+ *  Has a connect which select reported as writeable succeeded?  getpeername is used rather
+ *  than SO_ERROR, so that the error is left for the caller.
+ *  @param sock the socket
+ *  @return boolean
+ */
+static int Socket_isConnected(int sock)
+{
+	struct sockaddr_storage peer;
+	socklen_t len = sizeof(peer);
+
+	return getpeername(sock, (struct sockaddr*)&peer, &len) == 0;
+}
+
+
+/**
+ *  Move a winning connection onto the race socket, so that the caller sees it as the
+ *  connect it started.
+ *  @param race the race
+ *  @param sock the socket of the winning attempt, which is closed
+ *  @param tag the tag of the winning attempt
+ */
+static void Socket_winRace(Socket_race* race, int sock, int tag)
+{
+	if (dup2(sock, race->socket) == -1)
+	{
+		Socket_error("dup2", sock);
+		race->primary = 0;
+	}
+	close(sock);
+	Socket_endRace(race, tag);
+}
+
+
+/**
+ *  Add the addresses of the servers of a race whose lookups have completed to its targets.
+ *  A server whose name could not be resolved is dropped from the race.
+ *  @param race the race
+ */
+static void Socket_collectLookups(Socket_race* race)
+{
+	ListElement* current = race->lookups->first;
+
+	FUNC_ENTRY;
+	while (current)
+	{
+		Socket_lookup* lookup = (Socket_lookup*)(current->content);
+		struct addrinfo* result = NULL;
+		int rc = 0;
+
+		current = current->next;
+		if (Resolver_start(lookup->host, race->opts.dnsCacheTTL, race->opts.dnsNegativeTTL) == RESOLVER_IN_PROGRESS)
+			continue;
+		if ((rc = Resolver_getaddrinfo(lookup->host, race->opts.dnsCacheTTL,
+				race->opts.dnsNegativeTTL, &result)) != 0)
+			Log(LOG_ERROR, -1, "getaddrinfo failed for addr %s with rc %d", lookup->host, rc);
+		else
+		{
+			int count = race->targets->count;
+
+			Socket_addTargets(race->targets, result, lookup->port, lookup->tag);
+			Resolver_free(result);
+			Log(TRACE_MIN, -1, "Racing %d addresses of %s for socket %d", race->targets->count - count,
+					lookup->host, race->socket);
+		}
+		free(lookup->host);
+		ListRemove(race->lookups, lookup);
+	}
+	FUNC_EXIT;
+}
+
+
+/**
+ *  Check the attempts of a race for completion, and start the next attempt when it is due.
+ *  @param race the race
+ */
+static void Socket_checkRace(Socket_race* race)
+{
+	ListElement* current = NULL;
+	fd_set fds;
+	struct timeval zero = {0L, 0L};
+	int maxfd = race->socket;
+	int next = 0; /* start the next attempt now */
+
+	FUNC_ENTRY;
+	FD_ZERO(&fds);
+	if (race->primary)
+		FD_SET(race->socket, &fds);
+	while (ListNextElement(race->attempts, &current))
+	{
+		int sock = ((Socket_attempt*)(current->content))->socket;
+
+		FD_SET(sock, &fds);
+		maxfd = max(maxfd, sock);
+	}
+
+	if (select(maxfd + 1, NULL, &fds, NULL, &zero) > 0)
+	{
+		if (race->primary && FD_ISSET(race->socket, &fds))
+		{
+			if (Socket_isConnected(race->socket))
+			{
+				Socket_endRace(race, 0);
+				goto exit;
+			}
+			/* keep the socket, and its error to report if none of the other attempts connect */
+			Log(TRACE_MIN, -1, "Connect failed for socket %d, trying other addresses", race->socket);
+			race->primary = 0;
+			next = 1;
+		}
+		current = race->attempts->first;
+		while (current)
+		{
+			Socket_attempt* attempt = (Socket_attempt*)(current->content);
+
+			current = current->next;
+			if (!FD_ISSET(attempt->socket, &fds))
+				continue;
+			if (Socket_isConnected(attempt->socket))
+			{
+				int sock = attempt->socket;
+				int tag = attempt->tag;
+
+				ListRemove(race->attempts, attempt);
+				Socket_winRace(race, sock, tag);
+				goto exit;
+			}
+			close(attempt->socket);
+			race->tag = attempt->tag;
+			ListRemove(race->attempts, attempt);
+			next = 1;
+		}
+	}
+
+	if (race->lookups->count > 0)
+		Socket_collectLookups(race);
+	while (race->targets->count > 0 && (next || MQTTTime_elapsed(race->last) >= (ELAPSED_TIME_TYPE)race->delay))
+	{
+		Socket_target* target = (Socket_target*)(race->targets->first->content);
+		int tag = target->tag;
+		int sock = -1;
+		int rc = Socket_open(target, &race->opts, &sock);
+
+		ListRemoveHead(race->targets);
+		race->last = MQTTTime_start_clock();
+		if (rc == 0)
+		{
+			Socket_winRace(race, sock, tag);
+			goto exit;
+		}
+		else if (rc == EINPROGRESS || rc == EWOULDBLOCK)
+		{
+			Socket_attempt* attempt = malloc(sizeof(Socket_attempt));
+
+			if (attempt == NULL || !ListAppend(race->attempts, attempt, sizeof(Socket_attempt)))
+			{
+				free(attempt);
+				close(sock);
+			}
+			else
+			{
+				attempt->socket = sock;
+				attempt->tag = tag;
+				Log(TRACE_MIN, -1, "Started connect on socket %d in race for socket %d", sock, race->socket);
+			}
+			break;
+		}
+		race->tag = tag; /* failed immediately, so try the next address now */
+	}
+
+	if (!race->primary && race->attempts->count == 0 && race->targets->count == 0 && race->lookups->count == 0)
+		Socket_endRace(race, race->tag);
+exit:
+	FUNC_EXIT;
+}
+
+
+/**
+ *  Move on any connection races in progress, and add their sockets to the set for select
+ *  so that it wakes when an attempt completes.  Called with the socket mutex held.
+ *  @param pwset the write set for select, or NULL
+ *  @param nfds the number of descriptors for select, updated
+ *  @param timeout the select timeout, shortened to when the next attempt is due
+ *  @return the number of races which have finished
+ */
+static int Socket_continueRaces(fd_set* pwset, int* nfds, struct timeval* timeout)
+{
+	ListElement* current = NULL;
+	int finished = 0;
+
+	while (ListNextElement(mod_s.races, &current))
+	{
+		Socket_race* race = (Socket_race*)(current->content);
+		ListElement* attempt = NULL;
+
+		if (race->done)
+			continue;
+		Socket_checkRace(race);
+		if (race->done)
+		{
+			++finished;
+			continue;
+		}
+		if (pwset == NULL)
+			continue;
+		/* the race socket may have been added as a pending write by the caller */
+		FD_CLR(race->socket, &(mod_s.pending_wset));
+		FD_CLR(race->socket, pwset);
+		if (race->primary)
+			FD_SET(race->socket, pwset);
+		while (ListNextElement(race->attempts, &attempt))
+		{
+			int sock = ((Socket_attempt*)(attempt->content))->socket;
+
+			FD_SET(sock, pwset);
+			*nfds = max(*nfds, sock + 1);
+		}
+		if (race->targets->count > 0 || race->lookups->count > 0)
+		{
+			ELAPSED_TIME_TYPE elapsed = MQTTTime_elapsed(race->last);
+			long wait = (elapsed >= (ELAPSED_TIME_TYPE)race->delay) ? 0L : (long)(race->delay - elapsed);
+
+			if (race->targets->count == 0 || (race->lookups->count > 0 && wait > SOCKET_LOOKUP_INTERVAL))
+				wait = SOCKET_LOOKUP_INTERVAL; /* the resolver does not wake select */
+
+			if (timeout->tv_sec > wait / 1000 ||
+					(timeout->tv_sec == wait / 1000 && timeout->tv_usec > (wait % 1000) * 1000))
+			{
+				timeout->tv_sec = wait / 1000;
+				timeout->tv_usec = (wait % 1000) * 1000;
+			}
+		}
+	}
+	return finished;
+}
+#endif
+
+
+/**
+ *  Add another server to race against the connect in progress on a socket.  Its addresses
+ *  are tried after those of the server passed to Socket_new.  Unless the resolver cache
+ *  already has them, the server's name is looked up on a helper thread, and the addresses
+ *  join the race once the lookup completes, so that the connects in progress are not held up.
+ *  @param sock the socket returned by Socket_new, whose connect is in progress
+ *  @param addr the address string
+ *  @param addr_len the length of the address string
+ *  @param port the TCP port
+ *  @param tag a number identifying the server, returned by Socket_raceResult if it wins
+ *  @param opts options to set on the socket before connecting, or NULL
+ *  @return completion code
+ */
+int Socket_addRaceTarget(int sock, const char* addr, size_t addr_len, int port, int tag, const MQTTClient_socketOptions* opts)
+{
+	int rc = SOCKET_ERROR;
+#if defined(SOCKET_RACES)
+	struct addrinfo *result = NULL;
+	ListElement* found = NULL;
+	Socket_race* race = NULL;
+	Socket_lookup* lookup = NULL;
+	List* targets = NULL;
+	char* addr_mem = NULL;
+
+	FUNC_ENTRY;
+	if (addr[0] == '[')
+	{
+		++addr;
+		--addr_len;
+	}
+	if ((addr_mem = malloc(addr_len + 1u)) == NULL || (targets = ListInitialize()) == NULL)
+	{
+		rc = PAHO_MEMORY_ERROR;
+		goto exit;
+	}
+	memcpy(addr_mem, addr, addr_len);
+	addr_mem[addr_len] = '\0';
+
+	if ((found = ListFindItem(mod_s.races, &sock, intcompare)) != NULL)
+	{
+		race = (Socket_race*)(found->content);
+		if (race->done)
+		{
+			rc = SOCKET_ERROR;
+			goto exit;
+		}
+	}
+	else if (ListFindItem(mod_s.connect_pending, &sock, intcompare) == NULL)
+	{
+		rc = SOCKET_ERROR; /* the connect is not in progress */
+		goto exit;
+	}
+
+	if (Resolver_start(addr_mem, opts ? opts->dnsCacheTTL : 0, opts ? opts->dnsNegativeTTL : 0) == RESOLVER_IN_PROGRESS)
+	{
+		if ((lookup = malloc(sizeof(Socket_lookup))) == NULL)
+		{
+			rc = PAHO_MEMORY_ERROR;
+			goto exit;
+		}
+		lookup->host = addr_mem;
+		lookup->port = port;
+		lookup->tag = tag;
+		addr_mem = NULL;
+	}
+	else if ((rc = Resolver_getaddrinfo(addr_mem, opts ? opts->dnsCacheTTL : 0,
+			opts ? opts->dnsNegativeTTL : 0, &result)) != 0)
+	{
+		Log(LOG_ERROR, -1, "getaddrinfo failed for addr %s with rc %d", addr_mem, rc);
+		rc = SOCKET_ERROR;
+		goto exit;
+	}
+	else
+	{
+		rc = Socket_addTargets(targets, result, port, tag);
+		Resolver_free(result);
+		if (rc != 0)
+			goto exit;
+	}
+
+	if (race == NULL)
+	{
+		if ((race = Socket_startRace(sock, targets, opts)) == NULL)
+		{
+			rc = PAHO_MEMORY_ERROR;
+			goto exit;
+		}
+		targets = NULL;
+	}
+	else
+	{
+		Socket_target* target = NULL;
+
+		while ((target = ListDetachHead(targets)) != NULL)
+			ListAppend(race->targets, target, sizeof(Socket_target));
+	}
+	if (lookup)
+	{
+		if (!ListAppend(race->lookups, lookup, sizeof(Socket_lookup)))
+		{
+			rc = PAHO_MEMORY_ERROR;
+			goto exit;
+		}
+		Log(TRACE_MIN, -1, "Looking up %s to race for socket %d", lookup->host, sock);
+		lookup = NULL;
+	}
+	rc = 0;
+exit:
+	if (lookup)
+	{
+		free(lookup->host);
+		free(lookup);
+	}
+	if (targets)
+		ListFree(targets);
+	if (addr_mem)
+		free(addr_mem);
+	FUNC_EXIT_RC(rc);
+#endif
+	return rc;
+}
+
+
+/**
+ *  Find out which attempt won a connection race, once select has reported the socket's
+ *  connect as complete.  The record of the race is freed.
+ *  @param sock the socket returned by Socket_new
+ *  @return the tag of the winning target, or of the last to fail if none connected.  -1 if
+ *  there was no race.
+ */
+int Socket_raceResult(int sock)
+{
+	int tag = -1;
+#if defined(SOCKET_RACES)
+	ListElement* found = NULL;
+
+	FUNC_ENTRY;
+	if ((found = ListFindItem(mod_s.races, &sock, intcompare)) != NULL)
+	{
+		Socket_race* race = (Socket_race*)(found->content);
+
+		if (race->done)
+		{
+			tag = race->tag;
+			Socket_freeRace(race);
+		}
+	}
+	FUNC_EXIT_RC(tag);
+#endif
+	return tag;
+}
+
+
+/**
+ *  Create a new socket and TCP connect to an address/port.  If the address resolves to
+ *  more than one IP address, and the connect to the first does not complete immediately,
+ *  connects to the others are started in turn at intervals until one succeeds.  The
+ *  winning connection is given the socket number returned here.  The address is looked
+ *  up through the resolver cache, on a helper thread if the options ask for that.  An
+ *  address starting unix:// is the path of a Unix domain socket to connect to instead.
+ *  @param addr the address string
+ *  @param port the TCP port
+ *  @param sock returns the new socket
+ *  @param opts options to set on the socket before connecting, or NULL
+ *  @param timeout the timeout in milliseconds
+ *  @return completion code, #TCPSOCKET_RESOLVING if the address is being looked up on a
+ *  helper thread, in which case Socket_new is to be called again when the lookup completes
+ */
+#if defined(__GNUC__) && defined(__linux__)
+int Socket_new(const char* addr, size_t addr_len, int port, int* sock, const MQTTClient_socketOptions* opts, long timeout)
+#else
+int Socket_new(const char* addr, size_t addr_len, int port, int* sock, const MQTTClient_socketOptions* opts)
+#endif
+{
+	char *addr_mem = NULL;
+	int rc = SOCKET_ERROR;
+	struct addrinfo *result = NULL;
+	List* targets = NULL;
+
+	FUNC_ENTRY;
+	*sock = -1;
+
+#if defined(UNIXSOCK)
+	if (addr_len >= strlen(URI_UNIX) && strncmp(addr, URI_UNIX, strlen(URI_UNIX)) == 0)
+	{
+		if ((targets = ListInitialize()) == NULL)
+			rc = PAHO_MEMORY_ERROR;
+		else
+			rc = Socket_addUnixTarget(targets, addr + strlen(URI_UNIX), addr_len - strlen(URI_UNIX));
+		if (rc != 0)
+			goto exit;
+		goto connect_targets;
+	}
+#endif
+	if (addr[0] == '[')
+	{
+		++addr;
+		--addr_len;
+	}
+
+	if ((addr_mem = malloc( addr_len + 1u )) == NULL)
+	{
+		rc = PAHO_MEMORY_ERROR;
+		goto exit;
+	}
+	memcpy( addr_mem, addr, addr_len );
+	addr_mem[addr_len] = '\0';
+
+#if 0 /*defined(__GNUC__) && defined(__linux__)*/
+	/* Commented out because the CI tests get intermittent ECONNABORTED return values
+	 * and I don't know why yet.
+	 */
+	/* set getaddrinfo timeout if available */
+	struct addrinfo hints = {0, AF_UNSPEC, SOCK_STREAM, IPPROTO_TCP, 0, NULL, NULL, NULL};
+	struct gaicb ar = {addr_mem, NULL, &hints, NULL};
+	struct gaicb *reqs[] = {&ar};
+
+	unsigned long int seconds = timeout / 1000L;
+	unsigned long int nanos = (timeout - (seconds * 1000L)) * 1000000L;
+	struct timespec timeoutspec = {seconds, nanos};
+
+	rc = getaddrinfo_a(GAI_NOWAIT, reqs, 1, NULL);
+	if (rc == 0)
+		rc = gai_suspend((const struct gaicb* const *) reqs, 1, &timeoutspec);
+
+	if (rc == 0)
+	{
+		rc = gai_error(reqs[0]);
+		result = ar.ar_result;
+	}
+#else
+	if (opts && opts->asyncDNS &&
+			Resolver_start(addr_mem, opts->dnsCacheTTL, opts->dnsNegativeTTL) == RESOLVER_IN_PROGRESS)
+	{
+		rc = TCPSOCKET_RESOLVING;
+		goto exit;
+	}
+	rc = Resolver_getaddrinfo(addr_mem, opts ? opts->dnsCacheTTL : 0, opts ? opts->dnsNegativeTTL : 0, &result);
+#endif
+
+	if (rc == 0)
+	{
+		if ((targets = ListInitialize()) == NULL)
+			rc = PAHO_MEMORY_ERROR;
+		else if ((rc = Socket_addTargets(targets, result, port, 0)) == 0 && targets->count == 0)
+			rc = -1;
+		Resolver_free(result);
+	}
+	else
+	  	Log(LOG_ERROR, -1, "getaddrinfo failed for addr %s with rc %d", addr_mem, rc);
+
+	if (rc != 0)
+	{
+		Log(LOG_ERROR, -1, "%s is not a valid IP address", addr_mem);
+		goto exit;
+	}
+
+#if defined(UNIXSOCK)
+connect_targets:
+#endif
+	/* connect to each address in turn until one is connected or in progress */
+	rc = SOCKET_ERROR;
+	while (targets->count > 0 && rc != 0 && rc != EINPROGRESS && rc != EWOULDBLOCK)
+	{
+		rc = Socket_open((Socket_target*)(targets->first->content), opts, sock);
+		ListRemoveHead(targets);
+		if (*sock == -1)
+			continue;
+
+		Log(TRACE_MIN, -1, "New socket %d for %s, port %d",	*sock, addr, port);
+		if (Socket_addSocket(*sock) != 0)
+		{
+			/* Prevent socket leak by closing unusable sockets,
+			   as reported in https://github.com/eclipse/paho.mqtt.c/issues/135 */
+			Log(LOG_ERROR, -1, "addSocket failed for socket %d", *sock);
+			Socket_close(*sock); /* close socket and remove from our list of sockets */
+			*sock = -1; /* as initialized before */
+			rc = SOCKET_ERROR;
+			goto exit;
+		}
+	}
+
+	if (rc == EINPROGRESS || rc == EWOULDBLOCK)
+	{
+		int* pnewSd = (int*)malloc(sizeof(int));
+
+		if (!pnewSd)
+		{
+			rc = PAHO_MEMORY_ERROR;
+			goto exit;
+		}
+		*pnewSd = *sock;
+		if (!ListAppend(mod_s.connect_pending, pnewSd, sizeof(int)))
+		{
+			free(pnewSd);
+			rc = PAHO_MEMORY_ERROR;
+			goto exit;
+		}
+		Log(TRACE_MIN, 15, "Connect pending");
+#if defined(SOCKET_RACES)
+		if (targets->count > 0 && (opts == NULL || opts->connectAttemptDelay >= 0) &&
+				Socket_startRace(*sock, targets, opts) != NULL)
+			targets = NULL;
+#endif
+	}
+
+exit:
+	if (targets)
+		ListFree(targets);
+	if (addr_mem)
+		free(addr_mem);
+
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+static Socket_writeComplete* writecomplete = NULL;
+
+void Socket_setWriteCompleteCallback(Socket_writeComplete* mywritecomplete)
+{
+	writecomplete = mywritecomplete;
+}
+
+
+
+/**
+ *  Continue an outstanding write for a particular socket
+ *  @param socket that socket
+ *  @return completion code: 0=incomplete, 1=complete, -1=socket error
+ */
+int Socket_continueWrite(int socket)
+{
+	int rc = 0;
+	pending_writes* pw;
+	unsigned long curbuflen = 0L, /* cumulative total of buffer lengths */
+		bytes = 0L;
+	int curbuf = -1, i;
+	iobuf iovecs1[5];
+
+	FUNC_ENTRY;
+	pw = SocketBuffer_getWrite(socket);
 
 #if defined(OPENSSL)
 	if (pw->ssl)
@@ -1043,7 +2010,7 @@ char* Socket_getaddrname(struct sockaddr* sa, int sock)
  * maximum length of the port string
  */
 #define PORTLEN 10
-	static char addr_string[ADDRLEN + PORTLEN];
+	static THREAD_LOCAL char addr_string[ADDRLEN + PORTLEN];
 
 #if defined(_WIN32) || defined(_WIN64)
 	int buflen = ADDRLEN*2;
@@ -1058,6 +2025,13 @@ char* Socket_getaddrname(struct sockaddr* sa, int sock)
 	struct sockaddr_in *sin = (struct sockaddr_in *)sa;
 	size_t buflen = sizeof(addr_string) - strlen(addr_string);
 
+#if defined(UNIXSOCK)
+	if (sa->sa_family == AF_UNIX)
+	{
+		strcpy(addr_string, URI_UNIX); /* the path is not returned by getpeername */
+		return addr_string;
+	}
+#endif
 	inet_ntop(sin->sin_family, &sin->sin_addr, addr_string, ADDRLEN);
 	if (snprintf(&addr_string[strlen(addr_string)], buflen, ":%d", ntohs(sin->sin_port)) >= buflen)
 		addr_string[sizeof(addr_string)-1] = '\0'; /* just in case of snprintf buffer filling */
@@ -77,6 +77,15 @@
 #endif
 /** must be the same as SOCKETBUFFER_INTERRUPTED */
 #define TCPSOCKET_INTERRUPTED -22
+/** the server's host name is being looked up on a helper thread, so the connect is to be retried */
+#define TCPSOCKET_RESOLVING -23
+
+/** the URI scheme for the path of a Unix domain socket */
+#define URI_UNIX "unix://"
+#if !defined(_WIN32) && !defined(_WIN64)
+/** connects to unix:// addresses are supported */
+#define UNIXSOCK
+#endif
 #define SSL_FATAL -3
 
 #if !defined(INET6_ADDRSTRLEN)
@@ -89,6 +98,7 @@
 #endif
 
 #include "LinkedList.h"
+#include "MQTTClient.h"
 
 /*
  * Network write buffers for an MQTT packet
@@ -116,8 +126,19 @@ typedef struct
 	List* connect_pending; /**< list of sockets for which a connect is pending */		// comment by Clark:: pend: 悬而未决  ::2020-12-22
 	List* write_pending; /**< list of sockets for which a write is pending */
 	fd_set pending_wset; /**< socket pending write set for select */
+	List* races; /**< connection attempts racing to complete the connect of a socket */
+	fd_set wset; /**< sockets found writable by the last select */
 } Sockets;
 
+/** the most reactor threads, each of which has a set of sockets of its own */
+#define SOCKET_MAX_REACTORS 64
+
+void Socket_setReactorCount(int count);
+int Socket_getReactorCount(void);
+void Socket_setReactor(int reactor);
+int Socket_getReactor(void);
+Sockets* Socket_getSockets(void);
+
 
 void Socket_outInitialize(void);
 void Socket_outTerminate(void);
@@ -128,17 +149,25 @@ int Socket_putdatas(int socket, char* buf0, size_t buf0len, PacketBuffers bufs);
 void Socket_close(int socket);
 #if defined(__GNUC__) && defined(__linux__)
 /* able to use GNU's getaddrinfo_a to make timeouts possible */
-int Socket_new(const char* addr, size_t addr_len, int port, int* socket, long timeout);
+int Socket_new(const char* addr, size_t addr_len, int port, int* socket, const MQTTClient_socketOptions* opts, long timeout);
 #else
-int Socket_new(const char* addr, size_t addr_len, int port, int* socket);
+int Socket_new(const char* addr, size_t addr_len, int port, int* socket, const MQTTClient_socketOptions* opts);
 #endif
 
+int Socket_addRaceTarget(int socket, const char* addr, size_t addr_len, int port, int tag, const MQTTClient_socketOptions* opts);
+int Socket_raceResult(int socket);
+
 int Socket_noPendingWrites(int socket);
 char* Socket_getpeer(int sock);
 
 void Socket_addPendingWrite(int socket);
 void Socket_clearPendingWrite(int socket);
 
+void Socket_hold(int socket);
+int Socket_release(int socket);
+void Socket_pauseReads(int socket);
+void Socket_resumeReads(int socket);
+
 typedef void Socket_writeComplete(int socket, int rc);
 void Socket_setWriteCompleteCallback(Socket_writeComplete*);
 
@@ -23,6 +23,7 @@
  * Some other related functions are in the Socket module
  */
 #include "SocketBuffer.h"
+#include "Socket.h"
 #include "LinkedList.h"
 #include "Log.h"
 #include "Messages.h"
@@ -44,19 +45,22 @@
  */
 
 // comment by Clark:: 当前默认的对象  ::2020-12-22
-static socket_queue* def_queue;
+static socket_queue* reactor_def_queue[SOCKET_MAX_REACTORS];
+#define def_queue (reactor_def_queue[Socket_getReactor()])
 
 
 // comment by Clark:: content 结构体为 socket_queue  ::2020-12-22
 /**
  * List of queued input buffers
  */
-static List* queues;
+static List* reactor_queues[SOCKET_MAX_REACTORS];
+#define queues (reactor_queues[Socket_getReactor()])
 
 /**
  * List of queued write buffers
  */
-static List writes;
+static List reactor_writes[SOCKET_MAX_REACTORS];
+#define writes (reactor_writes[Socket_getReactor()])
 
 
 int socketcompare(void* a, void* b);
@@ -81,6 +81,54 @@ thread_type Thread_start(thread_fn fn, void* parameter)
 }
 
 
+/**
+ * Start a new thread which can be waited for with ::Thread_join
+ * @param fn the function to run, must be of the correct signature
+ * @param parameter pointer to the function parameter, can be NULL
+ * @return the new thread, or 0 (NULL on Windows) if it could not be started
+ */
+thread_type Thread_start_joinable(thread_fn fn, void* parameter)
+{
+#if defined(_WIN32) || defined(_WIN64)
+	thread_type thread = NULL;
+#else
+	thread_type thread = 0;
+#endif
+
+	FUNC_ENTRY;
+#if defined(_WIN32) || defined(_WIN64)
+	thread = CreateThread(NULL, 0, fn, parameter, 0, NULL);
+#else
+	if (pthread_create(&thread, NULL, fn, parameter) != 0)
+		thread = 0;
+#endif
+	FUNC_EXIT;
+	return thread;
+}
+
+
+/**
+ * Wait for a thread started with ::Thread_start_joinable to end, and free its resources
+ * @param thread the thread
+ * @return completion code, 0 is success
+ */
+int Thread_join(thread_type thread)
+{
+	int rc = 0;
+
+	FUNC_ENTRY;
+#if defined(_WIN32) || defined(_WIN64)
+	if (WaitForSingleObject(thread, INFINITE) == WAIT_FAILED)
+		rc = GetLastError();
+	CloseHandle(thread);
+#else
+	rc = pthread_join(thread, NULL);
+#endif
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
 /**
  * Create a new mutex
  * @return the new mutex
@@ -437,6 +485,39 @@ int Thread_wait_cond(cond_type condvar, int timeout)
 	return rc;
 }
 
+/**
+ * Wait with a timeout (milliseconds) for condition variable
+ * @return 0 for success, ETIMEDOUT otherwise
+ */
+int Thread_wait_cond_ms(cond_type condvar, int timeout_ms)
+{
+	int rc = 0;
+	struct timespec cond_timeout;
+
+	FUNC_ENTRY;
+#if defined(__APPLE__) && __MAC_OS_X_VERSION_MIN_REQUIRED < 101200 /* for older versions of MacOS */
+	struct timeval cur_time;
+	gettimeofday(&cur_time, NULL);
+	cond_timeout.tv_sec = cur_time.tv_sec;
+	cond_timeout.tv_nsec = cur_time.tv_usec * 1000;
+#else
+	clock_gettime(CLOCK_REALTIME, &cond_timeout);
+#endif
+	cond_timeout.tv_sec += timeout_ms / 1000;
+	cond_timeout.tv_nsec += (timeout_ms % 1000) * 1000000L;
+	if (cond_timeout.tv_nsec >= 1000000000L)
+	{
+		cond_timeout.tv_sec++;
+		cond_timeout.tv_nsec -= 1000000000L;
+	}
+	pthread_mutex_lock(&condvar->mutex);
+	rc = pthread_cond_timedwait(&condvar->cond, &condvar->mutex, &cond_timeout);
+	pthread_mutex_unlock(&condvar->mutex);
+
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
 /**
  * Destroy a condition variable
  * @return completion code
@@ -34,6 +34,9 @@
 	#define thread_fn LPTHREAD_START_ROUTINE
 	#define cond_type HANDLE
 	#define sem_type HANDLE
+	#define THREAD_LOCAL __declspec(thread)
+	#define Thread_increment(count) InterlockedIncrement(count)
+	#define Thread_decrement(count) InterlockedDecrement(count)
 	#undef ETIMEDOUT
 	#define ETIMEDOUT WSAETIMEDOUT
 #else
@@ -43,6 +46,10 @@
 	#define thread_id_type pthread_t
 	#define thread_return_type void*
 	typedef thread_return_type (*thread_fn)(void*);
+	#define THREAD_LOCAL __thread
+	/* atomically change a volatile long, returning the new value */
+	#define Thread_increment(count) __sync_add_and_fetch(count, 1)
+	#define Thread_decrement(count) __sync_sub_and_fetch(count, 1)
 	typedef struct { pthread_cond_t cond; pthread_mutex_t mutex; } cond_type_struct;
 	typedef cond_type_struct *cond_type;
 	#if defined(OSX)
@@ -56,10 +63,13 @@
 	cond_type Thread_create_cond(int*);
 	int Thread_signal_cond(cond_type);
 	int Thread_wait_cond(cond_type condvar, int timeout);
+	int Thread_wait_cond_ms(cond_type condvar, int timeout_ms);
 	int Thread_destroy_cond(cond_type);
 #endif
 
 LIBMQTT_API thread_type Thread_start(thread_fn, void*);
+thread_type Thread_start_joinable(thread_fn, void*);
+int Thread_join(thread_type);
 
 LIBMQTT_API mutex_type Thread_create_mutex(int*);
 LIBMQTT_API int Thread_lock_mutex(mutex_type);
@@ -151,16 +151,24 @@ struct ws_frame
 	size_t pos; /**< current position within the buffer */
 };
 
-/** Current frame being processed */
-struct ws_frame *last_frame = NULL;
-
-/** Holds any received websocket frames, to be process */
-static List* in_frames = NULL;
+/** frame data of the sockets of one reactor */
+struct ws_frames
+{
+	struct ws_frame *last_frame; /**< Current frame being processed */
+	List* in_frames; /**< Holds any received websocket frames, to be process */
+	char * frame_buffer;
+	size_t frame_buffer_len;
+	size_t frame_buffer_index;
+	size_t frame_buffer_data_len;
+};
 
-static char * frame_buffer = NULL;
-static size_t frame_buffer_len = 0;
-static size_t frame_buffer_index = 0;
-static size_t frame_buffer_data_len = 0;
+static struct ws_frames reactor_frames[SOCKET_MAX_REACTORS];
+#define last_frame (reactor_frames[Socket_getReactor()].last_frame)
+#define in_frames (reactor_frames[Socket_getReactor()].in_frames)
+#define frame_buffer (reactor_frames[Socket_getReactor()].frame_buffer)
+#define frame_buffer_len (reactor_frames[Socket_getReactor()].frame_buffer_len)
+#define frame_buffer_index (reactor_frames[Socket_getReactor()].frame_buffer_index)
+#define frame_buffer_data_len (reactor_frames[Socket_getReactor()].frame_buffer_data_len)
 
 /* static function declarations */
 static const char *WebSocket_strcasefind(
@@ -1257,34 +1265,42 @@ const char *WebSocket_strcasefind(const char *buf, const char *str, size_t len)
  */
 void WebSocket_terminate( void )
 {
+	int saved_reactor = Socket_getReactor();
+	int reactor;
+
 	FUNC_ENTRY;
-	/* clean up and un-processed websocket frames */
-	if ( in_frames )
+	for (reactor = 0; reactor < Socket_getReactorCount(); ++reactor)
 	{
-		struct ws_frame *f = ListDetachHead( in_frames );
-		while ( f )
+		Socket_setReactor(reactor);
+		/* clean up and un-processed websocket frames */
+		if ( in_frames )
 		{
-			free( f );
-			f = ListDetachHead( in_frames );
+			struct ws_frame *f = ListDetachHead( in_frames );
+			while ( f )
+			{
+				free( f );
+				f = ListDetachHead( in_frames );
+			}
+			ListFree( in_frames );
+			in_frames = NULL;
 		}
-		ListFree( in_frames );
-		in_frames = NULL;
-	}
-	if ( last_frame )
-	{
-		free( last_frame );
-		last_frame = NULL;
-	}
-	
-	if ( frame_buffer )
-	{
-		free( frame_buffer );
-		frame_buffer = NULL;
+		if ( last_frame )
+		{
+			free( last_frame );
+			last_frame = NULL;
+		}
+
+		if ( frame_buffer )
+		{
+			free( frame_buffer );
+			frame_buffer = NULL;
+		}
+
+		frame_buffer_len = 0;
+		frame_buffer_index = 0;
+		frame_buffer_data_len = 0;
 	}
-	
-	frame_buffer_len = 0;
-	frame_buffer_index = 0;
-	frame_buffer_data_len = 0;
+	Socket_setReactor(saved_reactor);
 
 	Socket_outTerminate();
 #if defined(OPENSSL)
@@ -45,9 +45,11 @@ struct pubsub_opts opts =
 	NULL, NULL, 1, 0, 0, /* message options */
 	MQTTVERSION_DEFAULT, NULL, "paho-c-pub", 0, 0, NULL, NULL, "localhost", "1883", NULL, 10, /* MQTT options */
 	NULL, NULL, 0, 0, /* will options */
-	0, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, /* TLS options */
+	0, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, 0, /* TLS options */
 	0, {NULL, NULL}, /* MQTT V5 options */
 	NULL, NULL, /* HTTP and HTTPS proxies */
+	0, 0, 0, 0, /* TCP socket options */
+	0, /* benchmark options */
 };
 
 MQTTAsync_responseOptions pub_opts = MQTTAsync_responseOptions_initializer;
@@ -277,6 +279,7 @@ void myconnect(MQTTAsync client)
 	MQTTAsync_connectOptions conn_opts = MQTTAsync_connectOptions_initializer;
 	MQTTAsync_SSLOptions ssl_opts = MQTTAsync_SSLOptions_initializer;
 	MQTTAsync_willOptions will_opts = MQTTAsync_willOptions_initializer;
+	MQTTAsync_socketOptions sock_opts = MQTTAsync_socketOptions_initializer;
 	int rc = 0;
 
 	if (opts.verbose)
@@ -303,6 +306,11 @@ void myconnect(MQTTAsync client)
 	conn_opts.automaticReconnect = 1;
 	conn_opts.httpProxy = opts.http_proxy;
 	conn_opts.httpsProxy = opts.https_proxy;
+	sock_opts.noDelay = opts.nodelay;
+	sock_opts.sendBufferSize = opts.sndbuf;
+	sock_opts.receiveBufferSize = opts.rcvbuf;
+	sock_opts.tos = opts.tos;
+	conn_opts.socketOptions = &sock_opts;
 
 	if (opts.will_topic) 	/* will options */
 	{
@@ -326,6 +334,7 @@ void myconnect(MQTTAsync client)
 		ssl_opts.privateKey = opts.key;
 		ssl_opts.privateKeyPassword = opts.keypass;
 		ssl_opts.enabledCipherSuites = opts.ciphers;
+		ssl_opts.enableKernelTLS = opts.ktls;
 		ssl_opts.ssl_error_cb = onSSLError;
 		ssl_opts.ssl_error_context = client;
 		ssl_opts.ssl_psk_cb = onPSKAuth;
@@ -66,9 +66,11 @@ struct pubsub_opts opts =
 	NULL, NULL, 1, 0, 0, /* message options */
 	MQTTVERSION_DEFAULT, NULL, "paho-c-sub", 0, 0, NULL, NULL, "localhost", "1883", NULL, 10, /* MQTT options */
 	NULL, NULL, 0, 0, /* will options */
-	0, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, /* TLS options */
+	0, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, 0, /* TLS options */
 	0, {NULL, NULL}, /* MQTT V5 options */
 	NULL, NULL, /* HTTP and HTTPS proxies */
+	0, 0, 0, 0, /* TCP socket options */
+	0, /* benchmark options */
 };
 
 
@@ -204,6 +206,7 @@ int main(int argc, char** argv)
 	MQTTAsync_disconnectOptions disc_opts = MQTTAsync_disconnectOptions_initializer;
 	MQTTAsync_createOptions create_opts = MQTTAsync_createOptions_initializer;
 	MQTTAsync_willOptions will_opts = MQTTAsync_willOptions_initializer;
+	MQTTAsync_socketOptions sock_opts = MQTTAsync_socketOptions_initializer;
 	MQTTAsync_SSLOptions ssl_opts = MQTTAsync_SSLOptions_initializer;
 	int rc = 0;
 	char* url = NULL;
@@ -292,6 +295,11 @@ int main(int argc, char** argv)
 	conn_opts.automaticReconnect = 1;
 	conn_opts.httpProxy = opts.http_proxy;
 	conn_opts.httpsProxy = opts.https_proxy;
+	sock_opts.noDelay = opts.nodelay;
+	sock_opts.sendBufferSize = opts.sndbuf;
+	sock_opts.receiveBufferSize = opts.rcvbuf;
+	sock_opts.tos = opts.tos;
+	conn_opts.socketOptions = &sock_opts;
 
 	if (opts.will_topic) 	/* will options */
 	{
@@ -312,6 +320,7 @@ int main(int argc, char** argv)
 		ssl_opts.privateKey = opts.key;
 		ssl_opts.privateKeyPassword = opts.keypass;
 		ssl_opts.enabledCipherSuites = opts.ciphers;
+		ssl_opts.enableKernelTLS = opts.ktls;
 		conn_opts.ssl = &ssl_opts;
 	}
 
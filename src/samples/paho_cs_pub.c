@@ -46,9 +46,11 @@ struct pubsub_opts opts =
 	NULL, NULL, 1, 0, 0, /* message options */
 	MQTTVERSION_DEFAULT, NULL, "paho-cs-pub", 0, 0, NULL, NULL, "localhost", "1883", NULL, 10, /* MQTT options */
 	NULL, NULL, 0, 0, /* will options */
-	0, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, /* TLS options */
+	0, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, 0, /* TLS options */
 	0, {NULL, NULL}, /* MQTT V5 options */
 	NULL, NULL, /* HTTP and HTTPS proxies */
+	0, 0, 0, 0, /* TCP socket options */
+	0, /* benchmark options */
 };
 
 
@@ -57,6 +59,7 @@ int myconnect(MQTTClient* client)
 	MQTTClient_connectOptions conn_opts = MQTTClient_connectOptions_initializer;
 	MQTTClient_SSLOptions ssl_opts = MQTTClient_SSLOptions_initializer;
 	MQTTClient_willOptions will_opts = MQTTClient_willOptions_initializer;
+	MQTTClient_socketOptions sock_opts = MQTTClient_socketOptions_initializer;
 	int rc = 0;
 
 	if (opts.verbose)
@@ -74,6 +77,11 @@ int myconnect(MQTTClient* client)
 	conn_opts.MQTTVersion = opts.MQTTVersion;
 	conn_opts.httpProxy = opts.http_proxy;
 	conn_opts.httpsProxy = opts.https_proxy;
+	sock_opts.noDelay = opts.nodelay;
+	sock_opts.sendBufferSize = opts.sndbuf;
+	sock_opts.receiveBufferSize = opts.rcvbuf;
+	sock_opts.tos = opts.tos;
+	conn_opts.socketOptions = &sock_opts;
 
 	if (opts.will_topic) 	/* will options */
 	{
@@ -97,6 +105,7 @@ int myconnect(MQTTClient* client)
 		ssl_opts.privateKey = opts.key;
 		ssl_opts.privateKeyPassword = opts.keypass;
 		ssl_opts.enabledCipherSuites = opts.ciphers;
+		ssl_opts.enableKernelTLS = opts.ktls;
 		conn_opts.ssl = &ssl_opts;
 	}
 
@@ -133,6 +142,87 @@ int messageArrived(void* context, char* topicName, int topicLen, MQTTClient_mess
 }
 
 
+volatile MQTTClient_deliveryToken last_delivered = 0;
+
+void delivered(void* context, MQTTClient_deliveryToken dt)
+{
+	last_delivered = dt;
+}
+
+
+double microseconds(void)
+{
+#if defined(_WIN32)
+	LARGE_INTEGER count, frequency;
+
+	QueryPerformanceCounter(&count);
+	QueryPerformanceFrequency(&frequency);
+	return (double)count.QuadPart * 1000000.0 / (double)frequency.QuadPart;
+#else
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return now.tv_sec * 1000000.0 + now.tv_usec;
+#endif
+}
+
+
+/*
+ * Publish the message --repeat times, each once the one before has completed, and print the
+ * round trip times.  Running this against the same broker over tcp://localhost and unix://
+ * compares the latency of the two.  At QoS 0 only the time to send is measured.
+ */
+int timePublishes(MQTTClient client, MQTTProperties* pub_props)
+{
+	char* payload = opts.message ? opts.message : "";
+	int payloadlen = (int)strlen(payload);
+	double total = 0, least = 0, most = 0;
+	int count = 0;
+	int rc = MQTTCLIENT_SUCCESS;
+
+	while (count < opts.repeat && !toStop)
+	{
+		MQTTClient_deliveryToken token;
+		double start = microseconds(), took;
+
+		last_delivered = 0;
+		if (opts.MQTTVersion == MQTTVERSION_5)
+		{
+			MQTTResponse response = MQTTClient_publish5(client, opts.topic, payloadlen, payload,
+					opts.qos, opts.retained, pub_props, &token);
+
+			rc = response.reasonCode;
+			MQTTResponse_free(response);
+		}
+		else
+			rc = MQTTClient_publish(client, opts.topic, payloadlen, payload, opts.qos, opts.retained, &token);
+		/* waitForCompletion checks every 100 milliseconds, which is too coarse to time with */
+		while (rc == MQTTCLIENT_SUCCESS && opts.qos > 0 && last_delivered != token && !toStop)
+		{
+			if (!MQTTClient_isConnected(client))
+				rc = MQTTCLIENT_DISCONNECTED;
+		}
+		if (rc != MQTTCLIENT_SUCCESS)
+		{
+			if (!opts.quiet)
+				fprintf(stderr, "Publish failed return code: %s\n", MQTTClient_strerror(rc));
+			break;
+		}
+		took = microseconds() - start;
+		total += took;
+		if (count == 0 || took < least)
+			least = took;
+		if (took > most)
+			most = took;
+		count++;
+	}
+	if (count > 0)
+		printf("%d publishes at QoS %d: min %.1f us, mean %.1f us, max %.1f us\n",
+				count, opts.qos, least, total / count, most);
+	return rc;
+}
+
+
 void trace_callback(enum MQTTCLIENT_TRACE_LEVELS level, char* message)
 {
 	fprintf(stderr, "Trace : %d, %s\n", level, message);
@@ -200,7 +290,7 @@ int main(int argc, char** argv)
     sigaction(SIGTERM, &sa, NULL);
 #endif
 
-	rc = MQTTClient_setCallbacks(client, NULL, NULL, messageArrived, NULL);
+	rc = MQTTClient_setCallbacks(client, NULL, NULL, messageArrived, opts.repeat > 0 ? delivered : NULL);
 	if (rc != MQTTCLIENT_SUCCESS)
 	{
 		if (!opts.quiet)
@@ -232,6 +322,12 @@ int main(int argc, char** argv)
 		}
 	}
 
+	if (opts.repeat > 0)
+	{
+		rc = timePublishes(client, &pub_props);
+		goto exit;
+	}
+
 	while (!toStop)
 	{
 		int data_len = 0;
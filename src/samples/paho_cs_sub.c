@@ -43,9 +43,11 @@ struct pubsub_opts opts =
 	NULL, NULL, 1, 0, 0, /* message options */
 	MQTTVERSION_DEFAULT, NULL, "paho-cs-sub", 0, 0, NULL, NULL, "localhost", "1883", NULL, 10, /* MQTT options */
 	NULL, NULL, 0, 0, /* will options */
-	0, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, /* TLS options */
+	0, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, 0, /* TLS options */
 	0, {NULL, NULL}, /* MQTT V5 options */
 	NULL, NULL, /* HTTP and HTTPS proxies */
+	0, 0, 0, 0, /* TCP socket options */
+	0, /* benchmark options */
 };
 
 
@@ -54,6 +56,7 @@ int myconnect(MQTTClient* client)
 	MQTTClient_connectOptions conn_opts = MQTTClient_connectOptions_initializer;
 	MQTTClient_SSLOptions ssl_opts = MQTTClient_SSLOptions_initializer;
 	MQTTClient_willOptions will_opts = MQTTClient_willOptions_initializer;
+	MQTTClient_socketOptions sock_opts = MQTTClient_socketOptions_initializer;
 	int rc = 0;
 
 	if (opts.verbose)
@@ -71,6 +74,11 @@ int myconnect(MQTTClient* client)
 	conn_opts.MQTTVersion = opts.MQTTVersion;
 	conn_opts.httpProxy = opts.http_proxy;
 	conn_opts.httpsProxy = opts.https_proxy;
+	sock_opts.noDelay = opts.nodelay;
+	sock_opts.sendBufferSize = opts.sndbuf;
+	sock_opts.receiveBufferSize = opts.rcvbuf;
+	sock_opts.tos = opts.tos;
+	conn_opts.socketOptions = &sock_opts;
 
 	if (opts.will_topic) 	/* will options */
 	{
@@ -94,6 +102,7 @@ int myconnect(MQTTClient* client)
 		ssl_opts.privateKey = opts.key;
 		ssl_opts.privateKeyPassword = opts.keypass;
 		ssl_opts.enabledCipherSuites = opts.ciphers;
+		ssl_opts.enableKernelTLS = opts.ktls;
 		conn_opts.ssl = &ssl_opts;
 	}
 
@@ -50,17 +50,21 @@ void usage(struct pubsub_opts* opts, pubsub_opts_nameValue* name_values, const c
 	{
 		printf("       [-r] [-n] [-m message] [-f filename]\n");
 		printf("       [--maxdatalen len] [--message-expiry seconds] [--user-property name value]\n");
+		printf("       [--repeat count]\n");
 	}
 	else
 		printf("       [-R] [--no-delimiter]\n");
 	printf("       [--will-topic topic] [--will-payload message] [--will-qos qos] [--will-retain]\n");
 	printf("       [--cafile filename] [--capath dirname] [--cert filename] [--key filename]\n"
-		   "       [--keypass string] [--ciphers string] [--insecure]");
+		   "       [--keypass string] [--ciphers string] [--insecure] [--ktls]\n"
+		   "       [--nodelay] [--sndbuf bytes] [--rcvbuf bytes] [--tos value]");
 
 	printf(
 	"\n\n  -t (--topic)        : MQTT topic to %s to\n"
 	"  -c (--connection)   : connection string, overrides host/port e.g wss://hostname:port/ws.  Use this option\n"
-	"                        rather than host/port to connect with TLS and/or web sockets. No default.\n"
+	"                        rather than host/port to connect with TLS and/or web sockets, or to a Unix domain\n"
+	"                        socket with unix:///path/to/socket (or unix://@name in the Linux abstract namespace).\n"
+	"                        No default.\n"
 	"  -h (--host)         : host to connect to.  Default is %s.\n"
 	"  -p (--port)         : network port to connect to. Default is %s.\n"
 	"  -q (--qos)          : MQTT QoS to %s with (0, 1 or 2). Default is %d.\n"
@@ -92,6 +96,8 @@ void usage(struct pubsub_opts* opts, pubsub_opts_nameValue* name_values, const c
 				opts->maxdatalen);
 		printf("  --message-expiry    : MQTT 5 only.  Sets the message expiry property in seconds.\n");
 		printf("  --user-property     : MQTT 5 only.  Sets a user property.\n");
+		printf("  --repeat            : publish the message this many times, one at a time, and print the\n"
+		       "                        round trip times.  Only paho_cs_pub.\n");
 	}
 	else
 	{
@@ -115,6 +121,7 @@ void usage(struct pubsub_opts* opts, pubsub_opts_nameValue* name_values, const c
 	"  --ciphers           : the list of cipher suites that the client will present to the server during\n"
 	"                        the TLS handshake.\n"
 	"  --insecure          : don't check that the server certificate common name matches the hostname.\n"
+	"  --ktls              : use kernel TLS for encryption after the handshake, if the system supports it.\n"
 	"  --psk               : pre-shared-key in hexadecimal (no leading 0x) \n"
 	"  --psk-identity      : client identity string for TLS-PSK mode.\n"
 	);
@@ -124,6 +131,13 @@ void usage(struct pubsub_opts* opts, pubsub_opts_nameValue* name_values, const c
 	"  --https-proxy       : HTTPS proxy string.\n"
 	);
 
+	printf(
+	"  --nodelay           : send small packets immediately (TCP_NODELAY).\n"
+	"  --sndbuf            : TCP send buffer size in bytes.  Default is the system setting.\n"
+	"  --rcvbuf            : TCP receive buffer size in bytes.  Default is the system setting.\n"
+	"  --tos               : IP type of service byte, e.g. 184 (0xB8) for DSCP expedited forwarding.\n"
+	);
+
 	printf("\nSee http://eclipse.org/paho for more information about the Eclipse Paho project.\n");
 	exit(EXIT_FAILURE);
 }
@@ -197,6 +211,36 @@ int getopts(int argc, char** argv, struct pubsub_opts* opts)
 			else
 				return 1;
 		}
+		else if (strcmp(argv[count], "--nodelay") == 0)
+			opts->nodelay = 1;
+		else if (strcmp(argv[count], "--sndbuf") == 0)
+		{
+			if (++count < argc)
+				opts->sndbuf = atoi(argv[count]);
+			else
+				return 1;
+		}
+		else if (strcmp(argv[count], "--rcvbuf") == 0)
+		{
+			if (++count < argc)
+				opts->rcvbuf = atoi(argv[count]);
+			else
+				return 1;
+		}
+		else if (strcmp(argv[count], "--tos") == 0)
+		{
+			if (++count < argc)
+				opts->tos = (int)strtol(argv[count], NULL, 0);
+			else
+				return 1;
+		}
+		else if (strcmp(argv[count], "--repeat") == 0)
+		{
+			if (++count < argc)
+				opts->repeat = atoi(argv[count]);
+			else
+				return 1;
+		}
 		else if (strcmp(argv[count], "--clientid") == 0 || strcmp(argv[count], "-i") == 0)
 		{
 			if (++count < argc)
@@ -278,6 +322,8 @@ int getopts(int argc, char** argv, struct pubsub_opts* opts)
 		}
 		else if (strcmp(argv[count], "--insecure") == 0)
 			opts->insecure = 1;
+		else if (strcmp(argv[count], "--ktls") == 0)
+			opts->ktls = 1;
 		else if (strcmp(argv[count], "--capath") == 0)
 		{
 			if (++count < argc)
@@ -63,6 +63,7 @@ struct pubsub_opts
 	char* ciphers;
 	char* psk_identity;
 	char* psk;
+	int ktls;
 	/* MQTT V5 options */
 	int message_expiry;
 	struct {
@@ -72,6 +73,13 @@ struct pubsub_opts
 	/* websocket HTTP proxies */
 	char* http_proxy;
 	char* https_proxy;
+	/* TCP socket options */
+	int nodelay;
+	int sndbuf;
+	int rcvbuf;
+	int tos;
+	/* benchmark options */
+	int repeat;
 };
 
 typedef struct
@@ -0,0 +1,137 @@
+/*******************************************************************************
+ * Copyright (c) 2026 Contributors to the Eclipse Foundation
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v2.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    https://www.eclipse.org/legal/epl-2.0/
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *******************************************************************************/
+
+
+/**
+ * @file
+ * Benchmark of the allocations made for the MQTT V5 properties of a publish.
+ *
+ * The properties of a message are copied from the application into the publish command,
+ * from the command into the stored outbound message, and from an inbound publish into the
+ * message passed to messageArrived.  This program makes the same chain of copies of a
+ * typical property list, and reports the allocations and time per publish.  It fails if
+ * copying a copy allocates, or if adding to a copy changes the list it was copied from.
+ *
+ * The allocations are counted by replacing malloc, which needs glibc.
+ */
+
+
+#include "MQTTAsync.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__GLIBC__)
+extern void* __libc_malloc(size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+
+static volatile long allocations = 0;
+
+void* malloc(size_t size)
+{
+	allocations++;
+	return __libc_malloc(size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+	allocations++;
+	return __libc_realloc(ptr, size);
+}
+#else
+static long allocations = -1; /* not counted */
+#endif
+
+
+static void addUserProperty(MQTTProperties* props, char* name, char* value)
+{
+	MQTTProperty property;
+
+	property.identifier = MQTTPROPERTY_CODE_USER_PROPERTY;
+	property.value.data.data = name;
+	property.value.data.len = (int)strlen(name);
+	property.value.value.data = value;
+	property.value.value.len = (int)strlen(value);
+	MQTTProperties_add(props, &property);
+}
+
+
+static double elapsed(struct timespec* start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1e9 + (now.tv_nsec - start->tv_nsec);
+}
+
+
+int main(int argc, char** argv)
+{
+	MQTTProperties props = MQTTProperties_initializer;
+	MQTTProperties command, message, delivered;
+	MQTTProperty property;
+	struct timespec start;
+	long before, copies, shared;
+	int iterations = (argc > 1) ? atoi(argv[1]) : 1000000;
+	int failures = 0;
+	int i;
+
+	property.identifier = MQTTPROPERTY_CODE_CONTENT_TYPE;
+	property.value.data.data = "application/json";
+	property.value.data.len = (int)strlen(property.value.data.data);
+	MQTTProperties_add(&props, &property);
+	addUserProperty(&props, "source", "sensor-17");
+	addUserProperty(&props, "region", "eu-west");
+	addUserProperty(&props, "schema", "v3");
+	addUserProperty(&props, "trace-id", "4bf92f3577b34da6a3ce929d0e0e4736");
+	addUserProperty(&props, "span-id", "00f067aa0ba902b7");
+
+	before = allocations;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < iterations; ++i)
+	{
+		command = MQTTProperties_copy(&props);       /* MQTTAsync_send */
+		message = MQTTProperties_copy(&command);     /* the stored outbound message */
+		delivered = MQTTProperties_copy(&message);   /* the message passed to a callback */
+		MQTTProperties_free(&delivered);
+		MQTTProperties_free(&message);
+		MQTTProperties_free(&command);
+	}
+	copies = allocations - before;
+	printf("%d properties, %d bytes: %.1f allocations and %.0f ns per publish\n", props.count, props.length,
+		(allocations < 0) ? -1.0 : (double)copies / iterations, elapsed(&start) / iterations);
+
+	command = MQTTProperties_copy(&props);
+	before = allocations;
+	message = MQTTProperties_copy(&command);
+	shared = allocations - before;
+	if (allocations >= 0 && shared != 0)
+	{
+		printf("copying a copy made %ld allocations\n", shared);
+		failures++;
+	}
+	addUserProperty(&message, "hop", "2");
+	if (command.count != props.count || message.count != props.count + 1 ||
+		memcmp(command.array[1].value.value.data, "sensor-17", 9) != 0 ||
+		memcmp(message.array[1].value.value.data, "sensor-17", 9) != 0)
+	{
+		printf("adding to a copy changed the original\n");
+		failures++;
+	}
+	MQTTProperties_free(&message);
+	MQTTProperties_free(&command);
+	MQTTProperties_free(&props);
+	return failures;
+}
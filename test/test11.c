@@ -2082,6 +2082,208 @@ exit:
 	return failures;
 }
 
+
+/*********************************************************************
+
+Test10: topic aliases assigned by the client, with maxTopicAliases.
+The broker must resolve every message to the topic it was sent to,
+as aliases are reused and then forgotten on reconnect.
+
+*********************************************************************/
+
+struct
+{
+	char* topics[3];
+	char* filter;
+	volatile int subscribed;
+	volatile int disconnected;
+	volatile int messages_arrived;
+	volatile int wrong_topics;
+} test_automatic_topic_aliases_globals =
+{
+	{"automatic topic aliases/one", "automatic topic aliases/two", "automatic topic aliases/three"},
+	"automatic topic aliases/+", 0, 0, 0, 0
+};
+
+
+int test_automatic_topic_aliases_messageArrived(void* context, char* topicName, int topicLen, MQTTAsync_message* message)
+{
+	/* each message carries the topic it was sent to */
+	if (strlen(topicName) != (size_t)message->payloadlen || memcmp(topicName, message->payload, message->payloadlen) != 0)
+	{
+		MyLog(LOGA_INFO, "Message for topic %.*s arrived on %s", message->payloadlen, (char*)message->payload, topicName);
+		test_automatic_topic_aliases_globals.wrong_topics++;
+	}
+	test_automatic_topic_aliases_globals.messages_arrived++;
+
+	MQTTAsync_freeMessage(&message);
+	MQTTAsync_free(topicName);
+
+	return 1;
+}
+
+
+void test_automatic_topic_aliases_onSubscribe(void* context, MQTTAsync_successData5* response)
+{
+	MyLog(LOGA_DEBUG, "In subscribe onSuccess callback, context %p", context);
+	test_automatic_topic_aliases_globals.subscribed = 1;
+}
+
+
+void test_automatic_topic_aliases_onConnect(void* context, MQTTAsync_successData5* response)
+{
+	MQTTAsync c = (MQTTAsync)context;
+	MQTTAsync_responseOptions opts = MQTTAsync_responseOptions_initializer;
+	int rc;
+
+	MyLog(LOGA_DEBUG, "In connect onSuccess callback, context %p", context);
+
+	opts.onSuccess5 = test_automatic_topic_aliases_onSubscribe;
+	opts.context = c;
+	rc = MQTTAsync_subscribe(c, test_automatic_topic_aliases_globals.filter, 1, &opts);
+	assert("Good rc from subscribe", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+}
+
+
+void test_automatic_topic_aliases_onDisconnect(void* context, MQTTAsync_successData5* response)
+{
+	MyLog(LOGA_DEBUG, "In disconnect onSuccess callback, context %p", context);
+	test_automatic_topic_aliases_globals.disconnected = 1;
+}
+
+
+int test_automatic_topic_aliases_send(MQTTAsync c, int topic, int count)
+{
+	char* topicName = test_automatic_topic_aliases_globals.topics[topic];
+	int rc = MQTTASYNC_SUCCESS;
+	int i;
+
+	for (i = 0; i < count && rc == MQTTASYNC_SUCCESS; ++i)
+	{
+		rc = MQTTAsync_send(c, topicName, (int)strlen(topicName), topicName, 1, 0, NULL);
+		assert("Good rc from send", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	}
+	return rc;
+}
+
+
+void test_automatic_topic_aliases_wait(int messages)
+{
+	int count = 0;
+
+	while (test_automatic_topic_aliases_globals.messages_arrived < messages && ++count < 1000)
+		#if defined(_WIN32)
+			Sleep(100);
+		#else
+			usleep(10000L);
+		#endif
+	assert("All messages arrived", test_automatic_topic_aliases_globals.messages_arrived == messages,
+			"messages arrived were %d", test_automatic_topic_aliases_globals.messages_arrived);
+}
+
+
+int test_automatic_topic_aliases(struct Options options)
+{
+	MQTTAsync c;
+	MQTTAsync_connectOptions opts = MQTTAsync_connectOptions_initializer5;
+	MQTTAsync_disconnectOptions dopts = MQTTAsync_disconnectOptions_initializer;
+	MQTTAsync_createOptions createOpts = MQTTAsync_createOptions_initializer5;
+	MQTTAsync_statistics stats = MQTTAsync_statistics_initializer;
+	int rc = 0, count = 0, round = 0;
+
+	MyLog(LOGA_INFO, "Starting V5 test 10 - automatic topic aliases");
+	fprintf(xml, "<testcase classname=\"test11\" name=\"automatic topic aliases\"");
+	global_start_time = start_clock();
+
+	createOpts.maxTopicAliases = 2;
+	rc = MQTTAsync_createWithOptions(&c, options.connection, "async_test_automatic_aliases",
+			MQTTCLIENT_PERSISTENCE_NONE, NULL, &createOpts);
+	assert("good rc from create",  rc == MQTTASYNC_SUCCESS, "rc was %d\n", rc);
+	if (rc != MQTTASYNC_SUCCESS)
+		goto exit;
+
+	rc = MQTTAsync_setCallbacks(c, c, NULL, test_automatic_topic_aliases_messageArrived, NULL);
+	assert("Good rc from setCallbacks", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+
+	opts.MQTTVersion = options.MQTTVersion;
+	opts.onSuccess5 = test_automatic_topic_aliases_onConnect;
+	opts.context = c;
+	opts.cleanstart = 1;
+
+	MyLog(LOGA_DEBUG, "Connecting");
+	rc = MQTTAsync_connect(c, &opts);
+	assert("Good rc from connect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	if (rc != MQTTASYNC_SUCCESS)
+		goto destroy;
+	while (test_automatic_topic_aliases_globals.subscribed == 0 && ++count < 1000)
+		#if defined(_WIN32)
+			Sleep(100);
+		#else
+			usleep(10000L);
+		#endif
+
+	/* one topic: the first message sets the alias, the rest use it */
+	test_automatic_topic_aliases_send(c, 0, 10);
+	test_automatic_topic_aliases_wait(10);
+	rc = MQTTAsync_getStatistics(c, &stats);
+	assert("Good rc from getStatistics", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	assert("One alias assigned", stats.topicAliases == 1, "aliases were %d", stats.topicAliases);
+	assert("Bytes saved by the alias", stats.topicAliasBytesSaved > 0, "bytes saved were %ld", stats.topicAliasBytesSaved);
+
+	/* three topics over two aliases, so that the least recently used is given away */
+	for (round = 0; round < 3; ++round)
+	{
+		test_automatic_topic_aliases_send(c, 0, 1);
+		test_automatic_topic_aliases_send(c, 1, 1);
+		test_automatic_topic_aliases_send(c, 2, 1);
+	}
+	test_automatic_topic_aliases_wait(19);
+	rc = MQTTAsync_getStatistics(c, &stats);
+	assert("Good rc from getStatistics", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	assert("No more aliases than allowed", stats.topicAliases == 2, "aliases were %d", stats.topicAliases);
+
+	/* the aliases are forgotten with the connection */
+	dopts.onSuccess5 = test_automatic_topic_aliases_onDisconnect;
+	dopts.context = c;
+	rc = MQTTAsync_disconnect(c, &dopts);
+	assert("Good rc from disconnect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	count = 0;
+	while (test_automatic_topic_aliases_globals.disconnected == 0 && ++count < 1000)
+		#if defined(_WIN32)
+			Sleep(100);
+		#else
+			usleep(10000L);
+		#endif
+	test_automatic_topic_aliases_globals.subscribed = 0;
+	rc = MQTTAsync_connect(c, &opts);
+	assert("Good rc from connect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	count = 0;
+	while (test_automatic_topic_aliases_globals.subscribed == 0 && ++count < 1000)
+		#if defined(_WIN32)
+			Sleep(100);
+		#else
+			usleep(10000L);
+		#endif
+	rc = MQTTAsync_getStatistics(c, &stats);
+	assert("Good rc from getStatistics", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	assert("No aliases on the new connection", stats.topicAliases == 0, "aliases were %d", stats.topicAliases);
+	test_automatic_topic_aliases_send(c, 2, 1);
+	test_automatic_topic_aliases_send(c, 0, 2);
+	test_automatic_topic_aliases_wait(22);
+
+	assert("All messages arrived on their topics", test_automatic_topic_aliases_globals.wrong_topics == 0,
+			"wrong topics were %d", test_automatic_topic_aliases_globals.wrong_topics);
+
+destroy:
+	MQTTAsync_destroy(&c);
+
+exit:
+	MyLog(LOGA_INFO, "TEST10: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", tests, failures);
+	write_test_result();
+	return failures;
+}
+
 void trace_callback(enum MQTTASYNC_TRACE_LEVELS level, char* message)
 {
 	printf("Trace : %d, %s\n", level, message);
@@ -2100,7 +2302,8 @@ int main(int argc, char** argv)
 		test_qos_1_2_errors,
 		test_request_response,
 		test_subscribeOptions,
-		test_shared_subscriptions
+		test_shared_subscriptions,
+		test_automatic_topic_aliases
  	}; /* indexed starting from 1 */
 	MQTTAsync_nameValue* info;
 	int i;
@@ -24,14 +24,20 @@
 
 
 #include "MQTTAsync.h"
+#include "MQTTAsyncGroup.h"
+#include "MQTTAsyncStripe.h"
 #include <string.h>
 #include <stdlib.h>
 
 #if !defined(_WINDOWS)
 	#include <sys/time.h>
   #include <sys/socket.h>
+  #include <sys/un.h>
 	#include <unistd.h>
+	#include <pthread.h>
   #include <errno.h>
+	#include <netinet/in.h>
+	#include <netinet/tcp.h>
 #else
 	#include <windows.h>
 #endif
@@ -1740,18 +1746,2163 @@ exit:
 
 
 
+/*********************************************************************
+
+Test9: clients on different reactors, with a callback of one client
+calling the API of a client on another reactor, and the first client
+destroyed while that is going on
+
+*********************************************************************/
+
+char* test9_topic = "C client test9";
+char* test9_echo_topic = "C client test9 echo";
+MQTTAsync test9_a = NULL;
+MQTTAsync test9_b = NULL;
+volatile int test9_connected = 0;
+volatile int test9_subscribed = 0;
+volatile int test9_arrived = 0;
+volatile int test9_echoed = 0;
+volatile int test9_echo_failures = 0;
+
+void test9_onSubscribe(void* context, MQTTAsync_successData* response)
+{
+	MyLog(LOGA_DEBUG, "In subscribe onSuccess callback %p", context);
+	test9_subscribed++;
+}
+
+void test9_onConnect(void* context, MQTTAsync_successData* response)
+{
+	MQTTAsync c = (MQTTAsync)context;
+	MQTTAsync_responseOptions opts = MQTTAsync_responseOptions_initializer;
+	int rc;
+
+	MyLog(LOGA_DEBUG, "In connect onSuccess callback, context %p", context);
+	test9_connected++;
+	opts.onSuccess = test9_onSubscribe;
+	opts.context = c;
+	rc = MQTTAsync_subscribe(c, (c == test9_a) ? test9_topic : test9_echo_topic, 1, &opts);
+	assert("Good rc from subscribe", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+}
+
+int test9_messageArrived(void* context, char* topicName, int topicLen, MQTTAsync_message* message)
+{
+	MQTTAsync c = (MQTTAsync)context;
+	int rc;
+
+	if (c == test9_a)
+	{
+		/* runs on a's reactor, and calls into b's */
+		rc = MQTTAsync_send(test9_b, test9_echo_topic, message->payloadlen, message->payload, 0, 0, NULL);
+		if (rc != MQTTASYNC_SUCCESS)
+			test9_echo_failures++;
+		test9_arrived++;
+	}
+	else
+		test9_echoed++;
+
+	MQTTAsync_freeMessage(&message);
+	MQTTAsync_free(topicName);
+	return 1;
+}
+
+int test9(struct Options options)
+{
+	MQTTAsync_init_options inits = MQTTAsync_init_options_initializer;
+	MQTTAsync_connectOptions opts = MQTTAsync_connectOptions_initializer;
+	MQTTAsync_disconnectOptions dopts = MQTTAsync_disconnectOptions_initializer;
+	int msg_count = 100;
+	int rc = 0;
+	int i;
+
+	MyLog(LOGA_INFO, "Starting test 9 - clients on different reactors");
+	fprintf(xml, "<testcase classname=\"test4\" name=\"reactors\"");
+	global_start_time = start_clock();
+
+	inits.struct_version = 2;
+	inits.reactorThreads = 2;
+	MQTTAsync_global_init(&inits);
+
+	rc = MQTTAsync_create(&test9_a, options.connection, "async_test9_a", MQTTCLIENT_PERSISTENCE_NONE, NULL);
+	assert("good rc from create", rc == MQTTASYNC_SUCCESS, "rc was %d\n", rc);
+	rc = MQTTAsync_create(&test9_b, options.connection, "async_test9_b", MQTTCLIENT_PERSISTENCE_NONE, NULL);
+	assert("good rc from create", rc == MQTTASYNC_SUCCESS, "rc was %d\n", rc);
+	if (rc != MQTTASYNC_SUCCESS)
+		goto exit;
+
+	rc = MQTTAsync_setCallbacks(test9_a, test9_a, NULL, test9_messageArrived, NULL);
+	assert("Good rc from setCallbacks", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	rc = MQTTAsync_setCallbacks(test9_b, test9_b, NULL, test9_messageArrived, NULL);
+	assert("Good rc from setCallbacks", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+
+	opts.keepAliveInterval = 20;
+	opts.cleansession = 1;
+	opts.MQTTVersion = options.MQTTVersion;
+	opts.onSuccess = test9_onConnect;
+	opts.context = test9_a;
+	rc = MQTTAsync_connect(test9_a, &opts);
+	assert("Good rc from connect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	opts.context = test9_b;
+	rc = MQTTAsync_connect(test9_b, &opts);
+	assert("Good rc from connect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+
+	for (i = 0; test9_subscribed < 2 && i < 500; ++i)
+		#if defined(_WIN32)
+			Sleep(100);
+		#else
+			usleep(10000L);
+		#endif
+	assert("Both clients subscribed", test9_subscribed == 2, "subscribed was %d", test9_subscribed);
+	if (test9_subscribed < 2)
+		goto exit;
+
+	for (i = 0; i < msg_count; ++i)
+	{
+		rc = MQTTAsync_send(test9_b, test9_topic, 11, "test9 data!", 1, 0, NULL);
+		assert("Good rc from send", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	}
+	for (i = 0; (test9_arrived < msg_count || test9_echoed < msg_count) && i < 1000; ++i)
+		#if defined(_WIN32)
+			Sleep(100);
+		#else
+			usleep(10000L);
+		#endif
+	assert("All messages arrived", test9_arrived == msg_count, "arrived was %d", test9_arrived);
+	assert("All messages echoed by the other reactor", test9_echoed == msg_count, "echoed was %d", test9_echoed);
+	assert("No echo failures", test9_echo_failures == 0, "failures were %d", test9_echo_failures);
+
+	/* destroy a while its callbacks are calling into b's reactor */
+	for (i = 0; i < msg_count * 5; ++i)
+		MQTTAsync_send(test9_b, test9_topic, 11, "test9 data!", 0, 0, NULL);
+	for (i = 0; test9_arrived < msg_count + 10 && i < 100000; ++i)
+		#if defined(_WIN32)
+			Sleep(1);
+		#else
+			usleep(100L);
+		#endif
+	assert("Messages arriving on a", test9_arrived >= msg_count + 10, "arrived was %d", test9_arrived);
+	MQTTAsync_destroy(&test9_a);
+	assert("a destroyed", test9_a == NULL, "a was %p", test9_a);
+
+	test_finished = 0;
+	dopts.onSuccess = test1_onDisconnect;
+	dopts.context = test9_b;
+	rc = MQTTAsync_disconnect(test9_b, &dopts);
+	assert("Good rc from disconnect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	for (i = 0; !test_finished && i < 500; ++i)
+		#if defined(_WIN32)
+			Sleep(100);
+		#else
+			usleep(10000L);
+		#endif
+
+exit:
+	if (test9_a)
+		MQTTAsync_destroy(&test9_a);
+	if (test9_b)
+		MQTTAsync_destroy(&test9_b);
+	inits.reactorThreads = 1;
+	MQTTAsync_global_init(&inits);
+	MyLog(LOGA_INFO, "TEST9: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", tests, failures);
+	write_test_result();
+	return failures;
+}
+
+
+
+/*********************************************************************
+
+Test10: callback threads.  A message whose messageArrived returns false
+is offered again without holding up the other clients on the thread, and
+stays in persistence until it is accepted.
+
+*********************************************************************/
+
+char* test10_topic_a = "C client test10 a";
+char* test10_topic_b = "C client test10 b";
+MQTTAsync test10_a = NULL;
+MQTTAsync test10_b = NULL;
+volatile int test10_subscribed = 0;
+volatile int test10_rejections = 0;
+volatile int test10_accept_all = 0;
+volatile int test10_b_arrived = 0;
+char test10_received[10];
+volatile int test10_received_count = 0;
+
+void test10_onSubscribe(void* context, MQTTAsync_successData* response)
+{
+	MyLog(LOGA_DEBUG, "In subscribe onSuccess callback %p", context);
+	test10_subscribed++;
+}
+
+void test10_onConnect(void* context, MQTTAsync_successData* response)
+{
+	MQTTAsync c = (MQTTAsync)context;
+	MQTTAsync_responseOptions opts = MQTTAsync_responseOptions_initializer;
+	int rc;
+
+	MyLog(LOGA_DEBUG, "In connect onSuccess callback, context %p", context);
+	opts.onSuccess = test10_onSubscribe;
+	opts.context = c;
+	rc = MQTTAsync_subscribe(c, (c == test10_a) ? test10_topic_a : test10_topic_b, 1, &opts);
+	assert("Good rc from subscribe", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+}
+
+int test10_messageArrived(void* context, char* topicName, int topicLen, MQTTAsync_message* message)
+{
+	MQTTAsync c = (MQTTAsync)context;
+
+	if (c == test10_b)
+		test10_b_arrived++;
+	else if (test10_accept_all)
+	{
+		if (test10_received_count < sizeof(test10_received))
+			test10_received[test10_received_count++] = ((char*)message->payload)[0];
+	}
+	else if (((char*)message->payload)[0] == '1')
+		#if defined(_WIN32)
+			Sleep(500); /* so that the messages behind it wait in the client's queue, and persistence */
+		#else
+			usleep(500000L); /* so that the messages behind it wait in the client's queue, and persistence */
+		#endif
+	else
+	{
+		test10_rejections++;
+		return 0; /* not accepted: offered again later */
+	}
+	MQTTAsync_freeMessage(&message);
+	MQTTAsync_free(topicName);
+	return 1;
+}
+
+int test10_connect(MQTTAsync c, int cleansession)
+{
+	MQTTAsync_connectOptions opts = MQTTAsync_connectOptions_initializer;
+
+	opts.keepAliveInterval = 20;
+	opts.cleansession = cleansession;
+	opts.MQTTVersion = options.MQTTVersion;
+	opts.onSuccess = test10_onConnect;
+	opts.context = c;
+	return MQTTAsync_connect(c, &opts);
+}
+
+int test10(struct Options options)
+{
+	MQTTAsync_init_options inits = MQTTAsync_init_options_initializer;
+	MQTTAsync_disconnectOptions dopts = MQTTAsync_disconnectOptions_initializer;
+	char payload[2] = "1";
+	int rc = 0;
+	int i;
+
+	MyLog(LOGA_INFO, "Starting test 10 - callback threads");
+	fprintf(xml, "<testcase classname=\"test4\" name=\"callback threads\"");
+	global_start_time = start_clock();
+
+	inits.struct_version = 3;
+	inits.callbackThreads = 1;
+	inits.callbackQueueLimit = 1;
+	MQTTAsync_global_init(&inits);
+
+	rc = MQTTAsync_create(&test10_a, options.connection, "async_test10_a", MQTTCLIENT_PERSISTENCE_DEFAULT, NULL);
+	assert("good rc from create", rc == MQTTASYNC_SUCCESS, "rc was %d\n", rc);
+	rc = MQTTAsync_create(&test10_b, options.connection, "async_test10_b", MQTTCLIENT_PERSISTENCE_NONE, NULL);
+	assert("good rc from create", rc == MQTTASYNC_SUCCESS, "rc was %d\n", rc);
+	if (rc != MQTTASYNC_SUCCESS)
+		goto exit;
+	MQTTAsync_setCallbacks(test10_a, test10_a, NULL, test10_messageArrived, NULL);
+	MQTTAsync_setCallbacks(test10_b, test10_b, NULL, test10_messageArrived, NULL);
+
+	rc = test10_connect(test10_a, 1);
+	assert("Good rc from connect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	rc = test10_connect(test10_b, 1);
+	assert("Good rc from connect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	for (i = 0; test10_subscribed < 2 && i < 500; ++i)
+		#if defined(_WIN32)
+			Sleep(100);
+		#else
+			usleep(10000L);
+		#endif
+	assert("Both clients subscribed", test10_subscribed == 2, "subscribed was %d", test10_subscribed);
+	if (test10_subscribed < 2)
+		goto exit;
+
+	/* message 1 is accepted slowly, 2 is refused, 3 and 4 wait behind it */
+	for (i = 0; i < 4; ++i)
+	{
+		payload[0] = '1' + i;
+		rc = MQTTAsync_send(test10_b, test10_topic_a, 1, payload, 1, 0, NULL);
+		assert("Good rc from send", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	}
+	for (i = 0; test10_rejections < 2 && i < 500; ++i)
+		#if defined(_WIN32)
+			Sleep(100);
+		#else
+			usleep(10000L);
+		#endif
+	assert("Refused message offered again", test10_rejections >= 2, "rejections were %d", test10_rejections);
+
+	/* the other client's messages are called back on the same thread in the meantime */
+	for (i = 0; i < 10; ++i)
+		MQTTAsync_send(test10_b, test10_topic_b, 1, "b", 1, 0, NULL);
+	for (i = 0; test10_b_arrived < 10 && i < 300; ++i)
+		#if defined(_WIN32)
+			Sleep(100);
+		#else
+			usleep(10000L);
+		#endif
+	assert("Other client's messages not held up", test10_b_arrived == 10, "arrived was %d", test10_b_arrived);
+
+	/* the refused message and those behind it are still in persistence */
+	MQTTAsync_destroy(&test10_a);
+	test10_accept_all = 1;
+	test10_subscribed = 0;
+	rc = MQTTAsync_create(&test10_a, options.connection, "async_test10_a", MQTTCLIENT_PERSISTENCE_DEFAULT, NULL);
+	assert("good rc from create", rc == MQTTASYNC_SUCCESS, "rc was %d\n", rc);
+	MQTTAsync_setCallbacks(test10_a, test10_a, NULL, test10_messageArrived, NULL);
+	rc = test10_connect(test10_a, 0);
+	assert("Good rc from connect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	for (i = 0; test10_received_count < 3 && i < 500; ++i)
+		#if defined(_WIN32)
+			Sleep(100);
+		#else
+			usleep(10000L);
+		#endif
+	assert("Refused messages restored", test10_received_count == 3, "received %d", test10_received_count);
+	test10_received[test10_received_count] = '\0';
+	assert("Restored in order", strcmp(test10_received, "234") == 0, "received %s", test10_received);
+
+	test_finished = 0;
+	dopts.onSuccess = test1_onDisconnect;
+	dopts.context = test10_a;
+	rc = MQTTAsync_disconnect(test10_a, &dopts);
+	assert("Good rc from disconnect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	while (!test_finished)
+		#if defined(_WIN32)
+			Sleep(100);
+		#else
+			usleep(10000L);
+		#endif
+
+exit:
+	if (test10_a)
+		MQTTAsync_destroy(&test10_a);
+	if (test10_b)
+		MQTTAsync_destroy(&test10_b);
+	MyLog(LOGA_INFO, "TEST10: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", tests, failures);
+	write_test_result();
+	return failures;
+}
+
+
+
+/*********************************************************************
+
+Test11: adaptive inflight window
+
+*********************************************************************/
+
+volatile int test11_connected = 0;
+volatile int test11_completed = 0;
+
+void test11_onConnect(void* context, MQTTAsync_successData* response)
+{
+	MyLog(LOGA_DEBUG, "In connect onSuccess callback, context %p", context);
+	test11_connected = 1;
+}
+
+void test11_deliveryComplete(void* context, MQTTAsync_token token)
+{
+	test11_completed++;
+}
+
+int test11_messageArrived(void* context, char* topicName, int topicLen, MQTTAsync_message* message)
+{
+	MQTTAsync_freeMessage(&message);
+	MQTTAsync_free(topicName);
+	return 1;
+}
+
+int test11(struct Options options)
+{
+	MQTTAsync c;
+	MQTTAsync_connectOptions opts = MQTTAsync_connectOptions_initializer;
+	MQTTAsync_disconnectOptions dopts = MQTTAsync_disconnectOptions_initializer;
+	MQTTAsync_statistics stats = MQTTAsync_statistics_initializer;
+	int msg_count = 1000;
+	int rc = 0;
+	int i;
+
+	MyLog(LOGA_INFO, "Starting test 11 - adaptive inflight window");
+	fprintf(xml, "<testcase classname=\"test4\" name=\"adaptive inflight window\"");
+	global_start_time = start_clock();
+
+	rc = MQTTAsync_create(&c, options.connection, "async_test11", MQTTCLIENT_PERSISTENCE_NONE, NULL);
+	assert("good rc from create", rc == MQTTASYNC_SUCCESS, "rc was %d\n", rc);
+	if (rc != MQTTASYNC_SUCCESS)
+		goto exit;
+	MQTTAsync_setCallbacks(c, c, NULL, test11_messageArrived, test11_deliveryComplete);
+
+	opts.keepAliveInterval = 20;
+	opts.cleansession = 1;
+	opts.MQTTVersion = options.MQTTVersion;
+	opts.maxInflight = 200;
+	opts.adaptiveInflight = 1;
+	opts.onSuccess = test11_onConnect;
+	opts.context = c;
+	rc = MQTTAsync_connect(c, &opts);
+	assert("Good rc from connect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	for (i = 0; !test11_connected && i < 500; ++i)
+		#if defined(_WIN32)
+			Sleep(100);
+		#else
+			usleep(10000L);
+		#endif
+	assert("Connected", test11_connected, "connected was %d", test11_connected);
+	if (!test11_connected)
+		goto exit;
+
+	rc = MQTTAsync_getStatistics(c, &stats);
+	assert("Good rc from getStatistics", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	assert("Window starts at 10", stats.inflightWindow == 10, "window was %d", stats.inflightWindow);
+
+	for (i = 0; i < msg_count; ++i)
+	{
+		rc = MQTTAsync_send(c, "C client test11", 20, "adaptive window data", 1, 0, NULL);
+		assert("Good rc from send", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	}
+	for (i = 0; test11_completed < msg_count && i < 3000; ++i)
+		#if defined(_WIN32)
+			Sleep(100);
+		#else
+			usleep(10000L);
+		#endif
+	assert("All messages completed", test11_completed == msg_count, "completed was %d", test11_completed);
+
+	rc = MQTTAsync_getStatistics(c, &stats);
+	assert("Good rc from getStatistics", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	MyLog(LOGA_INFO, "Inflight window %d, round trip %d ms", stats.inflightWindow, stats.inflightRTT);
+	assert("Window within limits", stats.inflightWindow >= 1 && stats.inflightWindow <= opts.maxInflight,
+			"window was %d", stats.inflightWindow);
+	assert("Window has moved", stats.inflightWindow != 10, "window was %d", stats.inflightWindow);
+
+	test_finished = 0;
+	dopts.onSuccess = test1_onDisconnect;
+	dopts.context = c;
+	rc = MQTTAsync_disconnect(c, &dopts);
+	assert("Good rc from disconnect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	while (!test_finished)
+		#if defined(_WIN32)
+			Sleep(100);
+		#else
+			usleep(10000L);
+		#endif
+	MQTTAsync_destroy(&c);
+
+exit:
+	MyLog(LOGA_INFO, "TEST11: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", tests, failures);
+	write_test_result();
+	return failures;
+}
+
+
+
+/*********************************************************************
+
+Test12: priorities.  Messages buffered while disconnected are sent in
+priority order, and a full buffer drops the oldest of the lowest priority,
+or refuses a new message of a lower priority than all those buffered.
+
+*********************************************************************/
+
+char* test12_topic = "C client test12";
+volatile int test12_connected = 0;
+volatile int test12_subscribed = 0;
+char test12_received[10];
+volatile int test12_received_count = 0;
+
+void test12_onSubscribe(void* context, MQTTAsync_successData* response)
+{
+	MyLog(LOGA_DEBUG, "In subscribe onSuccess callback %p", context);
+	test12_subscribed = 1;
+}
+
+void test12_onConnect(void* context, MQTTAsync_successData* response)
+{
+	MQTTAsync c = (MQTTAsync)context;
+	MQTTAsync_responseOptions opts = MQTTAsync_responseOptions_initializer;
+	int rc;
+
+	MyLog(LOGA_DEBUG, "In connect onSuccess callback, context %p", context);
+	if (test12_connected++ > 0)
+		return; /* the sender */
+	opts.onSuccess = test12_onSubscribe;
+	opts.context = c;
+	rc = MQTTAsync_subscribe(c, test12_topic, 1, &opts);
+	assert("Good rc from subscribe", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+}
+
+int test12_messageArrived(void* context, char* topicName, int topicLen, MQTTAsync_message* message)
+{
+	if (test12_received_count < sizeof(test12_received) - 1)
+		test12_received[test12_received_count++] = ((char*)message->payload)[0];
+	MQTTAsync_freeMessage(&message);
+	MQTTAsync_free(topicName);
+	return 1;
+}
+
+int test12_send(MQTTAsync c, char* payload, int priority)
+{
+	MQTTAsync_responseOptions ropts = MQTTAsync_responseOptions_initializer;
+
+	ropts.priority = priority;
+	return MQTTAsync_send(c, test12_topic, 1, payload, 1, 0, &ropts);
+}
+
+int test12(struct Options options)
+{
+	MQTTAsync receiver = NULL;
+	MQTTAsync sender = NULL;
+	MQTTAsync_createOptions createOpts = MQTTAsync_createOptions_initializer;
+	MQTTAsync_connectOptions opts = MQTTAsync_connectOptions_initializer;
+	int rc = 0;
+	int i;
+
+	MyLog(LOGA_INFO, "Starting test 12 - priorities");
+	fprintf(xml, "<testcase classname=\"test4\" name=\"priorities\"");
+	global_start_time = start_clock();
+
+	rc = MQTTAsync_create(&receiver, options.connection, "async_test12_receiver", MQTTCLIENT_PERSISTENCE_NONE, NULL);
+	assert("good rc from create", rc == MQTTASYNC_SUCCESS, "rc was %d\n", rc);
+	createOpts.sendWhileDisconnected = 1;
+	createOpts.allowDisconnectedSendAtAnyTime = 1;
+	createOpts.deleteOldestMessages = 1;
+	createOpts.maxBufferedMessages = 3;
+	rc = MQTTAsync_createWithOptions(&sender, options.connection, "async_test12_sender", MQTTCLIENT_PERSISTENCE_NONE,
+			NULL, &createOpts);
+	assert("good rc from create", rc == MQTTASYNC_SUCCESS, "rc was %d\n", rc);
+	if (rc != MQTTASYNC_SUCCESS)
+		goto exit;
+	MQTTAsync_setCallbacks(receiver, receiver, NULL, test12_messageArrived, NULL);
+
+	opts.keepAliveInterval = 20;
+	opts.cleansession = 1;
+	opts.MQTTVersion = options.MQTTVersion;
+	opts.onSuccess = test12_onConnect;
+	opts.context = receiver;
+	rc = MQTTAsync_connect(receiver, &opts);
+	assert("Good rc from connect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	for (i = 0; !test12_subscribed && i < 500; ++i)
+		#if defined(_WIN32)
+			Sleep(100);
+		#else
+			usleep(10000L);
+		#endif
+	assert("Receiver subscribed", test12_subscribed, "subscribed was %d", test12_subscribed);
+	if (!test12_subscribed)
+		goto exit;
+
+	/* buffer while disconnected: n and o normal, h high */
+	rc = test12_send(sender, "n", MQTTASYNC_PRIORITY_NORMAL);
+	assert("Good rc from send", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	rc = test12_send(sender, "h", MQTTASYNC_PRIORITY_HIGH);
+	assert("Good rc from send", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	rc = test12_send(sender, "o", MQTTASYNC_PRIORITY_NORMAL);
+	assert("Good rc from send", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	rc = test12_send(sender, "b", MQTTASYNC_PRIORITY_BULK);
+	assert("Bulk message refused when the buffer is full of higher ones", rc == MQTTASYNC_MAX_BUFFERED_MESSAGES,
+			"rc was %d", rc);
+	rc = test12_send(sender, "i", MQTTASYNC_PRIORITY_HIGH);
+	assert("Good rc from send", rc == MQTTASYNC_SUCCESS, "rc was %d", rc); /* drops n */
+	rc = test12_send(sender, "c", MQTTASYNC_PRIORITY_CONTROL);
+	assert("Good rc from send", rc == MQTTASYNC_SUCCESS, "rc was %d", rc); /* drops o */
+
+	opts.context = sender;
+	rc = MQTTAsync_connect(sender, &opts);
+	assert("Good rc from connect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	for (i = 0; test12_received_count < 3 && i < 500; ++i)
+		#if defined(_WIN32)
+			Sleep(100);
+		#else
+			usleep(10000L);
+		#endif
+	#if defined(_WIN32)
+		Sleep(100);
+	#else
+		usleep(100000L); /* in case of any more */
+	#endif
+	test12_received[test12_received_count] = '\0';
+	assert("Sent in priority order, lowest dropped", strcmp(test12_received, "chi") == 0,
+			"received %s", test12_received);
+
+exit:
+	if (sender)
+		MQTTAsync_destroy(&sender);
+	if (receiver)
+		MQTTAsync_destroy(&receiver);
+	MyLog(LOGA_INFO, "TEST12: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", tests, failures);
+	write_test_result();
+	return failures;
+}
+
+
+/*********************************************************************
+
+Test13: consumer group.  MQTT V5 members subscribe to the shared
+subscription, and are read on a reactor each.
+
+*********************************************************************/
+
+#define TEST13_MEMBERS 4
+#define TEST13_MESSAGES 40
+
+char* test13_topic = "C client test13";
+MQTTAsync test13_publisher = NULL;
+MQTTAsyncGroup test13_group = NULL;
+volatile int test13_started = 0;
+volatile int test13_publisher_connected = 0;
+volatile int test13_arrived = 0;
+unsigned long test13_threads[TEST13_MESSAGES];
+
+void test13_onStart(void* context, MQTTAsync_successData5* response)
+{
+	MyLog(LOGA_DEBUG, "In group start onSuccess callback %p", context);
+	test13_started = 1;
+}
+
+void test13_onStartFailure(void* context, MQTTAsync_failureData5* response)
+{
+	MyLog(LOGA_DEBUG, "In group start onFailure callback %p, code %d", context, response->code);
+	test13_started = -1;
+}
+
+void test13_onConnect(void* context, MQTTAsync_successData* response)
+{
+	MyLog(LOGA_DEBUG, "In connect onSuccess callback, context %p", context);
+	test13_publisher_connected = 1;
+}
+
+void test13_onStop(void* context, MQTTAsync_successData* response)
+{
+	MyLog(LOGA_DEBUG, "In group stop onSuccess callback %p", context);
+	test_finished = 1;
+}
+
+int test13_messageArrived(void* context, char* topicName, int topicLen, MQTTAsync_message* message)
+{
+	int n = atoi((char*)message->payload);
+
+	/* each message has its own slot, so no lock is needed */
+	if (n >= 0 && n < TEST13_MESSAGES)
+	{
+		#if defined(_WIN32)
+			test13_threads[n] = (unsigned long)GetCurrentThreadId();
+		#else
+			test13_threads[n] = (unsigned long)pthread_self();
+		#endif
+	}
+	test13_arrived++;
+	MQTTAsync_freeMessage(&message);
+	MQTTAsync_free(topicName);
+	return 1;
+}
+
+int test13(struct Options options)
+{
+	MQTTAsync_init_options inits = MQTTAsync_init_options_initializer;
+	MQTTAsync_createOptions createOpts = MQTTAsync_createOptions_initializer5;
+	MQTTAsyncGroup_options gopts = MQTTAsyncGroup_options_initializer;
+	MQTTAsyncGroup_statistics stats = MQTTAsyncGroup_statistics_initializer;
+	MQTTAsync_connectOptions opts = MQTTAsync_connectOptions_initializer;
+	MQTTAsync_connectOptions gconn = MQTTAsync_connectOptions_initializer5;
+	MQTTAsync_disconnectOptions dopts = MQTTAsync_disconnectOptions_initializer;
+	unsigned long threads[TEST13_MEMBERS];
+	int thread_count = 0;
+	int rc = 0;
+	int i, j;
+
+	MyLog(LOGA_INFO, "Starting test 13 - consumer group");
+	fprintf(xml, "<testcase classname=\"test4\" name=\"group\"");
+	global_start_time = start_clock();
+
+	inits.struct_version = 2;
+	inits.reactorThreads = TEST13_MEMBERS;
+	MQTTAsync_global_init(&inits);
+
+	rc = MQTTAsync_create(&test13_publisher, options.connection, "async_test13_publisher", MQTTCLIENT_PERSISTENCE_NONE, NULL);
+	assert("good rc from create", rc == MQTTASYNC_SUCCESS, "rc was %d\n", rc);
+	gopts.members = TEST13_MEMBERS;
+	gopts.qos = 1;
+	gopts.createOptions = &createOpts;
+	rc = MQTTAsyncGroup_create(&test13_group, options.connection, "async_test13", test13_topic,
+			MQTTCLIENT_PERSISTENCE_NONE, NULL, &gopts);
+	assert("good rc from group create", rc == MQTTASYNC_SUCCESS, "rc was %d\n", rc);
+	if (rc != MQTTASYNC_SUCCESS)
+		goto exit;
+	rc = MQTTAsyncGroup_setCallbacks(test13_group, NULL, NULL, test13_messageArrived);
+	assert("Good rc from setCallbacks", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+
+	gconn.keepAliveInterval = 20;
+	gconn.cleanstart = 1;
+	gconn.onSuccess5 = test13_onStart;
+	gconn.onFailure5 = test13_onStartFailure;
+	rc = MQTTAsyncGroup_start(test13_group, &gconn);
+	assert("Good rc from group start", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	opts.keepAliveInterval = 20;
+	opts.cleansession = 1;
+	opts.MQTTVersion = options.MQTTVersion;
+	opts.onSuccess = test13_onConnect;
+	rc = MQTTAsync_connect(test13_publisher, &opts);
+	assert("Good rc from connect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	for (i = 0; (test13_started == 0 || !test13_publisher_connected) && i < 500; ++i)
+		#if defined(_WIN32)
+			Sleep(100);
+		#else
+			usleep(10000L);
+		#endif
+	assert("All the members subscribed", test13_started == 1, "started was %d", test13_started);
+	if (test13_started != 1 || !test13_publisher_connected)
+		goto exit;
+
+	for (i = 0; i < TEST13_MESSAGES; ++i)
+	{
+		char payload[10];
+
+		sprintf(payload, "%d", i);
+		rc = MQTTAsync_send(test13_publisher, test13_topic, (int)strlen(payload) + 1, payload, 1, 0, NULL);
+		assert("Good rc from send", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	}
+	for (i = 0; test13_arrived < TEST13_MESSAGES && i < 500; ++i)
+		#if defined(_WIN32)
+			Sleep(100);
+		#else
+			usleep(10000L);
+		#endif
+	assert("All messages arrived", test13_arrived == TEST13_MESSAGES, "arrived was %d", test13_arrived);
+
+	rc = MQTTAsyncGroup_getStatistics(test13_group, &stats);
+	assert("Good rc from getStatistics", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	assert("Messages shared by all the members", stats.minMemberMessages > 0,
+			"fewest messages on a member %ld", stats.minMemberMessages);
+	for (i = 0; i < TEST13_MESSAGES; ++i)
+	{
+		for (j = 0; j < thread_count && threads[j] != test13_threads[i]; ++j)
+			;
+		if (j == thread_count && thread_count < TEST13_MEMBERS)
+			threads[thread_count++] = test13_threads[i];
+	}
+	assert("Members read on a reactor each", thread_count == TEST13_MEMBERS, "threads were %d", thread_count);
+
+	test_finished = 0;
+	dopts.onSuccess = test13_onStop;
+	rc = MQTTAsyncGroup_stop(test13_group, &dopts);
+	assert("Good rc from group stop", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	for (i = 0; !test_finished && i < 500; ++i)
+		#if defined(_WIN32)
+			Sleep(100);
+		#else
+			usleep(10000L);
+		#endif
+	assert("Group stopped", test_finished, "finished was %d", test_finished);
+
+exit:
+	if (test13_group)
+		MQTTAsyncGroup_destroy(&test13_group);
+	if (test13_publisher)
+		MQTTAsync_destroy(&test13_publisher);
+	inits.reactorThreads = 1;
+	MQTTAsync_global_init(&inits);
+	MyLog(LOGA_INFO, "TEST13: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", tests, failures);
+	write_test_result();
+	return failures;
+}
+
+
+/*********************************************************************
+
+Test14: inbound limit.  While messageArrived refuses messages, the
+client stops reading once maxInboundMessages are queued, so that the
+publisher is held back, and then delivers them all in order.
+
+*********************************************************************/
+
+#define TEST14_MESSAGES 200
+#define TEST14_PAYLOAD 100000
+
+char* test14_topic = "C client test14";
+volatile int test14_connected = 0;
+volatile int test14_accept = 0;
+volatile int test14_arrived = 0;
+volatile int test14_out_of_order = 0;
+volatile int test14_completed = 0;
+
+void test14_onSubscribe(void* context, MQTTAsync_successData* response)
+{
+	MyLog(LOGA_DEBUG, "In subscribe onSuccess callback %p", context);
+	test14_connected++;
+}
+
+void test14_onConnect(void* context, MQTTAsync_successData* response)
+{
+	MQTTAsync c = (MQTTAsync)context;
+	MQTTAsync_responseOptions opts = MQTTAsync_responseOptions_initializer;
+	int rc;
+
+	MyLog(LOGA_DEBUG, "In connect onSuccess callback, context %p", context);
+	opts.onSuccess = test14_onSubscribe;
+	opts.context = c;
+	rc = MQTTAsync_subscribe(c, test14_topic, 1, &opts);
+	assert("Good rc from subscribe", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+}
+
+void test14_onPublisherConnect(void* context, MQTTAsync_successData* response)
+{
+	MyLog(LOGA_DEBUG, "In connect onSuccess callback, context %p", context);
+	test14_connected++;
+}
+
+void test14_deliveryComplete(void* context, MQTTAsync_token token)
+{
+	test14_completed++;
+}
+
+int test14_messageArrived(void* context, char* topicName, int topicLen, MQTTAsync_message* message)
+{
+	if (!test14_accept)
+		return 0; /* stays at the head of the queue */
+	if (atoi((char*)message->payload) != test14_arrived)
+		test14_out_of_order++;
+	test14_arrived++;
+	MQTTAsync_freeMessage(&message);
+	MQTTAsync_free(topicName);
+	return 1;
+}
+
+int test14(struct Options options)
+{
+	MQTTAsync receiver = NULL;
+	MQTTAsync publisher = NULL;
+	MQTTAsync_createOptions createOpts = MQTTAsync_createOptions_initializer;
+	MQTTAsync_connectOptions opts = MQTTAsync_connectOptions_initializer;
+	char* payload = NULL;
+	int rc = 0;
+	int i;
+
+	MyLog(LOGA_INFO, "Starting test 14 - inbound limit");
+	fprintf(xml, "<testcase classname=\"test4\" name=\"inbound-limit\"");
+	global_start_time = start_clock();
+
+	createOpts.maxInboundMessages = 5;
+	rc = MQTTAsync_createWithOptions(&receiver, options.connection, "async_test14_receiver", MQTTCLIENT_PERSISTENCE_NONE,
+			NULL, &createOpts);
+	assert("good rc from create", rc == MQTTASYNC_SUCCESS, "rc was %d\n", rc);
+	rc = MQTTAsync_create(&publisher, options.connection, "async_test14_publisher", MQTTCLIENT_PERSISTENCE_NONE, NULL);
+	assert("good rc from create", rc == MQTTASYNC_SUCCESS, "rc was %d\n", rc);
+	if (rc != MQTTASYNC_SUCCESS || (payload = malloc(TEST14_PAYLOAD)) == NULL)
+		goto exit;
+	MQTTAsync_setCallbacks(receiver, receiver, NULL, test14_messageArrived, NULL);
+	MQTTAsync_setCallbacks(publisher, publisher, NULL, test11_messageArrived, test14_deliveryComplete);
+
+	opts.keepAliveInterval = 20;
+	opts.cleansession = 1;
+	opts.MQTTVersion = options.MQTTVersion;
+	opts.onSuccess = test14_onConnect;
+	opts.context = receiver;
+	rc = MQTTAsync_connect(receiver, &opts);
+	assert("Good rc from connect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	opts.onSuccess = test14_onPublisherConnect;
+	opts.context = publisher;
+	rc = MQTTAsync_connect(publisher, &opts);
+	assert("Good rc from connect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	for (i = 0; test14_connected < 2 && i < 500; ++i)
+		#if defined(_WIN32)
+			Sleep(100);
+		#else
+			usleep(10000L);
+		#endif
+	assert("Both clients ready", test14_connected == 2, "connected was %d", test14_connected);
+	if (test14_connected < 2)
+		goto exit;
+
+	memset(payload, ' ', TEST14_PAYLOAD);
+	for (i = 0; i < TEST14_MESSAGES; ++i)
+	{
+		sprintf(payload, "%d", i);
+		rc = MQTTAsync_send(publisher, test14_topic, TEST14_PAYLOAD, payload, 1, 0, NULL);
+		assert("Good rc from send", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	}
+	#if defined(_WIN32)
+		Sleep(2000);
+	#else
+		usleep(2000000L); /* long enough for them all to have been sent, if nothing held them back */
+	#endif
+	assert("Publisher held back while the receiver is full", test14_completed < TEST14_MESSAGES,
+			"completed was %d", test14_completed);
+
+	test14_accept = 1;
+	for (i = 0; (test14_arrived < TEST14_MESSAGES || test14_completed < TEST14_MESSAGES) && i < 3000; ++i)
+		#if defined(_WIN32)
+			Sleep(100);
+		#else
+			usleep(10000L);
+		#endif
+	assert("All messages arrived", test14_arrived == TEST14_MESSAGES, "arrived was %d", test14_arrived);
+	assert("Messages arrived in order", test14_out_of_order == 0, "out of order were %d", test14_out_of_order);
+	assert("All messages completed", test14_completed == TEST14_MESSAGES, "completed was %d", test14_completed);
+
+exit:
+	if (publisher)
+		MQTTAsync_destroy(&publisher);
+	if (receiver)
+		MQTTAsync_destroy(&receiver);
+	if (payload)
+		free(payload);
+	MyLog(LOGA_INFO, "TEST14: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", tests, failures);
+	write_test_result();
+	return failures;
+}
+
+
+/*********************************************************************
+
+Test15: publish pacing.  With publishRate set, a burst of messages is
+sent no faster than the rate allows, after the first publishBurst.
+
+*********************************************************************/
+
+#define TEST15_MESSAGES 45
+
+char* test15_topic = "C client test15";
+volatile int test15_subscribed = 0;
+volatile int test15_arrived = 0;
+
+void test15_onSubscribe(void* context, MQTTAsync_successData* response)
+{
+	MyLog(LOGA_DEBUG, "In subscribe onSuccess callback %p", context);
+	test15_subscribed = 1;
+}
+
+void test15_onConnect(void* context, MQTTAsync_successData* response)
+{
+	MQTTAsync c = (MQTTAsync)context;
+	MQTTAsync_responseOptions opts = MQTTAsync_responseOptions_initializer;
+	int rc;
+
+	MyLog(LOGA_DEBUG, "In connect onSuccess callback, context %p", context);
+	opts.onSuccess = test15_onSubscribe;
+	opts.context = c;
+	rc = MQTTAsync_subscribe(c, test15_topic, 1, &opts);
+	assert("Good rc from subscribe", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+}
+
+int test15_messageArrived(void* context, char* topicName, int topicLen, MQTTAsync_message* message)
+{
+	test15_arrived++;
+	MQTTAsync_freeMessage(&message);
+	MQTTAsync_free(topicName);
+	return 1;
+}
+
+int test15(struct Options options)
+{
+	MQTTAsync c = NULL;
+	MQTTAsync_createOptions createOpts = MQTTAsync_createOptions_initializer;
+	MQTTAsync_connectOptions opts = MQTTAsync_connectOptions_initializer;
+	START_TIME_TYPE start;
+	long duration = 0;
+	int rc = 0;
+	int i;
+
+	MyLog(LOGA_INFO, "Starting test 15 - publish pacing");
+	fprintf(xml, "<testcase classname=\"test4\" name=\"publish-pacing\"");
+	global_start_time = start_clock();
+
+	createOpts.publishRate = 20;
+	createOpts.publishBurst = 5;
+	rc = MQTTAsync_createWithOptions(&c, options.connection, "async_test15", MQTTCLIENT_PERSISTENCE_NONE,
+			NULL, &createOpts);
+	assert("good rc from create", rc == MQTTASYNC_SUCCESS, "rc was %d\n", rc);
+	if (rc != MQTTASYNC_SUCCESS)
+		goto exit;
+	MQTTAsync_setCallbacks(c, c, NULL, test15_messageArrived, NULL);
+
+	opts.keepAliveInterval = 20;
+	opts.cleansession = 1;
+	opts.MQTTVersion = options.MQTTVersion;
+	opts.onSuccess = test15_onConnect;
+	opts.context = c;
+	rc = MQTTAsync_connect(c, &opts);
+	assert("Good rc from connect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	for (i = 0; !test15_subscribed && i < 500; ++i)
+		#if defined(_WIN32)
+			Sleep(100);
+		#else
+			usleep(10000L);
+		#endif
+	assert("Subscribed", test15_subscribed, "subscribed was %d", test15_subscribed);
+	if (!test15_subscribed)
+		goto exit;
+
+	start = start_clock();
+	for (i = 0; i < TEST15_MESSAGES; ++i)
+	{
+		rc = MQTTAsync_send(c, test15_topic, 11, "test15 data", 1, 0, NULL);
+		assert("Good rc from send", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	}
+	for (i = 0; test15_arrived < TEST15_MESSAGES && i < 1000; ++i)
+		#if defined(_WIN32)
+			Sleep(100);
+		#else
+			usleep(10000L);
+		#endif
+	duration = elapsed(start);
+	assert("All messages arrived", test15_arrived == TEST15_MESSAGES, "arrived was %d", test15_arrived);
+	/* the burst of 5 at once, then 40 at 20 a second */
+	assert("Messages paced to the rate", duration >= 1800L, "duration was %ld ms", duration);
+	assert("Messages not held back beyond the rate", duration < 5000L, "duration was %ld ms", duration);
+
+exit:
+	if (c)
+		MQTTAsync_destroy(&c);
+	MyLog(LOGA_INFO, "TEST15: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", tests, failures);
+	write_test_result();
+	return failures;
+}
+
+
+/*********************************************************************
+
+Test16: striped publisher.  The messages on each topic are sent on one
+stripe, in order, the topics are spread over the stripes, and the
+tokens passed to deliveryComplete are those returned by send.
+
+*********************************************************************/
+
+#define TEST16_TOPICS 8
+#define TEST16_MESSAGES 10
+
+char* test16_topic = "C client test16";
+MQTTAsync_token test16_tokens[TEST16_TOPICS * TEST16_MESSAGES];
+volatile int test16_connected = 0;
+volatile int test16_subscribed = 0;
+volatile int test16_completed = 0;
+volatile int test16_unknown_tokens = 0;
+volatile int test16_arrived = 0;
+volatile int test16_out_of_order = 0;
+int test16_next[TEST16_TOPICS];
+
+void test16_onSubscribe(void* context, MQTTAsync_successData* response)
+{
+	MyLog(LOGA_DEBUG, "In subscribe onSuccess callback %p", context);
+	test16_subscribed = 1;
+}
+
+void test16_onConnect(void* context, MQTTAsync_successData* response)
+{
+	MQTTAsync c = (MQTTAsync)context;
+	MQTTAsync_responseOptions opts = MQTTAsync_responseOptions_initializer;
+	char filter[30];
+	int rc;
+
+	MyLog(LOGA_DEBUG, "In connect onSuccess callback, context %p", context);
+	sprintf(filter, "%s/#", test16_topic);
+	opts.onSuccess = test16_onSubscribe;
+	opts.context = c;
+	rc = MQTTAsync_subscribe(c, filter, 1, &opts);
+	assert("Good rc from subscribe", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+}
+
+void test16_onStripeConnect(void* context, MQTTAsync_successData* response)
+{
+	MyLog(LOGA_DEBUG, "In striped connect onSuccess callback, context %p", context);
+	test16_connected++;
+}
+
+void test16_onStripeDisconnect(void* context, MQTTAsync_successData* response)
+{
+	MyLog(LOGA_DEBUG, "In striped disconnect onSuccess callback, context %p", context);
+	test_finished++;
+}
+
+void test16_deliveryComplete(void* context, MQTTAsync_token token)
+{
+	int i;
+
+	for (i = 0; i < TEST16_TOPICS * TEST16_MESSAGES && test16_tokens[i] != token; ++i)
+		;
+	if (i == TEST16_TOPICS * TEST16_MESSAGES)
+		test16_unknown_tokens++;
+	test16_completed++;
+}
+
+int test16_messageArrived(void* context, char* topicName, int topicLen, MQTTAsync_message* message)
+{
+	int topic = atoi(&topicName[strlen(test16_topic) + 1]);
+
+	/* the receiver's callbacks are all called on one thread, so no lock is needed */
+	if (topic < 0 || topic >= TEST16_TOPICS || atoi((char*)message->payload) != test16_next[topic]++)
+		test16_out_of_order++;
+	test16_arrived++;
+	MQTTAsync_freeMessage(&message);
+	MQTTAsync_free(topicName);
+	return 1;
+}
+
+int test16(struct Options options)
+{
+	MQTTAsync receiver = NULL;
+	MQTTAsyncStripe striped = NULL;
+	MQTTAsyncStripe_options sopts = MQTTAsyncStripe_options_initializer;
+	MQTTAsync_connectOptions opts = MQTTAsync_connectOptions_initializer;
+	MQTTAsync_disconnectOptions dopts = MQTTAsync_disconnectOptions_initializer;
+	MQTTAsync clients[TEST16_TOPICS];
+	int client_count = 0;
+	int rc = 0;
+	int i, j;
+
+	MyLog(LOGA_INFO, "Starting test 16 - striped publisher");
+	fprintf(xml, "<testcase classname=\"test4\" name=\"striped-publisher\"");
+	global_start_time = start_clock();
+
+	rc = MQTTAsync_create(&receiver, options.connection, "async_test16_receiver", MQTTCLIENT_PERSISTENCE_NONE, NULL);
+	assert("good rc from create", rc == MQTTASYNC_SUCCESS, "rc was %d\n", rc);
+	sopts.stripes = 4;
+	rc = MQTTAsyncStripe_create(&striped, options.connection, "async_test16", MQTTCLIENT_PERSISTENCE_NONE, NULL, &sopts);
+	assert("good rc from striped create", rc == MQTTASYNC_SUCCESS, "rc was %d\n", rc);
+	if (rc != MQTTASYNC_SUCCESS)
+		goto exit;
+	MQTTAsync_setCallbacks(receiver, receiver, NULL, test16_messageArrived, NULL);
+	rc = MQTTAsyncStripe_setCallbacks(striped, NULL, NULL, NULL, test16_deliveryComplete);
+	assert("Good rc from striped setCallbacks, with no messageArrived", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+
+	opts.keepAliveInterval = 20;
+	opts.cleansession = 1;
+	opts.MQTTVersion = options.MQTTVersion;
+	opts.onSuccess = test16_onConnect;
+	opts.context = receiver;
+	rc = MQTTAsync_connect(receiver, &opts);
+	assert("Good rc from connect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	opts.onSuccess = test16_onStripeConnect;
+	opts.context = NULL;
+	rc = MQTTAsyncStripe_connect(striped, &opts);
+	assert("Good rc from striped connect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	for (i = 0; (!test16_subscribed || !test16_connected) && i < 500; ++i)
+		#if defined(_WIN32)
+			Sleep(100);
+		#else
+			usleep(10000L);
+		#endif
+	assert("Receiver subscribed", test16_subscribed, "subscribed was %d", test16_subscribed);
+	assert("Stripes connected", test16_connected == 1, "connected was %d", test16_connected);
+	assert("All stripes connected", MQTTAsyncStripe_isConnected(striped), "connected was %d", 0);
+	if (!test16_subscribed || !test16_connected)
+		goto exit;
+
+	for (i = 0; i < TEST16_TOPICS; ++i)
+	{
+		char topic[30];
+
+		sprintf(topic, "%s/%d", test16_topic, i);
+		for (j = 0; j < client_count && clients[j] != MQTTAsyncStripe_getClient(striped, topic); ++j)
+			;
+		if (j == client_count)
+			clients[client_count++] = MQTTAsyncStripe_getClient(striped, topic);
+	}
+	assert("Topics spread over the stripes", client_count > 1, "stripes used were %d", client_count);
+
+	for (j = 0; j < TEST16_MESSAGES; ++j)
+	{
+		for (i = 0; i < TEST16_TOPICS; ++i)
+		{
+			MQTTAsync_responseOptions ropts = MQTTAsync_responseOptions_initializer;
+			char topic[30];
+			char payload[10];
+
+			sprintf(topic, "%s/%d", test16_topic, i);
+			sprintf(payload, "%d", j);
+			rc = MQTTAsyncStripe_send(striped, topic, (int)strlen(payload) + 1, payload, 1, 0, &ropts);
+			assert("Good rc from striped send", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+			test16_tokens[j * TEST16_TOPICS + i] = ropts.token;
+		}
+	}
+	rc = MQTTAsyncStripe_waitForCompletion(striped, test16_tokens[TEST16_TOPICS * TEST16_MESSAGES - 1], 5000L);
+	assert("Good rc from waitForCompletion", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	for (i = 0; (test16_arrived < TEST16_TOPICS * TEST16_MESSAGES ||
+			test16_completed < TEST16_TOPICS * TEST16_MESSAGES) && i < 500; ++i)
+		#if defined(_WIN32)
+			Sleep(100);
+		#else
+			usleep(10000L);
+		#endif
+	assert("All messages arrived", test16_arrived == TEST16_TOPICS * TEST16_MESSAGES, "arrived was %d", test16_arrived);
+	assert("Messages arrived in order on each topic", test16_out_of_order == 0, "out of order were %d", test16_out_of_order);
+	assert("All messages completed", test16_completed == TEST16_TOPICS * TEST16_MESSAGES, "completed was %d", test16_completed);
+	assert("Completed with the tokens returned", test16_unknown_tokens == 0, "unknown tokens were %d", test16_unknown_tokens);
+
+	test_finished = 0;
+	dopts.onSuccess = test16_onStripeDisconnect;
+	rc = MQTTAsyncStripe_disconnect(striped, &dopts);
+	assert("Good rc from striped disconnect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	for (i = 0; !test_finished && i < 500; ++i)
+		#if defined(_WIN32)
+			Sleep(100);
+		#else
+			usleep(10000L);
+		#endif
+	#if defined(_WIN32)
+		Sleep(100);
+	#else
+		usleep(100000L); /* in case it is called more than once */
+	#endif
+	assert("Disconnect completed once", test_finished == 1, "finished was %d", test_finished);
+
+exit:
+	if (striped)
+		MQTTAsyncStripe_destroy(&striped);
+	if (receiver)
+		MQTTAsync_destroy(&receiver);
+	MyLog(LOGA_INFO, "TEST16: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", tests, failures);
+	write_test_result();
+	return failures;
+}
+
+
+/*********************************************************************
+
+Test17: prepared publications.  Messages sent with a prepared topic and
+qos arrive as if sent with MQTTAsync_send, including those still being
+sent when the prepared publication is freed.
+
+*********************************************************************/
+
+#define TEST17_MESSAGES 50
+
+char* test17_topic = "C client test17";
+volatile int test17_subscribed = 0;
+volatile int test17_arrived = 0;
+volatile int test17_wrong = 0;
+volatile int test17_completed = 0;
+
+void test17_onSubscribe(void* context, MQTTAsync_successData* response)
+{
+	MyLog(LOGA_DEBUG, "In subscribe onSuccess callback %p", context);
+	test17_subscribed = 1;
+}
+
+void test17_onConnect(void* context, MQTTAsync_successData* response)
+{
+	MQTTAsync c = (MQTTAsync)context;
+	MQTTAsync_responseOptions opts = MQTTAsync_responseOptions_initializer;
+	int rc;
+
+	MyLog(LOGA_DEBUG, "In connect onSuccess callback, context %p", context);
+	opts.onSuccess = test17_onSubscribe;
+	opts.context = c;
+	rc = MQTTAsync_subscribe(c, test17_topic, 1, &opts);
+	assert("Good rc from subscribe", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+}
+
+void test17_onPublish(void* context, MQTTAsync_successData* response)
+{
+	test17_completed++;
+}
+
+int test17_messageArrived(void* context, char* topicName, int topicLen, MQTTAsync_message* message)
+{
+	if (strcmp(topicName, test17_topic) != 0 || message->qos != 1 || message->retained != 0 ||
+			atoi((char*)message->payload) != test17_arrived)
+		test17_wrong++;
+	test17_arrived++;
+	MQTTAsync_freeMessage(&message);
+	MQTTAsync_free(topicName);
+	return 1;
+}
+
+int test17(struct Options options)
+{
+	MQTTAsync c = NULL;
+	MQTTAsync d = NULL;
+	MQTTAsync_prepared prepared = NULL;
+	MQTTAsync_prepared bad = NULL;
+	MQTTAsync_connectOptions opts = MQTTAsync_connectOptions_initializer;
+	MQTTProperties props = MQTTProperties_initializer;
+	MQTTProperty property;
+	int rc = 0;
+	int i;
+
+	MyLog(LOGA_INFO, "Starting test 17 - prepared publications");
+	fprintf(xml, "<testcase classname=\"test4\" name=\"prepared-publications\"");
+	global_start_time = start_clock();
+
+	rc = MQTTAsync_create(&c, options.connection, "async_test17", MQTTCLIENT_PERSISTENCE_NONE, NULL);
+	assert("good rc from create", rc == MQTTASYNC_SUCCESS, "rc was %d\n", rc);
+	if (rc != MQTTASYNC_SUCCESS)
+		goto exit;
+	MQTTAsync_setCallbacks(c, c, NULL, test17_messageArrived, NULL);
+
+	rc = MQTTAsync_preparePublish(c, test17_topic, 3, 0, NULL, &bad);
+	assert("Bad qos refused", rc == MQTTASYNC_BAD_QOS, "rc was %d", rc);
+	property.identifier = MQTTPROPERTY_CODE_MESSAGE_EXPIRY_INTERVAL;
+	property.value.integer4 = 60;
+	MQTTProperties_add(&props, &property);
+	rc = MQTTAsync_preparePublish(c, test17_topic, 1, 0, &props, &bad);
+	assert("Properties refused for an MQTT 3 client", rc == MQTTASYNC_BAD_MQTT_OPTION, "rc was %d", rc);
+	MQTTProperties_free(&props);
+	assert("Nothing prepared on error", bad == NULL, "prepared was %p", bad);
+	rc = MQTTAsync_preparePublish(c, test17_topic, 1, 0, NULL, &prepared);
+	assert("Good rc from preparePublish", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	if (rc != MQTTASYNC_SUCCESS)
+		goto exit;
+
+	rc = MQTTAsync_create(&d, options.connection, "async_test17_other", MQTTCLIENT_PERSISTENCE_NONE, NULL);
+	assert("good rc from create", rc == MQTTASYNC_SUCCESS, "rc was %d\n", rc);
+	if (rc != MQTTASYNC_SUCCESS)
+		goto exit;
+	rc = MQTTAsync_sendPrepared(d, prepared, 4, "bad", NULL);
+	assert("Publication prepared for another client refused", rc == MQTTASYNC_FAILURE, "rc was %d", rc);
+
+	opts.keepAliveInterval = 20;
+	opts.cleansession = 1;
+	opts.MQTTVersion = options.MQTTVersion;
+	opts.onSuccess = test17_onConnect;
+	opts.context = c;
+	rc = MQTTAsync_connect(c, &opts);
+	assert("Good rc from connect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	for (i = 0; !test17_subscribed && i < 500; ++i)
+		#if defined(_WIN32)
+			Sleep(100);
+		#else
+			usleep(10000L);
+		#endif
+	assert("Subscribed", test17_subscribed, "subscribed was %d", test17_subscribed);
+	if (!test17_subscribed)
+		goto exit;
+
+	for (i = 0; i < TEST17_MESSAGES; ++i)
+	{
+		MQTTAsync_responseOptions ropts = MQTTAsync_responseOptions_initializer;
+		char payload[10];
+
+		sprintf(payload, "%d", i);
+		ropts.onSuccess = test17_onPublish;
+		ropts.context = c;
+		rc = MQTTAsync_sendPrepared(c, prepared, (int)strlen(payload) + 1, payload, &ropts);
+		assert("Good rc from sendPrepared", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	}
+	MQTTAsync_freePrepared(&prepared); /* while the messages are still being sent */
+	assert("Prepared handle cleared", prepared == NULL, "prepared was %p", prepared);
+
+	for (i = 0; (test17_arrived < TEST17_MESSAGES || test17_completed < TEST17_MESSAGES) && i < 500; ++i)
+		#if defined(_WIN32)
+			Sleep(100);
+		#else
+			usleep(10000L);
+		#endif
+	assert("All messages arrived", test17_arrived == TEST17_MESSAGES, "arrived was %d", test17_arrived);
+	assert("Messages arrived with the prepared topic and qos, in order", test17_wrong == 0,
+			"wrong were %d", test17_wrong);
+	assert("All messages completed", test17_completed == TEST17_MESSAGES, "completed was %d", test17_completed);
+
+exit:
+	if (prepared)
+		MQTTAsync_freePrepared(&prepared);
+	if (d)
+		MQTTAsync_destroy(&d);
+	if (c)
+		MQTTAsync_destroy(&c);
+	MyLog(LOGA_INFO, "TEST17: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", tests, failures);
+	write_test_result();
+	return failures;
+}
+
+
+
+/*********************************************************************
+
+Test18: a client disconnected while its messageArrived callback is
+calling the API of a client on another reactor, which is busy.  The
+disconnect waits for the callback to return, so that the message being
+delivered is not freed under it.
+
+*********************************************************************/
+
+char* test18_topic = "C client test18";
+char* test18_echo_topic = "C client test18 echo";
+MQTTAsync test18_a = NULL;
+MQTTAsync test18_b = NULL;
+MQTTAsync test18_c = NULL;
+volatile int test18_subscribed = 0;
+volatile int test18_arrived = 0;
+volatile int test18_b_busy = 0;
+volatile int test18_calling = 0;
+volatile int test18_returned = 0;
+volatile int test18_connected_on_return = -1;
+volatile int test18_disconnected = 0;
+
+void test18_onSubscribe(void* context, MQTTAsync_successData* response)
+{
+	MyLog(LOGA_DEBUG, "In subscribe onSuccess callback %p", context);
+	test18_subscribed++;
+}
+
+void test18_onConnect(void* context, MQTTAsync_successData* response)
+{
+	MQTTAsync c = (MQTTAsync)context;
+	MQTTAsync_responseOptions opts = MQTTAsync_responseOptions_initializer;
+	int rc;
+
+	MyLog(LOGA_DEBUG, "In connect onSuccess callback, context %p", context);
+	if (c == test18_c)
+		return;
+	opts.onSuccess = test18_onSubscribe;
+	opts.context = c;
+	rc = MQTTAsync_subscribe(c, (c == test18_a) ? test18_topic : test18_echo_topic, 2, &opts);
+	assert("Good rc from subscribe", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+}
+
+void test18_onDisconnect(void* context, MQTTAsync_successData* response)
+{
+	MyLog(LOGA_DEBUG, "In disconnect onSuccess callback %p", context);
+	test18_disconnected = 1;
+}
+
+int test18_messageArrived(void* context, char* topicName, int topicLen, MQTTAsync_message* message)
+{
+	MQTTAsync c = (MQTTAsync)context;
+
+	if (c == test18_a)
+	{
+		/* runs on a's reactor, and waits for b's while a is disconnected */
+		int calling = test18_b_busy;
+
+		test18_arrived++;
+		if (calling)
+			test18_calling = 1;
+		MQTTAsync_send(test18_b, test18_echo_topic, message->payloadlen, message->payload, 1, 0, NULL);
+		if (calling)
+		{
+			test18_connected_on_return = MQTTAsync_isConnected(test18_a);
+			test18_returned = 1;
+		}
+	}
+	else if (!test18_b_busy)
+	{
+		/* hold b's reactor */
+		test18_b_busy = 1;
+		#if defined(_WIN32)
+			Sleep(1000);
+		#else
+			usleep(1000000L);
+		#endif
+	}
+
+	MQTTAsync_freeMessage(&message);
+	MQTTAsync_free(topicName);
+	return 1;
+}
+
+int test18(struct Options options)
+{
+	MQTTAsync_init_options inits = MQTTAsync_init_options_initializer;
+	MQTTAsync_connectOptions opts = MQTTAsync_connectOptions_initializer;
+	MQTTAsync_disconnectOptions dopts = MQTTAsync_disconnectOptions_initializer;
+	int rc = 0;
+	int i;
+
+	MyLog(LOGA_INFO, "Starting test 18 - disconnect during a callback into another reactor");
+	fprintf(xml, "<testcase classname=\"test4\" name=\"disconnect-while-lent\"");
+	global_start_time = start_clock();
+
+	inits.struct_version = 2;
+	inits.reactorThreads = 3;
+	MQTTAsync_global_init(&inits);
+
+	rc = MQTTAsync_create(&test18_a, options.connection, "async_test18_a", MQTTCLIENT_PERSISTENCE_NONE, NULL);
+	assert("good rc from create", rc == MQTTASYNC_SUCCESS, "rc was %d\n", rc);
+	rc = MQTTAsync_create(&test18_b, options.connection, "async_test18_b", MQTTCLIENT_PERSISTENCE_NONE, NULL);
+	assert("good rc from create", rc == MQTTASYNC_SUCCESS, "rc was %d\n", rc);
+	rc = MQTTAsync_create(&test18_c, options.connection, "async_test18_c", MQTTCLIENT_PERSISTENCE_NONE, NULL);
+	assert("good rc from create", rc == MQTTASYNC_SUCCESS, "rc was %d\n", rc);
+	if (rc != MQTTASYNC_SUCCESS)
+		goto exit;
+
+	rc = MQTTAsync_setCallbacks(test18_a, test18_a, NULL, test18_messageArrived, NULL);
+	assert("Good rc from setCallbacks", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	rc = MQTTAsync_setCallbacks(test18_b, test18_b, NULL, test18_messageArrived, NULL);
+	assert("Good rc from setCallbacks", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+
+	opts.keepAliveInterval = 20;
+	opts.cleansession = 1;
+	opts.MQTTVersion = options.MQTTVersion;
+	opts.onSuccess = test18_onConnect;
+	opts.context = test18_a;
+	rc = MQTTAsync_connect(test18_a, &opts);
+	assert("Good rc from connect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	opts.context = test18_b;
+	rc = MQTTAsync_connect(test18_b, &opts);
+	assert("Good rc from connect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	opts.context = test18_c;
+	rc = MQTTAsync_connect(test18_c, &opts);
+	assert("Good rc from connect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+
+	for (i = 0; (test18_subscribed < 2 || !MQTTAsync_isConnected(test18_c)) && i < 500; ++i)
+		#if defined(_WIN32)
+			Sleep(100);
+		#else
+			usleep(10000L);
+		#endif
+	assert("Both clients subscribed", test18_subscribed == 2, "subscribed was %d", test18_subscribed);
+	if (test18_subscribed < 2)
+		goto exit;
+
+	/* the first message, echoed to b, keeps b's reactor busy */
+	rc = MQTTAsync_send(test18_c, test18_topic, 12, "test18 data!", 2, 0, NULL);
+	assert("Good rc from send", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	for (i = 0; !test18_b_busy && i < 500; ++i)
+		#if defined(_WIN32)
+			Sleep(100);
+		#else
+			usleep(10000L);
+		#endif
+	assert("b busy", test18_b_busy, "busy was %d", test18_b_busy);
+
+	/* the second is delivered to a by the QoS 2 exchange, and its callback waits for b */
+	rc = MQTTAsync_send(test18_c, test18_topic, 12, "test18 data!", 2, 0, NULL);
+	assert("Good rc from send", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	for (i = 0; !test18_calling && i < 500; ++i)
+		#if defined(_WIN32)
+			Sleep(1);
+		#else
+			usleep(1000L);
+		#endif
+	assert("a calling into b's reactor", test18_calling, "calling was %d", test18_calling);
+
+	dopts.onSuccess = test18_onDisconnect;
+	dopts.context = test18_a;
+	rc = MQTTAsync_disconnect(test18_a, &dopts);
+	assert("Good rc from disconnect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	for (i = 0; !test18_disconnected && i < 500; ++i)
+		#if defined(_WIN32)
+			Sleep(100);
+		#else
+			usleep(10000L);
+		#endif
+	assert("a disconnected", test18_disconnected, "disconnected was %d", test18_disconnected);
+	assert("Callback returned", test18_returned, "returned was %d", test18_returned);
+	assert("a not disconnected under the callback", test18_connected_on_return == 1,
+			"connected was %d", test18_connected_on_return);
+	assert("Both messages arrived", test18_arrived == 2, "arrived was %d", test18_arrived);
+
+exit:
+	if (test18_a)
+		MQTTAsync_destroy(&test18_a);
+	if (test18_b)
+		MQTTAsync_destroy(&test18_b);
+	if (test18_c)
+		MQTTAsync_destroy(&test18_c);
+	inits.reactorThreads = 1;
+	MQTTAsync_global_init(&inits);
+	MyLog(LOGA_INFO, "TEST18: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", tests, failures);
+	write_test_result();
+	return failures;
+}
+
+
+
 void trace_callback(enum MQTTASYNC_TRACE_LEVELS level, char* message)
 {
 	printf("Trace : %d, %s\n", level, message);
 }
 
 
+/*********************************************************************
+
+Test19: Resolver cache, and a serverURI raced once its name is looked up
+
+*********************************************************************/
+
+#if !defined(_WINDOWS)
+
+int test19_cached = 0;
+int test19_raceLookups = 0;
+int test19_connected = 0;
+int test19_failed = 0;
+char test19_serverURI[200];
+
+void test19_trace(enum MQTTASYNC_TRACE_LEVELS level, char* message)
+{
+	if (strstr(message, "Using cached addresses for "))
+		test19_cached++;
+	else if (strstr(message, "Looking up ") && strstr(message, " to race for socket "))
+		test19_raceLookups++;
+}
+
+void test19_onConnect(void* context, MQTTAsync_successData* response)
+{
+	MyLog(LOGA_DEBUG, "In connect onSuccess callback to %s", response->alt.connect.serverURI);
+	if (response->alt.connect.serverURI)
+		strncpy(test19_serverURI, response->alt.connect.serverURI, sizeof(test19_serverURI) - 1);
+	test19_connected = 1;
+}
+
+void test19_onConnectFailure(void* context, MQTTAsync_failureData* response)
+{
+	MyLog(LOGA_DEBUG, "In connect onFailure callback, rc %d", response ? response->code : 0);
+	test19_failed = 1;
+}
+
+void test19_onDisconnect(void* context, MQTTAsync_successData* response)
+{
+	MyLog(LOGA_DEBUG, "In disconnect onSuccess callback %p", context);
+	test_finished = 1;
+}
+
+/* a listening socket whose backlog is full, so that a connect to its port stays in progress */
+int test19_stalledListener(int* port, int* filler)
+{
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	int sock = socket(AF_INET, SOCK_STREAM, 0);
+
+	memset(&addr, '\0', sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	*filler = -1;
+	if (sock < 0 || bind(sock, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(sock, 0) != 0 ||
+			getsockname(sock, (struct sockaddr*)&addr, &len) != 0)
+		goto error;
+	*port = ntohs(addr.sin_port);
+	if ((*filler = socket(AF_INET, SOCK_STREAM, 0)) < 0 || connect(*filler, (struct sockaddr*)&addr, len) != 0)
+		goto error;
+	return sock;
+error:
+	if (*filler >= 0)
+		close(*filler);
+	if (sock >= 0)
+		close(sock);
+	return -1;
+}
+
+/* connect and disconnect, returning whether the connect succeeded */
+int test19_connect(MQTTAsync c, MQTTAsync_connectOptions* opts)
+{
+	MQTTAsync_disconnectOptions dopts = MQTTAsync_disconnectOptions_initializer;
+	int rc;
+	int i;
+
+	test19_connected = test19_failed = 0;
+	test19_serverURI[0] = '\0';
+	opts->onSuccess = test19_onConnect;
+	opts->onFailure = test19_onConnectFailure;
+	opts->context = c;
+	rc = MQTTAsync_connect(c, opts);
+	assert("Good rc from connect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	if (rc != MQTTASYNC_SUCCESS)
+		return 0;
+	for (i = 0; !test19_connected && !test19_failed && i < 1000; ++i)
+		usleep(10000L);
+	if (test19_connected)
+	{
+		test_finished = 0;
+		dopts.onSuccess = test19_onDisconnect;
+		dopts.context = c;
+		rc = MQTTAsync_disconnect(c, &dopts);
+		assert("Good rc from disconnect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+		for (i = 0; !test_finished && i < 500; ++i)
+			usleep(10000L);
+	}
+	return test19_connected;
+}
+
+int test19(struct Options options)
+{
+	MQTTAsync c = NULL;
+	MQTTAsync_connectOptions opts = MQTTAsync_connectOptions_initializer;
+	MQTTAsync_socketOptions sockopts = MQTTAsync_socketOptions_initializer;
+	char stalledURI[100];
+	char* serverURIs[2] = {stalledURI, options.connection};
+	int listener = -1;
+	int filler = -1;
+	int port = 0;
+	int rc = 0;
+
+	MyLog(LOGA_INFO, "Starting test 19 - resolver cache, and racing a serverURI once it is looked up");
+	fprintf(xml, "<testcase classname=\"test4\" name=\"resolver-cache\"");
+	global_start_time = start_clock();
+	MQTTAsync_setTraceCallback(test19_trace);
+	MQTTAsync_setTraceLevel(MQTTASYNC_TRACE_MINIMUM);
+
+	rc = MQTTAsync_create(&c, options.connection, "async_test19", MQTTCLIENT_PERSISTENCE_NONE, NULL);
+	assert("good rc from create", rc == MQTTASYNC_SUCCESS, "rc was %d\n", rc);
+	if (rc != MQTTASYNC_SUCCESS)
+		goto exit;
+
+	opts.keepAliveInterval = 20;
+	opts.cleansession = 1;
+	opts.connectTimeout = 5;
+	opts.socketOptions = &sockopts;
+
+	/* a successful lookup is reused, with one version so that each connect looks the name up once */
+	opts.MQTTVersion = MQTTVERSION_3_1_1;
+	sockopts.dnsCacheTTL = 60;
+	test19_cached = 0;
+	rc = test19_connect(c, &opts);
+	assert("Connected", rc == 1, "connected was %d", rc);
+	rc = test19_connect(c, &opts);
+	assert("Connected", rc == 1, "connected was %d", rc);
+	assert("Addresses reused from the cache", test19_cached == 1, "cached was %d", test19_cached);
+	MQTTAsync_destroy(&c);
+
+	/* and so is a failed one, for the negative TTL */
+	rc = MQTTAsync_create(&c, "tcp://paho-test19.invalid:1883", "async_test19", MQTTCLIENT_PERSISTENCE_NONE, NULL);
+	assert("good rc from create", rc == MQTTASYNC_SUCCESS, "rc was %d\n", rc);
+	if (rc != MQTTASYNC_SUCCESS)
+		goto exit;
+	sockopts.dnsCacheTTL = 0;
+	sockopts.dnsNegativeTTL = 60;
+	test19_cached = 0;
+	rc = test19_connect(c, &opts);
+	assert("Connect failed", rc == 0 && test19_failed, "failed was %d", test19_failed);
+	rc = test19_connect(c, &opts);
+	assert("Connect failed", rc == 0 && test19_failed, "failed was %d", test19_failed);
+	assert("Failure reused from the cache", test19_cached == 1, "cached was %d", test19_cached);
+	MQTTAsync_destroy(&c);
+	sockopts.dnsNegativeTTL = 0;
+	opts.MQTTVersion = options.MQTTVersion;
+
+	rc = MQTTAsync_create(&c, options.connection, "async_test19", MQTTCLIENT_PERSISTENCE_NONE, NULL);
+	assert("good rc from create", rc == MQTTASYNC_SUCCESS, "rc was %d\n", rc);
+	if (rc != MQTTASYNC_SUCCESS)
+		goto exit;
+
+	/* the first serverURI never connects, and the second is raced once its name is looked up */
+	listener = test19_stalledListener(&port, &filler);
+	assert("Stalled listener created", listener >= 0, "listener was %d", listener);
+	if (listener < 0)
+		goto exit;
+	sprintf(stalledURI, "tcp://127.0.0.1:%d", port);
+	opts.serverURIs = serverURIs;
+	opts.serverURIcount = 2;
+	opts.raceServerURIs = 1;
+	sockopts.connectAttemptDelay = 100;
+	rc = test19_connect(c, &opts);
+	assert("Connected by the race", rc == 1, "connected was %d", rc);
+	assert("Connected to the second serverURI", strcmp(test19_serverURI, options.connection) == 0,
+			"serverURI was %s", test19_serverURI);
+	assert("Second serverURI looked up alongside the connect", test19_raceLookups == 1,
+			"race lookups were %d", test19_raceLookups);
+
+exit:
+	if (c)
+		MQTTAsync_destroy(&c);
+	if (filler >= 0)
+		close(filler);
+	if (listener >= 0)
+		close(listener);
+	MQTTAsync_setTraceLevel(MQTTASYNC_TRACE_ERROR);
+	MQTTAsync_setTraceCallback(trace_callback);
+	MyLog(LOGA_INFO, "TEST19: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", tests, failures);
+	write_test_result();
+	return failures;
+}
+
+#else
+
+int test19(struct Options options)
+{
+	MyLog(LOGA_INFO, "Test 19 - resolver cache, and racing a serverURI once it is looked up - not run on Windows");
+	return 0;
+}
+
+#endif
+
+
+/*********************************************************************
+
+Test20: Racing serverURIs, so that unreachable ones do not hold up the connect
+
+*********************************************************************/
+
+#if !defined(_WINDOWS)
+
+int test20(struct Options options)
+{
+	MQTTAsync c = NULL;
+	MQTTAsync_connectOptions opts = MQTTAsync_connectOptions_initializer;
+	MQTTAsync_socketOptions sockopts = MQTTAsync_socketOptions_initializer;
+	char stalledURI[100];
+	char* serverURIs[2] = {stalledURI, options.connection};
+	START_TIME_TYPE start;
+	long duration;
+	int listener = -1;
+	int filler = -1;
+	int port = 0;
+	int rc = 0;
+
+	MyLog(LOGA_INFO, "Starting test 20 - racing serverURIs");
+	fprintf(xml, "<testcase classname=\"test4\" name=\"race-serverURIs\"");
+	global_start_time = start_clock();
+
+	rc = MQTTAsync_create(&c, options.connection, "async_test20", MQTTCLIENT_PERSISTENCE_NONE, NULL);
+	assert("good rc from create", rc == MQTTASYNC_SUCCESS, "rc was %d\n", rc);
+	if (rc != MQTTASYNC_SUCCESS)
+		goto exit;
+
+	listener = test19_stalledListener(&port, &filler);
+	assert("Stalled listener created", listener >= 0, "listener was %d", listener);
+	if (listener < 0)
+		goto exit;
+	sprintf(stalledURI, "tcp://127.0.0.1:%d", port);
+
+	opts.keepAliveInterval = 20;
+	opts.cleansession = 1;
+	opts.MQTTVersion = MQTTVERSION_3_1_1;
+	opts.connectTimeout = 1;
+	opts.socketOptions = &sockopts;
+	opts.serverURIs = serverURIs;
+	opts.serverURIcount = 2;
+
+	/* one after another, the stalled serverURI takes the whole connect timeout */
+	start = start_clock();
+	rc = test19_connect(c, &opts);
+	duration = elapsed(start);
+	assert("Connected in turn", rc == 1, "connected was %d", rc);
+	assert("Connected to the second serverURI", strcmp(test19_serverURI, options.connection) == 0,
+			"serverURI was %s", test19_serverURI);
+	assert("Stalled serverURI timed out", duration >= 1000L, "duration was %ld", duration);
+
+	/* raced, the second is started after the attempt delay and wins */
+	opts.raceServerURIs = 1;
+	sockopts.connectAttemptDelay = 100;
+	start = start_clock();
+	rc = test19_connect(c, &opts);
+	duration = elapsed(start);
+	assert("Connected by the race", rc == 1, "connected was %d", rc);
+	assert("Connected to the second serverURI", strcmp(test19_serverURI, options.connection) == 0,
+			"serverURI was %s", test19_serverURI);
+	assert("Race won within the connect timeout", duration < 1000L, "duration was %ld", duration);
+
+exit:
+	if (c)
+		MQTTAsync_destroy(&c);
+	if (filler >= 0)
+		close(filler);
+	if (listener >= 0)
+		close(listener);
+	MyLog(LOGA_INFO, "TEST20: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", tests, failures);
+	write_test_result();
+	return failures;
+}
+
+#else
+
+int test20(struct Options options)
+{
+	MyLog(LOGA_INFO, "Test 20 - racing serverURIs - not run on Windows");
+	return 0;
+}
+
+#endif
+
+
+/*********************************************************************
+
+Test21: Socket options are set on the connection to the server
+
+*********************************************************************/
+
+#if defined(__linux__)
+
+int test21_connected = 0;
+
+void test21_onConnect(void* context, MQTTAsync_successData* response)
+{
+	MyLog(LOGA_DEBUG, "In connect onSuccess callback, context %p", context);
+	test21_connected = 1;
+}
+
+/* find the process's connection to a port, there being only one */
+int test21_findSocket(int port)
+{
+	int sock;
+
+	for (sock = 3; sock < 1024; ++sock)
+	{
+		struct sockaddr_storage peer;
+		socklen_t len = sizeof(peer);
+
+		if (getpeername(sock, (struct sockaddr*)&peer, &len) != 0)
+			continue;
+		if ((peer.ss_family == AF_INET && ntohs(((struct sockaddr_in*)&peer)->sin_port) == port) ||
+				(peer.ss_family == AF_INET6 && ntohs(((struct sockaddr_in6*)&peer)->sin6_port) == port))
+			return sock;
+	}
+	return -1;
+}
+
+int test21_getOption(int sock, int level, int name)
+{
+	int value = -1;
+	socklen_t len = sizeof(value);
+
+	if (getsockopt(sock, level, name, (void*)&value, &len) != 0)
+		value = -1;
+	return value;
+}
+
+int test21(struct Options options)
+{
+	MQTTAsync c = NULL;
+	MQTTAsync_connectOptions opts = MQTTAsync_connectOptions_initializer;
+	MQTTAsync_socketOptions sockopts = MQTTAsync_socketOptions_initializer;
+	MQTTAsync_disconnectOptions dopts = MQTTAsync_disconnectOptions_initializer;
+	char* port = strrchr(options.connection, ':');
+	int sock = -1;
+	int value = 0;
+	int rc = 0;
+	int i;
+
+	MyLog(LOGA_INFO, "Starting test 21 - socket options");
+	fprintf(xml, "<testcase classname=\"test4\" name=\"socket-options\"");
+	global_start_time = start_clock();
+
+	rc = MQTTAsync_create(&c, options.connection, "async_test21", MQTTCLIENT_PERSISTENCE_NONE, NULL);
+	assert("good rc from create", rc == MQTTASYNC_SUCCESS, "rc was %d\n", rc);
+	if (rc != MQTTASYNC_SUCCESS)
+		goto exit;
+
+	sockopts.noDelay = 1;
+	sockopts.sendBufferSize = 32768;
+	sockopts.receiveBufferSize = 65536;
+	sockopts.userTimeout = 5000;
+	sockopts.tos = 0xB8;
+	sockopts.priority = 4;
+	opts.keepAliveInterval = 20;
+	opts.cleansession = 1;
+	opts.MQTTVersion = options.MQTTVersion;
+	opts.socketOptions = &sockopts;
+	opts.onSuccess = test21_onConnect;
+	opts.context = c;
+	rc = MQTTAsync_connect(c, &opts);
+	assert("Good rc from connect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	for (i = 0; !test21_connected && i < 500; ++i)
+		usleep(10000L);
+	assert("Connected", test21_connected, "connected was %d", test21_connected);
+	if (!test21_connected)
+		goto exit;
+
+	sock = test21_findSocket(port ? atoi(port + 1) : 1883);
+	assert("Connection found", sock >= 0, "socket was %d", sock);
+	if (sock < 0)
+		goto disconnect;
+	value = test21_getOption(sock, IPPROTO_TCP, TCP_NODELAY);
+	assert("TCP_NODELAY set", value > 0, "value was %d", value);
+	value = test21_getOption(sock, SOL_SOCKET, SO_SNDBUF); /* which Linux doubles */
+	assert("SO_SNDBUF set", value >= 32768 && value <= 2 * 32768, "value was %d", value);
+	value = test21_getOption(sock, SOL_SOCKET, SO_RCVBUF);
+	assert("SO_RCVBUF set", value >= 65536 && value <= 2 * 65536, "value was %d", value);
+	value = test21_getOption(sock, IPPROTO_TCP, TCP_USER_TIMEOUT);
+	assert("TCP_USER_TIMEOUT set", value == 5000, "value was %d", value);
+	value = test21_getOption(sock, SOL_SOCKET, SO_PRIORITY);
+	assert("SO_PRIORITY set", value == 4, "value was %d", value);
+
+disconnect:
+	rc = MQTTAsync_disconnect(c, &dopts);
+	assert("Good rc from disconnect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	for (i = 0; MQTTAsync_isConnected(c) && i < 500; ++i)
+		usleep(10000L);
+
+exit:
+	if (c)
+		MQTTAsync_destroy(&c);
+	MyLog(LOGA_INFO, "TEST21: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", tests, failures);
+	write_test_result();
+	return failures;
+}
+
+#else
+
+int test21(struct Options options)
+{
+	MyLog(LOGA_INFO, "Test 21 - socket options - only run on Linux");
+	return 0;
+}
+
+#endif
+
+
+#if !defined(_WINDOWS)
+
+/*********************************************************************
+
+Test22: connecting through a Unix domain socket, served by a minimal
+broker in the test which accepts one connection
+
+*********************************************************************/
+
+#define TEST22_PATH "async_test22.sock"
+
+int test22_connected = 0;
+
+void test22_onConnect(void* context, MQTTAsync_successData* response)
+{
+	MyLog(LOGA_DEBUG, "In connect onSuccess callback, context %p", context);
+	test22_connected = 1;
+}
+
+/* read a whole packet, returning its type, or -1 if the connection closed */
+int test22_readPacket(int sock)
+{
+	unsigned char header = 0;
+	unsigned char c = 0;
+	int remaining = 0;
+	int multiplier = 1;
+
+	if (recv(sock, &header, 1, MSG_WAITALL) != 1)
+		return -1;
+	do
+	{
+		if (recv(sock, &c, 1, MSG_WAITALL) != 1)
+			return -1;
+		remaining += (c & 127) * multiplier;
+		multiplier *= 128;
+	} while ((c & 128) != 0);
+	while (remaining-- > 0)
+	{
+		if (recv(sock, &c, 1, MSG_WAITALL) != 1)
+			return -1;
+	}
+	return header >> 4;
+}
+
+void* test22_broker(void* arg)
+{
+	int listener = *(int*)arg;
+	unsigned char connack[] = {0x20, 0x02, 0x00, 0x00};
+	int sock = -1;
+	int type = 0;
+
+	if ((sock = accept(listener, NULL, NULL)) < 0)
+		return NULL;
+	while ((type = test22_readPacket(sock)) > 0)
+	{
+		if (type == 1) /* CONNECT */
+			send(sock, connack, sizeof(connack), 0);
+		else if (type == 12) /* PINGREQ */
+		{
+			unsigned char pingresp[] = {0xD0, 0x00};
+			send(sock, pingresp, sizeof(pingresp), 0);
+		}
+		else if (type == 14) /* DISCONNECT */
+			break;
+	}
+	close(sock);
+	return NULL;
+}
+
+int test22(struct Options options)
+{
+	MQTTAsync c = NULL;
+	MQTTAsync_connectOptions opts = MQTTAsync_connectOptions_initializer;
+	MQTTAsync_disconnectOptions dopts = MQTTAsync_disconnectOptions_initializer;
+	struct sockaddr_un address;
+	pthread_t broker;
+	int started = 0;
+	int listener = -1;
+	int rc = 0;
+	int i;
+
+	MyLog(LOGA_INFO, "Starting test 22 - Unix domain sockets");
+	fprintf(xml, "<testcase classname=\"test4\" name=\"unix-domain-sockets\"");
+	global_start_time = start_clock();
+
+	unlink(TEST22_PATH);
+	memset(&address, '\0', sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, TEST22_PATH);
+	listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	assert("Listener created", listener >= 0, "errno was %d", errno);
+	if (listener < 0)
+		goto exit;
+	rc = bind(listener, (struct sockaddr*)&address, sizeof(address));
+	if (rc == 0)
+		rc = listen(listener, 1);
+	assert("Listening", rc == 0, "errno was %d", errno);
+	if (rc != 0)
+		goto exit;
+	started = (pthread_create(&broker, NULL, test22_broker, &listener) == 0);
+	assert("Broker started", started, "started was %d", started);
+	if (!started)
+		goto exit;
+
+	rc = MQTTAsync_create(&c, "unix://" TEST22_PATH, "async_test22", MQTTCLIENT_PERSISTENCE_NONE, NULL);
+	assert("good rc from create", rc == MQTTASYNC_SUCCESS, "rc was %d\n", rc);
+	if (rc != MQTTASYNC_SUCCESS)
+		goto exit;
+
+	opts.keepAliveInterval = 20;
+	opts.cleansession = 1;
+	opts.MQTTVersion = MQTTVERSION_3_1_1;
+	opts.onSuccess = test22_onConnect;
+	opts.context = c;
+	rc = MQTTAsync_connect(c, &opts);
+	assert("Good rc from connect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	for (i = 0; !test22_connected && i < 500; ++i)
+		usleep(10000L);
+	assert("Connected", test22_connected, "connected was %d", test22_connected);
+	if (!test22_connected)
+		goto exit;
+
+	rc = MQTTAsync_disconnect(c, &dopts);
+	assert("Good rc from disconnect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	for (i = 0; MQTTAsync_isConnected(c) && i < 500; ++i)
+		usleep(10000L);
+
+exit:
+	if (c)
+		MQTTAsync_destroy(&c);
+	if (listener >= 0)
+	{
+		shutdown(listener, SHUT_RDWR); /* ends a broker still waiting in accept */
+		if (started)
+			pthread_join(broker, NULL);
+		close(listener);
+	}
+	unlink(TEST22_PATH);
+	MyLog(LOGA_INFO, "TEST22: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", tests, failures);
+	write_test_result();
+	return failures;
+}
+
+#else
+
+int test22(struct Options options)
+{
+	MyLog(LOGA_INFO, "Test 22 - Unix domain sockets - not run on Windows");
+	return 0;
+}
+
+#endif
+
 
 
 int main(int argc, char** argv)
 {
 	int rc = 0;
- 	int (*tests[])() = {NULL, test1, test2, test3, test4, test5, test6, test7, test8}; /* indexed starting from 1 */
+ 	int (*tests[])() = {NULL, test1, test2, test3, test4, test5, test6, test7, test8, test9, test10, test11, test12, test13, test14, test15, test16, test17, test18, test19, test20, test21, test22}; /* indexed starting from 1 */
 	MQTTAsync_nameValue* info;
 	int i;
 
@@ -33,6 +33,8 @@
   #include <sys/socket.h>
 	#include <unistd.h>
   #include <errno.h>
+	#include <signal.h>
+	#include <sys/wait.h>
 #else
 	#include <windows.h>
 #endif
@@ -2033,6 +2035,1315 @@ exit:
 }
 
 
+/*********************************************************************
+
+Test9: Restore order of more than ten persisted MQTT V5 commands
+
+*********************************************************************/
+
+char* test9_topic = "C client test9";
+int test9_messageCount = 0;
+int test9_outOfOrder = 0;
+int test9_subscribed = 0;
+int test9_connected = 0;
+#define TEST9_MESSAGE_COUNT 15
+
+int test9_messageArrived(void* context, char* topicName, int topicLen, MQTTAsync_message* message)
+{
+	int seqno = atoi((char*)message->payload);
+
+	MyLog(LOGA_DEBUG, "Test9: received message %d", seqno);
+	if (seqno != test9_messageCount)
+		test9_outOfOrder++;
+	test9_messageCount++;
+
+	MQTTAsync_freeMessage(&message);
+	MQTTAsync_free(topicName);
+
+	return 1;
+}
+
+
+void test9_onSubscribe(void* context, MQTTAsync_successData5* response)
+{
+	MyLog(LOGA_DEBUG, "In subscribe onSuccess callback %p granted qos %d", context, response->reasonCode);
+	test9_subscribed = 1;
+}
+
+
+void test9_onConnect(void* context, MQTTAsync_successData5* response)
+{
+	MyLog(LOGA_DEBUG, "In connect onSuccess callback, context %p", context);
+	test9_connected = 1;
+}
+
+
+void test9_onDisconnect(void* context, MQTTAsync_successData5* response)
+{
+	MyLog(LOGA_DEBUG, "In onDisconnect callback %p", context);
+	test_finished = 1;
+}
+
+
+int test9(struct Options options)
+{
+	MQTTAsync c, d;
+	MQTTAsync_connectOptions opts = MQTTAsync_connectOptions_initializer5;
+	MQTTAsync_message pubmsg = MQTTAsync_message_initializer;
+	MQTTAsync_responseOptions ropts = MQTTAsync_responseOptions_initializer;
+	MQTTAsync_disconnectOptions dopts = MQTTAsync_disconnectOptions_initializer5;
+	MQTTAsync_createOptions createOpts = MQTTAsync_createOptions_initializer;
+	char payload[16];
+	int rc = 0;
+	int i;
+	int count = 0;
+
+	MyLog(LOGA_INFO, "Starting test 9 - restore order of persisted commands");
+	fprintf(xml, "<testcase classname=\"test4\" name=\"restore order\"");
+	global_start_time = start_clock();
+	test_finished = test9_messageCount = test9_outOfOrder = 0;
+	test9_subscribed = test9_connected = 0;
+
+	/* the publisher persists its commands while it has never been connected */
+	createOpts.MQTTVersion = MQTTVERSION_5;
+	createOpts.sendWhileDisconnected = 1;
+	createOpts.allowDisconnectedSendAtAnyTime = 1;
+	createOpts.maxBufferedMessages = 100;
+	rc = MQTTAsync_createWithOptions(&c, options.connection, "async_test9_pub",
+			MQTTCLIENT_PERSISTENCE_DEFAULT, NULL, &createOpts);
+	assert("good rc from create",  rc == MQTTASYNC_SUCCESS, "rc was %d\n", rc);
+	if (rc != MQTTASYNC_SUCCESS)
+	{
+		MQTTAsync_destroy(&c);
+		goto exit;
+	}
+
+	pubmsg.qos = 1;
+	pubmsg.retained = 0;
+	for (i = 0; i < TEST9_MESSAGE_COUNT; ++i)
+	{
+		sprintf(payload, "%d", i);
+		pubmsg.payload = payload;
+		pubmsg.payloadlen = (int)strlen(payload) + 1;
+		rc = MQTTAsync_sendMessage(c, test9_topic, &pubmsg, &ropts);
+		assert("Good rc from sendMessage", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	}
+	MQTTAsync_destroy(&c);
+
+	rc = MQTTAsync_createWithOptions(&d, options.connection, "async_test9_sub",
+			MQTTCLIENT_PERSISTENCE_NONE, NULL, &createOpts);
+	assert("good rc from create",  rc == MQTTASYNC_SUCCESS, "rc was %d\n", rc);
+	if (rc != MQTTASYNC_SUCCESS)
+	{
+		MQTTAsync_destroy(&d);
+		goto exit;
+	}
+
+	rc = MQTTAsync_setCallbacks(d, d, NULL, test9_messageArrived, NULL);
+	assert("Good rc from setCallbacks", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+
+	opts.keepAliveInterval = 20;
+	opts.cleanstart = 1;
+	opts.onSuccess5 = test9_onConnect;
+	opts.context = d;
+	rc = MQTTAsync_connect(d, &opts);
+	assert("Good rc from connect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	if (rc != MQTTASYNC_SUCCESS)
+		goto destroy_d;
+
+	while (!test9_connected && ++count < 100)
+		MySleep(100);
+
+	ropts.onSuccess5 = test9_onSubscribe;
+	ropts.context = d;
+	rc = MQTTAsync_subscribe(d, test9_topic, 1, &ropts);
+	assert("Good rc from subscribe", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+
+	count = 0;
+	while (!test9_subscribed && ++count < 100)
+		MySleep(100);
+
+	/* the recreated publisher restores the commands, and sends them on connect */
+	rc = MQTTAsync_createWithOptions(&c, options.connection, "async_test9_pub",
+			MQTTCLIENT_PERSISTENCE_DEFAULT, NULL, &createOpts);
+	assert("good rc from create",  rc == MQTTASYNC_SUCCESS, "rc was %d\n", rc);
+	if (rc != MQTTASYNC_SUCCESS)
+	{
+		MQTTAsync_destroy(&c);
+		goto disconnect_d;
+	}
+
+	test9_connected = 0;
+	opts.context = c;
+	rc = MQTTAsync_connect(c, &opts);
+	assert("Good rc from connect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+
+	count = 0;
+	while (test9_messageCount < TEST9_MESSAGE_COUNT && ++count < 100)
+		MySleep(100);
+
+	assert("All messages received", test9_messageCount == TEST9_MESSAGE_COUNT,
+			"test9_messageCount was %d", test9_messageCount);
+	assert("Messages received in order", test9_outOfOrder == 0,
+			"test9_outOfOrder was %d", test9_outOfOrder);
+
+	dopts.onSuccess5 = test9_onDisconnect;
+	dopts.context = c;
+	rc = MQTTAsync_disconnect(c, &dopts);
+	assert("Good rc from disconnect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+
+	count = 0;
+	while (!test_finished && ++count < 100)
+		MySleep(100);
+	MQTTAsync_destroy(&c);
+
+disconnect_d:
+	test_finished = 0;
+	dopts.context = d;
+	rc = MQTTAsync_disconnect(d, &dopts);
+	assert("Good rc from disconnect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+
+	count = 0;
+	while (!test_finished && ++count < 100)
+		MySleep(100);
+destroy_d:
+	MQTTAsync_destroy(&d);
+
+exit:
+	MyLog(LOGA_INFO, "TEST9: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", tests, failures);
+	write_test_result();
+	return failures;
+}
+
+
+/*********************************************************************
+
+Test10: Ring buffer persistence, overwriting the oldest buffered commands
+
+*********************************************************************/
+
+char* test10_topic = "C client test10";
+int test10_messageCount = 0;
+int test10_lastReceived = -1;
+int test10_outOfOrder = 0;
+int test10_subscribed = 0;
+int test10_connected = 0;
+#define TEST10_MESSAGE_COUNT 30
+
+int test10_messageArrived(void* context, char* topicName, int topicLen, MQTTAsync_message* message)
+{
+	int seqno = atoi((char*)message->payload);
+
+	MyLog(LOGA_DEBUG, "Test10: received message %d", seqno);
+	if (seqno <= test10_lastReceived)
+		test10_outOfOrder++;
+	test10_lastReceived = seqno;
+	test10_messageCount++;
+
+	MQTTAsync_freeMessage(&message);
+	MQTTAsync_free(topicName);
+
+	return 1;
+}
+
+
+void test10_onSubscribe(void* context, MQTTAsync_successData5* response)
+{
+	MyLog(LOGA_DEBUG, "In subscribe onSuccess callback %p granted qos %d", context, response->reasonCode);
+	test10_subscribed = 1;
+}
+
+
+void test10_onConnect(void* context, MQTTAsync_successData5* response)
+{
+	MyLog(LOGA_DEBUG, "In connect onSuccess callback, context %p", context);
+	test10_connected = 1;
+}
+
+
+int test10_publishFailures = 0;
+
+void test10_onPublishFailure(void* context, MQTTAsync_failureData5* response)
+{
+	MyLog(LOGA_DEBUG, "In onPublish failure callback %p", context);
+
+	assert("Response code should be persistence error", response->code == MQTTASYNC_PERSISTENCE_ERROR,
+			"rc was %d", response->code);
+
+	test10_publishFailures++;
+}
+
+
+void test10_onDisconnect(void* context, MQTTAsync_successData5* response)
+{
+	MyLog(LOGA_DEBUG, "In onDisconnect callback %p", context);
+	test_finished = 1;
+}
+
+
+int test10(struct Options options)
+{
+	MQTTAsync c, d;
+	MQTTAsync_connectOptions opts = MQTTAsync_connectOptions_initializer5;
+	MQTTAsync_message pubmsg = MQTTAsync_message_initializer;
+	MQTTAsync_responseOptions ropts = MQTTAsync_responseOptions_initializer;
+	MQTTAsync_disconnectOptions dopts = MQTTAsync_disconnectOptions_initializer5;
+	MQTTAsync_createOptions createOpts = MQTTAsync_createOptions_initializer;
+	MQTTClient_ringPersistenceOptions ringOpts = MQTTClient_ringPersistenceOptions_initializer;
+	char payload[100];
+	char filename[200];
+	char* ptr = NULL;
+	int rc = 0;
+	int i;
+	int count = 0;
+
+	MyLog(LOGA_INFO, "Starting test 10 - ring buffer persistence");
+	fprintf(xml, "<testcase classname=\"test4\" name=\"ring buffer persistence\"");
+	global_start_time = start_clock();
+	test_finished = test10_messageCount = test10_outOfOrder = 0;
+	test10_subscribed = test10_connected = test10_publishFailures = 0;
+	test10_lastReceived = -1;
+
+	/* start with a new ring file, which is named as the persistence does, without the URI prefix */
+	ptr = strstr(options.connection, "://");
+	sprintf(filename, "./async_test10_pub-%s.ring", ptr ? ptr + 3 : options.connection);
+	for (ptr = &filename[2]; (ptr = strpbrk(ptr, ":/\\")) != NULL; )
+		*ptr = '-';
+	remove(filename);
+
+	/* a ring which holds fewer commands than are buffered, so the oldest are overwritten */
+	ringOpts.size = 2048;
+	ringOpts.overwriteOldest = 1;
+	createOpts.MQTTVersion = MQTTVERSION_5;
+	createOpts.sendWhileDisconnected = 1;
+	createOpts.allowDisconnectedSendAtAnyTime = 1;
+	createOpts.maxBufferedMessages = 100;
+	rc = MQTTAsync_createWithOptions(&c, options.connection, "async_test10_pub",
+			MQTTCLIENT_PERSISTENCE_RING, &ringOpts, &createOpts);
+	assert("good rc from create",  rc == MQTTASYNC_SUCCESS, "rc was %d\n", rc);
+	if (rc != MQTTASYNC_SUCCESS)
+	{
+		MQTTAsync_destroy(&c);
+		goto exit;
+	}
+
+	memset(payload, ' ', sizeof(payload));
+	payload[sizeof(payload) - 1] = '\0';
+	pubmsg.payload = payload;
+	pubmsg.payloadlen = (int)sizeof(payload);
+	pubmsg.qos = 1;
+	pubmsg.retained = 0;
+	for (i = 0; i < TEST10_MESSAGE_COUNT; ++i)
+	{
+		sprintf(payload, "%d", i);
+		payload[strlen(payload)] = ' ';
+		rc = MQTTAsync_sendMessage(c, test10_topic, &pubmsg, &ropts);
+		assert("Good rc from sendMessage", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	}
+	MQTTAsync_destroy(&c);
+
+	rc = MQTTAsync_createWithOptions(&d, options.connection, "async_test10_sub",
+			MQTTCLIENT_PERSISTENCE_NONE, NULL, &createOpts);
+	assert("good rc from create",  rc == MQTTASYNC_SUCCESS, "rc was %d\n", rc);
+	if (rc != MQTTASYNC_SUCCESS)
+	{
+		MQTTAsync_destroy(&d);
+		goto exit;
+	}
+
+	rc = MQTTAsync_setCallbacks(d, d, NULL, test10_messageArrived, NULL);
+	assert("Good rc from setCallbacks", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+
+	opts.keepAliveInterval = 20;
+	opts.cleanstart = 1;
+	opts.onSuccess5 = test10_onConnect;
+	opts.context = d;
+	rc = MQTTAsync_connect(d, &opts);
+	assert("Good rc from connect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	if (rc != MQTTASYNC_SUCCESS)
+		goto destroy_d;
+
+	while (!test10_connected && ++count < 100)
+		MySleep(100);
+
+	ropts.onSuccess5 = test10_onSubscribe;
+	ropts.context = d;
+	rc = MQTTAsync_subscribe(d, test10_topic, 1, &ropts);
+	assert("Good rc from subscribe", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+
+	count = 0;
+	while (!test10_subscribed && ++count < 100)
+		MySleep(100);
+
+	/* only the newest commands are restored from the ring */
+	rc = MQTTAsync_createWithOptions(&c, options.connection, "async_test10_pub",
+			MQTTCLIENT_PERSISTENCE_RING, &ringOpts, &createOpts);
+	assert("good rc from create",  rc == MQTTASYNC_SUCCESS, "rc was %d\n", rc);
+	if (rc != MQTTASYNC_SUCCESS)
+	{
+		MQTTAsync_destroy(&c);
+		goto disconnect_d;
+	}
+
+	opts.context = c;
+	rc = MQTTAsync_connect(c, &opts);
+	assert("Good rc from connect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+
+	count = 0;
+	while (test10_lastReceived < TEST10_MESSAGE_COUNT - 1 && ++count < 100)
+		MySleep(100);
+	MySleep(200);
+
+	MyLog(LOGA_INFO, "%d of %d messages restored", test10_messageCount, TEST10_MESSAGE_COUNT);
+	assert("Some messages restored", test10_messageCount > 0,
+			"test10_messageCount was %d", test10_messageCount);
+	assert("The oldest messages overwritten", test10_messageCount < TEST10_MESSAGE_COUNT,
+			"test10_messageCount was %d", test10_messageCount);
+	assert("The newest message restored", test10_lastReceived == TEST10_MESSAGE_COUNT - 1,
+			"test10_lastReceived was %d", test10_lastReceived);
+	assert("Messages received in order", test10_outOfOrder == 0,
+			"test10_outOfOrder was %d", test10_outOfOrder);
+
+	dopts.onSuccess5 = test10_onDisconnect;
+	dopts.context = c;
+	rc = MQTTAsync_disconnect(c, &dopts);
+	assert("Good rc from disconnect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+
+	count = 0;
+	while (!test_finished && ++count < 100)
+		MySleep(100);
+	MQTTAsync_destroy(&c);
+
+	/* the commands still in memory whose persisted copies were overwritten fail */
+	rc = MQTTAsync_createWithOptions(&c, options.connection, "async_test10_pub",
+			MQTTCLIENT_PERSISTENCE_RING, &ringOpts, &createOpts);
+	assert("good rc from create",  rc == MQTTASYNC_SUCCESS, "rc was %d\n", rc);
+	if (rc != MQTTASYNC_SUCCESS)
+	{
+		MQTTAsync_destroy(&c);
+		goto disconnect_d;
+	}
+
+	test10_messageCount = test10_outOfOrder = 0;
+	test10_lastReceived = -1;
+	ropts.onSuccess5 = NULL;
+	ropts.onFailure5 = test10_onPublishFailure;
+	ropts.context = c;
+	for (i = 0; i < TEST10_MESSAGE_COUNT; ++i)
+	{
+		sprintf(payload, "%d", i);
+		payload[strlen(payload)] = ' ';
+		rc = MQTTAsync_sendMessage(c, test10_topic, &pubmsg, &ropts);
+		assert("Good rc from sendMessage", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	}
+
+	opts.context = c;
+	rc = MQTTAsync_connect(c, &opts);
+	assert("Good rc from connect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+
+	count = 0;
+	while (test10_messageCount + test10_publishFailures < TEST10_MESSAGE_COUNT && ++count < 100)
+		MySleep(100);
+
+	MyLog(LOGA_INFO, "%d messages received, %d failed", test10_messageCount, test10_publishFailures);
+	assert("Overwritten messages failed", test10_publishFailures > 0,
+			"test10_publishFailures was %d", test10_publishFailures);
+	assert("All messages received or failed", test10_messageCount + test10_publishFailures == TEST10_MESSAGE_COUNT,
+			"test10_messageCount was %d", test10_messageCount);
+	assert("The newest message received", test10_lastReceived == TEST10_MESSAGE_COUNT - 1,
+			"test10_lastReceived was %d", test10_lastReceived);
+	assert("Messages received in order", test10_outOfOrder == 0,
+			"test10_outOfOrder was %d", test10_outOfOrder);
+
+	test_finished = 0;
+	dopts.context = c;
+	rc = MQTTAsync_disconnect(c, &dopts);
+	assert("Good rc from disconnect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+
+	count = 0;
+	while (!test_finished && ++count < 100)
+		MySleep(100);
+	MQTTAsync_destroy(&c);
+
+disconnect_d:
+	test_finished = 0;
+	dopts.onSuccess5 = test10_onDisconnect;
+	dopts.context = d;
+	rc = MQTTAsync_disconnect(d, &dopts);
+	assert("Good rc from disconnect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+
+	count = 0;
+	while (!test_finished && ++count < 100)
+		MySleep(100);
+destroy_d:
+	MQTTAsync_destroy(&d);
+	remove(filename);
+
+exit:
+	MyLog(LOGA_INFO, "TEST10: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", tests, failures);
+	write_test_result();
+	return failures;
+}
+
+
+
+/*********************************************************************
+
+An in-memory persistence implementation, which records the calls made
+to it, for the tests of deferred persistence
+
+*********************************************************************/
+
+#define MEMSTORE_MAX_RECORDS 200
+
+typedef struct
+{
+	char* keys[MEMSTORE_MAX_RECORDS];
+	char* buffers[MEMSTORE_MAX_RECORDS];
+	int buflens[MEMSTORE_MAX_RECORDS];
+	int count;
+	int keepRemoved; /* ignore removes, as if the process had ended before they were made */
+	int puts;        /* calls of pput, and of pputMany */
+	int putManys;
+	int removes;     /* calls of premove, and of premoveMany */
+	int removeManys;
+	int gets;
+} memstore;
+
+memstore memstore_store;
+
+int memstore_find(memstore* s, char* key)
+{
+	int i;
+
+	for (i = 0; i < s->count; ++i)
+		if (strcmp(s->keys[i], key) == 0)
+			return i;
+	return -1;
+}
+
+void memstore_delete(memstore* s, int i)
+{
+	free(s->keys[i]);
+	free(s->buffers[i]);
+	s->count--;
+	s->keys[i] = s->keys[s->count];
+	s->buffers[i] = s->buffers[s->count];
+	s->buflens[i] = s->buflens[s->count];
+}
+
+void memstore_empty(memstore* s)
+{
+	while (s->count > 0)
+		memstore_delete(s, 0);
+	memset(s, '\0', sizeof(memstore));
+}
+
+int memstore_open(void** handle, const char* clientID, const char* serverURI, void* context)
+{
+	*handle = context;
+	return 0;
+}
+
+int memstore_close(void* handle)
+{
+	return 0;
+}
+
+int memstore_write(memstore* s, char* key, int bufcount, char* buffers[], int buflens[])
+{
+	int i = memstore_find(s, key);
+	int j, len = 0;
+
+	if (i == -1)
+	{
+		if (s->count == MEMSTORE_MAX_RECORDS)
+			return MQTTCLIENT_PERSISTENCE_ERROR;
+		i = s->count++;
+		s->keys[i] = malloc(strlen(key) + 1);
+		strcpy(s->keys[i], key);
+	}
+	else
+		free(s->buffers[i]);
+	for (j = 0; j < bufcount; ++j)
+		len += buflens[j];
+	s->buffers[i] = malloc(len + 1);
+	s->buflens[i] = 0;
+	for (j = 0; j < bufcount; ++j)
+	{
+		memcpy(&s->buffers[i][s->buflens[i]], buffers[j], buflens[j]);
+		s->buflens[i] += buflens[j];
+	}
+	return 0;
+}
+
+int memstore_put(void* handle, char* key, int bufcount, char* buffers[], int buflens[])
+{
+	memstore* s = (memstore*)handle;
+
+	s->puts++;
+	return memstore_write(s, key, bufcount, buffers, buflens);
+}
+
+int memstore_putMany(void* handle, int count, char* keys[], int bufcounts[], char** buffers[], int* buflens[])
+{
+	memstore* s = (memstore*)handle;
+	int i, rc = 0;
+
+	s->puts++;
+	s->putManys++;
+	for (i = 0; i < count && rc == 0; ++i)
+		rc = memstore_write(s, keys[i], bufcounts[i], buffers[i], buflens[i]);
+	return rc;
+}
+
+int memstore_get(void* handle, char* key, char** buffer, int* buflen)
+{
+	memstore* s = (memstore*)handle;
+	int i = memstore_find(s, key);
+
+	s->gets++;
+	if (i == -1)
+		return MQTTCLIENT_PERSISTENCE_ERROR;
+	*buffer = MQTTAsync_malloc(s->buflens[i] + 1); /* freed by the library */
+	memcpy(*buffer, s->buffers[i], s->buflens[i]);
+	*buflen = s->buflens[i];
+	return 0;
+}
+
+int memstore_remove(void* handle, char* key)
+{
+	memstore* s = (memstore*)handle;
+	int i = memstore_find(s, key);
+
+	s->removes++;
+	if (i != -1 && !s->keepRemoved)
+		memstore_delete(s, i);
+	return 0;
+}
+
+int memstore_removeMany(void* handle, int count, char* keys[])
+{
+	memstore* s = (memstore*)handle;
+	int i;
+
+	s->removeManys++;
+	for (i = 0; i < count; ++i)
+		memstore_remove(handle, keys[i]);
+	s->removes -= count - 1;
+	return 0;
+}
+
+int memstore_keys(void* handle, char*** keys, int* nkeys)
+{
+	memstore* s = (memstore*)handle;
+	int i;
+
+	*nkeys = s->count;
+	*keys = NULL;
+	if (s->count == 0)
+		return 0;
+	*keys = MQTTAsync_malloc(sizeof(char*) * s->count); /* freed by the library */
+	for (i = 0; i < s->count; ++i)
+	{
+		(*keys)[i] = MQTTAsync_malloc(strlen(s->keys[i]) + 1);
+		strcpy((*keys)[i], s->keys[i]);
+	}
+	return 0;
+}
+
+int memstore_clear(void* handle)
+{
+	memstore* s = (memstore*)handle;
+
+	while (s->count > 0)
+		memstore_delete(s, 0);
+	return 0;
+}
+
+int memstore_containskey(void* handle, char* key)
+{
+	return (memstore_find((memstore*)handle, key) == -1) ? MQTTCLIENT_PERSISTENCE_ERROR : 0;
+}
+
+MQTTClient_persistence memstore_persistence =
+{
+	&memstore_store,
+	memstore_open,
+	memstore_close,
+	memstore_put,
+	memstore_get,
+	memstore_remove,
+	memstore_keys,
+	memstore_clear,
+	memstore_containskey
+};
+
+
+/*********************************************************************
+
+Test11: Deferred persistence.  A publication restored from persistence
+is written again when it is resent, which is deferred, and its record
+stays in persistence until the publication is acknowledged.
+
+*********************************************************************/
+
+char* test11_topic = "C client test11";
+volatile int test11_connected = 0;
+volatile int test11_delivered = 0;
+volatile int test11_onConnect_keyFound = -1;
+
+void test11_onConnect(void* context, MQTTAsync_successData* response)
+{
+	MyLog(LOGA_DEBUG, "In connect onSuccess callback, context %p", context);
+	/* the restored publication has been resent by now, but not yet acknowledged */
+	if (test11_onConnect_keyFound == -1 && memstore_store.keepRemoved == 0)
+		test11_onConnect_keyFound = (memstore_find(&memstore_store, "s-1") != -1);
+	test11_connected = 1;
+}
+
+
+void test11_onPublish(void* context, MQTTAsync_successData* response)
+{
+	MyLog(LOGA_DEBUG, "In publish onSuccess callback, context %p", context);
+	test11_delivered = 1;
+}
+
+
+void test11_onDisconnect(void* context, MQTTAsync_successData* response)
+{
+	MyLog(LOGA_DEBUG, "In onDisconnect callback %p", context);
+	test_finished = 1;
+}
+
+
+int test11(struct Options options)
+{
+	MQTTAsync c;
+	MQTTAsync_connectOptions opts = MQTTAsync_connectOptions_initializer;
+	MQTTAsync_responseOptions ropts = MQTTAsync_responseOptions_initializer;
+	MQTTAsync_disconnectOptions dopts = MQTTAsync_disconnectOptions_initializer;
+	MQTTAsync_createOptions createOpts = MQTTAsync_createOptions_initializer;
+	int rc = 0;
+	int i;
+	int count = 0;
+
+	MyLog(LOGA_INFO, "Starting test 11 - deferred persistence of a restored publication");
+	fprintf(xml, "<testcase classname=\"test4\" name=\"deferred persistence rewrite\"");
+	global_start_time = start_clock();
+	test_finished = test11_connected = test11_delivered = 0;
+	test11_onConnect_keyFound = -1;
+	memstore_empty(&memstore_store);
+
+	/* leave a publication in persistence, as if the process ended before it was acknowledged */
+	memstore_store.keepRemoved = 1;
+	rc = MQTTAsync_createWithOptions(&c, options.connection, "async_test11",
+			MQTTCLIENT_PERSISTENCE_USER, &memstore_persistence, &createOpts);
+	assert("good rc from create",  rc == MQTTASYNC_SUCCESS, "rc was %d\n", rc);
+	if (rc != MQTTASYNC_SUCCESS)
+	{
+		MQTTAsync_destroy(&c);
+		goto exit;
+	}
+
+	/* a new persistent session, so that the publication is resent when it is restored */
+	opts.keepAliveInterval = 20;
+	opts.cleansession = 1;
+	opts.onSuccess = test11_onConnect;
+	opts.context = c;
+	rc = MQTTAsync_connect(c, &opts);
+	assert("Good rc from connect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	while (!test11_connected && ++count < 100)
+		MySleep(100);
+	dopts.onSuccess = test11_onDisconnect;
+	dopts.context = c;
+	rc = MQTTAsync_disconnect(c, &dopts);
+	assert("Good rc from disconnect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	count = 0;
+	while (!test_finished && ++count < 100)
+		MySleep(100);
+
+	test11_connected = 0;
+	opts.cleansession = 0;
+	rc = MQTTAsync_connect(c, &opts);
+	assert("Good rc from connect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	count = 0;
+	while (!test11_connected && ++count < 100)
+		MySleep(100);
+
+	ropts.onSuccess = test11_onPublish;
+	ropts.context = c;
+	rc = MQTTAsync_send(c, test11_topic, 11, "test11 data", 1, 0, &ropts);
+	assert("Good rc from send", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	count = 0;
+	while (!test11_delivered && ++count < 100)
+		MySleep(100);
+	assert("Publication delivered", test11_delivered, "delivered was %d", test11_delivered);
+
+	test_finished = 0;
+	rc = MQTTAsync_disconnect(c, &dopts);
+	assert("Good rc from disconnect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	count = 0;
+	while (!test_finished && ++count < 100)
+		MySleep(100);
+	MQTTAsync_destroy(&c);
+
+	/* only the publication is restored, not the command which sent it */
+	for (i = memstore_store.count - 1; i >= 0; --i)
+		if (strncmp(memstore_store.keys[i], "s-", 2) != 0)
+			memstore_delete(&memstore_store, i);
+	assert("Publication left in persistence", memstore_find(&memstore_store, "s-1") != -1,
+			"count was %d", memstore_store.count);
+	memstore_store.keepRemoved = memstore_store.puts = memstore_store.removes = 0;
+
+	createOpts.struct_version = 5;
+	createOpts.deferPersistenceInterval = 10000;
+	rc = MQTTAsync_createWithOptions(&c, options.connection, "async_test11",
+			MQTTCLIENT_PERSISTENCE_USER, &memstore_persistence, &createOpts);
+	assert("good rc from create",  rc == MQTTASYNC_SUCCESS, "rc was %d\n", rc);
+	if (rc != MQTTASYNC_SUCCESS)
+	{
+		MQTTAsync_destroy(&c);
+		goto exit;
+	}
+
+	test11_connected = 0;
+	rc = MQTTAsync_connect(c, &opts);
+	assert("Good rc from connect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	count = 0;
+	while (!test11_connected && ++count < 100)
+		MySleep(100);
+	assert("The resent publication is still in persistence", test11_onConnect_keyFound == 1,
+			"found was %d", test11_onConnect_keyFound);
+
+	/* and is removed when it is acknowledged, without having been written again */
+	count = 0;
+	while (memstore_find(&memstore_store, "s-1") != -1 && ++count < 100)
+		MySleep(100);
+	assert("The acknowledged publication removed", memstore_find(&memstore_store, "s-1") == -1,
+			"count was %d", memstore_store.count);
+	assert("Nothing written", memstore_store.puts == 0, "puts were %d", memstore_store.puts);
+
+	test_finished = 0;
+	rc = MQTTAsync_disconnect(c, &dopts);
+	assert("Good rc from disconnect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	count = 0;
+	while (!test_finished && ++count < 100)
+		MySleep(100);
+
+	/* end the session */
+	test_finished = test11_connected = 0;
+	opts.cleansession = 1;
+	rc = MQTTAsync_connect(c, &opts);
+	assert("Good rc from connect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	count = 0;
+	while (!test11_connected && ++count < 100)
+		MySleep(100);
+	rc = MQTTAsync_disconnect(c, &dopts);
+	assert("Good rc from disconnect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	count = 0;
+	while (!test_finished && ++count < 100)
+		MySleep(100);
+	MQTTAsync_destroy(&c);
+
+exit:
+	memstore_empty(&memstore_store);
+	MyLog(LOGA_INFO, "TEST11: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", tests, failures);
+	write_test_result();
+	return failures;
+}
+
+
+
+/*********************************************************************
+
+Test12: Ring buffer persistence, restored after the process writing it
+was killed.  The ring is written in place, with the oldest commands
+overwritten, so the process is likely to be killed part way through
+changing it.  The commands restored must be a run of the latest ones,
+in order, each one intact.
+
+*********************************************************************/
+
+#if !defined(_WINDOWS)
+
+char* test12_topic = "C client test12";
+int test12_messageCount = 0;
+int test12_lastReceived = -1;
+int test12_gaps = 0;
+int test12_corrupt = 0;
+int test12_subscribed = 0;
+int test12_connected = 0;
+#define TEST12_PAYLOAD_LENGTH 60
+
+int test12_messageArrived(void* context, char* topicName, int topicLen, MQTTAsync_message* message)
+{
+	char* payload = (char*)message->payload;
+	int seqno = atoi(payload);
+	int i;
+
+	MyLog(LOGA_DEBUG, "Test12: received message %d", seqno);
+	if (test12_lastReceived != -1 && seqno != test12_lastReceived + 1)
+		test12_gaps++;
+	if (message->payloadlen != TEST12_PAYLOAD_LENGTH)
+		test12_corrupt++;
+	else
+	{
+		for (i = (int)strlen(payload) + 1; i < TEST12_PAYLOAD_LENGTH; ++i)
+			if (payload[i] != (char)('a' + seqno % 26))
+			{
+				test12_corrupt++;
+				break;
+			}
+	}
+	test12_lastReceived = seqno;
+	test12_messageCount++;
+
+	MQTTAsync_freeMessage(&message);
+	MQTTAsync_free(topicName);
+
+	return 1;
+}
+
+
+void test12_onSubscribe(void* context, MQTTAsync_successData5* response)
+{
+	MyLog(LOGA_DEBUG, "In subscribe onSuccess callback %p granted qos %d", context, response->reasonCode);
+	test12_subscribed = 1;
+}
+
+
+void test12_onConnect(void* context, MQTTAsync_successData5* response)
+{
+	MyLog(LOGA_DEBUG, "In connect onSuccess callback, context %p", context);
+	test12_connected++;
+}
+
+
+void test12_onDisconnect(void* context, MQTTAsync_successData5* response)
+{
+	MyLog(LOGA_DEBUG, "In onDisconnect callback %p", context);
+	test_finished = 1;
+}
+
+
+/* writes commands to the ring until it is killed */
+void test12_writer(struct Options options, MQTTClient_ringPersistenceOptions* ringOpts,
+		MQTTAsync_createOptions* createOpts)
+{
+	MQTTAsync c;
+	MQTTAsync_message pubmsg = MQTTAsync_message_initializer;
+	char payload[TEST12_PAYLOAD_LENGTH];
+	int i;
+
+	if (MQTTAsync_createWithOptions(&c, options.connection, "async_test12_pub",
+			MQTTCLIENT_PERSISTENCE_RING, ringOpts, createOpts) != MQTTASYNC_SUCCESS)
+		_exit(1);
+	pubmsg.payload = payload;
+	pubmsg.payloadlen = (int)sizeof(payload);
+	pubmsg.qos = 1;
+	for (i = 0; ; ++i)
+	{
+		memset(payload, 'a' + i % 26, sizeof(payload));
+		sprintf(payload, "%d", i);
+		MQTTAsync_sendMessage(c, test12_topic, &pubmsg, NULL);
+	}
+}
+
+
+int test12(struct Options options)
+{
+	MQTTAsync c, d;
+	MQTTAsync_connectOptions opts = MQTTAsync_connectOptions_initializer5;
+	MQTTAsync_responseOptions ropts = MQTTAsync_responseOptions_initializer;
+	MQTTAsync_disconnectOptions dopts = MQTTAsync_disconnectOptions_initializer5;
+	MQTTAsync_createOptions createOpts = MQTTAsync_createOptions_initializer;
+	MQTTClient_ringPersistenceOptions ringOpts = MQTTClient_ringPersistenceOptions_initializer;
+	char filename[200];
+	char* ptr = NULL;
+	pid_t writer;
+	int rc = 0;
+	int count = 0;
+
+	MyLog(LOGA_INFO, "Starting test 12 - ring buffer persistence after the writer is killed");
+	fprintf(xml, "<testcase classname=\"test4\" name=\"ring buffer persistence killed\"");
+	global_start_time = start_clock();
+	test_finished = test12_messageCount = test12_gaps = test12_corrupt = 0;
+	test12_subscribed = test12_connected = 0;
+	test12_lastReceived = -1;
+
+	ptr = strstr(options.connection, "://");
+	sprintf(filename, "./async_test12_pub-%s.ring", ptr ? ptr + 3 : options.connection);
+	for (ptr = &filename[2]; (ptr = strpbrk(ptr, ":/\\")) != NULL; )
+		*ptr = '-';
+	remove(filename);
+
+	ringOpts.size = 4096;
+	ringOpts.overwriteOldest = 1;
+	createOpts.MQTTVersion = MQTTVERSION_5;
+	createOpts.sendWhileDisconnected = 1;
+	createOpts.allowDisconnectedSendAtAnyTime = 1;
+	createOpts.maxBufferedMessages = 100;
+	createOpts.deleteOldestMessages = 1;
+
+	if ((writer = fork()) == 0)
+		test12_writer(options, &ringOpts, &createOpts);
+	assert("Writer started", writer > 0, "pid was %d", (int)writer);
+	if (writer <= 0)
+		goto exit;
+	MySleep(500);
+	kill(writer, SIGKILL);
+	waitpid(writer, NULL, 0);
+
+	rc = MQTTAsync_createWithOptions(&d, options.connection, "async_test12_sub",
+			MQTTCLIENT_PERSISTENCE_NONE, NULL, &createOpts);
+	assert("good rc from create",  rc == MQTTASYNC_SUCCESS, "rc was %d\n", rc);
+	if (rc != MQTTASYNC_SUCCESS)
+	{
+		MQTTAsync_destroy(&d);
+		goto exit;
+	}
+
+	rc = MQTTAsync_setCallbacks(d, d, NULL, test12_messageArrived, NULL);
+	assert("Good rc from setCallbacks", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+
+	opts.keepAliveInterval = 20;
+	opts.cleanstart = 1;
+	opts.onSuccess5 = test12_onConnect;
+	opts.context = d;
+	rc = MQTTAsync_connect(d, &opts);
+	assert("Good rc from connect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	if (rc != MQTTASYNC_SUCCESS)
+		goto destroy_d;
+
+	while (!test12_connected && ++count < 100)
+		MySleep(100);
+
+	ropts.onSuccess5 = test12_onSubscribe;
+	ropts.context = d;
+	rc = MQTTAsync_subscribe(d, test12_topic, 1, &ropts);
+	assert("Good rc from subscribe", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+
+	count = 0;
+	while (!test12_subscribed && ++count < 100)
+		MySleep(100);
+
+	/* the commands in the ring are restored and sent */
+	rc = MQTTAsync_createWithOptions(&c, options.connection, "async_test12_pub",
+			MQTTCLIENT_PERSISTENCE_RING, &ringOpts, &createOpts);
+	assert("good rc from create",  rc == MQTTASYNC_SUCCESS, "rc was %d\n", rc);
+	if (rc != MQTTASYNC_SUCCESS)
+	{
+		MQTTAsync_destroy(&c);
+		goto disconnect_d;
+	}
+
+	opts.context = c;
+	rc = MQTTAsync_connect(c, &opts);
+	assert("Good rc from connect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+
+	count = 0;
+	while (test12_connected < 2 && ++count < 100)
+		MySleep(100);
+	count = 0;
+	while (++count < 100)
+	{
+		MQTTAsync_token* tokens = NULL;
+
+		MQTTAsync_getPendingTokens(c, &tokens);
+		if (tokens == NULL || tokens[0] == -1)
+		{
+			MQTTAsync_free(tokens);
+			break;
+		}
+		MQTTAsync_free(tokens);
+		MySleep(100);
+	}
+	MySleep(500);
+
+	MyLog(LOGA_INFO, "%d messages restored, ending at %d", test12_messageCount, test12_lastReceived);
+	assert("Some messages restored", test12_messageCount > 0,
+			"test12_messageCount was %d", test12_messageCount);
+	assert("Restored messages are a run of consecutive messages", test12_gaps == 0,
+			"test12_gaps was %d", test12_gaps);
+	assert("Restored messages intact", test12_corrupt == 0,
+			"test12_corrupt was %d", test12_corrupt);
+
+	test_finished = 0;
+	dopts.onSuccess5 = test12_onDisconnect;
+	dopts.context = c;
+	rc = MQTTAsync_disconnect(c, &dopts);
+	assert("Good rc from disconnect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	count = 0;
+	while (!test_finished && ++count < 100)
+		MySleep(100);
+	MQTTAsync_destroy(&c);
+
+disconnect_d:
+	test_finished = 0;
+	dopts.onSuccess5 = test12_onDisconnect;
+	dopts.context = d;
+	rc = MQTTAsync_disconnect(d, &dopts);
+	assert("Good rc from disconnect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	count = 0;
+	while (!test_finished && ++count < 100)
+		MySleep(100);
+
+destroy_d:
+	MQTTAsync_destroy(&d);
+
+exit:
+	remove(filename);
+	MyLog(LOGA_INFO, "TEST12: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", tests, failures);
+	write_test_result();
+	return failures;
+}
+
+#else
+
+int test12(struct Options options)
+{
+	MyLog(LOGA_INFO, "Test 12 - ring buffer persistence after the writer is killed - not run on Windows");
+	return 0;
+}
+
+#endif
+
+
+
+/*********************************************************************
+
+Test13: Buffered publish commands kept in memory within a byte budget,
+so that they are not read back from persistence to be sent.
+
+*********************************************************************/
+
+char* test13_topic = "C client test13";
+#define TEST13_MESSAGES 10
+#define TEST13_PAYLOAD_LENGTH 100
+volatile int test13_connected = 0;
+volatile int test13_delivered = 0;
+
+void test13_onConnect(void* context, MQTTAsync_successData* response)
+{
+	MyLog(LOGA_DEBUG, "In connect onSuccess callback, context %p", context);
+	test13_connected = 1;
+}
+
+
+void test13_onPublish(void* context, MQTTAsync_successData* response)
+{
+	MyLog(LOGA_DEBUG, "In publish onSuccess callback, context %p", context);
+	test13_delivered++;
+}
+
+
+void test13_onDisconnect(void* context, MQTTAsync_successData* response)
+{
+	MyLog(LOGA_DEBUG, "In onDisconnect callback %p", context);
+	test_finished = 1;
+}
+
+
+/* buffer publications while disconnected, then send them, returning the number of reads from persistence */
+int test13_send(struct Options options, int budget)
+{
+	MQTTAsync c;
+	MQTTAsync_connectOptions opts = MQTTAsync_connectOptions_initializer;
+	MQTTAsync_disconnectOptions dopts = MQTTAsync_disconnectOptions_initializer;
+	MQTTAsync_createOptions createOpts = MQTTAsync_createOptions_initializer;
+	char payload[TEST13_PAYLOAD_LENGTH];
+	int rc = 0;
+	int i;
+	int count = 0;
+
+	test_finished = test13_connected = test13_delivered = 0;
+	memstore_empty(&memstore_store);
+	createOpts.sendWhileDisconnected = 1;
+	createOpts.allowDisconnectedSendAtAnyTime = 1;
+	createOpts.maxCachedPayloadBytes = budget;
+	rc = MQTTAsync_createWithOptions(&c, options.connection, "async_test13",
+			MQTTCLIENT_PERSISTENCE_USER, &memstore_persistence, &createOpts);
+	assert("good rc from create",  rc == MQTTASYNC_SUCCESS, "rc was %d\n", rc);
+	if (rc != MQTTASYNC_SUCCESS)
+	{
+		MQTTAsync_destroy(&c);
+		return -1;
+	}
+
+	memset(payload, 'x', sizeof(payload));
+	for (i = 0; i < TEST13_MESSAGES; ++i)
+	{
+		MQTTAsync_responseOptions ropts = MQTTAsync_responseOptions_initializer;
+
+		ropts.onSuccess = test13_onPublish;
+		ropts.context = c;
+		rc = MQTTAsync_send(c, test13_topic, sizeof(payload), payload, 1, 0, &ropts);
+		assert("Good rc from send", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	}
+
+	opts.keepAliveInterval = 20;
+	opts.cleansession = 1;
+	opts.onSuccess = test13_onConnect;
+	opts.context = c;
+	rc = MQTTAsync_connect(c, &opts);
+	assert("Good rc from connect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	while (test13_delivered < TEST13_MESSAGES && ++count < 100)
+		MySleep(100);
+	assert("All publications delivered", test13_delivered == TEST13_MESSAGES,
+			"delivered was %d", test13_delivered);
+
+	dopts.onSuccess = test13_onDisconnect;
+	dopts.context = c;
+	rc = MQTTAsync_disconnect(c, &dopts);
+	assert("Good rc from disconnect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	count = 0;
+	while (!test_finished && ++count < 100)
+		MySleep(100);
+	MQTTAsync_destroy(&c);
+	return memstore_store.gets;
+}
+
+
+int test13(struct Options options)
+{
+	int gets = 0;
+
+	MyLog(LOGA_INFO, "Starting test 13 - buffered publications kept in memory");
+	fprintf(xml, "<testcase classname=\"test4\" name=\"payload cache budget\"");
+	global_start_time = start_clock();
+
+	gets = test13_send(options, 0);
+	assert("Without a budget, each publication read back", gets == TEST13_MESSAGES, "gets were %d", gets);
+
+	gets = test13_send(options, TEST13_MESSAGES * (TEST13_PAYLOAD_LENGTH + 100));
+	assert("Within the budget, none read back", gets == 0, "gets were %d", gets);
+
+	gets = test13_send(options, TEST13_MESSAGES * TEST13_PAYLOAD_LENGTH / 2);
+	assert("Beyond the budget, some read back", gets > 0 && gets < TEST13_MESSAGES, "gets were %d", gets);
+
+	memstore_empty(&memstore_store);
+	MyLog(LOGA_INFO, "TEST13: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", tests, failures);
+	write_test_result();
+	return failures;
+}
+
+
+
+/*********************************************************************
+
+Test14: Batched persistence.  Deferred records are written with the
+application's Persistence_putMany, and removed with its
+Persistence_removeMany, when they are set.  Without them each record is
+written and removed on its own.
+
+*********************************************************************/
+
+#define TEST14_MESSAGES 10
+
+/* buffer publications while disconnected, wait for them to be written, then send them */
+void test14_send(struct Options options, int batch)
+{
+	MQTTAsync c;
+	MQTTAsync_connectOptions opts = MQTTAsync_connectOptions_initializer;
+	MQTTAsync_disconnectOptions dopts = MQTTAsync_disconnectOptions_initializer;
+	MQTTAsync_createOptions createOpts = MQTTAsync_createOptions_initializer;
+	char payload[TEST13_PAYLOAD_LENGTH];
+	int rc = 0;
+	int i;
+	int count = 0;
+
+	test_finished = test13_connected = test13_delivered = 0;
+	memstore_empty(&memstore_store);
+	createOpts.sendWhileDisconnected = 1;
+	createOpts.allowDisconnectedSendAtAnyTime = 1;
+	createOpts.deferPersistenceInterval = 100;
+	rc = MQTTAsync_createWithOptions(&c, options.connection, "async_test14",
+			MQTTCLIENT_PERSISTENCE_USER, &memstore_persistence, &createOpts);
+	assert("good rc from create",  rc == MQTTASYNC_SUCCESS, "rc was %d\n", rc);
+	if (rc != MQTTASYNC_SUCCESS)
+	{
+		MQTTAsync_destroy(&c);
+		return;
+	}
+	if (batch)
+	{
+		rc = MQTTAsync_setPersistenceBatch(c, memstore_putMany, memstore_removeMany);
+		assert("Good rc from setPersistenceBatch", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	}
+
+	memset(payload, 'x', sizeof(payload));
+	for (i = 0; i < TEST14_MESSAGES; ++i)
+	{
+		MQTTAsync_responseOptions ropts = MQTTAsync_responseOptions_initializer;
+
+		ropts.onSuccess = test13_onPublish;
+		ropts.context = c;
+		rc = MQTTAsync_send(c, test13_topic, sizeof(payload), payload, 1, 0, &ropts);
+		assert("Good rc from send", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	}
+	while (memstore_store.count < TEST14_MESSAGES && ++count < 100)
+		MySleep(100);
+	assert("Buffered publications written", memstore_store.count == TEST14_MESSAGES,
+			"count was %d", memstore_store.count);
+
+	opts.keepAliveInterval = 20;
+	opts.cleansession = 1;
+	opts.onSuccess = test13_onConnect;
+	opts.context = c;
+	rc = MQTTAsync_connect(c, &opts);
+	assert("Good rc from connect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	count = 0;
+	while (test13_delivered < TEST14_MESSAGES && ++count < 100)
+		MySleep(100);
+	assert("All publications delivered", test13_delivered == TEST14_MESSAGES,
+			"delivered was %d", test13_delivered);
+
+	dopts.onSuccess = test13_onDisconnect;
+	dopts.context = c;
+	rc = MQTTAsync_disconnect(c, &dopts);
+	assert("Good rc from disconnect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	count = 0;
+	while (!test_finished && ++count < 100)
+		MySleep(100);
+	MQTTAsync_destroy(&c);
+	assert("All records removed", memstore_store.count == 0, "count was %d", memstore_store.count);
+}
+
+
+int test14(struct Options options)
+{
+	MyLog(LOGA_INFO, "Starting test 14 - batched persistence");
+	fprintf(xml, "<testcase classname=\"test4\" name=\"batched persistence\"");
+	global_start_time = start_clock();
+
+	/* without the batch functions, one call for each record */
+	test14_send(options, 0);
+	assert("No batched writes", memstore_store.putManys == 0, "putManys were %d", memstore_store.putManys);
+	assert("Each record written on its own", memstore_store.puts >= TEST14_MESSAGES,
+			"puts were %d", memstore_store.puts);
+	assert("No batched removes", memstore_store.removeManys == 0,
+			"removeManys were %d", memstore_store.removeManys);
+
+	/* with them, fewer calls */
+	test14_send(options, 1);
+	assert("Batched writes", memstore_store.putManys > 0, "putManys were %d", memstore_store.putManys);
+	assert("Fewer writes than records", memstore_store.puts < TEST14_MESSAGES,
+			"puts were %d", memstore_store.puts);
+
+	memstore_empty(&memstore_store);
+	MyLog(LOGA_INFO, "TEST14: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", tests, failures);
+	write_test_result();
+	return failures;
+}
+
+
 
 void trace_callback(enum MQTTASYNC_TRACE_LEVELS level, char* message)
 {
@@ -2045,7 +3356,7 @@ void trace_callback(enum MQTTASYNC_TRACE_LEVELS level, char* message)
 int main(int argc, char** argv)
 {
 	int rc = -1;
- 	int (*tests[])() = {NULL, test1, test2, test3, test4, test5, test6, test7, test8}; /* indexed starting from 1 */
+ 	int (*tests[])() = {NULL, test1, test2, test3, test4, test5, test6, test7, test8, test9, test10, test11, test12, test13, test14}; /* indexed starting from 1 */
 	MQTTAsync_nameValue* info;
 	int i;
 
@@ -2689,13 +2689,640 @@ void handleTrace(enum MQTTASYNC_TRACE_LEVELS level, char* message)
 }
 
 
+/*********************************************************************
+
+ Helpers for tests 11 to 15, which connect with server authentication
+ and wait for each step on the main thread
+
+ *********************************************************************/
+
+typedef struct
+{
+	MQTTAsync client;
+	volatile int connected;
+	volatile int connectFailed;
+	volatile int disconnected;
+	volatile int subscribed;
+	volatile int received;
+	volatile int receivedBytes;
+	volatile int outOfOrder;
+} TLSTestClient;
+
+#define TLSTestClient_initializer {NULL, 0, 0, 0, 0, 0, 0, 0}
+
+/* the trace message counted by tlsTestTrace */
+char* tlsTestTraceString = NULL;
+volatile int tlsTestTraceCount = 0;
+
+void tlsTestTrace(enum MQTTASYNC_TRACE_LEVELS level, char* message)
+{
+	if (tlsTestTraceString && strstr(message, tlsTestTraceString))
+		++tlsTestTraceCount;
+}
+
+void tlsTestCountTrace(char* string)
+{
+	tlsTestTraceString = string;
+	tlsTestTraceCount = 0;
+}
+
+void tlsTestOnConnect(void* context, MQTTAsync_successData* response)
+{
+	((TLSTestClient*)context)->connected = 1;
+}
+
+void tlsTestOnConnectFailure(void* context, MQTTAsync_failureData* response)
+{
+	((TLSTestClient*)context)->connectFailed = 1;
+}
+
+void tlsTestOnDisconnect(void* context, MQTTAsync_successData* response)
+{
+	((TLSTestClient*)context)->disconnected = 1;
+}
+
+void tlsTestOnSubscribe(void* context, MQTTAsync_successData* response)
+{
+	((TLSTestClient*)context)->subscribed = 1;
+}
+
+/* the payloads start with their sequence number, so that the order can be checked */
+int tlsTestMessageArrived(void* context, char* topicName, int topicLen, MQTTAsync_message* m)
+{
+	TLSTestClient* tc = (TLSTestClient*)context;
+	int seqno = -1;
+
+	if (m->payloadlen >= (int)sizeof(int))
+		memcpy(&seqno, m->payload, sizeof(int));
+	if (seqno != tc->received)
+		tc->outOfOrder++;
+	tc->receivedBytes += m->payloadlen;
+	tc->received++;
+	MQTTAsync_freeMessage(&m);
+	MQTTAsync_free(topicName);
+	return 1;
+}
+
+/* waits up to 10 seconds for the flag to be set */
+int tlsTestWait(volatile int* flag)
+{
+	int count = 0;
+
+	while (!*flag && ++count < 1000)
+#if defined(_WIN32)
+		Sleep(10);
+#else
+		usleep(10000L);
+#endif
+	return *flag;
+}
+
+int tlsTestCreate(TLSTestClient* tc, char* uri, char* clientid)
+{
+	int rc = MQTTAsync_create(&tc->client, uri, clientid, MQTTCLIENT_PERSISTENCE_NONE, NULL);
+
+	assert("good rc from create", rc == MQTTASYNC_SUCCESS, "rc was %d\n", rc);
+	if (rc == MQTTASYNC_SUCCESS)
+	{
+		rc = MQTTAsync_setCallbacks(tc->client, tc, NULL, tlsTestMessageArrived, NULL);
+		assert("Good rc from setCallbacks", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	}
+	return rc;
+}
+
+int tlsTestConnect(TLSTestClient* tc, MQTTAsync_SSLOptions* sslopts)
+{
+	MQTTAsync_connectOptions opts = MQTTAsync_connectOptions_initializer;
+	int rc = 0;
+
+	tc->connected = tc->connectFailed = tc->disconnected = 0;
+	opts.keepAliveInterval = 20;
+	opts.cleansession = 1;
+	opts.username = "testuser";
+	opts.password = "testpassword";
+	opts.onSuccess = tlsTestOnConnect;
+	opts.onFailure = tlsTestOnConnectFailure;
+	opts.context = tc;
+	opts.ssl = sslopts;
+	rc = MQTTAsync_connect(tc->client, &opts);
+	assert("Good rc from connect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	if (rc == MQTTASYNC_SUCCESS)
+	{
+		int count = 0;
+
+		while (!tc->connected && !tc->connectFailed && ++count < 1000)
+#if defined(_WIN32)
+			Sleep(10);
+#else
+			usleep(10000L);
+#endif
+		assert("Connected", tc->connected, "connectFailed was %d", tc->connectFailed);
+		rc = tc->connected ? MQTTASYNC_SUCCESS : MQTTASYNC_FAILURE;
+	}
+	return rc;
+}
+
+void tlsTestDisconnect(TLSTestClient* tc)
+{
+	MQTTAsync_disconnectOptions opts = MQTTAsync_disconnectOptions_initializer;
+	int rc = 0;
+
+	if (!tc->connected)
+		return;
+	opts.onSuccess = tlsTestOnDisconnect;
+	opts.context = tc;
+	rc = MQTTAsync_disconnect(tc->client, &opts);
+	assert("Good rc from disconnect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	if (rc == MQTTASYNC_SUCCESS)
+		tlsTestWait(&tc->disconnected);
+	tc->connected = 0;
+}
+
+void tlsTestSslopts(MQTTAsync_SSLOptions* sslopts, struct Options options)
+{
+	if (options.server_key_file != NULL)
+		sslopts->trustStore = options.server_key_file; /*file of certificates trusted by client*/
+}
+
+/*********************************************************************
+
+ Test11: Shared SSL contexts - connections with the same options share
+ one context, which is created again when one of its files changes
+
+ *********************************************************************/
+
+int test11(struct Options options)
+{
+	char* testname = "test11";
+	TLSTestClient tc[3] = {TLSTestClient_initializer, TLSTestClient_initializer, TLSTestClient_initializer};
+	MQTTAsync_SSLOptions sslopts = MQTTAsync_SSLOptions_initializer;
+	char* trustStore = "test11_truststore.crt";
+	int rc = 0;
+	int i;
+
+	failures = 0;
+	MyLog(LOGA_INFO, "Starting test 11 - shared SSL contexts");
+	fprintf(xml, "<testcase classname=\"test5\" name=\"%s\"", testname);
+	global_start_time = start_clock();
+
+	tlsTestSslopts(&sslopts, options);
+	if (sslopts.trustStore)
+	{
+		/* a copy of the trust store, which can be changed */
+		FILE* in = fopen(sslopts.trustStore, "rb");
+		FILE* out = fopen(trustStore, "wb");
+		char buf[1024];
+		size_t len = 0;
+
+		assert("Trust store copied", in && out, "files opened %d", (in != NULL) + (out != NULL));
+		while (in && out && (len = fread(buf, 1, sizeof(buf), in)) > 0)
+			fwrite(buf, 1, len, out);
+		if (in)
+			fclose(in);
+		if (out)
+			fclose(out);
+		sslopts.trustStore = trustStore;
+	}
+
+	MQTTAsync_setTraceCallback(tlsTestTrace);
+	MQTTAsync_setTraceLevel(MQTTASYNC_TRACE_MINIMUM);
+	for (i = 0; i < 3; ++i)
+	{
+		char clientid[24];
+
+		sprintf(clientid, "%s-%d", testname, i);
+		if ((rc = tlsTestCreate(&tc[i], options.server_auth_connection, clientid)) != MQTTASYNC_SUCCESS)
+			goto exit;
+	}
+
+	/* the second connection takes the context of the first */
+	tlsTestCountTrace("Sharing SSL context with 1 other");
+	if ((rc = tlsTestConnect(&tc[0], &sslopts)) != MQTTASYNC_SUCCESS ||
+			(rc = tlsTestConnect(&tc[1], &sslopts)) != MQTTASYNC_SUCCESS)
+		goto exit;
+	assert("Context shared", tlsTestTraceCount == 1, "count was %d", tlsTestTraceCount);
+
+	if (sslopts.trustStore == trustStore)
+	{
+		/* once the file has changed, a new connection gets a new context */
+		FILE* out = fopen(trustStore, "ab");
+
+		if (out)
+		{
+			fputs("\n", out);
+			fclose(out);
+		}
+		tlsTestCountTrace("SSL context files have changed");
+		if ((rc = tlsTestConnect(&tc[2], &sslopts)) != MQTTASYNC_SUCCESS)
+			goto exit;
+		assert("Context created again", tlsTestTraceCount == 1, "count was %d", tlsTestTraceCount);
+
+		/* which the next connection shares, while the first two keep theirs */
+		tlsTestDisconnect(&tc[1]);
+		tlsTestCountTrace("Sharing SSL context with 1 other");
+		if ((rc = tlsTestConnect(&tc[1], &sslopts)) != MQTTASYNC_SUCCESS)
+			goto exit;
+		assert("New context shared", tlsTestTraceCount == 1, "count was %d", tlsTestTraceCount);
+	}
+
+exit:
+	for (i = 0; i < 3; ++i)
+	{
+		if (tc[i].client)
+		{
+			tlsTestDisconnect(&tc[i]);
+			MQTTAsync_destroy(&tc[i].client);
+		}
+	}
+	tlsTestCountTrace(NULL);
+	MQTTAsync_setTraceLevel(MQTTASYNC_TRACE_ERROR);
+	MQTTAsync_setTraceCallback(handleTrace);
+	remove(trustStore);
+	MyLog(LOGA_INFO, "%s: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", testname, tests, failures);
+	write_test_result();
+	return failures;
+}
+
+
+/*********************************************************************
+
+ Test12: TLS session resumption - a client resumes its session when it
+ reconnects, and with shareSessions, another client's session
+
+ *********************************************************************/
+
+int test12(struct Options options)
+{
+	char* testname = "test12";
+	TLSTestClient tc[2] = {TLSTestClient_initializer, TLSTestClient_initializer};
+	MQTTAsync_SSLOptions sslopts = MQTTAsync_SSLOptions_initializer;
+	MQTTAsync_statistics stats = MQTTAsync_statistics_initializer;
+	int rc = 0;
+
+	failures = 0;
+	MyLog(LOGA_INFO, "Starting test 12 - TLS session resumption");
+	fprintf(xml, "<testcase classname=\"test5\" name=\"%s\"", testname);
+	global_start_time = start_clock();
+
+	tlsTestSslopts(&sslopts, options);
+	sslopts.shareSessions = 1;
+	if ((rc = tlsTestCreate(&tc[0], options.server_auth_connection, "test12-0")) != MQTTASYNC_SUCCESS ||
+			(rc = tlsTestCreate(&tc[1], options.server_auth_connection, "test12-1")) != MQTTASYNC_SUCCESS)
+		goto exit;
+
+	/* a full handshake, then a resumed one on reconnect */
+	if ((rc = tlsTestConnect(&tc[0], &sslopts)) != MQTTASYNC_SUCCESS)
+		goto exit;
+	tlsTestDisconnect(&tc[0]);
+	if ((rc = tlsTestConnect(&tc[0], &sslopts)) != MQTTASYNC_SUCCESS)
+		goto exit;
+	rc = MQTTAsync_getStatistics(tc[0].client, &stats);
+	assert("Good rc from getStatistics", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	assert("Two handshakes", stats.tlsHandshakes == 2, "tlsHandshakes was %d", stats.tlsHandshakes);
+	assert("Reconnect resumed the session", stats.tlsResumedHandshakes == 1,
+			"tlsResumedHandshakes was %d", stats.tlsResumedHandshakes);
+	assert("Handshake times recorded", stats.tlsHandshakeTime >= stats.tlsLastHandshakeTime,
+			"tlsHandshakeTime was %ld", stats.tlsHandshakeTime);
+
+	/* the other client's first connection resumes the shared session */
+	if ((rc = tlsTestConnect(&tc[1], &sslopts)) != MQTTASYNC_SUCCESS)
+		goto exit;
+	rc = MQTTAsync_getStatistics(tc[1].client, &stats);
+	assert("Good rc from getStatistics", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	assert("One handshake", stats.tlsHandshakes == 1, "tlsHandshakes was %d", stats.tlsHandshakes);
+	assert("Shared session resumed", stats.tlsResumedHandshakes == 1,
+			"tlsResumedHandshakes was %d", stats.tlsResumedHandshakes);
+
+	/* without shareSessions, the first connection is a full handshake */
+	tlsTestDisconnect(&tc[1]);
+	MQTTAsync_destroy(&tc[1].client);
+	if ((rc = tlsTestCreate(&tc[1], options.server_auth_connection, "test12-2")) != MQTTASYNC_SUCCESS)
+		goto exit;
+	sslopts.shareSessions = 0;
+	if ((rc = tlsTestConnect(&tc[1], &sslopts)) != MQTTASYNC_SUCCESS)
+		goto exit;
+	rc = MQTTAsync_getStatistics(tc[1].client, &stats);
+	assert("Good rc from getStatistics", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	assert("Session not shared", stats.tlsHandshakes == 1 && stats.tlsResumedHandshakes == 0,
+			"tlsResumedHandshakes was %d", stats.tlsResumedHandshakes);
+
+exit:
+	if (tc[0].client)
+	{
+		tlsTestDisconnect(&tc[0]);
+		MQTTAsync_destroy(&tc[0].client);
+	}
+	if (tc[1].client)
+	{
+		tlsTestDisconnect(&tc[1]);
+		MQTTAsync_destroy(&tc[1].client);
+	}
+	MyLog(LOGA_INFO, "%s: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", testname, tests, failures);
+	write_test_result();
+	return failures;
+}
+
+
+/*********************************************************************
+
+ Test13: Buffered TLS reads - many small packets arriving together, so
+ that several are read from one TLS record, then packets larger than
+ the read buffer
+
+ *********************************************************************/
+
+#define TEST13_SMALL_MESSAGES 200
+#define TEST13_LARGE_MESSAGES 2
+#define TEST13_LARGE_LENGTH 40000
+
+int test13(struct Options options)
+{
+	char* testname = "test13";
+	TLSTestClient tc = TLSTestClient_initializer;
+	MQTTAsync_SSLOptions sslopts = MQTTAsync_SSLOptions_initializer;
+	MQTTAsync_responseOptions ropts = MQTTAsync_responseOptions_initializer;
+	char* topic = "C client SSL test13";
+	char* payload = NULL;
+	int bytes = 0;
+	int count = 0;
+	int rc = 0;
+	int i;
+
+	failures = 0;
+	MyLog(LOGA_INFO, "Starting test 13 - buffered TLS reads");
+	fprintf(xml, "<testcase classname=\"test5\" name=\"%s\"", testname);
+	global_start_time = start_clock();
+
+	tlsTestSslopts(&sslopts, options);
+	if ((rc = tlsTestCreate(&tc, options.server_auth_connection, "test13")) != MQTTASYNC_SUCCESS ||
+			(rc = tlsTestConnect(&tc, &sslopts)) != MQTTASYNC_SUCCESS)
+		goto exit;
+
+	ropts.onSuccess = tlsTestOnSubscribe;
+	ropts.context = &tc;
+	rc = MQTTAsync_subscribe(tc.client, topic, 1, &ropts);
+	assert("Good rc from subscribe", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	if (rc != MQTTASYNC_SUCCESS || !tlsTestWait(&tc.subscribed))
+		goto exit;
+
+	if ((payload = malloc(TEST13_LARGE_LENGTH)) == NULL)
+		goto exit;
+	memset(payload, 'x', TEST13_LARGE_LENGTH);
+	for (i = 0; i < TEST13_SMALL_MESSAGES + TEST13_LARGE_MESSAGES; ++i)
+	{
+		int len = (i < TEST13_SMALL_MESSAGES) ? (int)sizeof(int) + i % 20 : TEST13_LARGE_LENGTH;
+
+		memcpy(payload, &i, sizeof(int));
+		rc = MQTTAsync_send(tc.client, topic, len, payload, (i < TEST13_SMALL_MESSAGES) ? 0 : 1, 0, NULL);
+		assert("Good rc from send", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+		bytes += len;
+	}
+	while (tc.received < TEST13_SMALL_MESSAGES + TEST13_LARGE_MESSAGES && ++count < 1000)
+#if defined(_WIN32)
+		Sleep(10);
+#else
+		usleep(10000L);
+#endif
+	assert("All messages received", tc.received == TEST13_SMALL_MESSAGES + TEST13_LARGE_MESSAGES,
+			"received was %d", tc.received);
+	assert("Messages received in order", tc.outOfOrder == 0, "outOfOrder was %d", tc.outOfOrder);
+	assert("All bytes received", tc.receivedBytes == bytes, "receivedBytes was %d", tc.receivedBytes);
+
+exit:
+	if (payload)
+		free(payload);
+	if (tc.client)
+	{
+		tlsTestDisconnect(&tc);
+		MQTTAsync_destroy(&tc.client);
+	}
+	MyLog(LOGA_INFO, "%s: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", testname, tests, failures);
+	write_test_result();
+	return failures;
+}
+
+
+/*********************************************************************
+
+ Test14: Kernel TLS - with enableKernelTLS, messages are sent and
+ received whether or not the kernel takes the encryption over, and
+ the statistics say which it did
+
+ *********************************************************************/
+
+#define TEST14_MESSAGES 20
+#define TEST14_LARGE_LENGTH 40000
+
+int test14(struct Options options)
+{
+	char* testname = "test14";
+	TLSTestClient tc = TLSTestClient_initializer;
+	MQTTAsync_SSLOptions sslopts = MQTTAsync_SSLOptions_initializer;
+	MQTTAsync_responseOptions ropts = MQTTAsync_responseOptions_initializer;
+	MQTTAsync_statistics stats = MQTTAsync_statistics_initializer;
+	char* topic = "C client SSL test14";
+	char* payload = NULL;
+	int bytes = 0;
+	int count = 0;
+	int rc = 0;
+	int i;
+
+	failures = 0;
+	MyLog(LOGA_INFO, "Starting test 14 - kernel TLS");
+	fprintf(xml, "<testcase classname=\"test5\" name=\"%s\"", testname);
+	global_start_time = start_clock();
+
+	tlsTestSslopts(&sslopts, options);
+	sslopts.enableKernelTLS = 1;
+	if ((rc = tlsTestCreate(&tc, options.server_auth_connection, "test14")) != MQTTASYNC_SUCCESS ||
+			(rc = tlsTestConnect(&tc, &sslopts)) != MQTTASYNC_SUCCESS)
+		goto exit;
+
+	rc = MQTTAsync_getStatistics(tc.client, &stats);
+	assert("Good rc from getStatistics", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	assert("Kernel send is on or off", stats.tlsKernelSend == 0 || stats.tlsKernelSend == 1,
+			"tlsKernelSend was %d", stats.tlsKernelSend);
+	assert("Kernel receive is on or off", stats.tlsKernelReceive == 0 || stats.tlsKernelReceive == 1,
+			"tlsKernelReceive was %d", stats.tlsKernelReceive);
+	MyLog(LOGA_INFO, "Kernel TLS send %s, receive %s", stats.tlsKernelSend ? "on" : "off",
+			stats.tlsKernelReceive ? "on" : "off");
+
+	ropts.onSuccess = tlsTestOnSubscribe;
+	ropts.context = &tc;
+	rc = MQTTAsync_subscribe(tc.client, topic, 1, &ropts);
+	assert("Good rc from subscribe", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	if (rc != MQTTASYNC_SUCCESS || !tlsTestWait(&tc.subscribed))
+		goto exit;
+
+	/* small messages, and large ones which need several writes */
+	if ((payload = malloc(TEST14_LARGE_LENGTH)) == NULL)
+		goto exit;
+	memset(payload, 'x', TEST14_LARGE_LENGTH);
+	for (i = 0; i < TEST14_MESSAGES; ++i)
+	{
+		int len = (i % 5 == 4) ? TEST14_LARGE_LENGTH : (int)sizeof(int) + i;
+
+		memcpy(payload, &i, sizeof(int));
+		rc = MQTTAsync_send(tc.client, topic, len, payload, i % 2, 0, NULL);
+		assert("Good rc from send", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+		bytes += len;
+	}
+	while (tc.received < TEST14_MESSAGES && ++count < 1000)
+#if defined(_WIN32)
+		Sleep(10);
+#else
+		usleep(10000L);
+#endif
+	assert("All messages received", tc.received == TEST14_MESSAGES, "received was %d", tc.received);
+	assert("Messages received in order", tc.outOfOrder == 0, "outOfOrder was %d", tc.outOfOrder);
+	assert("All bytes received", tc.receivedBytes == bytes, "receivedBytes was %d", tc.receivedBytes);
+
+	/* and without enableKernelTLS, the kernel is not used */
+	tlsTestDisconnect(&tc);
+	sslopts.enableKernelTLS = 0;
+	if ((rc = tlsTestConnect(&tc, &sslopts)) != MQTTASYNC_SUCCESS)
+		goto exit;
+	rc = MQTTAsync_getStatistics(tc.client, &stats);
+	assert("Good rc from getStatistics", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+	assert("Kernel TLS not used", stats.tlsKernelSend == 0 && stats.tlsKernelReceive == 0,
+			"tlsKernelSend was %d", stats.tlsKernelSend);
+
+exit:
+	if (payload)
+		free(payload);
+	if (tc.client)
+	{
+		tlsTestDisconnect(&tc);
+		MQTTAsync_destroy(&tc.client);
+	}
+	MyLog(LOGA_INFO, "%s: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", testname, tests, failures);
+	write_test_result();
+	return failures;
+}
+
+
+/*********************************************************************
+
+ Test15: TLS handshake threads - the handshakes of clients connecting
+ together are run by a pool of worker threads
+
+ *********************************************************************/
+
+#define TEST15_CLIENTS 4
+#define TEST15_ROUNDS 10
+
+int test15(struct Options options)
+{
+	char* testname = "test15";
+	TLSTestClient tc[TEST15_CLIENTS];
+	MQTTAsync_SSLOptions sslopts = MQTTAsync_SSLOptions_initializer;
+	MQTTAsync_connectOptions opts = MQTTAsync_connectOptions_initializer;
+	MQTTAsync_init_options inits = MQTTAsync_init_options_initializer;
+	int count = 0;
+	int connected = 0;
+	int attempt;
+	int rc = 0;
+	int i;
+
+	failures = 0;
+	MyLog(LOGA_INFO, "Starting test 15 - TLS handshake threads");
+	fprintf(xml, "<testcase classname=\"test5\" name=\"%s\"", testname);
+	global_start_time = start_clock();
+
+	inits.struct_version = 1; /* only the handshake threads */
+	inits.do_openssl_init = 1;
+	inits.handshakeThreads = 2;
+	MQTTAsync_global_init(&inits);
+
+	MQTTAsync_setTraceCallback(tlsTestTrace);
+	MQTTAsync_setTraceLevel(MQTTASYNC_TRACE_MINIMUM);
+	tlsTestCountTrace("handed to a worker");
+	memset(tc, '\0', sizeof(tc));
+	tlsTestSslopts(&sslopts, options);
+	opts.keepAliveInterval = 20;
+	opts.cleansession = 1;
+	opts.username = "testuser";
+	opts.password = "testpassword";
+	opts.onSuccess = tlsTestOnConnect;
+	opts.onFailure = tlsTestOnConnectFailure;
+	opts.ssl = &sslopts;
+	/* a handshake that completes in the first SSL_connect never reaches the workers,
+	 * so connect in rounds until one has been handed over */
+	for (attempt = 0; attempt < TEST15_ROUNDS && tlsTestTraceCount == 0; ++attempt)
+	{
+		memset(tc, '\0', sizeof(tc));
+		for (i = 0; i < TEST15_CLIENTS; ++i)
+		{
+			char clientid[24];
+
+			sprintf(clientid, "%s-%d", testname, i);
+			if ((rc = tlsTestCreate(&tc[i], options.server_auth_connection, clientid)) != MQTTASYNC_SUCCESS)
+				goto exit;
+			opts.context = &tc[i];
+			rc = MQTTAsync_connect(tc[i].client, &opts);
+			assert("Good rc from connect", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+		}
+
+		/* all connecting at once */
+		count = connected = 0;
+		while (connected < TEST15_CLIENTS && ++count < 1000)
+		{
+#if defined(_WIN32)
+			Sleep(10);
+#else
+			usleep(10000L);
+#endif
+			for (connected = i = 0; i < TEST15_CLIENTS; ++i)
+				connected += tc[i].connected;
+		}
+		assert("All clients connected", connected == TEST15_CLIENTS, "connected was %d", connected);
+		for (i = 0; i < TEST15_CLIENTS; ++i)
+		{
+			MQTTAsync_statistics stats = MQTTAsync_statistics_initializer;
+
+			rc = MQTTAsync_getStatistics(tc[i].client, &stats);
+			assert("Good rc from getStatistics", rc == MQTTASYNC_SUCCESS, "rc was %d", rc);
+			assert("One handshake", stats.tlsHandshakes == 1, "tlsHandshakes was %d", stats.tlsHandshakes);
+			tlsTestDisconnect(&tc[i]);
+			MQTTAsync_destroy(&tc[i].client);
+		}
+		if (connected < TEST15_CLIENTS)
+			goto exit;
+	}
+	assert("Handshakes run by the workers", tlsTestTraceCount > 0, "count was %d", tlsTestTraceCount);
+
+exit:
+	for (i = 0; i < TEST15_CLIENTS; ++i)
+	{
+		if (tc[i].client)
+		{
+			tlsTestDisconnect(&tc[i]);
+			MQTTAsync_destroy(&tc[i].client);
+		}
+	}
+	tlsTestCountTrace(NULL);
+	MQTTAsync_setTraceLevel(MQTTASYNC_TRACE_ERROR);
+	MQTTAsync_setTraceCallback(handleTrace);
+	inits.handshakeThreads = 0;
+	MQTTAsync_global_init(&inits);
+	MyLog(LOGA_INFO, "%s: test %s. %d tests run, %d failures.",
+			(failures == 0) ? "passed" : "failed", testname, tests, failures);
+	write_test_result();
+	return failures;
+}
+
+
 int main(int argc, char** argv)
 {
 	int* numtests = &tests;
 	int rc = 0;
 	int (*tests[])() =
             { NULL, test1, test2a, test2b, test2c, test2d, test3a, test3b, test4, /* test5a,
-			test5b, test5c, */ test6, test7, test8, test9, test10, test2e };
+			test5b, test5c, */ test6, test7, test8, test9, test10, test2e, test11, test12, test13, test14, test15 };
 
 	xml = fopen("TEST-test5.xml", "w");
 	fprintf(xml, "<testsuite name=\"test5\" tests=\"%d\">\n", (int)ARRAY_SIZE(tests) - 1);